@@ -12,6 +12,7 @@
 #include "NextBotVisionInterface.h"
 #include "NextBotBodyInterface.h"
 #include "NextBotUtil.h"
+#include "static_world_los.h"
 
 #ifdef TERROR
 #include "querycache.h"
@@ -698,6 +699,10 @@ bool IVision::IsLineOfSightClear( const Vector &pos ) const
 	VPROF_BUDGET( "IVision::IsLineOfSightClear", "NextBot" );
 	VPROF_INCREMENT_COUNTER( "IVision::IsLineOfSightClear", 1 );
 
+	// static world geometry in the way settles it without a trace
+	if ( g_StaticWorldLOS.IsOccluded( GetBot()->GetBodyInterface()->GetEyePosition(), pos ) )
+		return false;
+
 	trace_t result;
 	NextBotVisionTraceFilter filter( GetBot()->GetEntity(), COLLISION_GROUP_NONE );
 	
@@ -749,6 +754,17 @@ bool IVision::IsLineOfSightClearToEntity( const CBaseEntity *subject, Vector *vi
 	// TODO: Use plain-old traces until querycache/etc gets integrated
 	VPROF_BUDGET( "IVision::IsLineOfSightClearToEntity", "NextBot" );
 
+	if ( !visibleSpot && g_StaticWorldLOS.IsReady() )
+	{
+		// if the static world hides all three spots we would trace to, none of the traces can succeed
+		const Vector &vecEye = GetBot()->GetBodyInterface()->GetEyePosition();
+		Vector vecStarts[3] = { vecEye, vecEye, vecEye };
+		Vector vecSpots[3] = { subject->WorldSpaceCenter(), subject->EyePosition(), subject->GetAbsOrigin() };
+		bool bOccluded[3];
+		if ( g_StaticWorldLOS.ComputeOcclusion( 3, vecStarts, vecSpots, bOccluded ) == 3 )
+			return false;
+	}
+
 	trace_t result;
 	NextBotTraceFilterIgnoreActors filter( subject, COLLISION_GROUP_NONE );
 
@@ -3807,6 +3807,109 @@ bool CBaseEntity::ShouldSavePhysics()
 
 #include "tier0/memdbgoff.h"
 
+//-----------------------------------------------------------------------------
+// Per-class allocators for entity classes linked with LINK_ENTITY_TO_CLASS_POOLED.
+// Each factory owns a CUtlMemoryPool sized for its class and hands it to operator
+// new just before constructing the entity. Only the memory of the C++ object is
+// recycled: entities are still constructed and destroyed as usual, and the edict
+// and its serial number still come and go through the engine.
+//
+// Entities from the engine heap are allocated exactly as before. operator delete
+// only looks through the pools while some pooled entity is alive, and the pools
+// give their memory back at level shutdown.
+//-----------------------------------------------------------------------------
+#define MAX_POOLED_ENTITY_CLASSES 16
+
+struct EntityMemoryPool_t
+{
+	size_t			m_stSize;
+	const char		*m_pszClassName;
+	CUtlMemoryPool	*m_pPool;
+	int				m_nAllocs;		// total allocations served, for entity_pool_stats
+};
+
+static EntityMemoryPool_t s_EntityMemoryPools[MAX_POOLED_ENTITY_CLASSES];
+static int s_nEntityMemoryPools = 0;
+static int s_nLivePooledEntities = 0;
+static bool s_bEntityMemoryPoolsEnabled = true;
+
+// Set by CPooledEntityFactory::Create, taken by the next CBaseEntity::operator new
+static EntityMemoryPool_t *s_pNextEntityMemoryPool = NULL;
+
+EntityMemoryPool_t *RegisterPooledEntityClass( size_t stClassSize, const char *pszClassName )
+{
+	if ( s_nEntityMemoryPools >= MAX_POOLED_ENTITY_CLASSES )
+	{
+		AssertMsg( false, "Too many pooled entity classes, %s will use the engine heap\n", pszClassName );
+		return NULL;
+	}
+
+	EntityMemoryPool_t &entry = s_EntityMemoryPools[s_nEntityMemoryPools++];
+	entry.m_stSize = stClassSize;
+	entry.m_pszClassName = pszClassName;
+	entry.m_pPool = new CUtlMemoryPool( stClassSize, 32, CUtlMemoryPool::GROW_SLOW, pszClassName, 16 );
+	entry.m_nAllocs = 0;
+	return &entry;
+}
+
+void SetNextEntityMemoryPool( EntityMemoryPool_t *pPool )
+{
+	s_pNextEntityMemoryPool = s_bEntityMemoryPoolsEnabled ? pPool : NULL;
+}
+
+// Turns the pools off so pooled classes come from the engine heap, for entity_pool_benchmark.
+// Entities already in a pool still go back to it.
+void EnableEntityMemoryPools( bool bEnable )
+{
+	s_bEntityMemoryPoolsEnabled = bEnable;
+}
+
+static void PrintEntityPoolStats()
+{
+	for ( int i = 0; i < s_nEntityMemoryPools; i++ )
+	{
+		const EntityMemoryPool_t &entry = s_EntityMemoryPools[i];
+		Msg( "%-32s %6d bytes: %5d live, %5d peak, %8d allocations\n", entry.m_pszClassName, (int)entry.m_stSize,
+			entry.m_pPool->Count(), entry.m_pPool->PeakCount(), entry.m_nAllocs );
+	}
+}
+
+CON_COMMAND( entity_pool_stats, "Shows usage of the per-class allocators for frequently created entity classes" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	PrintEntityPoolStats();
+}
+
+//-----------------------------------------------------------------------------
+// Gives the pool memory back once the level's entities are gone
+//-----------------------------------------------------------------------------
+class CEntityMemoryPoolSystem : public CAutoGameSystem
+{
+public:
+	CEntityMemoryPoolSystem( const char *name ) : CAutoGameSystem( name )
+	{
+	}
+
+	virtual void LevelShutdownPostEntity()
+	{
+		for ( int i = 0; i < s_nEntityMemoryPools; i++ )
+		{
+			EntityMemoryPool_t &entry = s_EntityMemoryPools[i];
+			if ( entry.m_pPool->Count() )
+			{
+				DevWarning( "%d %s entities outlived the level, keeping their pool\n", entry.m_pPool->Count(), entry.m_pszClassName );
+				continue;
+			}
+
+			entry.m_pPool->Clear();
+		}
+	}
+};
+
+static CEntityMemoryPoolSystem g_EntityMemoryPoolSystem( "CEntityMemoryPoolSystem" );
+
 //-----------------------------------------------------------------------------
 // CBaseEntity new/delete
 // allocates and frees memory for itself from the engine->
@@ -3816,18 +3919,45 @@ void *CBaseEntity::operator new( size_t stAllocateBlock )
 {
 	// call into engine to get memory
 	Assert( stAllocateBlock != 0 );
+
+	EntityMemoryPool_t *pEntry = s_pNextEntityMemoryPool;
+	if ( pEntry )
+	{
+		s_pNextEntityMemoryPool = NULL;
+		if ( pEntry->m_stSize == stAllocateBlock )
+		{
+			pEntry->m_nAllocs++;
+			s_nLivePooledEntities++;
+			return pEntry->m_pPool->AllocZero( stAllocateBlock );
+		}
+
+		AssertMsg( false, "Pooled entity factory for %s constructed an object of a different size\n", pEntry->m_pszClassName );
+	}
+
 	return engine->PvAllocEntPrivateData(stAllocateBlock);
 };
 
 void *CBaseEntity::operator new( size_t stAllocateBlock, int nBlockUse, const char *pFileName, int nLine )
 {
-	// call into engine to get memory
-	Assert( stAllocateBlock != 0 );
-	return engine->PvAllocEntPrivateData(stAllocateBlock);
+	return CBaseEntity::operator new( stAllocateBlock );
 }
 
 void CBaseEntity::operator delete( void *pMem )
 {
+	if ( s_nLivePooledEntities )
+	{
+		for ( int i = 0; i < s_nEntityMemoryPools; i++ )
+		{
+			CUtlMemoryPool *pPool = s_EntityMemoryPools[i].m_pPool;
+			if ( pPool->Count() && pPool->IsAllocationWithinPool( pMem ) )
+			{
+				s_nLivePooledEntities--;
+				pPool->Free( pMem );
+				return;
+			}
+		}
+	}
+
 	// get the engine to free the memory
 	engine->FreeEntPrivateData( pMem );
 }
@@ -1193,6 +1193,7 @@ void CServerGameDLL::GameServerSteamAPIShutdown( void )
 // Purpose: Called at the start of every game frame
 //-----------------------------------------------------------------------------
 ConVar  trace_report( "trace_report", "0" );
+ConVar  convar_lookup_report( "convar_lookup_report", "0", 0, "Print how many ConVar name lookups this module made each frame, and how many missed the lookup cache." );
 
 void CServerGameDLL::GameFrame( bool simulating )
 {
@@ -1285,6 +1286,16 @@ void CServerGameDLL::GameFrame( bool simulating )
 		}
 	}
 
+	if ( convar_lookup_report.GetBool() )
+	{
+		int nLookups, nResolves;
+		ConVar_GetLookupStats( &nLookups, &nResolves, true );
+		if ( nLookups )
+		{
+			Msg( "ConVar lookups: %d, resolved %d\n", nLookups, nResolves );
+		}
+	}
+
 	// Any entities that detect network state changes on a timer do it here.
 	g_NetworkPropertyEventMgr.FireEvents();
 
@@ -1385,6 +1396,9 @@ void CServerGameDLL::LevelShutdown( void )
 
 	g_pServerBenchmark->EndBenchmark();
 
+	// Anything cached from this map is looked up again on the next one
+	ConVar_FlushLookupCache();
+
 	MDLCACHE_CRITICAL_SECTION();
 	IGameSystem::LevelShutdownPreEntityAllSystems();
 
@@ -0,0 +1,736 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Occlusion-only line of sight queries against the static world.
+//
+// The world model's faces, its displacements and the collision meshes of
+// solid static props are fed to a RayTracingEnvironment when the map loads.
+// The resulting kd-tree is written next to the .nav as maps/<map>.los, keyed
+// by the CRC of the .bsp header, so only the first load of a given map pays for
+// the build.
+//
+// Faces that are not solid to traces (sky, nodraw, water, translucent, and
+// any face whose texinfo is used by a non-solid brush such as a grate) are
+// left out, so the structure is never more opaque than the engine's own
+// collision. That lets callers use it as an early reject: "occluded" here is
+// final, "clear" still needs the usual trace to account for dynamic entities.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "static_world_los.h"
+#include "raytrace.h"
+#include "bspfile.h"
+#include "vcollide.h"
+#include "engine/IStaticPropMgr.h"
+#include "tier0/fasttimer.h"
+#include "tier1/lzmaDecoder.h"
+#include "tier1/utlbuffer.h"
+#include "filesystem.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar sv_staticlos( "sv_staticlos", "0", FCVAR_NONE, "Build a static world occlusion tree at map load and use it to reject line of sight checks before tracing. Takes effect on the next map." );
+
+#define STATICLOS_FILE_ID		MAKEID( 'S', 'L', 'O', 'S' )
+#define STATICLOS_FILE_VERSION	2
+
+// Segments are shortened by this much at each end, so a point resting on a
+// surface (feet on the floor, a spot pressed against a wall) is not occluded
+// by the surface it is touching.
+#define STATICLOS_END_TOLERANCE	2.0f
+
+// Most threads a first time build of the tree may use
+#define STATICLOS_MAX_BUILD_THREADS	4
+
+// Far deeper than the builder goes and well inside Trace4Rays' node stack; a tree
+// loaded from disk that is deeper than this is rejected.
+#define STATICLOS_MAX_TREE_DEPTH	64
+
+struct StaticLOSFileHeader_t
+{
+	int		m_nId;
+	int		m_nVersion;
+	CRC32_t	m_MapCRC;
+	int		m_nTriangleSize;
+	int		m_nNodeSize;
+	int		m_nTriangles;
+	int		m_nNodes;
+	int		m_nTriangleIndices;
+	Vector	m_vecMins;
+	Vector	m_vecMaxs;
+};
+
+CStaticWorldLOS g_StaticWorldLOS( "CStaticWorldLOS" );
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns a pointer to a lump in a bsp loaded into memory,
+//			decompressing it into scratch if the map was built with lzma lumps
+//-----------------------------------------------------------------------------
+template< class T >
+static const T *GetBSPLump( CUtlBuffer &bsp, int nLump, int &nCount, CUtlMemory< byte > &scratch )
+{
+	nCount = 0;
+
+	const dheader_t *pHeader = (const dheader_t *)bsp.Base();
+	const lump_t &lump = pHeader->lumps[nLump];
+	if ( lump.filelen <= 0 || lump.fileofs < 0 || lump.fileofs + lump.filelen > bsp.TellPut() )
+		return NULL;
+
+	byte *pData = (byte *)bsp.Base() + lump.fileofs;
+	int nSize = lump.filelen;
+	if ( lump.uncompressedSize != 0 && CLZMA::IsCompressed( pData ) )
+	{
+		nSize = CLZMA::GetActualSize( pData );
+		scratch.EnsureCapacity( nSize );
+		if ( CLZMA::Uncompress( pData, scratch.Base() ) != (unsigned int)nSize )
+			return NULL;
+		pData = scratch.Base();
+	}
+
+	nCount = nSize / sizeof( T );
+	return (const T *)pData;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+CStaticWorldLOS::CStaticWorldLOS( char const *name ) : CAutoGameSystem( name )
+{
+	m_pEnvironment = NULL;
+	m_MapCRC = 0;
+	m_bLoadedFromCache = false;
+	m_flBuildTime = 0.0f;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Static props are placed by now, so this is where the tree is built
+//-----------------------------------------------------------------------------
+void CStaticWorldLOS::LevelInitPostEntity()
+{
+	Assert( !m_pEnvironment );
+
+	m_nQueries = 0;
+	m_nOccluded = 0;
+
+	if ( !sv_staticlos.GetBool() )
+		return;
+
+	char szBSPName[MAX_PATH], szCacheName[MAX_PATH];
+	Q_snprintf( szBSPName, sizeof( szBSPName ), "maps/%s.bsp", STRING( gpGlobals->mapname ) );
+	Q_snprintf( szCacheName, sizeof( szCacheName ), "maps/%s.los", STRING( gpGlobals->mapname ) );
+
+	// The cache is keyed by the bsp header alone. It holds every lump's offset, length and
+	// compression plus the map's revision, which Hammer bumps on every save, so an edited
+	// map won't match. Only a cache miss reads the whole bsp.
+	dheader_t header;
+	FileHandle_t hBSP = filesystem->Open( szBSPName, "rb", "GAME" );
+	if ( !hBSP )
+	{
+		Warning( "sv_staticlos: couldn't read %s\n", szBSPName );
+		return;
+	}
+	int nHeaderRead = filesystem->Read( &header, sizeof( header ), hBSP );
+	filesystem->Close( hBSP );
+
+	if ( nHeaderRead != (int)sizeof( header ) || header.ident != IDBSPHEADER || header.version < MINBSPVERSION || header.version > BSPVERSION )
+	{
+		Warning( "sv_staticlos: %s is not a supported bsp\n", szBSPName );
+		return;
+	}
+
+	m_MapCRC = CRC32_ProcessSingleBuffer( &header, sizeof( header ) );
+
+	CFastTimer timer;
+	timer.Start();
+
+	m_pEnvironment = new RayTracingEnvironment;
+	m_pEnvironment->Flags |= RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS | RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS;
+
+	m_bLoadedFromCache = LoadCache( szCacheName );
+	if ( !m_bLoadedFromCache )
+	{
+		CUtlBuffer bsp;
+		if ( !filesystem->ReadFile( szBSPName, "GAME", bsp ) || bsp.TellPut() < (int)sizeof( dheader_t ) || !BuildFromBSP( bsp ) )
+		{
+			Warning( "sv_staticlos: couldn't parse %s\n", szBSPName );
+			delete m_pEnvironment;
+			m_pEnvironment = NULL;
+			return;
+		}
+
+		AddStaticProps();
+
+		if ( m_pEnvironment->OptimizedTriangleList.Count() == 0 )
+		{
+			delete m_pEnvironment;
+			m_pEnvironment = NULL;
+			return;
+		}
+
+		// Leave the rest of the machine to the engine and any other servers running on it
+		int nThreads = clamp( GetCPUInformation()->m_nPhysicalProcessors - 1, 1, STATICLOS_MAX_BUILD_THREADS );
+		m_pEnvironment->SetupAccelerationStructure( nThreads );
+		SaveCache( szCacheName );
+	}
+
+	timer.End();
+	m_flBuildTime = timer.GetDuration().GetMillisecondsF();
+
+	DevMsg( "sv_staticlos: %s %d triangles, %d nodes in %.1f ms\n", m_bLoadedFromCache ? "loaded" : "built",
+		m_pEnvironment->OptimizedTriangleList.Count(), m_pEnvironment->OptimizedKDTree.Count(), m_flBuildTime );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CStaticWorldLOS::LevelShutdownPostEntity()
+{
+	delete m_pEnvironment;
+	m_pEnvironment = NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+bool CStaticWorldLOS::IsReady() const
+{
+	return m_pEnvironment != NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds the world model's faces and displacements
+//-----------------------------------------------------------------------------
+bool CStaticWorldLOS::BuildFromBSP( CUtlBuffer &bsp )
+{
+	CUtlMemory< byte > vertScratch, edgeScratch, surfEdgeScratch, faceScratch, texInfoScratch;
+	CUtlMemory< byte > modelScratch, brushScratch, brushSideScratch, dispScratch, dispVertScratch;
+
+	int nVerts, nEdges, nSurfEdges, nFaces, nTexInfos, nModels, nBrushes, nBrushSides, nDisps, nDispVerts;
+	const dvertex_t *pVerts = GetBSPLump< dvertex_t >( bsp, LUMP_VERTEXES, nVerts, vertScratch );
+	const dedge_t *pEdges = GetBSPLump< dedge_t >( bsp, LUMP_EDGES, nEdges, edgeScratch );
+	const int *pSurfEdges = GetBSPLump< int >( bsp, LUMP_SURFEDGES, nSurfEdges, surfEdgeScratch );
+	const dface_t *pFaces = GetBSPLump< dface_t >( bsp, LUMP_FACES, nFaces, faceScratch );
+	const texinfo_t *pTexInfos = GetBSPLump< texinfo_t >( bsp, LUMP_TEXINFO, nTexInfos, texInfoScratch );
+	const dmodel_t *pModels = GetBSPLump< dmodel_t >( bsp, LUMP_MODELS, nModels, modelScratch );
+	const dbrush_t *pBrushes = GetBSPLump< dbrush_t >( bsp, LUMP_BRUSHES, nBrushes, brushScratch );
+	const dbrushside_t *pBrushSides = GetBSPLump< dbrushside_t >( bsp, LUMP_BRUSHSIDES, nBrushSides, brushSideScratch );
+	const ddispinfo_t *pDisps = GetBSPLump< ddispinfo_t >( bsp, LUMP_DISPINFO, nDisps, dispScratch );
+	const CDispVert *pDispVerts = GetBSPLump< CDispVert >( bsp, LUMP_DISP_VERTS, nDispVerts, dispVertScratch );
+
+	if ( !pVerts || !pEdges || !pSurfEdges || !pFaces || !pTexInfos || !pModels )
+		return false;
+
+	// A texinfo used by any non-solid brush (grates, windows, water...) may be see-through
+	CUtlVector< bool > skipTexInfo;
+	skipTexInfo.SetCount( nTexInfos );
+	for ( int i = 0; i < nTexInfos; i++ )
+	{
+		skipTexInfo[i] = ( pTexInfos[i].flags & ( SURF_SKY | SURF_SKY2D | SURF_WARP | SURF_TRANS | SURF_TRIGGER | SURF_NODRAW | SURF_HINT | SURF_SKIP ) ) != 0;
+	}
+
+	for ( int i = 0; i < nBrushes; i++ )
+	{
+		if ( pBrushes[i].contents & CONTENTS_SOLID )
+			continue;
+
+		for ( int j = 0; j < pBrushes[i].numsides; j++ )
+		{
+			int nSide = pBrushes[i].firstside + j;
+			if ( nSide < 0 || nSide >= nBrushSides )
+				break;
+
+			int nTexInfo = pBrushSides[nSide].texinfo;
+			if ( nTexInfo >= 0 && nTexInfo < nTexInfos )
+			{
+				skipTexInfo[nTexInfo] = true;
+			}
+		}
+	}
+
+	// Only the world model: brush entities move, toggle or break
+	const dmodel_t &world = pModels[0];
+	Vector vecFaceVerts[64];
+	for ( int f = world.firstface; f < world.firstface + world.numfaces && f < nFaces; f++ )
+	{
+		const dface_t &face = pFaces[f];
+		if ( face.texinfo < 0 || face.texinfo >= nTexInfos || skipTexInfo[face.texinfo] )
+			continue;
+
+		int nFaceVerts = MIN( (int)face.numedges, (int)ARRAYSIZE( vecFaceVerts ) );
+		bool bValid = ( nFaceVerts >= 3 );
+		for ( int e = 0; e < nFaceVerts && bValid; e++ )
+		{
+			int nSurfEdge = face.firstedge + e;
+			if ( nSurfEdge < 0 || nSurfEdge >= nSurfEdges )
+			{
+				bValid = false;
+				break;
+			}
+
+			int nEdge = pSurfEdges[nSurfEdge];
+			int nVert = ( nEdge >= 0 ) ? ( nEdge < nEdges ? pEdges[nEdge].v[0] : -1 ) : ( -nEdge < nEdges ? pEdges[-nEdge].v[1] : -1 );
+			if ( nVert < 0 || nVert >= nVerts )
+			{
+				bValid = false;
+				break;
+			}
+			vecFaceVerts[e] = pVerts[nVert].point;
+		}
+
+		if ( !bValid )
+			continue;
+
+		if ( face.dispinfo < 0 )
+		{
+			for ( int v = 2; v < nFaceVerts; v++ )
+			{
+				m_pEnvironment->AddTriangle( f, vecFaceVerts[0], vecFaceVerts[v-1], vecFaceVerts[v], vec3_origin );
+			}
+			continue;
+		}
+
+		// Displacement: rebuild the surface from the base quad, starting at the corner
+		// closest to the stored start position
+		if ( face.dispinfo >= nDisps || nFaceVerts != 4 || !pDispVerts )
+			continue;
+
+		const ddispinfo_t &disp = pDisps[face.dispinfo];
+		if ( disp.contents & ( CONTENTS_WATER | CONTENTS_SLIME | CONTENTS_WINDOW | CONTENTS_GRATE ) )
+			continue;
+
+		int nSize = ( 1 << disp.power ) + 1;
+		if ( disp.m_iDispVertStart < 0 || disp.m_iDispVertStart + nSize * nSize > nDispVerts )
+			continue;
+
+		int nStart = 0;
+		float flBestDist = FLT_MAX;
+		for ( int c = 0; c < 4; c++ )
+		{
+			float flDist = vecFaceVerts[c].DistToSqr( disp.startPosition );
+			if ( flDist < flBestDist )
+			{
+				flBestDist = flDist;
+				nStart = c;
+			}
+		}
+
+		Vector vecCorners[4];
+		for ( int c = 0; c < 4; c++ )
+		{
+			vecCorners[c] = vecFaceVerts[( nStart + c ) & 3];
+		}
+
+		CUtlVector< Vector > dispPoints;
+		dispPoints.SetCount( nSize * nSize );
+		float flStep = 1.0f / ( nSize - 1 );
+		for ( int i = 0; i < nSize; i++ )
+		{
+			Vector vecEdge0, vecEdge1;
+			VectorLerp( vecCorners[0], vecCorners[1], i * flStep, vecEdge0 );
+			VectorLerp( vecCorners[3], vecCorners[2], i * flStep, vecEdge1 );
+			for ( int j = 0; j < nSize; j++ )
+			{
+				const CDispVert &dispVert = pDispVerts[disp.m_iDispVertStart + i * nSize + j];
+				Vector &vecPoint = dispPoints[i * nSize + j];
+				VectorLerp( vecEdge0, vecEdge1, j * flStep, vecPoint );
+				VectorMA( vecPoint, dispVert.m_flDist, dispVert.m_vVector, vecPoint );
+			}
+		}
+
+		for ( int i = 0; i < nSize - 1; i++ )
+		{
+			for ( int j = 0; j < nSize - 1; j++ )
+			{
+				const Vector &v00 = dispPoints[i * nSize + j];
+				const Vector &v01 = dispPoints[i * nSize + j + 1];
+				const Vector &v10 = dispPoints[( i + 1 ) * nSize + j];
+				const Vector &v11 = dispPoints[( i + 1 ) * nSize + j + 1];
+				m_pEnvironment->AddTriangle( f, v00, v10, v11, vec3_origin );
+				m_pEnvironment->AddTriangle( f, v00, v11, v01, vec3_origin );
+			}
+		}
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds the collision hulls of every solid static prop
+//-----------------------------------------------------------------------------
+void CStaticWorldLOS::AddStaticProps()
+{
+	CUtlVector< ICollideable * > props;
+	staticpropmgr->GetAllStaticProps( &props );
+
+	for ( int i = 0; i < props.Count(); i++ )
+	{
+		ICollideable *pProp = props[i];
+		int nId = -( i + 1 );
+
+		if ( pProp->GetSolid() == SOLID_BBOX )
+		{
+			Vector vecMins = pProp->GetCollisionOrigin() + pProp->OBBMins();
+			Vector vecMaxs = pProp->GetCollisionOrigin() + pProp->OBBMaxs();
+			m_pEnvironment->AddAxisAlignedRectangularSolid( nId, vecMins, vecMaxs, vec3_origin );
+			continue;
+		}
+
+		if ( pProp->GetSolid() != SOLID_VPHYSICS )
+			continue;
+
+		vcollide_t *pCollide = modelinfo->GetVCollide( pProp->GetCollisionModel() );
+		if ( !pCollide )
+			continue;
+
+		const matrix3x4_t &propToWorld = pProp->CollisionToWorldTransform();
+		for ( int s = 0; s < pCollide->solidCount; s++ )
+		{
+			Vector *pHullVerts = NULL;
+			int nHullVerts = physcollision->CreateDebugMesh( pCollide->solids[s], &pHullVerts );
+			for ( int v = 0; v + 2 < nHullVerts; v += 3 )
+			{
+				Vector vecTri[3];
+				VectorTransform( pHullVerts[v], propToWorld, vecTri[0] );
+				VectorTransform( pHullVerts[v+1], propToWorld, vecTri[1] );
+				VectorTransform( pHullVerts[v+2], propToWorld, vecTri[2] );
+				m_pEnvironment->AddTriangle( nId, vecTri[0], vecTri[1], vecTri[2], vec3_origin );
+			}
+			physcollision->DestroyDebugMesh( nHullVerts, pHullVerts );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Checks every index in a tree read from disk, so a stale or damaged
+//			file can't send Trace4Rays outside its arrays
+//-----------------------------------------------------------------------------
+static bool IsValidTree( const RayTracingEnvironment *pEnvironment )
+{
+	int nTriangles = pEnvironment->OptimizedTriangleList.Count();
+	int nNodes = pEnvironment->OptimizedKDTree.Count();
+	int nIndices = pEnvironment->TriangleIndexList.Count();
+
+	for ( int i = 0; i < nTriangles; i++ )
+	{
+		const TriIntersectData_t &tri = pEnvironment->OptimizedTriangleList[i].m_Data.m_IntersectData;
+		if ( tri.m_nCoordSelect0 > 2 || tri.m_nCoordSelect1 > 2 )
+			return false;
+	}
+
+	for ( int i = 0; i < nIndices; i++ )
+	{
+		int nTriangle = pEnvironment->TriangleIndexList[i];
+		if ( nTriangle < 0 || nTriangle >= nTriangles )
+			return false;
+	}
+
+	// The builder always stores children after their parent, so requiring that rules
+	// out cycles and lets depths be worked out in one pass
+	CUtlVector< int > depths;
+	depths.SetCount( nNodes );
+	depths.FillWithValue( 0 );
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		const CacheOptimizedKDNode &node = pEnvironment->OptimizedKDTree[i];
+		if ( node.NodeType() == KDNODE_STATE_LEAF )
+		{
+			int nStart = node.TriangleIndexStart();
+			int nCount = node.NumberOfTrianglesInLeaf();
+			if ( nStart < 0 || nCount < 0 || nCount > nIndices - nStart )
+				return false;
+			continue;
+		}
+
+		int nLeft = node.LeftChild();
+		if ( nLeft <= i || nLeft + 1 >= nNodes || depths[i] >= STATICLOS_MAX_TREE_DEPTH )
+			return false;
+
+		depths[nLeft] = MAX( depths[nLeft], depths[i] + 1 );
+		depths[nLeft + 1] = MAX( depths[nLeft + 1], depths[i] + 1 );
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Loads a previously built tree if it was made from this exact bsp
+//-----------------------------------------------------------------------------
+bool CStaticWorldLOS::LoadCache( const char *pszFilename )
+{
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( pszFilename, "MOD", buf ) )
+		return false;
+
+	StaticLOSFileHeader_t header;
+	buf.Get( &header, sizeof( header ) );
+	if ( !buf.IsValid() || header.m_nId != STATICLOS_FILE_ID || header.m_nVersion != STATICLOS_FILE_VERSION ||
+		header.m_MapCRC != m_MapCRC || header.m_nTriangleSize != sizeof( CacheOptimizedTriangle ) ||
+		header.m_nNodeSize != sizeof( CacheOptimizedKDNode ) )
+	{
+		return false;
+	}
+
+	// 64 bit so absurd counts in a damaged header can't wrap around to the file size
+	int64 nExpected = (int64)sizeof( header ) + (int64)header.m_nTriangles * sizeof( CacheOptimizedTriangle ) +
+		(int64)header.m_nNodes * sizeof( CacheOptimizedKDNode ) + (int64)header.m_nTriangleIndices * sizeof( int32 );
+	if ( header.m_nTriangles <= 0 || header.m_nNodes <= 0 || header.m_nTriangleIndices < 0 || buf.TellPut() != nExpected )
+		return false;
+
+	m_pEnvironment->m_MinBound = header.m_vecMins;
+	m_pEnvironment->m_MaxBound = header.m_vecMaxs;
+
+	m_pEnvironment->OptimizedTriangleList.EnsureCapacity( header.m_nTriangles );
+	for ( int i = 0; i < header.m_nTriangles; i++ )
+	{
+		CacheOptimizedTriangle tri;
+		buf.Get( &tri, sizeof( tri ) );
+		m_pEnvironment->OptimizedTriangleList.AddToTail( tri );
+	}
+
+	m_pEnvironment->OptimizedKDTree.SetCount( header.m_nNodes );
+	buf.Get( m_pEnvironment->OptimizedKDTree.Base(), header.m_nNodes * sizeof( CacheOptimizedKDNode ) );
+
+	m_pEnvironment->TriangleIndexList.SetCount( header.m_nTriangleIndices );
+	if ( header.m_nTriangleIndices )
+	{
+		buf.Get( m_pEnvironment->TriangleIndexList.Base(), header.m_nTriangleIndices * sizeof( int32 ) );
+	}
+
+	if ( !buf.IsValid() || !IsValidTree( m_pEnvironment ) )
+	{
+		Warning( "sv_staticlos: %s is damaged, rebuilding it\n", pszFilename );
+		m_pEnvironment->OptimizedTriangleList.RemoveAll();
+		m_pEnvironment->OptimizedKDTree.RemoveAll();
+		m_pEnvironment->TriangleIndexList.RemoveAll();
+		return false;
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CStaticWorldLOS::SaveCache( const char *pszFilename )
+{
+	StaticLOSFileHeader_t header;
+	header.m_nId = STATICLOS_FILE_ID;
+	header.m_nVersion = STATICLOS_FILE_VERSION;
+	header.m_MapCRC = m_MapCRC;
+	header.m_nTriangleSize = sizeof( CacheOptimizedTriangle );
+	header.m_nNodeSize = sizeof( CacheOptimizedKDNode );
+	header.m_nTriangles = m_pEnvironment->OptimizedTriangleList.Count();
+	header.m_nNodes = m_pEnvironment->OptimizedKDTree.Count();
+	header.m_nTriangleIndices = m_pEnvironment->TriangleIndexList.Count();
+	header.m_vecMins = m_pEnvironment->m_MinBound;
+	header.m_vecMaxs = m_pEnvironment->m_MaxBound;
+
+	CUtlBuffer buf;
+	buf.Put( &header, sizeof( header ) );
+	for ( int i = 0; i < header.m_nTriangles; i++ )
+	{
+		buf.Put( &m_pEnvironment->OptimizedTriangleList[i], sizeof( CacheOptimizedTriangle ) );
+	}
+	buf.Put( m_pEnvironment->OptimizedKDTree.Base(), header.m_nNodes * sizeof( CacheOptimizedKDNode ) );
+	if ( header.m_nTriangleIndices )
+	{
+		buf.Put( m_pEnvironment->TriangleIndexList.Base(), header.m_nTriangleIndices * sizeof( int32 ) );
+	}
+
+	if ( !filesystem->WriteFile( pszFilename, "MOD", buf ) )
+	{
+		Warning( "sv_staticlos: couldn't write %s\n", pszFilename );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+bool CStaticWorldLOS::IsOccluded( const Vector &vecStart, const Vector &vecEnd )
+{
+	bool bOccluded = false;
+	ComputeOcclusion( 1, &vecStart, &vecEnd, &bOccluded );
+	return bOccluded;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Traces the segments as packets of four rays. Safe to call from
+//			several threads at once; the tree is read-only after the build.
+//-----------------------------------------------------------------------------
+int CStaticWorldLOS::ComputeOcclusion( int nCount, const Vector *pStarts, const Vector *pEnds, bool *pOccluded )
+{
+	if ( !m_pEnvironment )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			pOccluded[i] = false;
+		}
+		return 0;
+	}
+
+	int nOccluded = 0;
+	for ( int nFirst = 0; nFirst < nCount; nFirst += 4 )
+	{
+		int nLanes = MIN( 4, nCount - nFirst );
+
+		FourRays rays;
+		fltx4 fl4TMin = ReplicateX4( STATICLOS_END_TOLERANCE );
+		fltx4 fl4TMax = Four_Zeros;
+		for ( int nLane = 0; nLane < 4; nLane++ )
+		{
+			// Unused lanes repeat the last segment so the packet keeps a single direction sign
+			int i = nFirst + MIN( nLane, nLanes - 1 );
+			Vector vecDir = pEnds[i] - pStarts[i];
+			float flLength = VectorNormalize( vecDir );
+
+			rays.origin.X( nLane ) = pStarts[i].x;
+			rays.origin.Y( nLane ) = pStarts[i].y;
+			rays.origin.Z( nLane ) = pStarts[i].z;
+			rays.direction.X( nLane ) = vecDir.x;
+			rays.direction.Y( nLane ) = vecDir.y;
+			rays.direction.Z( nLane ) = vecDir.z;
+			SubFloat( fl4TMax, nLane ) = flLength - STATICLOS_END_TOLERANCE;
+		}
+
+		RayTracingResult result;
+		m_pEnvironment->Trace4Rays( rays, fl4TMin, fl4TMax, &result );
+
+		for ( int nLane = 0; nLane < nLanes; nLane++ )
+		{
+			bool bHit = ( result.HitIds[nLane] != -1 ) && ( SubFloat( result.HitDistance, nLane ) <= SubFloat( fl4TMax, nLane ) );
+			pOccluded[nFirst + nLane] = bHit;
+			if ( bHit )
+			{
+				nOccluded++;
+			}
+		}
+	}
+
+	m_nQueries += nCount;
+	m_nOccluded += nOccluded;
+	return nOccluded;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CStaticWorldLOS::PrintStats()
+{
+	if ( !m_pEnvironment )
+	{
+		Msg( "Static world LOS is not active (sv_staticlos %d)\n", sv_staticlos.GetInt() );
+		return;
+	}
+
+	Msg( "Static world LOS: %d triangles, %d kd nodes, %s in %.1f ms (map crc %08x)\n",
+		m_pEnvironment->OptimizedTriangleList.Count(), m_pEnvironment->OptimizedKDTree.Count(),
+		m_bLoadedFromCache ? "loaded from cache" : "built", m_flBuildTime, (unsigned int)m_MapCRC );
+
+	int nQueries = m_nQueries;
+	int nOccluded = m_nOccluded;
+	Msg( "  %d queries, %d occluded (%.1f%% of traces skipped)\n", nQueries, nOccluded,
+		nQueries ? 100.0f * nOccluded / nQueries : 0.0f );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Times random segments through the map against engine traces and
+//			checks that nothing reported occluded is clear to the engine
+//-----------------------------------------------------------------------------
+void CStaticWorldLOS::RunBenchmark( int nRays )
+{
+	if ( !m_pEnvironment )
+	{
+		Msg( "Static world LOS is not active (sv_staticlos %d)\n", sv_staticlos.GetInt() );
+		return;
+	}
+
+	CUtlVector< Vector > starts, ends;
+	CUtlVector< bool > occluded, engineBlocked;
+	starts.SetCount( nRays );
+	ends.SetCount( nRays );
+	occluded.SetCount( nRays );
+	engineBlocked.SetCount( nRays );
+
+	const Vector &vecMins = m_pEnvironment->m_MinBound;
+	const Vector &vecMaxs = m_pEnvironment->m_MaxBound;
+	for ( int i = 0; i < nRays; i++ )
+	{
+		starts[i].Init( RandomFloat( vecMins.x, vecMaxs.x ), RandomFloat( vecMins.y, vecMaxs.y ), RandomFloat( vecMins.z, vecMaxs.z ) );
+		ends[i].Init( RandomFloat( vecMins.x, vecMaxs.x ), RandomFloat( vecMins.y, vecMaxs.y ), RandomFloat( vecMins.z, vecMaxs.z ) );
+	}
+
+	CFastTimer engineTimer;
+	engineTimer.Start();
+	CTraceFilterWorldAndPropsOnly filter;
+	for ( int i = 0; i < nRays; i++ )
+	{
+		trace_t tr;
+		UTIL_TraceLine( starts[i], ends[i], MASK_SOLID, &filter, &tr );
+		engineBlocked[i] = ( tr.fraction < 1.0f || tr.startsolid );
+	}
+	engineTimer.End();
+
+	int nQueries = m_nQueries;
+	int nPrevOccluded = m_nOccluded;
+
+	CFastTimer packetTimer;
+	packetTimer.Start();
+	int nOccluded = ComputeOcclusion( nRays, starts.Base(), ends.Base(), occluded.Base() );
+	packetTimer.End();
+
+	// keep the benchmark out of the gameplay stats
+	m_nQueries = nQueries;
+	m_nOccluded = nPrevOccluded;
+
+	int nEngineBlocked = 0, nFalseOcclusions = 0;
+	for ( int i = 0; i < nRays; i++ )
+	{
+		if ( engineBlocked[i] )
+		{
+			nEngineBlocked++;
+		}
+		else if ( occluded[i] )
+		{
+			nFalseOcclusions++;
+		}
+	}
+
+	Msg( "%d random segments:\n", nRays );
+	Msg( "  engine traces:  %8.2f ms, %d blocked\n", engineTimer.GetDuration().GetMillisecondsF(), nEngineBlocked );
+	Msg( "  static packets: %8.2f ms, %d occluded\n", packetTimer.GetDuration().GetMillisecondsF(), nOccluded );
+	Msg( "  occluded by the static tree but clear to the engine: %d\n", nFalseOcclusions );
+}
+
+
+CON_COMMAND( sv_staticlos_stats, "Print static world line of sight statistics" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_StaticWorldLOS.PrintStats();
+}
+
+
+CON_COMMAND_F( sv_staticlos_benchmark, "Compare static world line of sight packets against engine traces. Usage: sv_staticlos_benchmark [segments]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nRays = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 10000;
+	g_StaticWorldLOS.RunBenchmark( clamp( nRays, 4, 1000000 ) );
+}
@@ -0,0 +1,61 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Occlusion-only line of sight queries against the static world
+//			(world brushes, displacements and solid static props), answered
+//			from a kd-tree built once per map instead of through IEngineTrace.
+//
+//=============================================================================//
+
+#ifndef STATIC_WORLD_LOS_H
+#define STATIC_WORLD_LOS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "igamesystem.h"
+#include "checksum_crc.h"
+#include "tier0/threadtools.h"
+
+class RayTracingEnvironment;
+class CUtlBuffer;
+
+
+class CStaticWorldLOS : public CAutoGameSystem
+{
+public:
+	CStaticWorldLOS( char const *name );
+
+	// game system
+	virtual void LevelInitPostEntity();
+	virtual void LevelShutdownPostEntity();
+
+	bool IsReady() const;
+
+	// Returns true if the static world definitely blocks the segment. A false result only
+	// means nothing static is in the way; dynamic entities still need a real trace.
+	bool IsOccluded( const Vector &vecStart, const Vector &vecEnd );
+
+	// Tests nCount segments, four per ray packet. Returns how many were occluded.
+	int ComputeOcclusion( int nCount, const Vector *pStarts, const Vector *pEnds, bool *pOccluded );
+
+	void PrintStats();
+	void RunBenchmark( int nRays );
+
+private:
+	bool BuildFromBSP( CUtlBuffer &bsp );
+	void AddStaticProps();
+	bool LoadCache( const char *pszFilename );
+	void SaveCache( const char *pszFilename );
+
+	RayTracingEnvironment	*m_pEnvironment;
+	CRC32_t					m_MapCRC;
+	bool					m_bLoadedFromCache;
+	float					m_flBuildTime;
+
+	CInterlockedInt			m_nQueries;
+	CInterlockedInt			m_nOccluded;
+};
+
+extern CStaticWorldLOS g_StaticWorldLOS;
+
+#endif // STATIC_WORLD_LOS_H
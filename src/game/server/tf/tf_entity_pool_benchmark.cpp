@@ -0,0 +1,246 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: entity_pool_benchmark, rocket and pipe spam with and without the
+//			per-class entity pools
+//
+//=============================================================================
+#include "cbase.h"
+#include "tier0/fasttimer.h"
+#include "tf_player.h"
+#include "tf_projectile_rocket.h"
+#include "tf_weapon_grenade_pipebomb.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+enum
+{
+	POOL_BENCH_ROCKET = 0,
+	POOL_BENCH_PIPE,
+
+	POOL_BENCH_CLASSES
+};
+
+static const char *s_pszPoolBenchClasses[POOL_BENCH_CLASSES] = { "tf_projectile_rocket", "tf_projectile_pipe" };
+
+//-----------------------------------------------------------------------------
+// Keeps a window of live rockets and pipes in front of the player and replaces
+// the oldest few of each every frame, the way sustained spam does, first with
+// the entity pools turned off and then with them on. Only creating and removing
+// the projectiles is timed. They're frozen in place so they don't hit anything
+// and explode on their own.
+//-----------------------------------------------------------------------------
+class CEntityPoolBenchmark : public CAutoGameSystemPerFrame
+{
+public:
+	CEntityPoolBenchmark( const char *name ) : CAutoGameSystemPerFrame( name )
+	{
+		m_pPipeInfo = NULL;
+		m_nFrames = m_nPerFrame = m_nLive = 0;
+		m_nPhase = -1;
+		m_nFrame = 0;
+		m_nNext = 0;
+	}
+
+	bool IsRunning() const { return m_nPhase >= 0; }
+	void Start( CTFPlayer *pPlayer, const CTFWeaponInfo *pPipeInfo, int nFrames, int nPerFrame, int nLive );
+
+	virtual void FrameUpdatePreEntityThink();
+	virtual void LevelShutdownPreEntity() { Stop(); }
+
+private:
+	CBaseEntity *CreateProjectile( int iClass );
+	void FillWindows();
+	void RemoveAll();
+	void Stop();
+
+	CHandle<CTFPlayer>		m_hPlayer;
+	const CTFWeaponInfo		*m_pPipeInfo;
+	int						m_nFrames;
+	int						m_nPerFrame;
+	int						m_nLive;
+
+	int						m_nPhase;		// -1 idle, 0 engine heap, 1 entity pools
+	int						m_nFrame;
+	int						m_nNext;		// next slot of the windows to replace
+	CUtlVector<EHANDLE>		m_Live[POOL_BENCH_CLASSES];
+	CCycleCount				m_Time[2][POOL_BENCH_CLASSES];
+};
+
+static CEntityPoolBenchmark g_EntityPoolBenchmark( "CEntityPoolBenchmark" );
+
+void CEntityPoolBenchmark::Start( CTFPlayer *pPlayer, const CTFWeaponInfo *pPipeInfo, int nFrames, int nPerFrame, int nLive )
+{
+	m_hPlayer = pPlayer;
+	m_pPipeInfo = pPipeInfo;
+	m_nFrames = nFrames;
+	m_nPerFrame = nPerFrame;
+	m_nLive = nLive;
+
+	m_nPhase = 0;
+	m_nFrame = 0;
+	m_nNext = 0;
+	for ( int iClass = 0; iClass < POOL_BENCH_CLASSES; iClass++ )
+	{
+		m_Live[iClass].SetCount( m_nLive );
+		m_Time[0][iClass].Init();
+		m_Time[1][iClass].Init();
+	}
+}
+
+CBaseEntity *CEntityPoolBenchmark::CreateProjectile( int iClass )
+{
+	CTFPlayer *pPlayer = m_hPlayer;
+
+	Vector vecForward;
+	pPlayer->EyeVectors( &vecForward );
+	Vector vecSrc = pPlayer->EyePosition() + vecForward * 64.0f;
+	QAngle angles = pPlayer->EyeAngles();
+
+	if ( iClass == POOL_BENCH_ROCKET )
+	{
+		CTFProjectile_Rocket *pRocket = CTFProjectile_Rocket::Create( pPlayer->GetActiveWeapon(), vecSrc, angles, pPlayer, pPlayer );
+		if ( pRocket )
+		{
+			pRocket->SetMoveType( MOVETYPE_NONE );
+			pRocket->SetAbsVelocity( vec3_origin );
+		}
+		return pRocket;
+	}
+
+	CTFGrenadePipebombProjectile *pPipe = CTFGrenadePipebombProjectile::Create( vecSrc, angles, vec3_origin, AngularImpulse( 0, 0, 0 ), pPlayer, *m_pPipeInfo, TF_PROJECTILE_PIPEBOMB, 1.0f );
+	if ( pPipe && pPipe->VPhysicsGetObject() )
+	{
+		pPipe->VPhysicsGetObject()->EnableMotion( false );
+	}
+	return pPipe;
+}
+
+void CEntityPoolBenchmark::FillWindows()
+{
+	for ( int iClass = 0; iClass < POOL_BENCH_CLASSES; iClass++ )
+	{
+		FOR_EACH_VEC( m_Live[iClass], i )
+		{
+			m_Live[iClass][i] = CreateProjectile( iClass );
+		}
+	}
+}
+
+void CEntityPoolBenchmark::RemoveAll()
+{
+	for ( int iClass = 0; iClass < POOL_BENCH_CLASSES; iClass++ )
+	{
+		FOR_EACH_VEC( m_Live[iClass], i )
+		{
+			if ( m_Live[iClass][i] )
+			{
+				UTIL_Remove( m_Live[iClass][i] );
+			}
+			m_Live[iClass][i] = NULL;
+		}
+	}
+	gEntList.CleanupDeleteList();
+}
+
+void CEntityPoolBenchmark::Stop()
+{
+	if ( !IsRunning() )
+		return;
+
+	RemoveAll();
+	EnableEntityMemoryPools( true );
+	m_nPhase = -1;
+}
+
+void CEntityPoolBenchmark::FrameUpdatePreEntityThink()
+{
+	if ( !IsRunning() )
+		return;
+
+	if ( !m_hPlayer || !m_hPlayer->IsAlive() )
+	{
+		Warning( "entity_pool_benchmark: the player died or left, stopping\n" );
+		Stop();
+		return;
+	}
+
+	if ( m_nFrame == 0 )
+	{
+		// Untimed, so both phases are timed at the same steady state
+		EnableEntityMemoryPools( m_nPhase == 1 );
+		FillWindows();
+	}
+
+	for ( int iClass = 0; iClass < POOL_BENCH_CLASSES; iClass++ )
+	{
+		CFastTimer timer;
+		timer.Start();
+		for ( int i = 0; i < m_nPerFrame; i++ )
+		{
+			EHANDLE &hSlot = m_Live[iClass][( m_nNext + i ) % m_nLive];
+			if ( hSlot )
+			{
+				UTIL_Remove( hSlot );
+			}
+		}
+		gEntList.CleanupDeleteList();
+
+		for ( int i = 0; i < m_nPerFrame; i++ )
+		{
+			m_Live[iClass][( m_nNext + i ) % m_nLive] = CreateProjectile( iClass );
+		}
+		timer.End();
+		m_Time[m_nPhase][iClass] += timer.GetDuration();
+	}
+	m_nNext = ( m_nNext + m_nPerFrame ) % m_nLive;
+
+	if ( ++m_nFrame < m_nFrames )
+		return;
+
+	RemoveAll();
+	m_nFrame = 0;
+	m_nNext = 0;
+	if ( ++m_nPhase < 2 )
+		return;
+
+	int nReplaced = m_nFrames * m_nPerFrame;
+	Msg( "entity_pool_benchmark: %d frames, %d of %d live replaced per frame, per create/remove:\n", m_nFrames, m_nPerFrame, m_nLive );
+	for ( int iClass = 0; iClass < POOL_BENCH_CLASSES; iClass++ )
+	{
+		Msg( "  %-24s heap %7.2f us  pools %7.2f us\n", s_pszPoolBenchClasses[iClass],
+			m_Time[0][iClass].GetMicrosecondsF() / nReplaced, m_Time[1][iClass].GetMicrosecondsF() / nReplaced );
+	}
+
+	Stop();
+}
+
+CON_COMMAND_F( entity_pool_benchmark, "Spams rockets and pipes in front of you, first from the engine heap and then from the entity pools, and times creating and removing them. Usage: entity_pool_benchmark [frames] [replaced per frame] [live]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( g_EntityPoolBenchmark.IsRunning() )
+	{
+		Msg( "entity_pool_benchmark: already running\n" );
+		return;
+	}
+
+	CTFPlayer *pPlayer = ToTFPlayer( UTIL_GetCommandClient() );
+	if ( !pPlayer || !pPlayer->IsAlive() )
+	{
+		Msg( "entity_pool_benchmark: must be run by a live player\n" );
+		return;
+	}
+
+	WEAPON_FILE_INFO_HANDLE hPipeInfo = LookupWeaponInfoSlot( WeaponIdToAlias( TF_WEAPON_GRENADELAUNCHER ) );
+	if ( hPipeInfo == GetInvalidWeaponInfoHandle() )
+		return;
+
+	// Edicts aren't reused for a second after they're freed, so keep the churn well inside the edict limit
+	int nFrames = args.ArgC() >= 2 ? MAX( atoi( args[1] ), 1 ) : 600;
+	int nPerFrame = args.ArgC() >= 3 ? clamp( atoi( args[2] ), 1, 6 ) : 3;
+	int nLive = args.ArgC() >= 4 ? clamp( atoi( args[3] ), nPerFrame, 128 ) : 96;	// 24 players with 4 projectiles each in the air
+
+	g_EntityPoolBenchmark.Start( pPlayer, static_cast<CTFWeaponInfo *>( GetFileWeaponInfoFromHandle( hPipeInfo ) ), nFrames, nPerFrame, nLive );
+}
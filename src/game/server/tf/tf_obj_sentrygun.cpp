@@ -25,6 +25,7 @@
 #include "tf_weapon_knife.h"
 #include "tf_logic_robot_destruction.h"
 #include "tf_target_dummy.h"
+#include "static_world_los.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1080,6 +1081,10 @@ bool CObjectSentrygun::ValidTargetPlayer( CTFPlayer *pPlayer, const Vector &vecS
 	if ( ( GetWaterLevel() == 0 && pPlayer->GetWaterLevel() >= 3 ) || ( GetWaterLevel() == 3 && pPlayer->GetWaterLevel() <= 0 ) )
 		return false;
 
+	// Static world in the way, no need to trace
+	if ( g_StaticWorldLOS.IsOccluded( EyePosition(), pPlayer->EyePosition() ) )
+		return false;
+
 	// Ray trace!!!
 	return FVisible( pPlayer, MASK_SHOT | CONTENTS_GRATE );
 }
@@ -1104,6 +1109,10 @@ bool CObjectSentrygun::ValidTargetObject( CBaseObject *pObject, const Vector &ve
 	if ( pObject->GetObjectFlags() & OF_DOESNT_HAVE_A_MODEL )
 		return false;
 
+	// Static world in the way, no need to trace
+	if ( g_StaticWorldLOS.IsOccluded( EyePosition(), pObject->EyePosition() ) )
+		return false;
+
 	// Ray trace.
 	return FVisible( pObject, MASK_SHOT | CONTENTS_GRATE );
 }
@@ -50,7 +50,7 @@
 #define CLAW_REPAIR_EFFECT_BLU		"repair_claw_heal_blue"
 #define CLAW_REPAIR_EFFECT_RED		"repair_claw_heal_red"
 //-----------------------------------------------------------------------------
-LINK_ENTITY_TO_CLASS( tf_projectile_arrow, CTFProjectile_Arrow );
+LINK_ENTITY_TO_CLASS_POOLED( tf_projectile_arrow, CTFProjectile_Arrow );
 PRECACHE_WEAPON_REGISTER( tf_projectile_arrow );
 
 IMPLEMENT_NETWORKCLASS_ALIASED( TFProjectile_Arrow, DT_TFProjectile_Arrow )
@@ -21,7 +21,7 @@
 
 #define FLARE_THINK_CONTEXT			"CTFProjectile_FlareThink"
 
-LINK_ENTITY_TO_CLASS( tf_projectile_flare, CTFProjectile_Flare );
+LINK_ENTITY_TO_CLASS_POOLED( tf_projectile_flare, CTFProjectile_Flare );
 PRECACHE_WEAPON_REGISTER( tf_projectile_flare );
 
 IMPLEMENT_NETWORKCLASS_ALIASED( TFProjectile_Flare, DT_TFProjectile_Flare )
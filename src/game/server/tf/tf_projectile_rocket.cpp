@@ -15,7 +15,7 @@
 //
 #define ROCKET_MODEL "models/weapons/w_models/w_rocket.mdl"
 
-LINK_ENTITY_TO_CLASS( tf_projectile_rocket, CTFProjectile_Rocket );
+LINK_ENTITY_TO_CLASS_POOLED( tf_projectile_rocket, CTFProjectile_Rocket );
 PRECACHE_REGISTER( tf_projectile_rocket );
 
 IMPLEMENT_NETWORKCLASS_ALIASED( TFProjectile_Rocket, DT_TFProjectile_Rocket )
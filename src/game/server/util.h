@@ -149,6 +149,37 @@ public:
 #define LINK_ENTITY_TO_CLASS(mapClassName,DLLClassName) \
 	static CEntityFactory<DLLClassName> mapClassName( #mapClassName );
 
+// Same as CEntityFactory, but the entity's memory comes from an allocator owned by this
+// factory instead of the engine heap, and goes back to it when the entity is deleted.
+// Use it for classes that are created and removed constantly.
+struct EntityMemoryPool_t;
+EntityMemoryPool_t *RegisterPooledEntityClass( size_t stClassSize, const char *pszClassName );
+void SetNextEntityMemoryPool( EntityMemoryPool_t *pPool );
+void EnableEntityMemoryPools( bool bEnable );
+
+template <class T>
+class CPooledEntityFactory : public CEntityFactory<T>
+{
+public:
+	CPooledEntityFactory( const char *pClassName ) : CEntityFactory<T>( pClassName )
+	{
+		m_pPool = RegisterPooledEntityClass( sizeof(T), pClassName );
+	}
+
+	IServerNetworkable *Create( const char *pClassName )
+	{
+		// Taken by CBaseEntity::operator new for the entity constructed below
+		SetNextEntityMemoryPool( m_pPool );
+		return CEntityFactory<T>::Create( pClassName );
+	}
+
+private:
+	EntityMemoryPool_t *m_pPool;
+};
+
+#define LINK_ENTITY_TO_CLASS_POOLED(mapClassName,DLLClassName) \
+	static CPooledEntityFactory<DLLClassName> mapClassName( #mapClassName );
+
 
 //
 // Conversion among the three types of "entity", including identity-conversions.
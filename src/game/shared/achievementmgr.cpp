@@ -42,6 +42,7 @@
 #endif  // _X360
 #include "engine/imatchmaking.h"
 #include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
 
 #if defined(TF_DLL) || defined(TF_CLIENT_DLL)
 #include "tf_gamerules.h"
@@ -264,6 +265,9 @@ m_CallbackUserStatsStored( this, &CAchievementMgr::Steam_OnUserStatsStored )
 	m_bGlobalStateLoaded = false;
 	m_bCheatsEverOn = false;
 	m_flTimeLastSaved = 0;
+	m_nKillEventsDispatched = 0;
+	m_nKillEventListenersTouched = 0;
+	m_flKillDispatchTime = 0;
 
     //=============================================================================
     // HPE_BEGIN
@@ -500,6 +504,10 @@ void CAchievementMgr::LevelInitPreEntity()
 
 	m_AchievementsAwarded.RemoveAll();
 
+	m_nKillEventsDispatched = 0;
+	m_nKillEventListenersTouched = 0;
+	m_flKillDispatchTime = 0;
+
 	m_flLastClassChangeTime = 0;
 	m_flTeamplayStartTime = 0;
 	m_iMiniroundsCompleted = 0;
@@ -535,7 +543,7 @@ void CAchievementMgr::LevelInitPreEntity()
 		// if the achievement needs kill events, add it as a listener
 		if ( pAchievement->GetFlags() & ACH_LISTEN_KILL_EVENTS )
 		{
-			m_vecKillEventListeners.AddToTail( pAchievement );
+			AddKillEventListener( pAchievement );
 		}
 		// if the achievement needs map events, add it as a listener
 		if ( pAchievement->GetFlags() & ACH_LISTEN_MAP_EVENTS )
@@ -1505,6 +1513,27 @@ void CAchievementMgr::FireGameEvent( IGameEvent *event )
 #endif // CLIENT_DLL
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: adds an achievement to the kill event bucket for its player class
+//-----------------------------------------------------------------------------
+void CAchievementMgr::AddKillEventListener( CBaseAchievement *pAchievement )
+{
+	int iPlayerClass = pAchievement->GetPlayerClassFilter();
+
+	FOR_EACH_VEC( m_vecKillEventListeners, iBucket )
+	{
+		if ( m_vecKillEventListeners[iBucket].m_iPlayerClass == iPlayerClass )
+		{
+			m_vecKillEventListeners[iBucket].m_vecAchievements.AddToTail( pAchievement );
+			return;
+		}
+	}
+
+	int iBucket = m_vecKillEventListeners.AddToTail();
+	m_vecKillEventListeners[iBucket].m_iPlayerClass = iPlayerClass;
+	m_vecKillEventListeners[iBucket].m_vecAchievements.AddToTail( pAchievement );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: called when a player or character has been killed
 //-----------------------------------------------------------------------------
@@ -1544,53 +1573,92 @@ void CAchievementMgr::OnKillEvent( CBaseEntity *pVictim, CBaseEntity *pAttacker,
 	}
 #endif // GAME_DLL
 
+	CFastTimer timer;
+	timer.Start();
+	int nTouched = 0;
+
 	// look through all the kill event listeners and notify any achievements whose filters we pass
-	FOR_EACH_VEC( m_vecKillEventListeners, iAchievement )
+	FOR_EACH_VEC( m_vecKillEventListeners, iBucket )
 	{
-		CBaseAchievement *pAchievement = m_vecKillEventListeners[iAchievement];
+		killeventlisteners_t &bucket = m_vecKillEventListeners[iBucket];
 
-		if ( !pAchievement->IsActive() )
+		// every achievement in the bucket wants the same class, so one check rules them all out
+		if ( bucket.m_iPlayerClass != 0 && !bucket.m_vecAchievements[0]->LocalPlayerMatchesClassFilter() )
 			continue;
 
+		FOR_EACH_VEC( bucket.m_vecAchievements, iAchievement )
+		{
+			CBaseAchievement *pAchievement = bucket.m_vecAchievements[iAchievement];
+			nTouched++;
+
+			if ( !pAchievement->IsActive() )
+				continue;
+
 #ifdef CLIENT_DLL
-		// Swallow kill events that can't be earned right now
-		if ( !pAchievement->LocalPlayerCanEarn() )
-			continue;
+			// Swallow kill events that can't be earned right now
+			if ( !pAchievement->LocalPlayerCanEarn() )
+				continue;
 #endif
 
-		// if this achievement only looks for kills where attacker is player and that is not the case here, skip this achievement
-		if ( ( pAchievement->GetFlags() & ACH_FILTER_ATTACKER_IS_PLAYER ) && !bAttackerIsPlayer )
-			continue;
+			// if this achievement only looks for kills where attacker is player and that is not the case here, skip this achievement
+			if ( ( pAchievement->GetFlags() & ACH_FILTER_ATTACKER_IS_PLAYER ) && !bAttackerIsPlayer )
+				continue;
 
-		// if this achievement only looks for kills where victim is killer enemy and that is not the case here, skip this achievement
-		if ( ( pAchievement->GetFlags() & ACH_FILTER_VICTIM_IS_PLAYER_ENEMY ) && !bVictimIsPlayerEnemy )
-			continue;
+			// if this achievement only looks for kills where victim is killer enemy and that is not the case here, skip this achievement
+			if ( ( pAchievement->GetFlags() & ACH_FILTER_VICTIM_IS_PLAYER_ENEMY ) && !bVictimIsPlayerEnemy )
+				continue;
 
 #if GAME_DLL
-		// if this achievement only looks for a particular victim class name and this victim is a different class, skip this achievement
-		const char *pVictimClassNameFilter = pAchievement->m_pVictimClassNameFilter;
-		if ( pVictimClassNameFilter && !pVictim->ClassMatches( pVictimClassNameFilter ) )
-			continue;
+			// if this achievement only looks for a particular victim class name and this victim is a different class, skip this achievement
+			const char *pVictimClassNameFilter = pAchievement->m_pVictimClassNameFilter;
+			if ( pVictimClassNameFilter && !pVictim->ClassMatches( pVictimClassNameFilter ) )
+				continue;
+
+			// if this achievement only looks for a particular inflictor class name and this inflictor is a different class, skip this achievement
+			const char *pInflictorClassNameFilter = pAchievement->m_pInflictorClassNameFilter;
+			if ( pInflictorClassNameFilter &&  ( ( NULL == pInflictor ) || !pInflictor->ClassMatches( pInflictorClassNameFilter ) ) )
+				continue;
+
+			// if this achievement only looks for a particular attacker class name and this attacker is a different class, skip this achievement
+			const char *pAttackerClassNameFilter = pAchievement->m_pAttackerClassNameFilter;
+			if ( pAttackerClassNameFilter && ( ( NULL == pAttacker ) || !pAttacker->ClassMatches( pAttackerClassNameFilter ) ) )
+				continue;
+
+			// if this achievement only looks for a particular inflictor entity name and this inflictor has a different name, skip this achievement
+			const char *pInflictorEntityNameFilter = pAchievement->m_pInflictorEntityNameFilter;
+			if ( pInflictorEntityNameFilter && ( ( NULL == pInflictor ) || !pInflictor->NameMatches( pInflictorEntityNameFilter ) ) )
+				continue;
+#endif // GAME_DLL
 
-		// if this achievement only looks for a particular inflictor class name and this inflictor is a different class, skip this achievement
-		const char *pInflictorClassNameFilter = pAchievement->m_pInflictorClassNameFilter;
-		if ( pInflictorClassNameFilter &&  ( ( NULL == pInflictor ) || !pInflictor->ClassMatches( pInflictorClassNameFilter ) ) )
-			continue;
+			// we pass all filters for this achievement, notify the achievement of the kill
+			pAchievement->Event_EntityKilled( pVictim, pAttacker, pInflictor, event );
+		}
+	}
 
-		// if this achievement only looks for a particular attacker class name and this attacker is a different class, skip this achievement
-		const char *pAttackerClassNameFilter = pAchievement->m_pAttackerClassNameFilter;
-		if ( pAttackerClassNameFilter && ( ( NULL == pAttacker ) || !pAttacker->ClassMatches( pAttackerClassNameFilter ) ) )
-			continue;
+	timer.End();
+	m_nKillEventsDispatched++;
+	m_nKillEventListenersTouched += nTouched;
+	m_flKillDispatchTime += timer.GetDuration().GetMillisecondsF();
+}
 
-		// if this achievement only looks for a particular inflictor entity name and this inflictor has a different name, skip this achievement
-		const char *pInflictorEntityNameFilter = pAchievement->m_pInflictorEntityNameFilter;
-		if ( pInflictorEntityNameFilter && ( ( NULL == pInflictor ) || !pInflictor->NameMatches( pInflictorEntityNameFilter ) ) )
-			continue;
-#endif // GAME_DLL
+//-----------------------------------------------------------------------------
+// Purpose: reports how much work kill event dispatch has done this level
+//-----------------------------------------------------------------------------
+void CAchievementMgr::PrintKillDispatchStats()
+{
+	int nListeners = 0;
+	FOR_EACH_VEC( m_vecKillEventListeners, iBucket )
+	{
+		Msg( "  class %d: %d achievements\n", m_vecKillEventListeners[iBucket].m_iPlayerClass, m_vecKillEventListeners[iBucket].m_vecAchievements.Count() );
+		nListeners += m_vecKillEventListeners[iBucket].m_vecAchievements.Count();
+	}
 
-		// we pass all filters for this achievement, notify the achievement of the kill
-		pAchievement->Event_EntityKilled( pVictim, pAttacker, pInflictor, event );
-	}		
+	Msg( "%d kill event listeners in %d class buckets\n", nListeners, m_vecKillEventListeners.Count() );
+	if ( m_nKillEventsDispatched )
+	{
+		Msg( "%d kill events, %.1f achievements touched and %.4f ms per event\n", m_nKillEventsDispatched,
+			(float)m_nKillEventListenersTouched / m_nKillEventsDispatched, m_flKillDispatchTime / m_nKillEventsDispatched );
+	}
 }
 
 void CAchievementMgr::OnAchievementEvent( int iAchievementID, int iCount )
@@ -1940,6 +2008,14 @@ CON_COMMAND_F( achievement_status, "Shows status of all achievement", FCVAR_CHEA
 	pAchievementMgr->PrintAchievementStatus();
 }
 
+CON_COMMAND_F( achievement_dispatch_stats, "Shows how kill events are dispatched to achievements and what it costs", FCVAR_CHEAT )
+{
+	CAchievementMgr *pAchievementMgr = dynamic_cast<CAchievementMgr *>( engine->GetAchievementMgr() );
+	if ( !pAchievementMgr )
+		return;
+	pAchievementMgr->PrintKillDispatchStats();
+}
+
 CON_COMMAND_F( achievement_unlock, "<internal name> Unlocks achievement", FCVAR_CHEAT )
 {
 	CAchievementMgr *pAchievementMgr = dynamic_cast<CAchievementMgr *>( engine->GetAchievementMgr() );
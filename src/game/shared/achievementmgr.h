@@ -117,15 +117,24 @@ public:
 
 	void SetAchievementThink( CBaseAchievement *pAchievement, float flThinkTime );
 
+	void PrintKillDispatchStats();
+
 private:
 	void FireGameEvent( IGameEvent *event );
 	void OnKillEvent( CBaseEntity *pVictim, CBaseEntity *pAttacker, CBaseEntity *pInflictor, IGameEvent *event );
+	void AddKillEventListener( CBaseAchievement *pAchievement );
 	void ResetAchievement_Internal( CBaseAchievement *pAchievement );
 	void UpdateStateFromSteam_Internal();
 
 	CUtlMap<int, CBaseAchievement *> m_mapAchievement;					// map of all achievements
 	CUtlVector<CBaseAchievement *>	 m_vecAchievement;					// vector of all achievements for accessing by index
-	CUtlVector<CBaseAchievement *> m_vecKillEventListeners;				// vector of achievements that are listening for kill events
+
+	struct killeventlisteners_t
+	{
+		int							   m_iPlayerClass;					// player class every achievement in this bucket requires, 0 for any
+		CUtlVector<CBaseAchievement *> m_vecAchievements;
+	};
+	CUtlVector<killeventlisteners_t> m_vecKillEventListeners;			// achievements that are listening for kill events, bucketed by player class
 	CUtlVector<CBaseAchievement *> m_vecMapEventListeners;				// vector of achievements that are listening for map events
 	CUtlVector<CBaseAchievement *> m_vecComponentListeners;				// vector of achievements that are listening for components that make up an achievement
 	CUtlMap<int, CAchievement_AchievedCount *> m_mapMetaAchievement;				// map of CAchievement_AchievedCount
@@ -149,6 +158,10 @@ private:
 	bool  m_bCheatsEverOn;				// have cheats ever been turned on in this level
 	float m_flTimeLastSaved;			// last time we uploaded to Steam
 
+	int	   m_nKillEventsDispatched;		// kill events handed to listeners this level
+	int	   m_nKillEventListenersTouched;	// achievements looked at while dispatching them
+	double m_flKillDispatchTime;		// total time spent dispatching them, in ms
+
     //=============================================================================
     // HPE_BEGIN
     // [dwenger] Steam Cloud Support
@@ -66,6 +66,11 @@ public:
 	virtual bool AlwaysListen() { return false; }
 	virtual bool AlwaysEnabled() { return false; }
 
+	// Player class the local player must be for this achievement to progress, or 0 for any class.
+	// The achievement manager only hands kill events to buckets whose class matches.
+	virtual int GetPlayerClassFilter() { return 0; }
+	virtual bool LocalPlayerMatchesClassFilter() { return true; }
+
 	//=============================================================================
 	// HPE_BEGIN:
 	// [pfreese] Notification method for derived classes
@@ -57,9 +57,9 @@ public:
 
 	void Dump( void )
 	{
-		for ( int i = m_Strings.FirstInorder(); i != m_Strings.InvalidIndex(); i = m_Strings.NextInorder(i) )
+		for ( UtlHashHandle_t i = m_Strings.FirstHandle(); i != m_Strings.InvalidHandle(); i = m_Strings.NextHandle(i) )
 		{
-			DevMsg( "  %d (0x%p) : %s\n", i, m_Strings[i], m_Strings[i] );
+			DevMsg( "  %d (0x%p) : %s\n", i, m_Strings.Key(i), m_Strings.Key(i) );
 		}
 		DevMsg( "\n" );
 		DevMsg( "Size:  %d items\n", m_Strings.Count() );
@@ -67,11 +67,11 @@ public:
 
 	void Remove( const char *pszValue )
 	{
-		int i = m_Strings.Find( pszValue );
-		if ( i != m_Strings.InvalidIndex() )
+		UtlHashHandle_t i = m_Strings.Find( pszValue );
+		if ( i != m_Strings.InvalidHandle() )
 		{
-			m_DeferredDeleteList.AddToTail( m_Strings[ i ] );
-			m_Strings.RemoveAt( i );
+			m_DeferredDeleteList.AddToTail( m_Strings.Key( i ) );
+			m_Strings.RemoveByHandle( i );
 		}
 	}
 
@@ -29,7 +29,7 @@ public:
 		for ( int i = 0; i < msg.Body().convars_size(); ++i )
 		{
 			const CMsgConVarValue &updatedConVar = msg.Body().convars( i );
-			ConVar *pVar = g_pCVar->FindVar( updatedConVar.name().data() );
+			ConVar *pVar = ConVar_FindVar( updatedConVar.name().data() );
 			if ( pVar )
 			{
 				pVar->SetValue( updatedConVar.value().data() );
@@ -52,7 +52,7 @@ public:
 	virtual bool BYieldingRunGCJob( GCSDK::IMsgNetPacket *pNetPacket )
 	{
 		CProtoBufMsg< CMsgConVarValue > msg ( pNetPacket );
-		ConVar *pVar = g_pCVar->FindVar( msg.Body().name().data() );
+		ConVar *pVar = ConVar_FindVar( msg.Body().name().data() );
 		if ( pVar )
 		{
 			pVar->SetValue( msg.Body().value().data() );
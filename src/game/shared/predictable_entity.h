@@ -171,6 +171,9 @@ class SendTable;
 	};																		\
 	static C##localName##Foo g_C##localName##Foo;
 
+// Entity memory pooling only applies to the server.
+#define LINK_ENTITY_TO_CLASS_POOLED( localName, className ) LINK_ENTITY_TO_CLASS( localName, className )
+
 #define BEGIN_NETWORK_TABLE( className, tableName ) BEGIN_RECV_TABLE( className, tableName )
 #define BEGIN_NETWORK_TABLE_NOBASE( className, tableName ) BEGIN_RECV_TABLE_NOBASE( className, tableName )
 
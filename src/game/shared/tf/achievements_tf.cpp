@@ -77,18 +77,31 @@ bool CBaseTFAchievement::LocalPlayerCanEarn( void )
 	}
 
 	// Determine class & check it
-	if ( m_iAchievementID >= ACHIEVEMENT_START_CLASS_SPECIFIC && m_iAchievementID <= ACHIEVEMENT_END_CLASS_SPECIFIC )
+	if ( !LocalPlayerMatchesClassFilter() )
 	{
-		int iClass = floor( (m_iAchievementID - ACHIEVEMENT_START_CLASS_SPECIFIC) / 100.0f ) + 1;
-		if ( !IsLocalTFPlayerClass( iClass ) )
-		{
-			return false;
-		}
+		return false;
 	}
 
 	return BaseClass::LocalPlayerCanEarn();
 }
 
+int CBaseTFAchievement::GetPlayerClassFilter( void )
+{
+	// Class specific achievements are laid out in blocks of 100 IDs per class
+	if ( m_iAchievementID >= ACHIEVEMENT_START_CLASS_SPECIFIC && m_iAchievementID <= ACHIEVEMENT_END_CLASS_SPECIFIC )
+	{
+		return floor( (m_iAchievementID - ACHIEVEMENT_START_CLASS_SPECIFIC) / 100.0f ) + 1;
+	}
+
+	return TF_CLASS_UNDEFINED;
+}
+
+bool CBaseTFAchievement::LocalPlayerMatchesClassFilter( void )
+{
+	int iClass = GetPlayerClassFilter();
+	return ( iClass == TF_CLASS_UNDEFINED ) || IsLocalTFPlayerClass( iClass );
+}
+
 
 //-----------------------------------------------------------------------------
 // Purpose: 
@@ -34,6 +34,8 @@ class CBaseTFAchievement : public CBaseTFAchievementSimple
 	DECLARE_CLASS( CBaseTFAchievement, CBaseTFAchievementSimple );
 public:
 	virtual bool LocalPlayerCanEarn( void );
+	virtual int GetPlayerClassFilter( void );
+	virtual bool LocalPlayerMatchesClassFilter( void );
 };
 
 //----------------------------------------------------------------------------------------------------------------
@@ -127,6 +127,8 @@
 	#include "tf_party.h"
 	#include "tf_autobalance.h"
 	#include "player_voice_listener.h"
+	#include "static_world_los.h"
+	#include "collisionutils.h"
 #endif
 
 #include "tf_mann_vs_machine_stats.h"
@@ -154,6 +156,9 @@
 
 #define ITEM_RESPAWN_TIME	10.0f
 #define MASK_RADIUS_DAMAGE  ( MASK_SHOT & ~( CONTENTS_HITBOX ) )
+// Below this many targets the source trace the static cull needs costs more than the
+// per-target traces it can save, so RadiusDamage just traces each target
+#define RADIUS_DAMAGE_MIN_STATIC_CULL_TARGETS	4
 
 // Halloween 2013 VO defines for plr_hightower_event
 #define HELLTOWER_TIMER_INTERVAL	( 60 + RandomInt( -30, 30 )	)
@@ -5631,7 +5636,8 @@ void CTFGameRules::RadiusDamage( CTFRadiusDamageInfo &info )
 	// Some weapons pass a radius of 0, since their only goal is to give blast jumping ability
 	if ( info.flRadius > 0 )
 	{
-		// Find all the entities in the radius, and attempt to damage them.
+		// Find all the entities in the radius
+		CUtlVector< CBaseEntity * > targets;
 		CBaseEntity *pEntity = NULL;
 		for ( CEntitySphereQuery sphere( info.vecSrc, info.flRadius ); (pEntity = sphere.GetCurrentEntity()) != NULL; sphere.NextEntity() )
 		{
@@ -5645,6 +5651,69 @@ void CTFGameRules::RadiusDamage( CTFRadiusDamageInfo &info )
 			if ( (info.vecSrc - vecPos).LengthSqr() > flRadSqr )
 				continue;
 
+			targets.AddToTail( pEntity );
+		}
+
+		// Anything the static world hides from the explosion can't be damaged, so
+		// cull those in one batch before paying for a trace per target. Only cull
+		// where ApplyToEntity's trace is certain to be blocked by the world:
+		// - a trace that starts in solid is retried and can get out, so nothing is
+		//   culled when the source is in or touching world geometry
+		// - the trace succeeds if it reaches the target before the world, so each
+		//   segment stops where it enters the target's bounds
+		// Checking the source takes an engine trace, so the cull only runs when
+		// there are enough targets to pay for it.
+		CUtlVector< bool > occluded;
+		occluded.SetCount( targets.Count() );
+		occluded.FillWithValue( false );
+		if ( g_StaticWorldLOS.IsReady() && targets.Count() >= RADIUS_DAMAGE_MIN_STATIC_CULL_TARGETS )
+		{
+			trace_t trSource;
+			CTraceFilterWorldAndPropsOnly filterWorld;
+			UTIL_TraceHull( info.vecSrc, info.vecSrc, Vector( -0.5f, -0.5f, -0.5f ), Vector( 0.5f, 0.5f, 0.5f ), MASK_RADIUS_DAMAGE, &filterWorld, &trSource );
+			if ( !trSource.startsolid )
+			{
+				CUtlVector< int > candidates;
+				CUtlVector< Vector > sources, spots;
+				for ( int i = 0; i < targets.Count(); i++ )
+				{
+					Vector vecDelta = targets[i]->BodyTarget( info.vecSrc, false ) - info.vecSrc;
+					Vector vecMins, vecMaxs;
+					targets[i]->CollisionProp()->WorldSpaceAABB( &vecMins, &vecMaxs );
+
+					BoxTraceInfo_t box;
+					float flFraction = 1.0f;
+					if ( IntersectRayWithBox( info.vecSrc, vecDelta, vecMins, vecMaxs, 1.0f, &box ) )
+					{
+						flFraction = box.startsolid ? 0.0f : box.t1;
+					}
+
+					// Explosions inside or right at the target's bounds always get traced
+					if ( flFraction <= 0.0f )
+						continue;
+
+					candidates.AddToTail( i );
+					sources.AddToTail( info.vecSrc );
+					spots.AddToTail( info.vecSrc + vecDelta * MIN( flFraction, 1.0f ) );
+				}
+
+				CUtlVector< bool > candidateOccluded;
+				candidateOccluded.SetCount( candidates.Count() );
+				g_StaticWorldLOS.ComputeOcclusion( candidates.Count(), sources.Base(), spots.Base(), candidateOccluded.Base() );
+				for ( int i = 0; i < candidates.Count(); i++ )
+				{
+					occluded[candidates[i]] = candidateOccluded[i];
+				}
+			}
+		}
+
+		// Attempt to damage the rest
+		for ( int i = 0; i < targets.Count(); i++ )
+		{
+			if ( occluded[i] )
+				continue;
+
+			pEntity = targets[i];
 			int iDamageToEntity = info.ApplyToEntity( pEntity );
 			if ( iDamageToEntity )
 			{
@@ -7547,6 +7616,38 @@ public:
 	{
 		return TFGameRules()->TFVoiceManager( pListener, pTalker );
 	}
+
+	// Everything TFVoiceManager looks at, so the voice manager knows when to ask again.
+	virtual uint32		GetPlayerVoiceStateKey( CBasePlayer *pPlayer )
+	{
+		uint32 nKey = IVoiceGameMgrHelper::GetPlayerVoiceStateKey( pPlayer ) & 0x3FF;
+
+		CTFPlayer *pTFPlayer = ToTFPlayer( pPlayer );
+		if ( pTFPlayer )
+		{
+			nKey |= ( pTFPlayer->GetCoach() ? pTFPlayer->GetCoach()->entindex() & 0xFF : 0 ) << 10;
+			nKey |= ( pTFPlayer->GetStudent() ? pTFPlayer->GetStudent()->entindex() & 0xFF : 0 ) << 18;
+		}
+
+		if ( pPlayer->BHaveChatSuspensionInCurrentMatch() )
+		{
+			nKey |= 1u << 26;
+		}
+
+		return nKey;
+	}
+
+	virtual uint32		GetGlobalVoiceStateKey()
+	{
+		uint32 nKey = 0;
+		if ( TFGameRules()->IsMannVsMachineMode() )
+			nKey |= 1;
+		if ( tf_gravetalk.GetBool() )
+			nKey |= 2;
+		if ( TFGameRules()->State_Get() == GR_STATE_TEAM_WIN || TFGameRules()->State_Get() == GR_STATE_GAME_OVER )
+			nKey |= 4;
+		return nKey;
+	}
 };
 CVoiceGameMgrHelper g_VoiceGameMgrHelper;
 IVoiceGameMgrHelper *g_pVoiceGameMgrHelper = &g_VoiceGameMgrHelper;
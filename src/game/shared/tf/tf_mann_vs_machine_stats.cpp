@@ -524,7 +524,7 @@ void CMannVsMachineStats::RoundEvent_WaveEnd( bool bSuccess )
 {
 	// if failed, report immediately, 
 	// report successes on starting the next wave because of currency picked up late
-	ConVar *sv_cheats = g_pCVar->FindVar( "sv_cheats" );
+	ConVar *sv_cheats = ConVar_FindVar( "sv_cheats" );
 	if ( !bSuccess && ( !sv_cheats || !sv_cheats->GetBool() ) )
 	{
 		m_currentWaveStats.nAttempts++;
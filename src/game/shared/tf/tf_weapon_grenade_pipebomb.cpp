@@ -403,10 +403,10 @@ int CTFGrenadePipebombProjectile::DrawModel( int flags )
 BEGIN_DATADESC( CTFGrenadePipebombProjectile )
 END_DATADESC()
 
-LINK_ENTITY_TO_CLASS( tf_projectile_pipe_remote, CTFGrenadePipebombProjectile );
+LINK_ENTITY_TO_CLASS_POOLED( tf_projectile_pipe_remote, CTFGrenadePipebombProjectile );
 PRECACHE_WEAPON_REGISTER( tf_projectile_pipe_remote );
 
-LINK_ENTITY_TO_CLASS( tf_projectile_pipe, CTFGrenadePipebombProjectile );
+LINK_ENTITY_TO_CLASS_POOLED( tf_projectile_pipe, CTFGrenadePipebombProjectile );
 PRECACHE_WEAPON_REGISTER( tf_projectile_pipe );
 
 //-----------------------------------------------------------------------------
@@ -9,6 +9,7 @@
 #include "usercmd.h"
 #include "bitbuf.h"
 #include "checksum_md5.h"
+#include "in_buttons.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -304,3 +305,68 @@ void ReadUsercmd( bf_read *buf, CUserCmd *move, CUserCmd *from )
 	}
 #endif
 }
+
+#ifdef GAME_DLL
+//-----------------------------------------------------------------------------
+// Purpose: Times WriteUsercmd/ReadUsercmd on a stream of typical commands and
+//			checks that every one survives the round trip.
+//-----------------------------------------------------------------------------
+CON_COMMAND( usercmd_benchmark, "usercmd_benchmark [count]: times usercmd delta encoding and decoding" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nCommands = args.ArgC() > 1 ? atoi( args[1] ) : 100000;
+	nCommands = clamp( nCommands, 1, 10000000 );
+
+	// A client sends a few commands per packet; size the buffer like a real move message
+	byte data[256];
+	CUserCmd from, to, read;
+	int nTotalBits = 0;
+	int nMismatches = 0;
+	double flWriteTime = 0.0;
+	double flReadTime = 0.0;
+
+	for ( int i = 0; i < nCommands; i++ )
+	{
+		// Steady command and tick numbers with the view drifting and the odd button change,
+		// which is what the delta encoding sees from a player in motion
+		to = from;
+		to.command_number = from.command_number + 1;
+		to.tick_count = ( i % 16 ) ? from.tick_count + 1 : from.tick_count + 2;
+		to.viewangles[0] = sinf( i * 0.01f ) * 30.0f;
+		to.viewangles[1] = fmodf( i * 0.37f, 360.0f );
+		to.forwardmove = ( i & 256 ) ? 450.0f : 0.0f;
+		to.sidemove = ( i & 512 ) ? -450.0f : 0.0f;
+		to.buttons = ( i & 64 ) ? IN_ATTACK : 0;
+		to.weaponselect = ( i % 500 ) ? 0 : ( i / 500 ) % MAX_EDICTS;
+		to.mousedx = (short)( ( i * 7 ) % 41 - 20 );
+		to.mousedy = (short)( ( i * 3 ) % 17 - 8 );
+		to.random_seed = MD5_PseudoRandom( to.command_number ) & 0x7fffffff;
+
+		bf_write writeBuf( "usercmd_benchmark", data, sizeof( data ) );
+		double flStart = Plat_FloatTime();
+		WriteUsercmd( &writeBuf, &to, &from );
+		flWriteTime += Plat_FloatTime() - flStart;
+		nTotalBits += writeBuf.GetNumBitsWritten();
+
+		bf_read readBuf( "usercmd_benchmark", data, writeBuf.GetNumBytesWritten() );
+		flStart = Plat_FloatTime();
+		ReadUsercmd( &readBuf, &read, &from );
+		flReadTime += Plat_FloatTime() - flStart;
+
+		if ( writeBuf.IsOverflowed() || readBuf.IsOverflowed() || read.GetChecksum() != to.GetChecksum() )
+		{
+			++nMismatches;
+		}
+
+		from = to;
+	}
+
+	Msg( "%d usercmds, %.1f bits each: write %.1f ns, read %.1f ns%s\n", nCommands,
+		(float)nTotalBits / nCommands,
+		flWriteTime * 1e9 / nCommands,
+		flReadTime * 1e9 / nCommands,
+		nMismatches ? " ROUNDTRIP FAILED" : "" );
+}
+#endif // GAME_DLL
@@ -13,6 +13,7 @@
 #include "player.h"
 #include "ivoiceserver.h"
 #include "usermessages.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -34,6 +35,7 @@ CPlayerBitVec	g_SentBanMasks[VOICE_MAX_PLAYERS];			// we need to resend them.
 CPlayerBitVec	g_bWantModEnable;
 
 ConVar voice_serverdebug( "voice_serverdebug", "0" );
+ConVar voice_cachemasks( "voice_cachemasks", "1", 0, "Only re-query the game rules for players whose team, alive or other voice state changed" );
 
 // Set game rules to allow all clients to talk to each other.
 // Muted players still can't talk to each other.
@@ -94,6 +96,16 @@ CVoiceGameMgr* GetVoiceGameMgr()
 }
 
 
+// ------------------------------------------------------------------------ //
+// IVoiceGameMgrHelper.
+// ------------------------------------------------------------------------ //
+
+uint32 IVoiceGameMgrHelper::GetPlayerVoiceStateKey( CBasePlayer *pPlayer )
+{
+	return ( (uint32)pPlayer->GetTeamNumber() << 1 ) | ( pPlayer->IsAlive() ? 1 : 0 );
+}
+
+
 
 // ------------------------------------------------------------------------ //
 // CVoiceGameMgr.
@@ -104,6 +116,10 @@ CVoiceGameMgr::CVoiceGameMgr()
 	m_UpdateInterval = 0;
 	m_nMaxPlayers = 0;
 	m_iProximityDistance = -1;
+	m_GlobalVoiceStateKey = 0;
+	m_bRebuildAll = true;
+	m_bResendAll = true;
+	memset( m_PlayerVoiceStateKeys, 0, sizeof( m_PlayerVoiceStateKeys ) );
 }
 
 
@@ -118,6 +134,10 @@ bool CVoiceGameMgr::Init(
 	m_pHelper = pHelper;
 	m_nMaxPlayers = VOICE_MAX_PLAYERS < maxClients ? VOICE_MAX_PLAYERS : maxClients;
 
+	// Game rules were recreated, so nothing we cached can be trusted.
+	m_bRebuildAll = true;
+	m_bResendAll = true;
+
 	return true;
 }
 
@@ -125,6 +145,7 @@ bool CVoiceGameMgr::Init(
 void CVoiceGameMgr::SetHelper(IVoiceGameMgrHelper *pHelper)
 {
 	m_pHelper = pHelper;
+	m_bRebuildAll = true;
 }
 
 
@@ -147,6 +168,11 @@ void CVoiceGameMgr::ClientConnected(struct edict_t *pEdict)
 	g_bWantModEnable[index] = true;
 	g_SentGameRulesMasks[index].Init(0);
 	g_SentBanMasks[index].Init(0);
+
+	// The slot may be reused by a different player with the same key, and the engine
+	// resets its listening state for the new client.
+	m_PlayerVoiceStateKeys[index] = 0;
+	m_bResendAll = true;
 }
 
 
@@ -197,12 +223,100 @@ bool CVoiceGameMgr::ClientCommand( CBasePlayer *pPlayer, const CCommand &args )
 }
 
 
+void CVoiceGameMgr::UpdatePlayerVoiceStates( bool bAllTalk )
+{
+	uint32 nGlobalKey = ( m_pHelper->GetGlobalVoiceStateKey() << 1 ) | ( bAllTalk ? 1 : 0 );
+	if ( nGlobalKey != m_GlobalVoiceStateKey || !voice_cachemasks.GetBool() )
+	{
+		m_GlobalVoiceStateKey = nGlobalKey;
+		m_bRebuildAll = true;
+	}
+
+	for ( int iClient = 0; iClient < m_nMaxPlayers; iClient++ )
+	{
+		uint64 nKey = 0;
+
+		CBaseEntity *pEnt = UTIL_PlayerByIndex( iClient + 1 );
+		if ( pEnt && pEnt->IsPlayer() )
+		{
+			nKey = ( (uint64)m_pHelper->GetPlayerVoiceStateKey( (CBasePlayer*)pEnt ) << 2 ) |
+				( g_PlayerModEnable[iClient] ? 2 : 0 ) | 1;
+		}
+
+		if ( nKey != m_PlayerVoiceStateKeys[iClient] )
+		{
+			m_PlayerVoiceStateKeys[iClient] = nKey;
+			m_DirtyPlayers.Set( iClient );
+		}
+	}
+}
+
+
+void CVoiceGameMgr::RefreshHearingBit( CBasePlayer *pListener, int iListener, int iTalker, bool bAllTalk )
+{
+	bool bCanHear = false;
+	bool bProximity = false;
+
+	if ( m_PlayerVoiceStateKeys[iTalker] != 0 )
+	{
+		CBasePlayer *pTalker = (CBasePlayer*)UTIL_PlayerByIndex( iTalker + 1 );
+		bCanHear = bAllTalk || m_pHelper->CanPlayerHearPlayer( pListener, pTalker, bProximity );
+	}
+
+	m_HearingMasks[iListener].Set( iTalker, bCanHear );
+	m_ProximityMasks[iListener].Set( iTalker, bCanHear && bProximity );
+}
+
+
+void CVoiceGameMgr::RefreshHearingMasks( bool bAllTalk )
+{
+	if ( !m_bRebuildAll && m_DirtyPlayers.IsAllClear() )
+		return;
+
+	for ( int iClient = 0; iClient < m_nMaxPlayers; iClient++ )
+	{
+		// Players that don't want voice in this mod can't hear anyone, and empty slots don't matter.
+		if ( !( m_PlayerVoiceStateKeys[iClient] & 2 ) )
+		{
+			m_HearingMasks[iClient].ClearAll();
+			m_ProximityMasks[iClient].ClearAll();
+			continue;
+		}
+
+		CBasePlayer *pPlayer = (CBasePlayer*)UTIL_PlayerByIndex( iClient + 1 );
+
+		if ( m_bRebuildAll || m_DirtyPlayers.IsBitSet( iClient ) )
+		{
+			// The listener changed, so every talker needs to be checked again.
+			for ( int iOtherClient = 0; iOtherClient < m_nMaxPlayers; iOtherClient++ )
+			{
+				RefreshHearingBit( pPlayer, iClient, iOtherClient, bAllTalk );
+			}
+		}
+		else
+		{
+			// Only the talkers that changed.
+			for ( int iOtherClient = m_DirtyPlayers.FindNextSetBit( 0 ); iOtherClient != -1 && iOtherClient < m_nMaxPlayers; iOtherClient = m_DirtyPlayers.FindNextSetBit( iOtherClient + 1 ) )
+			{
+				RefreshHearingBit( pPlayer, iClient, iOtherClient, bAllTalk );
+			}
+		}
+	}
+
+	m_DirtyPlayers.ClearAll();
+	m_bRebuildAll = false;
+}
+
+
 void CVoiceGameMgr::UpdateMasks()
 {
 	m_UpdateInterval = 0;
 
 	bool bAllTalk = !!sv_alltalk.GetInt();
 
+	UpdatePlayerVoiceStates( bAllTalk );
+	RefreshHearingMasks( bAllTalk );
+
 	for(int iClient=0; iClient < m_nMaxPlayers; iClient++)
 	{
 		CBaseEntity *pEnt = UTIL_PlayerByIndex(iClient+1);
@@ -223,23 +337,7 @@ void CVoiceGameMgr::UpdateMasks()
 			g_bWantModEnable[iClient] = false;
 		}
 
-		CPlayerBitVec gameRulesMask;
-		CPlayerBitVec ProximityMask;
-		bool		bProximity = false;
-		if( g_PlayerModEnable[iClient] )
-		{
-			// Build a mask of who they can hear based on the game rules.
-			for(int iOtherClient=0; iOtherClient < m_nMaxPlayers; iOtherClient++)
-			{
-				CBaseEntity *pEnt = UTIL_PlayerByIndex(iOtherClient+1);
-				if(pEnt && pEnt->IsPlayer() && 
-					(bAllTalk || m_pHelper->CanPlayerHearPlayer(pPlayer, (CBasePlayer*)pEnt, bProximity )) )
-				{
-					gameRulesMask[iOtherClient] = true;
-					ProximityMask[iOtherClient] = bProximity;
-				}
-			}
-		}
+		const CPlayerBitVec &gameRulesMask = m_HearingMasks[iClient];
 
 		// If this is different from what the client has, send an update. 
 		if(gameRulesMask != g_SentGameRulesMasks[iClient] || 
@@ -259,18 +357,99 @@ void CVoiceGameMgr::UpdateMasks()
 			MessageEnd();
 		}
 
-		// Tell the engine.
+		// Tell the engine, if anything changed for this listener.
+		CPlayerBitVec notBanned, listenMask, proximityMask;
+		g_BanMasks[iClient].Not( &notBanned );
+		gameRulesMask.And( notBanned, &listenMask );
+		m_ProximityMasks[iClient].And( listenMask, &proximityMask );
+
+		if ( !m_bResendAll && listenMask == m_SentListenMasks[iClient] && proximityMask == m_SentProximityMasks[iClient] )
+			continue;
+
+		m_SentListenMasks[iClient] = listenMask;
+		m_SentProximityMasks[iClient] = proximityMask;
+
 		for(int iOtherClient=0; iOtherClient < m_nMaxPlayers; iOtherClient++)
 		{
-			bool bCanHear = gameRulesMask[iOtherClient] && !g_BanMasks[iClient][iOtherClient];
+			bool bCanHear = listenMask.IsBitSet( iOtherClient );
 			g_pVoiceServer->SetClientListening( iClient+1, iOtherClient+1, bCanHear );
 
 			if ( bCanHear )
 			{
-				g_pVoiceServer->SetClientProximity( iClient+1, iOtherClient+1, !!ProximityMask[iOtherClient] );
+				g_pVoiceServer->SetClientProximity( iClient+1, iOtherClient+1, proximityMask.IsBitSet( iOtherClient ) );
 			}
 		}
 	}
+
+	m_bResendAll = false;
+}
+
+void CVoiceGameMgr::RunBenchmark( int nIterations )
+{
+	// Always time the per-pair CanPlayerHearPlayer path; under sv_alltalk it's skipped and
+	// there'd be nothing to measure. The global key includes alltalk, so the next real
+	// update rebuilds the masks for the actual setting.
+	bool bAllTalk = false;
+
+	int nPlayers = 0;
+	for ( int iClient = 0; iClient < m_nMaxPlayers; iClient++ )
+	{
+		CBaseEntity *pEnt = UTIL_PlayerByIndex( iClient + 1 );
+		if ( pEnt && pEnt->IsPlayer() )
+		{
+			nPlayers++;
+		}
+	}
+
+	// What every update used to cost: all N^2 pairs.
+	CFastTimer fullTimer;
+	fullTimer.Start();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		UpdatePlayerVoiceStates( bAllTalk );
+		m_bRebuildAll = true;
+		RefreshHearingMasks( bAllTalk );
+	}
+	fullTimer.End();
+
+	// What an update costs when nobody changed team, died or respawned.
+	CFastTimer cachedTimer;
+	cachedTimer.Start();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		UpdatePlayerVoiceStates( bAllTalk );
+		RefreshHearingMasks( bAllTalk );
+	}
+	cachedTimer.End();
+
+	// And when one player changed state.
+	CFastTimer dirtyTimer;
+	dirtyTimer.Start();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		UpdatePlayerVoiceStates( bAllTalk );
+		m_DirtyPlayers.Set( i % MAX( m_nMaxPlayers, 1 ) );
+		RefreshHearingMasks( bAllTalk );
+	}
+	dirtyTimer.End();
+
+	Msg( "Voice mask benchmark: %d players (%d slots), %d iterations\n", nPlayers, m_nMaxPlayers, nIterations );
+	if ( sv_alltalk.GetBool() )
+	{
+		Msg( "  (sv_alltalk is on; timed as if it were off, real updates don't call CanPlayerHearPlayer)\n" );
+	}
+	Msg( "  full rebuild:     %.4f ms/update\n", fullTimer.GetDuration().GetMillisecondsF() / nIterations );
+	Msg( "  cached, no change: %.4f ms/update\n", cachedTimer.GetDuration().GetMillisecondsF() / nIterations );
+	Msg( "  cached, 1 changed: %.4f ms/update\n", dirtyTimer.GetDuration().GetMillisecondsF() / nIterations );
+}
+
+CON_COMMAND_F( voice_benchmark_masks, "Times the voice hearing matrix with the connected players (fill the server with bots first). Usage: voice_benchmark_masks [iterations]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nIterations = args.ArgC() >= 2 ? atoi( args[1] ) : 1000;
+	GetVoiceGameMgr()->RunBenchmark( MAX( nIterations, 1 ) );
 }
 
 bool CVoiceGameMgr::IsPlayerIgnoringPlayer( int iTalker, int iListener )
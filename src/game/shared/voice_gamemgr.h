@@ -24,6 +24,15 @@ public:
 	// Called each frame to determine which players are allowed to hear each other.	This overrides
 	// whatever squelch settings players have.
 	virtual bool		CanPlayerHearPlayer(CBasePlayer *pListener, CBasePlayer *pTalker, bool &bProximity ) = 0;
+
+	// CVoiceGameMgr caches the results of CanPlayerHearPlayer and only asks again about pairs
+	// involving a player whose state key changed. The key must cover everything about the player
+	// that CanPlayerHearPlayer looks at; the default covers team and alive state.
+	virtual uint32		GetPlayerVoiceStateKey( CBasePlayer *pPlayer );
+
+	// Same as above, for state that affects every pair (game mode, round state, convars).
+	// Any change rebuilds the whole matrix.
+	virtual uint32		GetGlobalVoiceStateKey() { return 0; }
 };
 
 
@@ -59,17 +68,41 @@ public:
 
 	bool				IsPlayerIgnoringPlayer( int iTalker, int iListener );
 
+	// Times a full rebuild of the hearing matrix against a cached refresh.
+	void				RunBenchmark( int nIterations );
+
 private:
 
 	// Force it to update the client masks.
 	void				UpdateMasks();
 
+	// Recomputes the voice state keys and marks players whose key changed as dirty.
+	void				UpdatePlayerVoiceStates( bool bAllTalk );
+
+	// Re-queries the game rules for every pair involving a dirty player.
+	void				RefreshHearingMasks( bool bAllTalk );
+	void				RefreshHearingBit( CBasePlayer *pListener, int iListener, int iTalker, bool bAllTalk );
+
 
 private:
 	IVoiceGameMgrHelper	*m_pHelper;
 	int					m_nMaxPlayers;
 	double				m_UpdateInterval;						// How long since the last update.
 	int					m_iProximityDistance;
+
+	// Cached game rules results. Row = listener, bit = talker.
+	CPlayerBitVec		m_HearingMasks[VOICE_MAX_PLAYERS];
+	CPlayerBitVec		m_ProximityMasks[VOICE_MAX_PLAYERS];
+
+	// What we last told the engine for each listener.
+	CPlayerBitVec		m_SentListenMasks[VOICE_MAX_PLAYERS];
+	CPlayerBitVec		m_SentProximityMasks[VOICE_MAX_PLAYERS];
+
+	uint64				m_PlayerVoiceStateKeys[VOICE_MAX_PLAYERS];	// 0 = empty slot.
+	CPlayerBitVec		m_DirtyPlayers;							// Players whose key changed since the last refresh.
+	uint32				m_GlobalVoiceStateKey;
+	bool				m_bRebuildAll;							// Re-query every pair on the next refresh.
+	bool				m_bResendAll;							// Resend every listener's state to the engine.
 };
 
 
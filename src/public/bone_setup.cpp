@@ -212,30 +212,31 @@ short *CBoneCache::CachedToStudio()
 	return (short *)( (char *)(this+1) + m_cachedToStudioOffset );
 }
 
-// Construct a singleton
-static CDataManager<CBoneCache, bonecacheparams_t, CBoneCache *, CThreadFastMutex> g_StudioBoneCache( 128 * 1024L );
+// Construct a singleton. Bones are set up on several threads at once, so the cache is
+// sharded: threads working on different entities rarely wait on the same mutex.
+static CDataManagerSharded<CBoneCache, bonecacheparams_t, CBoneCache *, 4> g_StudioBoneCache( 128 * 1024L );
 
 CBoneCache *Studio_GetBoneCache( memhandle_t cacheHandle )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
+	AUTO_LOCK( g_StudioBoneCache.AccessMutex( cacheHandle ) );
 	return g_StudioBoneCache.GetResource_NoLock( cacheHandle );
 }
 
 memhandle_t Studio_CreateBoneCache( bonecacheparams_t &params )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
+	// Locks the shard it picks
 	return g_StudioBoneCache.CreateResource( params );
 }
 
 void Studio_DestroyBoneCache( memhandle_t cacheHandle )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
+	AUTO_LOCK( g_StudioBoneCache.AccessMutex( cacheHandle ) );
 	g_StudioBoneCache.DestroyResource( cacheHandle );
 }
 
 void Studio_InvalidateBoneCache( memhandle_t cacheHandle )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
+	AUTO_LOCK( g_StudioBoneCache.AccessMutex( cacheHandle ) );
 	CBoneCache *pCache = g_StudioBoneCache.GetResource_NoLock( cacheHandle );
 	if ( pCache )
 	{
@@ -5147,6 +5148,38 @@ float Studio_GetPoseParameter( const CStudioHdr *pStudioHdr, int iParameter, flo
 #pragma warning (disable : 4701)
 
 
+//-----------------------------------------------------------------------------
+// Purpose: The rest of ClipRayToHitbox once the ray can't be separated from the
+//			box. extent is the ray's delta, scaled by 0.5 * tr.fraction, in the
+//			box's axes.
+//-----------------------------------------------------------------------------
+static int ClipRayToHitboxInBoneSpace( const Ray_t &ray, mstudiobbox_t *pbox, const matrix3x4_t& matrix, Vector extent, trace_t &tr )
+{
+	Vector start;
+
+	// Compute ray start in bone space
+	VectorITransform( ray.m_Start, matrix, start );
+	// extent is delta2 in bone space, recompute delta in bone space
+	VectorScale( extent, 2, extent );
+
+	// delta was prescaled by the current t, so no need to see if this intersection
+	// is closer
+	trace_t boxTrace;
+	if ( !IntersectRayWithBox( start, extent, pbox->bbmin, pbox->bbmax, 0.0f, &boxTrace ) )
+		return -1;
+
+	Assert( IsFinite(boxTrace.fraction) );
+	tr.fraction *= boxTrace.fraction;
+	tr.startsolid = boxTrace.startsolid;
+	int hitside = boxTrace.plane.type;
+	if ( boxTrace.plane.normal[hitside] >= 0 )
+	{
+		hitside += 3;
+	}
+	return hitside;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -5229,31 +5262,88 @@ static int ClipRayToHitbox( const Ray_t &ray, mstudiobbox_t *pbox, matrix3x4_t&
 //		DevWarning( "ClipRayToHitbox trace precision error case\n" );
 
 	// !!! We hit this box !!! compute intersection point and return
-	Vector start;
+	return ClipRayToHitboxInBoneSpace( ray, pbox, matrix, extent, tr );
+}
 
-	// Compute ray start in bone space
-	VectorITransform( ray.m_Start, matrix, start );
-	// extent is delta2 in bone space, recompute delta in bone space
-	VectorScale( extent, 2, extent );
+#pragma warning (default : 4701)
 
-	// delta was prescaled by the current t, so no need to see if this intersection
-	// is closer
-	trace_t boxTrace;
-	if ( !IntersectRayWithBox( start, extent, pbox->bbmin, pbox->bbmax, 0.0f, &boxTrace ) )
-		return -1;
 
-	Assert( IsFinite(boxTrace.fraction) );
-	tr.fraction *= boxTrace.fraction;
-	tr.startsolid = boxTrace.startsolid;
-	int hitside = boxTrace.plane.type;
-	if ( boxTrace.plane.normal[hitside] >= 0 )
-	{
-		hitside += 3;
+//-----------------------------------------------------------------------------
+// Purpose: ClipRayToHitbox against every hitbox of an unscaled set, with the
+//			separating axis tests done four boxes at a time. Returns the hitbox
+//			hit last, as the one box at a time loop does, or -1.
+//-----------------------------------------------------------------------------
+static int ClipRayToHitboxes( const Ray_t &ray, CStudioHdr *pStudioHdr, mstudiohitboxset_t *set, 
+				   matrix3x4_t **hitboxbones, int fContentsMask, trace_t &tr, int &hitside )
+{
+	const float flProjEpsilon = 0.01f;
+	int hitbox = -1;
+
+	int i = 0;
+	while ( i < set->numhitboxes )
+	{
+		// Gather the next four boxes that pass the contents mask
+		int boxIndex[4];
+		mstudiobbox_t *boxes[4];
+		const matrix3x4_t *matrices[4];
+		const Vector *mins[4];
+		const Vector *maxs[4];
+		int nCount = 0;
+		for ( ; i < set->numhitboxes && nCount < 4; i++ )
+		{
+			mstudiobbox_t *pbox = set->pHitbox(i);
+			int fBoneContents = pStudioHdr->pBone( pbox->bone )->contents;
+			if ( ( fBoneContents & fContentsMask ) == 0 )
+				continue;
+
+			boxIndex[nCount] = i;
+			boxes[nCount] = pbox;
+			matrices[nCount] = hitboxbones[pbox->bone];
+			mins[nCount] = &pbox->bbmin;
+			maxs[nCount] = &pbox->bbmax;
+			nCount++;
+		}
+
+		if ( !nCount )
+			break;
+
+		FourOBBs_t obbs;
+		obbs.Init( nCount, matrices, mins, maxs );
+
+		// scale by current t so hits shorten the ray, as ClipRayToHitbox does
+		float flFraction = tr.fraction;
+		Vector delta2;
+		VectorScale( ray.m_Delta, (0.5f * flFraction), delta2 );
+		FourVectors boneDelta2;
+		int nMask = IsSegmentPossiblyIntersectingFourOBBs( ray.m_Start + delta2, delta2, obbs, flProjEpsilon, &boneDelta2 );
+
+		for ( int nBox = 0; nBox < nCount; nBox++ )
+		{
+			int side;
+			if ( tr.fraction != flFraction )
+			{
+				// An earlier box in this group shortened the ray, so its test is out of date
+				side = ClipRayToHitbox( ray, boxes[nBox], *hitboxbones[boxes[nBox]->bone], tr );
+			}
+			else if ( nMask & ( 1 << nBox ) )
+			{
+				side = ClipRayToHitboxInBoneSpace( ray, boxes[nBox], *matrices[nBox], boneDelta2.Vec( nBox ), tr );
+			}
+			else
+			{
+				continue;
+			}
+
+			if ( side >= 0 )
+			{
+				hitbox = boxIndex[nBox];
+				hitside = side;
+			}
+		}
 	}
-	return hitside;
-}
 
-#pragma warning (default : 4701)
+	return hitbox;
+}
 
 
 //-----------------------------------------------------------------------------
@@ -5332,26 +5422,29 @@ bool TraceToStudio( IPhysicsSurfaceProps *pProps, const Ray_t& ray, CStudioHdr *
 	int hitbox = -1;
 	int hitside = -1;
 
-	// OPTIMIZE: Partition these?
-	for ( int i = 0; i < set->numhitboxes; i++ )
+	if ( flScale >= 1.0f-FLT_EPSILON && flScale <= 1.0f+FLT_EPSILON )
 	{
-		mstudiobbox_t *pbox = set->pHitbox(i);
+		hitbox = ClipRayToHitboxes( ray, pStudioHdr, set, hitboxbones, fContentsMask, tr, hitside );
+	}
+	else
+	{
+		// OPTIMIZE: Partition these?
+		for ( int i = 0; i < set->numhitboxes; i++ )
+		{
+			mstudiobbox_t *pbox = set->pHitbox(i);
 
-		// Filter based on contents mask
-		int fBoneContents = pStudioHdr->pBone( pbox->bone )->contents;
-		if ( ( fBoneContents & fContentsMask ) == 0 )
-			continue;
-		
-		// columns are axes of the bones in world space, translation is in world space
-		matrix3x4_t& matrix = *hitboxbones[pbox->bone];
-		
-		// Because we're sending in a matrix with scale data, and because the matrix inversion in the hitbox
-		// code does not handle that case, we pre-scale the bones and ray down here and do our collision checks
-		// in unscaled space.  We can then rescale the results afterwards.
+			// Filter based on contents mask
+			int fBoneContents = pStudioHdr->pBone( pbox->bone )->contents;
+			if ( ( fBoneContents & fContentsMask ) == 0 )
+				continue;
+			
+			// columns are axes of the bones in world space, translation is in world space
+			matrix3x4_t& matrix = *hitboxbones[pbox->bone];
+			
+			// Because we're sending in a matrix with scale data, and because the matrix inversion in the hitbox
+			// code does not handle that case, we pre-scale the bones and ray down here and do our collision checks
+			// in unscaled space.  We can then rescale the results afterwards.
 
-		int side = -1;
-		if ( flScale < 1.0f-FLT_EPSILON || flScale > 1.0f+FLT_EPSILON )
-		{
 			matrix3x4_t matScaled;
 			MatrixCopy( matrix, matScaled );
 			
@@ -5381,17 +5474,13 @@ bool TraceToStudio( IPhysicsSurfaceProps *pProps, const Ray_t& ray, CStudioHdr *
 			Ray_t newRay;
 			newRay.Init( vecRayStart, vecRayStart + vecRayDelta );  
 			
-			side = ClipRayToHitbox( newRay, pbox, matScaled, tr );
-		}
-		else
-		{
-			side = ClipRayToHitbox( ray, pbox, matrix, tr );
-		}
+			int side = ClipRayToHitbox( newRay, pbox, matScaled, tr );
 
-		if ( side >= 0 )
-		{
-			hitbox = i;
-			hitside = side;
+			if ( side >= 0 )
+			{
+				hitbox = i;
+				hitside = side;
+			}
 		}
 	}
 
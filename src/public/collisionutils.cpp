@@ -1709,7 +1709,133 @@ bool IntersectRayWithOBB( const Ray_t &ray, const Vector &vecBoxOrigin, const QA
 	return IntersectRayWithOBB( ray, matOBBToWorld, vecOBBMins, vecOBBMaxs, flTolerance, pTrace );
 }
 
-	
+
+//-----------------------------------------------------------------------------
+// Packs four OBBs into SIMD lanes
+//-----------------------------------------------------------------------------
+void FourOBBs_t::Init( int nCount, const matrix3x4_t * const *ppOBBToWorld, const Vector * const *ppOBBMins, const Vector * const *ppOBBMaxs )
+{
+	Assert( nCount >= 1 && nCount <= 4 );
+	m_nCount = nCount;
+
+	const matrix3x4_t *pMat[4];
+	const Vector *pMins[4];
+	const Vector *pMaxs[4];
+	for ( int i = 0; i < 4; ++i )
+	{
+		int nBox = MIN( i, nCount - 1 );
+		pMat[i] = ppOBBToWorld[nBox];
+		pMins[i] = ppOBBMins[nBox];
+		pMaxs[i] = ppOBBMaxs[nBox];
+	}
+
+	// Row r of each matrix transposes into component r of the three axes and the origin
+	fltx4 fl4Origin[3];
+	for ( int r = 0; r < 3; ++r )
+	{
+		fltx4 a = LoadUnalignedSIMD( (*pMat[0])[r] );
+		fltx4 b = LoadUnalignedSIMD( (*pMat[1])[r] );
+		fltx4 c = LoadUnalignedSIMD( (*pMat[2])[r] );
+		fltx4 d = LoadUnalignedSIMD( (*pMat[3])[r] );
+		TransposeSIMD( a, b, c, d );
+		m_vecAxis[0][r] = a;
+		m_vecAxis[1][r] = b;
+		m_vecAxis[2][r] = c;
+		fl4Origin[r] = d;
+	}
+
+	FourVectors vecMins, vecMaxs, vecLocalCenter;
+	vecMins.LoadAndSwizzle( *pMins[0], *pMins[1], *pMins[2], *pMins[3] );
+	vecMaxs.LoadAndSwizzle( *pMaxs[0], *pMaxs[1], *pMaxs[2], *pMaxs[3] );
+	vecLocalCenter = vecMins;
+	vecLocalCenter += vecMaxs;
+	vecLocalCenter *= 0.5f;
+	m_vecExtents = vecMaxs;
+	m_vecExtents -= vecLocalCenter;
+
+	// Same as VectorTransform( vecLocalCenter, matOBBToWorld, vecCenter ) in each lane
+	for ( int r = 0; r < 3; ++r )
+	{
+		fltx4 fl4Dot = AddSIMD( MulSIMD( vecLocalCenter.x, m_vecAxis[0][r] ), MulSIMD( vecLocalCenter.y, m_vecAxis[1][r] ) );
+		fl4Dot = AddSIMD( fl4Dot, MulSIMD( vecLocalCenter.z, m_vecAxis[2][r] ) );
+		m_vecCenter[r] = AddSIMD( fl4Dot, fl4Origin[r] );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Separating axis test of a segment against four OBBs
+//-----------------------------------------------------------------------------
+
+// a.x * b.x + a.y * b.y + a.z * b.z, unfused and in that order
+static FORCEINLINE fltx4 SegmentOBBDot( const FourVectors &a, const FourVectors &b )
+{
+	return AddSIMD( AddSIMD( MulSIMD( a.x, b.x ), MulSIMD( a.y, b.y ) ), MulSIMD( a.z, b.z ) );
+}
+
+int IsSegmentPossiblyIntersectingFourOBBs( const Vector &vecSegmentCenter, const Vector &vecHalfDelta,
+	const FourOBBs_t &boxes, float flProjEpsilon, FourVectors *pBoxHalfDelta )
+{
+	FourVectors vecDelta, vecCenter;
+	vecDelta.DuplicateVector( vecHalfDelta );
+	vecCenter.DuplicateVector( vecSegmentCenter );
+	vecCenter -= boxes.m_vecCenter;
+
+	// Box axes
+	FourVectors vecBoxDelta, vecAbsBoxDelta;
+	fltx4 fl4Separated = Four_Zeros;
+	for ( int j = 0; j < 3; ++j )
+	{
+		vecBoxDelta[j] = SegmentOBBDot( vecDelta, boxes.m_vecAxis[j] );
+		vecAbsBoxDelta[j] = fabs( vecBoxDelta[j] );
+		fltx4 fl4Coord = fabs( SegmentOBBDot( vecCenter, boxes.m_vecAxis[j] ) );
+		fl4Separated = OrSIMD( fl4Separated, CmpGtSIMD( fl4Coord, AddSIMD( boxes.m_vecExtents[j], vecAbsBoxDelta[j] ) ) );
+	}
+
+	// Cross axes
+	FourVectors vecCross;
+	vecCross.x = SubSIMD( MulSIMD( vecDelta.y, vecCenter.z ), MulSIMD( vecDelta.z, vecCenter.y ) );
+	vecCross.y = SubSIMD( MulSIMD( vecDelta.z, vecCenter.x ), MulSIMD( vecDelta.x, vecCenter.z ) );
+	vecCross.z = SubSIMD( MulSIMD( vecDelta.x, vecCenter.y ), MulSIMD( vecDelta.y, vecCenter.x ) );
+
+	fltx4 fl4ProjEpsilon = ReplicateX4( flProjEpsilon );
+	for ( int j = 0; j < 3; ++j )
+	{
+		int j1 = ( j == 0 ) ? 1 : 0;
+		int j2 = ( j == 2 ) ? 1 : 2;
+		fltx4 fl4CrossExtent = fabs( SegmentOBBDot( vecCross, boxes.m_vecAxis[j] ) );
+		fltx4 fl4Reach = AddSIMD( MulSIMD( boxes.m_vecExtents[j1], vecAbsBoxDelta[j2] ), MulSIMD( boxes.m_vecExtents[j2], vecAbsBoxDelta[j1] ) );
+		fl4Separated = OrSIMD( fl4Separated, CmpGtSIMD( fl4CrossExtent, MaxSIMD( fl4Reach, fl4ProjEpsilon ) ) );
+	}
+
+	if ( pBoxHalfDelta )
+	{
+		*pBoxHalfDelta = vecBoxDelta;
+	}
+
+	return ~TestSignSIMD( fl4Separated ) & ( ( 1 << boxes.m_nCount ) - 1 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Separating axis tests of many segments against many groups of OBBs
+//-----------------------------------------------------------------------------
+void IsSegmentPossiblyIntersectingOBBs( int nSegments, const Vector *pSegmentStarts, const Vector *pSegmentDeltas,
+	int nGroups, const FourOBBs_t *pGroups, float flProjEpsilon, int *pMasks )
+{
+	for ( int i = 0; i < nSegments; ++i )
+	{
+		Vector vecHalfDelta, vecCenter;
+		VectorScale( pSegmentDeltas[i], 0.5f, vecHalfDelta );
+		VectorAdd( pSegmentStarts[i], vecHalfDelta, vecCenter );
+		for ( int g = 0; g < nGroups; ++g )
+		{
+			pMasks[i * nGroups + g] = IsSegmentPossiblyIntersectingFourOBBs( vecCenter, vecHalfDelta, pGroups[g], flProjEpsilon );
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 //
 //-----------------------------------------------------------------------------
@@ -166,6 +166,51 @@ bool IntersectRayWithOBB( const Vector &vecRayStart, const Vector &vecRayDelta,
 	const matrix3x4_t &matOBBToWorld, const Vector &vecOBBMins, const Vector &vecOBBMaxs, 
 	float flTolerance, BoxTraceInfo_t *pTrace );
 
+
+//-----------------------------------------------------------------------------
+// FourOBBs_t
+//
+// Purpose: Four oriented boxes laid out SoA, so a segment can be tested
+//			against all of them at once. Lanes >= m_nCount are ignored.
+//-----------------------------------------------------------------------------
+struct FourOBBs_t
+{
+	FourVectors m_vecCenter;		// world space box centers
+	FourVectors m_vecAxis[3];		// world space box axes (columns 0-2 of the OBB-to-world matrix)
+	FourVectors m_vecExtents;		// half-extents along each box axis
+	int m_nCount;
+
+	// Unused lanes are filled with a copy of the last box
+	void Init( int nCount, const matrix3x4_t * const *ppOBBToWorld, const Vector * const *ppOBBMins, const Vector * const *ppOBBMaxs );
+};
+
+
+//-----------------------------------------------------------------------------
+// IsSegmentPossiblyIntersectingFourOBBs
+//
+// Purpose: Separating axis test of a segment, given as its midpoint and half
+//			delta, against four OBBs: the three axes of each box and their
+//			cross products with the segment. Cross axis projections within
+//			flProjEpsilon never separate. The math is done in the same order
+//			as the scalar hitbox test (ClipRayToHitbox), so both agree exactly.
+// Output : Bit i is set if box i wasn't separated. pBoxHalfDelta, if given,
+//			receives the half delta in each box's axes.
+//-----------------------------------------------------------------------------
+int IsSegmentPossiblyIntersectingFourOBBs( const Vector &vecSegmentCenter, const Vector &vecHalfDelta,
+	const FourOBBs_t &boxes, float flProjEpsilon, FourVectors *pBoxHalfDelta = NULL );
+
+
+//-----------------------------------------------------------------------------
+// IsSegmentPossiblyIntersectingOBBs
+//
+// Purpose: Runs IsSegmentPossiblyIntersectingFourOBBs for nSegments segments
+//			against nGroups groups of boxes, so the boxes are packed once and
+//			shared by every segment.
+// Output : pMasks[i * nGroups + g] receives the mask of segment i vs group g.
+//-----------------------------------------------------------------------------
+void IsSegmentPossiblyIntersectingOBBs( int nSegments, const Vector *pSegmentStarts, const Vector *pSegmentDeltas,
+	int nGroups, const FourOBBs_t *pGroups, float flProjEpsilon, int *pMasks );
+
 //-----------------------------------------------------------------------------
 // 
 // IsSphereIntersectingSphere
@@ -41,6 +41,21 @@ public:
 
 };
 
+// Eight rays for the AVX tracer. Stored as two FourRays so that each half can still be traced
+// by the SSE tracer or handed to an ITransparentTriangleCallback.
+class EightRays
+{
+public:
+	FourRays m_Half[2];
+
+	// returns -1 unless all eight rays have the same direction signs
+	int CalculateDirectionSignMask(void) const;
+};
+
+// True if the CPU and OS support AVX and it hasn't been turned off with RayTrace_AllowAVX.
+bool RayTrace_UseAVX( void );
+void RayTrace_AllowAVX( bool bAllow );
+
 /// The format a triangle is stored in for intersections. size of this structure is important.
 /// This structure can be in one of two forms. Before the ray tracing environment is set up, the
 /// ProjectedEdgeEquations hold the coordinates of the 3 vertices, for facilitating bounding box
@@ -294,8 +309,13 @@ public:
 										const Vector &color);
 
 
-	// SetupAccelerationStructure to prepare for tracing
-	void SetupAccelerationStructure(void);
+	// SetupAccelerationStructure to prepare for tracing. Builds the kd-tree with a binned SAH
+	// on nThreads threads (0 = one per logical processor). The tree doesn't depend on nThreads.
+	void SetupAccelerationStructure( int nThreads = 0 );
+
+	// The original builder, which tries triangle vertices as split candidates. Much slower to
+	// build, kept for comparison.
+	void SetupAccelerationStructureExhaustive(void);
 
 
 	// lowest level intersection routine - fire 4 rays through the scene. all 4 rays must pass the
@@ -310,6 +330,18 @@ public:
 					RayTracingResult *rslt_out,
 					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
 
+	// fire 8 rays. Uses the AVX tracer when the CPU has it and all 8 rays share their direction
+	// signs, and traces the two halves with Trace4Rays otherwise. TMin, TMax and rslt_out
+	// hold one entry per half; ppCallbacks, if not NULL, holds one callback per half.
+	void Trace8Rays(const EightRays &rays, const fltx4 *pTMin, const fltx4 *pTMax,
+					RayTracingResult *rslt_out,
+					int32 skip_id=-1, ITransparentTriangleCallback **ppCallbacks = NULL);
+
+	// AVX version of the lowest level Trace4Rays, only call this if RayTrace_UseAVX()
+	void Trace8RaysAVX(const EightRays &rays, const fltx4 *pTMin, const fltx4 *pTMax,
+					   int DirectionSignMask, RayTracingResult *rslt_out,
+					   int32 skip_id, ITransparentTriangleCallback **ppCallbacks);
+
 	// compute virtual light sources to model inter-reflection
 	void ComputeVirtualLightSources(void);
 
@@ -385,6 +417,9 @@ public:
 
 };
 
+// Builds a procedurally generated test scene with each kd-tree builder and prints timings
+void RunKDTreeBuildBenchmark( int nThreads );
+
 
 
 #endif
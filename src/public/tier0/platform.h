@@ -1596,6 +1596,19 @@ inline T* CopyConstruct( T* pMemory, T const& src )
 	return reinterpret_cast<T*>(::new( pMemory ) T(src));
 }
 
+template <class T>
+inline T* MoveConstruct( T* pMemory, T&& src )
+{
+	return reinterpret_cast<T*>(::new( pMemory ) T( static_cast<T&&>( src ) ));
+}
+
+// Forwards any number of arguments to the constructor (for the containers' Emplace methods)
+template <class T, typename... ARGS>
+inline T* EmplaceConstruct( T* pMemory, ARGS&&... args )
+{
+	return reinterpret_cast<T*>(::new( pMemory ) T( static_cast<ARGS&&>( args )... ));
+}
+
 template <class T>
 inline void Destruct( T* pMemory )
 {
@@ -17,6 +17,10 @@ void CRC32_ProcessBuffer( CRC32_t *pulCRC, const void *p, int len );
 void CRC32_Final( CRC32_t *pulCRC );
 CRC32_t	CRC32_GetTableEntry( unsigned int slot );
 
+// CRC32_ProcessBuffer uses PCLMULQDQ on large buffers when the CPU has it. The results are the
+// same either way; this turns it off for benchmarks. Returns whether it's now in use.
+bool CRC32_EnableHardware( bool bEnable );
+
 inline CRC32_t CRC32_ProcessSingleBuffer( const void *p, int len )
 {
 	CRC32_t crc;
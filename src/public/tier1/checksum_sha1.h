@@ -111,6 +111,10 @@ private:
 #define GenerateHash( hash, pubData, cubData ) { CSHA1 sha1; sha1.Update( (byte *)pubData, cubData ); sha1.Final(); sha1.GetHash( hash ); } 
 
 #if !defined(_MINIMUM_BUILD_)
+// CSHA1 uses the SHA extensions when the CPU has them. The results are the same either way;
+// this turns them off for benchmarks. Returns whether they're now in use.
+bool SHA1_EnableHardware( bool bEnable );
+
 // hash comparison function, for use with CUtlMap/CUtlRBTree
 bool HashLessFunc( SHADigest_t const &lhs, SHADigest_t const &rhs );
 
@@ -670,6 +670,15 @@ private:
 void ConVar_Register( int nCVarFlag = 0, IConCommandBaseAccessor *pAccessor = NULL );
 void ConVar_Unregister( );
 
+// Looks up a ConVar by name like ICvar::FindVar, through this module's name cache. ConVarRef
+// uses this; use it instead of FindVar for lookups that happen more than once.
+ConVar *ConVar_FindVar( const char *pName );
+void ConVar_FlushLookupCache();
+
+// Name lookups made through ConVar_FindVar in this module, and how many of those had to go to
+// ICvar::FindVar. bReset starts the counts over.
+void ConVar_GetLookupStats( int *pnLookups, int *pnResolves, bool bReset = false );
+
 
 //-----------------------------------------------------------------------------
 // Utility methods 
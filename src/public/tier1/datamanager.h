@@ -30,7 +30,7 @@ public:
 	// type-safe implementation in derived class
 	//void					*LockResource( memhandle_t handle );
 	int						UnlockResource( memhandle_t handle );
-	void					TouchResource( memhandle_t handle );
+	void					TouchResource( memhandle_t handle );	// doesn't lock with an approximate LRU
 	void					MarkAsStale( memhandle_t handle );		// move to head of LRU
 
 	int						LockCount( memhandle_t handle );
@@ -81,7 +81,10 @@ protected:
 	// NOTE: you must call this from the destructor of the derived class! (will assert otherwise)
 	void					FreeAllLists()	{ FlushAll(); m_listsAreFreed = true; }
 
-							CDataManagerBase( unsigned int maxSize );
+	// With bApproximateLRU, touching a resource just sets its access byte instead of
+	// moving it to the tail of the LRU, and flushing gives a resource whose byte is set
+	// a second chance (CLOCK).
+							CDataManagerBase( unsigned int maxSize, bool bApproximateLRU = false );
 	virtual					~CDataManagerBase();
 	
 	
@@ -98,6 +101,11 @@ protected:
 	
 	void					TouchByIndex( unsigned short memoryIndex );
 	void *					GetForFreeByIndex( unsigned short memoryIndex );
+	int32 volatile			*AccessWord( unsigned short memoryIndex );
+	void					SetAccessed( unsigned short memoryIndex, bool bAccessed );
+
+	// True if CreateHandle won't need more than nMaxHandles handles. Must lock first
+	bool					HasFreeHandle( int nMaxHandles ) { return m_memoryLists.Count( m_freeList ) > 0 || m_memoryLists.TotalCount() < nMaxHandles; }
 
 	// One of these is stored per active allocation
 	struct resource_lru_element_t
@@ -125,6 +133,16 @@ protected:
 	unsigned short m_listsAreFreed : 1;
 	unsigned short m_unused : 15;
 
+	// Access words for the approximate LRU, NULL if it's off. Each holds its slot's serial
+	// in the high word and the accessed bit in bit 0, so TouchResource can check the handle
+	// and set the bit with one compare-exchange. They're kept in chunks that never move so
+	// that can happen without the lock.
+	enum
+	{
+		ACCESS_CHUNK_SIZE = 256,
+		NUM_ACCESS_CHUNKS = 65536 / ACCESS_CHUNK_SIZE,
+	};
+	int32 volatile * volatile *m_ppAccessChunks;
 };
 
 template< class STORAGE_TYPE, class CREATE_PARAMS, class LOCK_TYPE = STORAGE_TYPE *, class MUTEX_TYPE = CThreadNullMutex>
@@ -133,7 +151,7 @@ class CDataManager : public CDataManagerBase
 	typedef CDataManagerBase BaseClass;
 public:
 
-	CDataManager( unsigned int size = (unsigned)-1 ) : BaseClass(size) {}
+	CDataManager( unsigned int size = (unsigned)-1, bool bApproximateLRU = false ) : BaseClass( size, bApproximateLRU ) {}
 	
 
 	~CDataManager()
@@ -274,4 +292,131 @@ inline int CDataManagerBase::LockCount( memhandle_t handle )
 }
 
 
+//-----------------------------------------------------------------------------
+// Spreads resources over NUM_SHARDS data managers, each with its own mutex and
+// an approximate LRU, so threads using different resources rarely wait on each
+// other and touching a resource never waits at all. Each shard gets an equal
+// part of the target size, and flushes only within itself. Handles carry their
+// shard in the low bits of the index.
+//-----------------------------------------------------------------------------
+template< class STORAGE_TYPE, class CREATE_PARAMS, class LOCK_TYPE = STORAGE_TYPE *, int NUM_SHARDS = 8 >
+class CDataManagerSharded
+{
+public:
+	CDataManagerSharded( unsigned int size = (unsigned)-1 )
+	{
+		m_nNextShard = 0;
+		SetTargetSize( size );
+	}
+
+	memhandle_t CreateResource( const CREATE_PARAMS &createParams, bool bCreateLocked = false )
+	{
+		// Round robin, skipping shards that have used up their share of the handles
+		int iFirstShard = (unsigned int)( m_nNextShard++ ) % NUM_SHARDS;
+		for ( int i = 0; i < NUM_SHARDS; i++ )
+		{
+			int iShard = ( iFirstShard + i ) % NUM_SHARDS;
+			CShard &shard = m_Shards[iShard];
+			AUTO_LOCK( shard.AccessMutex() );
+			if ( shard.HasFreeHandle( MAX_SHARD_HANDLES ) )
+			{
+				return ToHandle( shard.CreateResource( createParams, bCreateLocked ), iShard );
+			}
+		}
+
+		Error( "CDataManagerSharded overflow! (exhausted handles)\n" );
+		return INVALID_MEMHANDLE;
+	}
+
+	void DestroyResource( memhandle_t hMem )		{ int iShard; memhandle_t h = FromHandle( hMem, iShard ); m_Shards[iShard].DestroyResource( h ); }
+	LOCK_TYPE LockResource( memhandle_t hMem )		{ int iShard; memhandle_t h = FromHandle( hMem, iShard ); return m_Shards[iShard].LockResource( h ); }
+	int UnlockResource( memhandle_t hMem )			{ int iShard; memhandle_t h = FromHandle( hMem, iShard ); return m_Shards[iShard].UnlockResource( h ); }
+	void TouchResource( memhandle_t hMem )			{ int iShard; memhandle_t h = FromHandle( hMem, iShard ); m_Shards[iShard].TouchResource( h ); }
+	void MarkAsStale( memhandle_t hMem )			{ int iShard; memhandle_t h = FromHandle( hMem, iShard ); m_Shards[iShard].MarkAsStale( h ); }
+	int LockCount( memhandle_t hMem )				{ int iShard; memhandle_t h = FromHandle( hMem, iShard ); return m_Shards[iShard].LockCount( h ); }
+	int BreakLock( memhandle_t hMem )				{ int iShard; memhandle_t h = FromHandle( hMem, iShard ); return m_Shards[iShard].BreakLock( h ); }
+
+	LOCK_TYPE GetResource_NoLock( memhandle_t hMem )			{ int iShard; memhandle_t h = FromHandle( hMem, iShard ); return m_Shards[iShard].GetResource_NoLock( h ); }
+	LOCK_TYPE GetResource_NoLockNoLRUTouch( memhandle_t hMem )	{ int iShard; memhandle_t h = FromHandle( hMem, iShard ); return m_Shards[iShard].GetResource_NoLockNoLRUTouch( h ); }
+
+	// The mutex of the shard hMem is in
+	CThreadFastMutex &AccessMutex( memhandle_t hMem )	{ int iShard; FromHandle( hMem, iShard ); return m_Shards[iShard].AccessMutex(); }
+
+	int BreakAllLocks()						{ int n = 0; for ( int i = 0; i < NUM_SHARDS; i++ ) n += m_Shards[i].BreakAllLocks(); return n; }
+	unsigned int TargetSize()				{ unsigned int n = 0; for ( int i = 0; i < NUM_SHARDS; i++ ) n += m_Shards[i].TargetSize(); return n; }
+	unsigned int AvailableSize()			{ unsigned int n = 0; for ( int i = 0; i < NUM_SHARDS; i++ ) n += m_Shards[i].AvailableSize(); return n; }
+	unsigned int UsedSize()					{ unsigned int n = 0; for ( int i = 0; i < NUM_SHARDS; i++ ) n += m_Shards[i].UsedSize(); return n; }
+	unsigned int FlushAllUnlocked()			{ unsigned int n = 0; for ( int i = 0; i < NUM_SHARDS; i++ ) n += m_Shards[i].FlushAllUnlocked(); return n; }
+	unsigned int FlushToTargetSize()		{ unsigned int n = 0; for ( int i = 0; i < NUM_SHARDS; i++ ) n += m_Shards[i].FlushToTargetSize(); return n; }
+	unsigned int FlushAll()					{ unsigned int n = 0; for ( int i = 0; i < NUM_SHARDS; i++ ) n += m_Shards[i].FlushAll(); return n; }
+
+	void SetTargetSize( unsigned int targetSize )
+	{
+		for ( int i = 0; i < NUM_SHARDS; i++ )
+		{
+			m_Shards[i].SetTargetSize( targetSize / NUM_SHARDS );
+		}
+	}
+
+	// These split the request evenly over the shards
+	unsigned int Purge( unsigned int nBytesToPurge )
+	{
+		unsigned int nPurged = 0;
+		for ( int i = 0; i < NUM_SHARDS && nPurged < nBytesToPurge; i++ )
+		{
+			nPurged += m_Shards[i].Purge( ( nBytesToPurge - nPurged ) / ( NUM_SHARDS - i ) );
+		}
+		return nPurged;
+	}
+
+	unsigned int EnsureCapacity( unsigned int size )
+	{
+		unsigned int n = 0;
+		for ( int i = 0; i < NUM_SHARDS; i++ )
+		{
+			n += m_Shards[i].EnsureCapacity( size / NUM_SHARDS );
+		}
+		return n;
+	}
+
+private:
+	enum
+	{
+		MAX_SHARD_HANDLES = 0xFFFF / NUM_SHARDS,
+	};
+
+	class CShard : public CDataManager< STORAGE_TYPE, CREATE_PARAMS, LOCK_TYPE, CThreadFastMutex >
+	{
+	public:
+		CShard() : CDataManager< STORAGE_TYPE, CREATE_PARAMS, LOCK_TYPE, CThreadFastMutex >( (unsigned)-1, true ) {}
+		using CDataManagerBase::HasFreeHandle;
+	};
+
+	// Shard index i becomes i * NUM_SHARDS + iShard, the serial stays as it is
+	static memhandle_t ToHandle( memhandle_t hShard, int iShard )
+	{
+		unsigned int fullWord = (unsigned int)reinterpret_cast<uintp>( hShard );
+		unsigned int index = ( fullWord & 0xFFFF ) - 1;
+		return reinterpret_cast< memhandle_t >( (uintp)( ( fullWord & 0xFFFF0000 ) | ( index * NUM_SHARDS + iShard + 1 ) ) );
+	}
+
+	static memhandle_t FromHandle( memhandle_t hMem, int &iShard )
+	{
+		unsigned int fullWord = (unsigned int)reinterpret_cast<uintp>( hMem );
+		unsigned int index = fullWord & 0xFFFF;
+		if ( index == 0 )
+		{
+			iShard = 0;
+			return INVALID_MEMHANDLE;
+		}
+		index--;
+		iShard = index % NUM_SHARDS;
+		return reinterpret_cast< memhandle_t >( (uintp)( ( fullWord & 0xFFFF0000 ) | ( index / NUM_SHARDS + 1 ) ) );
+	}
+
+	CShard m_Shards[NUM_SHARDS];
+	CInterlockedInt m_nNextShard;
+};
+
+
 #endif // RESOURCEMANAGER_H
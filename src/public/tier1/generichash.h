@@ -25,6 +25,20 @@ unsigned FASTCALL HashBlock( const void *pKey, unsigned size );
 
 unsigned FASTCALL HashInt( const int key );
 
+//-----------------------------------------------------------------------------
+// Fast hash (wyhash), reads 8 bytes at a time. Much quicker and better spread
+// than the table hashes above, but the result differs between platforms and
+// builds, so never save it or send it over the network.
+//-----------------------------------------------------------------------------
+uint64 FastHash64( const void *pKey, int nLength, uint64 nSeed = 0 );
+
+// Same as FastHash64 on the data with 'A'-'Z' lowered
+uint64 FastHash64Caseless( const void *pKey, int nLength, uint64 nSeed = 0 );
+
+uint32 FastHashString( const char *pszKey );
+uint32 FastHashStringCaseless( const char *pszKey );
+
+
 // hash a uint32 into a uint32
 FORCEINLINE uint32 HashIntAlternate( uint32 n)
 {
@@ -141,7 +155,7 @@ struct HashMapFunctor_t<char *>
 	typedef uint32 TargetType;
 	TargetType operator()(const char *key) const
 	{
-		return HashString( key );
+		return FastHashString( key );
 	}
 };
 
@@ -151,7 +165,7 @@ struct HashMapFunctor_t<const char *>
 	typedef uint32 TargetType;
 	TargetType operator()(const char *key) const
 	{
-		return HashString( key );
+		return FastHashString( key );
 	}
 };
 
@@ -160,7 +174,7 @@ struct HashMapFunctor_tStringCaseless
 	typedef uint32 TargetType;
 	TargetType operator()(const char *key) const
 	{
-		return HashStringCaseless( key );
+		return FastHashStringCaseless( key );
 	}
 };
 
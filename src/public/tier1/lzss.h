@@ -23,6 +23,12 @@ class CUtlBuffer;
 
 #define DEFAULT_LZSS_WINDOW_SIZE 4096
 
+// How many earlier matches the compressor tries at each position. More finds longer
+// matches for a better ratio but compresses slower; decompression speed is the same.
+#define LZSS_EFFORT_FASTEST	4
+#define LZSS_EFFORT_DEFAULT	32
+#define LZSS_EFFORT_BEST	4096
+
 class CLZSS
 {
 public:
@@ -35,35 +41,29 @@ public:
 	static bool			IsCompressed( const unsigned char *pInput );
 	static unsigned int	GetActualSize( const unsigned char *pInput );
 
-	// windowsize must be a power of two.
-	FORCEINLINE CLZSS( int nWindowSize = DEFAULT_LZSS_WINDOW_SIZE );
+	// windowsize must be a power of two, no bigger than the 4096 the format can address.
+	FORCEINLINE CLZSS( int nWindowSize = DEFAULT_LZSS_WINDOW_SIZE, int nEffort = LZSS_EFFORT_DEFAULT );
 
 private:
-	// expected to be sixteen bytes
-	struct lzss_node_t
-	{
-		const unsigned char	*pData;
-		lzss_node_t		*pPrev;
-		lzss_node_t		*pNext;
-		char			empty[4];
-	};
-
-	struct lzss_list_t
+	enum
 	{
-		lzss_node_t *pStart;
-		lzss_node_t *pEnd;
+		HASH_BITS = 12,
+		HASH_SIZE = 1 << HASH_BITS,
 	};
 
-	void			BuildHash( const unsigned char *pData );
-	lzss_list_t		*m_pHashTable;	
-	lzss_node_t		*m_pHashTarget;
+	// Heads of the hash chains, keyed on the first three bytes, and each position's
+	// link to the previous one with the same hash. Positions are offsets into the input.
+	int				*m_pHashHead;
+	int				*m_pHashPrev;
 	int             m_nWindowSize;
+	int				m_nEffort;
 
 };
 
-FORCEINLINE CLZSS::CLZSS( int nWindowSize )
+FORCEINLINE CLZSS::CLZSS( int nWindowSize, int nEffort )
 {
 	m_nWindowSize = nWindowSize;
+	m_nEffort = nEffort > 0 ? nEffort : 1;
 }
 #endif
 
@@ -69,6 +69,9 @@ public:
 	int Count() const { return m_BlocksAllocated; }
 	int PeakCount() const { return m_PeakAlloc; }
 
+	// Is the memory inside one of our blobs? (for asserts)
+	bool IsAllocationWithinPool( void *pMem ) const;
+
 protected:
 	class CBlob
 	{
@@ -106,24 +109,93 @@ protected:
 
 
 //-----------------------------------------------------------------------------
-// 
+// Thread safe pool. Each thread allocates from and frees into a small
+// "magazine" of blocks, and only takes the pool's mutex to refill or drain one
+// a batch at a time. Magazines are picked by hashing the thread id, so a thread
+// that finds its magazine in use by another just goes to the pool directly.
 //-----------------------------------------------------------------------------
 class CMemoryPoolMT : public CUtlMemoryPool
 {
 public:
-	CMemoryPoolMT(int blockSize, int numElements, int growMode = UTLMEMORYPOOL_GROW_FAST, const char *pszAllocOwner = NULL) : CUtlMemoryPool( blockSize, numElements, growMode, pszAllocOwner) {}
-
+	CMemoryPoolMT( int blockSize, int numElements, int growMode = UTLMEMORYPOOL_GROW_FAST, const char *pszAllocOwner = NULL, int nAlignment = 0 );
+	~CMemoryPoolMT();
 
-	void*		Alloc()	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Alloc(); }
-	void*		Alloc( size_t amount )	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Alloc( amount ); }
-	void*		AllocZero()	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::AllocZero(); }	
-	void*		AllocZero( size_t amount )	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::AllocZero( amount ); }
-	void		Free(void *pMem) { AUTO_LOCK( m_mutex ); CUtlMemoryPool::Free( pMem ); }
+	void*		Alloc()	{ return Alloc( m_BlockSize ); }
+	void*		Alloc( size_t amount );
+	void*		AllocZero()	{ return AllocZero( m_BlockSize ); }
+	void*		AllocZero( size_t amount );
+	void		Free(void *pMem);
 
 	// Frees everything
-	void		Clear() { AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Clear(); }
+	void		Clear();
+
+	// Blocks held by callers, not counting those sitting in magazines. The peak
+	// is updated when magazines refill, so it can miss up to a batch per thread.
+	// Count() and PeakCount() are left to the base class, where they also count
+	// the blocks cached in magazines.
+	int InUseCount() const;
+	int PeakInUseCount() const { return m_nPeakInUse; }
+
+	bool IsAllocationWithinPool( void *pMem ) const;
+
+	struct Stats_t
+	{
+		int64	m_nAllocs;			// successful Alloc calls
+		int64	m_nFrees;
+		int		m_nInUse;			// same as InUseCount()
+		int		m_nPeakInUse;		// same as PeakInUseCount()
+		int		m_nCached;			// free blocks held in magazines
+		int		m_nRefills;			// batches moved from the pool to a magazine
+		int		m_nDrains;			// batches moved back
+		int		m_nLockContention;	// times the pool's mutex was already held
+		int		m_nMagazineContention;	// times a thread's magazine was in use by another thread
+	};
+
+	void GetStats( Stats_t &stats ) const;
+	void ReportStats( MemoryPoolReportFunc_t func ) const;
+
 private:
-	CThreadFastMutex m_mutex; // @TODO: Rework to use tslist (toml 7/6/2007)
+	enum
+	{
+		NUM_MAGAZINES = 32,
+		MAGAZINE_BATCH_BYTES = 8192,	// about this much is moved per refill or drain
+		MIN_MAGAZINE_BATCH = 4,
+		MAX_MAGAZINE_BATCH = 64,
+	};
+
+	// Aligned to a 64 byte cache line so threads don't share them
+	struct ALIGN_N( 64 ) Magazine_t
+	{
+		int32 volatile	m_nLock;
+		int				m_nCount;
+		void			*m_pHead;		// free blocks, linked through their first word like the pool's
+		int64			m_nAllocs;
+		int64			m_nFrees;
+	} ALIGN_N_POST( 64 );
+
+	Magazine_t	*LockMagazine();
+	void		UnlockMagazine( Magazine_t *pMagazine );
+	void		LockPool();
+	void		*LockedAlloc( size_t amount );
+	void		LockedFree( void *pMem );
+	void		RefillMagazine( Magazine_t *pMagazine );
+	void		DrainMagazine( Magazine_t *pMagazine, int nKeep );
+	int			CachedCount() const;
+
+	mutable CThreadFastMutex m_mutex;
+	int			m_nMagazineBatch;
+
+	// These are only changed with m_mutex held
+	int			m_nPeakInUse;
+	int			m_nRefills;
+	int			m_nDrains;
+	int			m_nLockContention;
+	int64		m_nLockedAllocs;
+	int64		m_nLockedFrees;
+
+	CInterlockedInt m_nMagazineContention;
+
+	Magazine_t	m_Magazines[NUM_MAGAZINES];
 };
 
 
@@ -376,7 +448,7 @@ inline void CClassMemoryPool<T>::Clear()
 		static   CMemoryPoolMT   s_Allocator
 
 #define DEFINE_FIXEDSIZE_ALLOCATOR_MT( _class, _initsize, _grow )					\
-	CMemoryPoolMT   _class::s_Allocator(sizeof(_class), _initsize, _grow, #_class " pool")
+	CMemoryPoolMT   _class::s_Allocator(sizeof(_class), _initsize, _grow, #_class " pool", alignof( _class ) )
 
 //-----------------------------------------------------------------------------
 // Macros that make it simple to make a class use a fixed-size allocator
@@ -9,4 +9,7 @@ bool CheckMMXTechnology(void);
 bool CheckSSETechnology(void);
 bool CheckSSE2Technology(void);
 bool Check3DNowTechnology(void);
+bool CheckAVX2Technology(void);	// CPU flag and OS support for the ymm registers
+bool CheckPCLMULTechnology(void);	// carry-less multiply (PCLMULQDQ)
+bool CheckSHATechnology(void);		// SHA extensions, along with the SSSE3 they are used with
 
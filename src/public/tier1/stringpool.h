@@ -12,12 +12,13 @@
 #pragma once
 #endif
 
-#include "utlrbtree.h"
+#include "utlhashtable.h"
 #include "utlvector.h"
 
 //-----------------------------------------------------------------------------
 // Purpose: Allocates memory for strings, checking for duplicates first,
-//			reusing exising strings if duplicate found.
+//			reusing exising strings if duplicate found. Strings are compared
+//			case insensitively and looked up by hash.
 //-----------------------------------------------------------------------------
 
 template< typename K >
@@ -38,7 +39,7 @@ public:
 	const char * Find( const char *pszValue );
 
 protected:
-	typedef CUtlRBTree<const char *, KeyType> CStrSet;
+	typedef CUtlHashtable<const char *, empty_t, FastCaselessStringHashFunctor, CaselessStringEqualFunctor> CStrSet;
 
 	CStrSet m_Strings;
 };
@@ -73,6 +73,19 @@ int V_stricmp_fast( const char *s1, const char *s2 );
 #define V_stristr_fast V_stristr
 const char* V_stristr_fast( const char* pStr, const char* pSearch );
 
+// V_stricmp, V_strnicmp and V_stristr use the widest vector instructions the CPU supports.
+// This caps them (at no more than the CPU supports) so benchmarks can compare the versions;
+// every level returns the same results.
+enum EStringSIMDLevel
+{
+	STRINGSIMD_NONE = 0,
+	STRINGSIMD_SSE2,
+	STRINGSIMD_AVX2,
+};
+
+void V_SetStringSIMDLevel( EStringSIMDLevel eLevel );
+EStringSIMDLevel V_GetStringSIMDLevel();
+
 //-----------------------------------------------------------------------------
 // Purpose: Slightly modified strtok. Does not modify the input string. Does
 //			not skip over more than one separator at a time. This allows parsing
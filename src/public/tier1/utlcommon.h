@@ -10,6 +10,8 @@
 #define UTLCOMMON_H
 #pragma once
 
+#include "tier1/generichash.h"
+
 //-----------------------------------------------------------------------------
 // Henry Goffin (henryg) was here. Questions? Bugs? Go slap him around a bit.
 //-----------------------------------------------------------------------------
@@ -125,6 +127,8 @@ struct Mix32HashFunctor { unsigned int operator()( uint32 s ) const; };
 struct Mix64HashFunctor { unsigned int operator()( uint64 s ) const; };
 struct StringHashFunctor { unsigned int operator()( const char* s ) const; };
 struct CaselessStringHashFunctor { unsigned int operator()( const char* s ) const; };
+struct FastStringHashFunctor { unsigned int operator()( const char* s ) const { return FastHashString( s ); } };
+struct FastCaselessStringHashFunctor { unsigned int operator()( const char* s ) const { return FastHashStringCaseless( s ); } };
 
 struct PointerLessFunctor { bool operator()( const void *a, const void *b ) const { return a < b; } };
 struct PointerEqualFunctor { bool operator()( const void *a, const void *b ) const { return a == b; } };
@@ -181,8 +185,8 @@ template <> struct DefaultLessFunctor<char*> : StringLessFunctor { };
 template <> struct DefaultLessFunctor<const char*> : StringLessFunctor { };
 template <> struct DefaultEqualFunctor<char*> : StringEqualFunctor { };
 template <> struct DefaultEqualFunctor<const char*> : StringEqualFunctor { };
-template <> struct DefaultHashFunctor<char*> : StringHashFunctor { };
-template <> struct DefaultHashFunctor<const char*> : StringHashFunctor { };
+template <> struct DefaultHashFunctor<char*> : FastStringHashFunctor { };
+template <> struct DefaultHashFunctor<const char*> : FastStringHashFunctor { };
 
 // CUtlString/CUtlConstString are specialized here and not in utlstring.h
 // because I consider string datatypes to be fundamental, and don't feel
@@ -191,9 +195,9 @@ class CUtlString;
 template < typename T > class CUtlConstStringBase;
 
 template <> struct DefaultLessFunctor<CUtlString> : StringLessFunctor { };
-template <> struct DefaultHashFunctor<CUtlString> : StringHashFunctor { };
+template <> struct DefaultHashFunctor<CUtlString> : FastStringHashFunctor { };
 template < typename T > struct DefaultLessFunctor< CUtlConstStringBase<T> > : StringLessFunctor { };
-template < typename T > struct DefaultHashFunctor< CUtlConstStringBase<T> > : StringHashFunctor { };
+template < typename T > struct DefaultHashFunctor< CUtlConstStringBase<T> > : FastStringHashFunctor { };
 
 
 // Helpers to deduce if a type defines a public AltArgumentType_t typedef:
@@ -91,7 +91,7 @@ protected:
 
 		unsigned operator()( const Entry_t &entry ) const
 		{
-			return !( ( bCaseInsensitive ) ? HashStringCaseless( entry.pszSymbol ) : HashString( entry.pszSymbol ) );
+			return ( bCaseInsensitive ) ? FastHashStringCaseless( entry.pszSymbol ) : FastHashString( entry.pszSymbol );
 		}
 	};
 
@@ -13,6 +13,7 @@
 #pragma once
 #endif
 
+#include <utility>
 #include "tier0/dbg.h"
 #include "utlrbtree.h"
 
@@ -71,6 +72,18 @@ public:
 	 : m_Tree( CKeyLess( lessfunc ) )
 	{
 	}
+
+	// Takes over the other map's nodes, leaving it empty
+	CUtlMap( CUtlMap &&that )
+	 : m_Tree( std::move( that.m_Tree ) )
+	{
+	}
+
+	CUtlMap &operator=( CUtlMap &&that )
+	{
+		m_Tree = std::move( that.m_Tree );
+		return *this;
+	}
 	
 	void EnsureCapacity( int num )							{ m_Tree.EnsureCapacity( num ); }
 
@@ -107,17 +120,24 @@ public:
 	// Insert method (inserts in order)
 	IndexType_t  Insert( const KeyType_t &key, const ElemType_t &insert )
 	{
-		Node_t node;
-		node.key = key;
-		node.elem = insert;
-		return m_Tree.Insert( node );
+		return m_Tree.Emplace( key, insert );
 	}
 	
+	IndexType_t  Insert( const KeyType_t &key, ElemType_t &&insert )
+	{
+		return m_Tree.Emplace( key, std::move( insert ) );
+	}
+
 	IndexType_t  Insert( const KeyType_t &key )
 	{
-		Node_t node;
-		node.key = key;
-		return m_Tree.Insert( node );
+		return m_Tree.Emplace( key );
+	}
+
+	// Constructs the element in place from the arguments (inserts in order)
+	template < typename... ARGS >
+	IndexType_t  Emplace( const KeyType_t &key, ARGS&&... args )
+	{
+		return m_Tree.Emplace( key, std::forward<ARGS>( args )... );
 	}
 
 	// API to macth src2 for Panormama
@@ -126,17 +146,12 @@ public:
 
 	IndexType_t  InsertWithDupes( const KeyType_t &key, const ElemType_t &insert )
 	{
-		Node_t node;
-		node.key = key;
-		node.elem = insert;
-		return m_Tree.Insert( node );
+		return m_Tree.Emplace( key, insert );
 	}
 
 	IndexType_t  InsertWithDupes( const KeyType_t &key )
 	{
-		Node_t node;
-		node.key = key;
-		return m_Tree.Insert( node );
+		return m_Tree.Emplace( key );
 	}
 
 
@@ -235,6 +250,18 @@ public:
 		return Insert( key, insert );
 	}
 
+	IndexType_t InsertOrReplace( const KeyType_t &key, ElemType_t &&insert )
+	{
+		IndexType_t i = Find( key );
+		if ( i != InvalidIndex() )
+		{
+			Element( i ) = std::move( insert );
+			return i;
+		}
+		
+		return Insert( key, std::move( insert ) );
+	}
+
 	void Swap( CUtlMap &that )
 	{
 		m_Tree.Swap( that.m_Tree );
@@ -253,6 +280,33 @@ public:
 		{
 		}
 
+		Node_t( Node_t &&from )
+		  : key( std::move( from.key ) ),
+			elem( std::move( from.elem ) )
+		{
+		}
+
+		template < typename... ARGS >
+		Node_t( const KeyType_t &k, ARGS&&... args )
+		  : key( k ),
+			elem( std::forward<ARGS>( args )... )
+		{
+		}
+
+		Node_t &operator=( const Node_t &from )
+		{
+			key = from.key;
+			elem = from.elem;
+			return *this;
+		}
+
+		Node_t &operator=( Node_t &&from )
+		{
+			key = std::move( from.key );
+			elem = std::move( from.elem );
+			return *this;
+		}
+
 		KeyType_t	key;
 		ElemType_t	elem;
 	};
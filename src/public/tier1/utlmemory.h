@@ -16,6 +16,7 @@
 
 #include "tier0/dbg.h"
 #include <string.h>
+#include <utility>
 #include "tier0/platform.h"
 #include "mathlib/mathlib.h"
 
@@ -54,6 +55,14 @@ public:
 	CUtlMemory( const T* pMemory, int numElements );
 	~CUtlMemory();
 
+	// Takes over the other memory's buffer, leaving it empty
+	CUtlMemory( CUtlMemory&& src );
+	CUtlMemory& operator=( CUtlMemory&& src );
+
+	// Copies just copy the pointer, as they always have; the containers never use them
+	CUtlMemory( const CUtlMemory& src ) = default;
+	CUtlMemory& operator=( const CUtlMemory& src ) = default;
+
 	// Set the size by which the memory grows
 	void Init( int nGrowSize = 0, int nInitSize = 0 );
 
@@ -174,6 +183,10 @@ public:
 		m_nMallocGrowSize = nGrowSize;
 	}
 
+	// The fixed buffer lives inside this object, so it can't be handed to another one
+	CUtlMemoryFixedGrowable( CUtlMemoryFixedGrowable&& src ) = delete;
+	CUtlMemoryFixedGrowable& operator=( CUtlMemoryFixedGrowable&& src ) = delete;
+
 	void Grow( int nCount = 1 )
 	{
 		if ( this->IsExternallyAllocated() )
@@ -450,6 +463,60 @@ CUtlMemory<T,I>::~CUtlMemory()
 	Purge();
 }
 
+template< class T, class I >
+CUtlMemory<T,I>::CUtlMemory( CUtlMemory<T,I>&& src ) : m_pMemory( src.m_pMemory ),
+	m_nAllocationCount( src.m_nAllocationCount ), m_nGrowSize( src.m_nGrowSize )
+{
+	src.m_pMemory = 0;
+	src.m_nAllocationCount = 0;
+	if ( src.IsExternallyAllocated() )
+	{
+		src.m_nGrowSize = 0;
+	}
+}
+
+template< class T, class I >
+CUtlMemory<T,I>& CUtlMemory<T,I>::operator=( CUtlMemory<T,I>&& src )
+{
+	if ( this != &src )
+	{
+		Purge();
+		m_pMemory = src.m_pMemory;
+		m_nAllocationCount = src.m_nAllocationCount;
+		m_nGrowSize = src.m_nGrowSize;
+
+		src.m_pMemory = 0;
+		src.m_nAllocationCount = 0;
+		if ( src.IsExternallyAllocated() )
+		{
+			src.m_nGrowSize = 0;
+		}
+	}
+	return *this;
+}
+
+
+//-----------------------------------------------------------------------------
+// Moves src's heap buffer to dest, for containers being moved. Only plain
+// CUtlMemory can do this; other allocators return false and the container
+// moves its elements one at a time instead.
+//-----------------------------------------------------------------------------
+template< class A >
+inline bool UtlMemory_StealBuffer( A &dest, A &src )
+{
+	return false;
+}
+
+template< class T, class I >
+inline bool UtlMemory_StealBuffer( CUtlMemory<T,I> &dest, CUtlMemory<T,I> &src )
+{
+	if ( src.IsExternallyAllocated() )
+		return false;
+
+	dest = std::move( src );
+	return true;
+}
+
 template< class T, class I >
 void CUtlMemory<T,I>::Init( int nGrowSize /*= 0*/, int nInitSize /*= 0*/ )
 {
@@ -9,6 +9,7 @@
 #ifndef UTLRBTREE_H
 #define UTLRBTREE_H
 
+#include <utility>
 #include "tier1/utlmemory.h"
 #include "tier1/utlfixedmemory.h"
 #include "tier1/utlblockmemory.h"
@@ -205,6 +206,10 @@ public:
 	explicit CUtlRBTree( const LessFunc_t &lessfunc );
 	~CUtlRBTree( );
 
+	// Takes over the other tree's nodes, leaving it empty
+	CUtlRBTree( CUtlRBTree<T, I, L, M> &&other );
+	CUtlRBTree<T, I, L, M>& operator=( CUtlRBTree<T, I, L, M> &&other );
+
 	void EnsureCapacity( int num );
 
 	void CopyFrom( const CUtlRBTree<T, I, L, M> &other );
@@ -263,9 +268,15 @@ public:
 	// NOTE: the returned 'index' will be valid as long as the element remains in the tree
 	//       (other elements being added/removed will not affect it)
 	I  Insert( T const &insert );
+	I  Insert( T &&insert );
 	void Insert( const T *pArray, int nItems );
 	I  InsertIfNotFound( T const &insert );
 
+	// Constructs the element in its node from the arguments, then inserts it in order.
+	// The arguments can't refer into this tree.
+	template < typename... ARGS >
+	I  Emplace( ARGS&&... args );
+
 	// Find method
 	I  Find( T const &search ) const;
 
@@ -468,6 +479,38 @@ inline CUtlRBTree<T, I, L, M>::~CUtlRBTree()
 	Purge();
 }
 
+template < class T, class I, typename L, class M >
+inline CUtlRBTree<T, I, L, M>::CUtlRBTree( CUtlRBTree<T, I, L, M> &&other ) : 
+m_LessFunc( other.m_LessFunc ),
+m_Elements( 0, 0 ),
+m_Root( InvalidIndex() ),
+m_NumElements( 0 ),
+m_FirstFree( InvalidIndex() ),
+m_LastAlloc( m_Elements.InvalidIterator() )
+{
+	ResetDbgInfo();
+	*this = std::move( other );
+}
+
+template < class T, class I, typename L, class M >
+CUtlRBTree<T, I, L, M>& CUtlRBTree<T, I, L, M>::operator=( CUtlRBTree<T, I, L, M> &&other )
+{
+	if ( this == &other )
+		return *this;
+
+	// Empty this tree, then trade places with the other one
+	Purge();
+	m_Elements.Swap( other.m_Elements );
+	V_swap( m_LessFunc, other.m_LessFunc );
+	V_swap( m_Root, other.m_Root );
+	V_swap( m_NumElements, other.m_NumElements );
+	V_swap( m_FirstFree, other.m_FirstFree );
+	V_swap( m_LastAlloc, other.m_LastAlloc );
+	ResetDbgInfo();
+	other.ResetDbgInfo();
+	return *this;
+}
+
 template < class T, class I, typename L, class M >
 inline void CUtlRBTree<T, I, L, M>::EnsureCapacity( int num )        
 { 
@@ -1587,6 +1630,40 @@ I CUtlRBTree<T, I, L, M>::Insert( T const &insert )
 }
 
 
+template < class T, class I, typename L, class M > 
+I CUtlRBTree<T, I, L, M>::Insert( T &&insert )
+{
+	// use move constructor to move it in
+	I parent = InvalidIndex();
+	bool leftchild = false;
+	FindInsertionPosition( insert, parent, leftchild );
+	I newNode = InsertAt( parent, leftchild );
+	Destruct( &Element( newNode ) );
+	MoveConstruct( &Element( newNode ), std::move( insert ) );
+	return newNode;
+}
+
+template < class T, class I, typename L, class M > 
+template < typename... ARGS >
+I CUtlRBTree<T, I, L, M>::Emplace( ARGS&&... args )
+{
+	// Build the element in a new node first, since we need it to find where it goes
+	I newNode = NewNode();
+	T *pElem = &m_Elements[newNode].m_Data;
+	Destruct( pElem );
+	EmplaceConstruct( pElem, std::forward<ARGS>( args )... );
+
+	I parent = InvalidIndex();
+	bool leftchild = false;
+	FindInsertionPosition( *pElem, parent, leftchild );
+	LinkToParent( newNode, parent, leftchild );
+	++m_NumElements;
+
+	Assert(IsValid());
+
+	return newNode;
+}
+
 template < class T, class I, typename L, class M > 
 void CUtlRBTree<T, I, L, M>::Insert( const T *pArray, int nItems )
 {
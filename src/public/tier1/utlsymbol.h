@@ -85,6 +85,11 @@ protected:
 //    of strings to symbols and back. The symbol class itself contains
 //    a static version of this class for creating global strings, but this
 //    class can also be instanced to create local symbol tables.
+//
+//    Symbols are numbered 0..GetNumStrings()-1 in the order they were added
+//    and are never moved or renumbered. Strings are found through an open
+//    addressed hash table that only ever has slots filled in, so Find and
+//    String never need a lock; see CUtlSymbolTableMT.
 //-----------------------------------------------------------------------------
 
 class CUtlSymbolTable
@@ -113,46 +118,39 @@ public:
 
 	int GetNumStrings( void ) const
 	{
-		return m_Lookup.Count();
+		return m_nSymbols;
 	}
 
 protected:
-	class CStringPoolIndex
+	// Symbols live in blocks which double in size, so adding one never moves the
+	// others. Block i holds FIRST_BLOCK_SIZE << i symbols.
+	enum
 	{
-	public:
-		inline CStringPoolIndex()
-		{
-		}
-
-		inline CStringPoolIndex( unsigned short iPool, unsigned short iOffset )
-		{
-			m_iPool = iPool;
-			m_iOffset = iOffset;
-		}
-
-		inline bool operator==( const CStringPoolIndex &other )	const
-		{
-			return m_iPool == other.m_iPool && m_iOffset == other.m_iOffset;
-		}
+		FIRST_BLOCK_SIZE = 32,
+		NUM_BLOCKS = 12,			// enough for every UtlSymId_t
+	};
 
-		unsigned short m_iPool;		// Index into m_StringPools.
-		unsigned short m_iOffset;	// Index into the string pool.
+	struct Symbol_t
+	{
+		const char *m_pString;
+		unsigned int m_nHash;
 	};
 
-	class CLess
+	// Each slot is UtlSymId_t in the low 16 bits and the top of the hash above it,
+	// or HASH_SLOT_EMPTY. A table that gets too full is replaced by a bigger copy;
+	// the old one is kept on m_pRetired until RemoveAll, since a reader may still
+	// be probing it.
+	enum
 	{
-	public:
-		CLess( int ignored = 0 ) {} // permits default initialization to NULL in CUtlRBTree
-		bool operator!() const { return false; }
-		bool operator()( const CStringPoolIndex &left, const CStringPoolIndex &right ) const;
+		HASH_SLOT_EMPTY = 0xFFFFFFFF,
+		HASH_TAG_MASK = 0xFFFF0000,
 	};
 
-	// Stores the symbol lookup
-	class CTree : public CUtlRBTree<CStringPoolIndex, unsigned short, CLess>
+	struct HashTable_t
 	{
-	public:
-		CTree(  int growSize, int initSize ) : CUtlRBTree<CStringPoolIndex, unsigned short, CLess>( growSize, initSize ) {}
-		friend class CUtlSymbolTable::CLess; // Needed to allow CLess to calculate pointer to symbol table
+		HashTable_t *m_pRetired;
+		unsigned int m_nMask;
+		unsigned int m_Slots[1];
 	};
 
 	struct StringPool_t
@@ -162,20 +160,29 @@ protected:
 		char m_Data[1];
 	};
 
-	CTree m_Lookup;
+	unsigned int HashSymbolString( const char *pString ) const;
+	CUtlSymbol FindHashed( const char *pString, unsigned int nHash ) const;
+
+	// Adds a string that FindHashed didn't find
+	CUtlSymbol AddHashed( const char *pString, unsigned int nHash );
+
+	Symbol_t * volatile m_pBlocks[NUM_BLOCKS];
+	HashTable_t * volatile m_pHashTable;
+	int m_nSymbols;
+	int m_nInitSize;
 	bool m_bInsensitive;
-	mutable const char* m_pUserSearchString;
 
 	// stores the string data
 	CUtlVector<StringPool_t*> m_StringPools;
 
 private:
 	int FindPoolWithSpace( int len ) const;
-	const char* StringFromIndex( const CStringPoolIndex &index ) const;
-
-	friend class CLess;
+	const Symbol_t &SymbolFromId( UtlSymId_t id ) const;
+	void GrowHashTable();
 };
 
+// Find and String don't lock at all; AddString only locks to add a string that
+// isn't in the table yet.
 class CUtlSymbolTableMT : private CUtlSymbolTable
 {
 public:
@@ -186,34 +193,37 @@ public:
 
 	CUtlSymbol AddString( const char* pString )
 	{
-		m_lock.LockForWrite();
-		CUtlSymbol result = CUtlSymbolTable::AddString( pString );
-		m_lock.UnlockWrite();
+		if ( !pString )
+			return CUtlSymbol( UTL_INVAL_SYMBOL );
+
+		unsigned int nHash = HashSymbolString( pString );
+		CUtlSymbol result = FindHashed( pString, nHash );
+		if ( !result.IsValid() )
+		{
+			m_lock.Lock();
+			// Someone may have added it while we were waiting
+			result = FindHashed( pString, nHash );
+			if ( !result.IsValid() )
+			{
+				result = AddHashed( pString, nHash );
+			}
+			m_lock.Unlock();
+		}
 		return result;
 	}
 
 	CUtlSymbol Find( const char* pString ) const
 	{
-		m_lock.LockForRead();
-		CUtlSymbol result = CUtlSymbolTable::Find( pString );
-		m_lock.UnlockRead();
-		return result;
+		return CUtlSymbolTable::Find( pString );
 	}
 
 	const char* String( CUtlSymbol id ) const
 	{
-		m_lock.LockForRead();
-		const char *pszResult = CUtlSymbolTable::String( id );
-		m_lock.UnlockRead();
-		return pszResult;
+		return CUtlSymbolTable::String( id );
 	}
 	
 private:
-#if defined(WIN32) || defined(_WIN32)
-	mutable CThreadSpinRWLock m_lock;
-#else
-	mutable CThreadRWLock m_lock;
-#endif
+	CThreadFastMutex m_lock;
 };
 
 
@@ -117,7 +117,8 @@ private:
 
 inline uint32 CUtlSymbolLarge_Hash( bool CASEINSENSITIVE, const char *pString, int len )
 {
-	return ( CASEINSENSITIVE ? HashStringCaseless( pString ) : HashString( pString ) ); 
+	// len includes the terminator
+	return (uint32)( CASEINSENSITIVE ? FastHash64Caseless( pString, len - 1 ) : FastHash64( pString, len - 1 ) );
 }
 
 typedef uint32 LargeSymbolTableHashDecoration_t; 
@@ -229,7 +229,7 @@ inline void CUtlTSHash<T,BUCKET_COUNT,KEYTYPE,HashFuncs,nAlignment>::Purge( void
 template<class T, int BUCKET_COUNT, class KEYTYPE, class HashFuncs, int nAlignment> 
 inline int CUtlTSHash<T,BUCKET_COUNT,KEYTYPE,HashFuncs,nAlignment>::Count() const
 {
-	return m_EntryMemory.Count();
+	return m_EntryMemory.InUseCount();
 }
 
 
@@ -444,7 +444,7 @@ inline void CUtlTSHash<T,BUCKET_COUNT,KEYTYPE,HashFuncs,nAlignment>::Commit( )
 template<class T, int BUCKET_COUNT, class KEYTYPE, class HashFuncs, int nAlignment> 
 inline void CUtlTSHash<T,BUCKET_COUNT,KEYTYPE,HashFuncs,nAlignment>::FindAndRemove( KEYTYPE uiKey )
 {
-	if ( m_EntryMemory.Count() == 0 )
+	if ( m_EntryMemory.InUseCount() == 0 )
 		return;
 
 	// This must occur when no queries are occurring
@@ -502,7 +502,7 @@ template<class T, int BUCKET_COUNT, class KEYTYPE, class HashFuncs, int nAlignme
 inline void CUtlTSHash<T,BUCKET_COUNT,KEYTYPE,HashFuncs,nAlignment>::RemoveAll( void )
 {
 	m_bNeedsCommit = false;
-	if ( m_EntryMemory.Count() == 0 )
+	if ( m_EntryMemory.InUseCount() == 0 )
 		return;
 
 	// This must occur when no queries are occurring
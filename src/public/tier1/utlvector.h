@@ -16,6 +16,7 @@
 #endif
 
 #include <algorithm>
+#include <utility>
 
 #include <string.h>
 #include "tier0/platform.h"
@@ -68,6 +69,11 @@ public:
 	// Copy the array.
 	CUtlVector<T, A>& operator=( const CUtlVector<T, A> &other );
 
+	// Move the array, leaving the other one empty. The buffer itself changes hands if the
+	// allocator allows it (plain CUtlMemory on the heap); otherwise each element is moved.
+	CUtlVector( CUtlVector<T, A> &&other );
+	CUtlVector<T, A>& operator=( CUtlVector<T, A> &&other );
+
 	// element access
 	T& operator[]( int i );
 	const T& operator[]( int i ) const;
@@ -119,6 +125,17 @@ public:
 	int InsertBefore( int elem, const T& src );
 	int InsertAfter( int elem, const T& src );
 
+	// Adds an element, uses move constructor
+	int AddToHead( T&& src );
+	int AddToTail( T&& src );
+	int InsertBefore( int elem, T&& src );
+	int InsertAfter( int elem, T&& src );
+
+	// Adds an element, constructed in place from the arguments. As with the copying
+	// versions, the arguments can't refer into this vector.
+	template< typename... Args > int EmplaceToTail( Args&&... args );
+	template< typename... Args > int EmplaceBefore( int elem, Args&&... args );
+
 	// Adds multiple elements, uses default constructor
 	int AddMultipleToHead( int num );
 	int AddMultipleToTail( int num );	   
@@ -594,6 +611,9 @@ public:
 	CCopyableUtlVector( T* pMemory, int numElements ) : BaseClass( pMemory, numElements ) {}
 	virtual ~CCopyableUtlVector() {}
 	CCopyableUtlVector( CCopyableUtlVector const& vec ) { this->CopyArray( vec.Base(), vec.Count() ); }
+	CCopyableUtlVector( CCopyableUtlVector&& vec ) : BaseClass( std::move( vec ) ) {}
+	CCopyableUtlVector& operator=( CCopyableUtlVector const& vec ) { BaseClass::operator=( vec ); return *this; }
+	CCopyableUtlVector& operator=( CCopyableUtlVector&& vec ) { BaseClass::operator=( std::move( vec ) ); return *this; }
 };
 
 //-----------------------------------------------------------------------------
@@ -667,6 +687,39 @@ inline CUtlVector<T, A>& CUtlVector<T, A>::operator=( const CUtlVector<T, A> &ot
 	return *this;
 }
 
+template< typename T, class A >
+inline CUtlVector<T, A>::CUtlVector( CUtlVector<T, A> &&other ) : m_Size( 0 )
+{
+	ResetDbgInfo();
+	*this = std::move( other );
+}
+
+template< typename T, class A >
+CUtlVector<T, A>& CUtlVector<T, A>::operator=( CUtlVector<T, A> &&other )
+{
+	if ( this == &other )
+		return *this;
+
+	Purge();
+	int nCount = other.m_Size;
+	if ( !UtlMemory_StealBuffer( m_Memory, other.m_Memory ) )
+	{
+		MEM_ALLOC_CREDIT_CLASS();
+		m_Memory.EnsureCapacity( nCount );
+		for ( int i = 0; i < nCount; i++ )
+		{
+			MoveConstruct( &m_Memory[ i ], std::move( other.m_Memory[ i ] ) );
+		}
+		other.RemoveAll();
+	}
+
+	m_Size = nCount;
+	other.m_Size = 0;
+	ResetDbgInfo();
+	other.ResetDbgInfo();
+	return *this;
+}
+
 #define StagingUtlVectorBoundsCheck( _i, _size )
 
 //-----------------------------------------------------------------------------
@@ -1087,6 +1140,73 @@ int CUtlVector<T, A>::InsertBefore( int elem, const T& src )
 }
 
 
+//-----------------------------------------------------------------------------
+// Adds an element, uses move constructor
+//-----------------------------------------------------------------------------
+template< typename T, class A >
+inline int CUtlVector<T, A>::AddToHead( T&& src )
+{
+	// Can't insert something that's in the list... reallocation may hose us
+	Assert( (Base() == NULL) || (&src < Base()) || (&src >= (Base() + Count()) ) ); 
+	return InsertBefore( 0, std::move( src ) );
+}
+
+template< typename T, class A >
+inline int CUtlVector<T, A>::AddToTail( T&& src )
+{
+	// Can't insert something that's in the list... reallocation may hose us
+	Assert( (Base() == NULL) || (&src < Base()) || (&src >= (Base() + Count()) ) ); 
+	return InsertBefore( m_Size, std::move( src ) );
+}
+
+template< typename T, class A >
+inline int CUtlVector<T, A>::InsertAfter( int elem, T&& src )
+{
+	// Can't insert something that's in the list... reallocation may hose us
+	Assert( (Base() == NULL) || (&src < Base()) || (&src >= (Base() + Count()) ) ); 
+	return InsertBefore( elem + 1, std::move( src ) );
+}
+
+template< typename T, class A >
+int CUtlVector<T, A>::InsertBefore( int elem, T&& src )
+{
+	// Can't insert something that's in the list... reallocation may hose us
+	Assert( (Base() == NULL) || (&src < Base()) || (&src >= (Base() + Count()) ) ); 
+
+	// Can insert at the end
+	Assert( (elem == Count()) || IsValidIndex(elem) );
+
+	GrowVector();
+	ShiftElementsRight(elem);
+	MoveConstruct( &Element(elem), std::move( src ) );
+	return elem;
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds an element, constructed in place
+//-----------------------------------------------------------------------------
+template< typename T, class A >
+template< typename... Args >
+inline int CUtlVector<T, A>::EmplaceToTail( Args&&... args )
+{
+	return EmplaceBefore( m_Size, std::forward<Args>( args )... );
+}
+
+template< typename T, class A >
+template< typename... Args >
+int CUtlVector<T, A>::EmplaceBefore( int elem, Args&&... args )
+{
+	// Can insert at the end
+	Assert( (elem == Count()) || IsValidIndex(elem) );
+
+	GrowVector();
+	ShiftElementsRight(elem);
+	EmplaceConstruct( &Element(elem), std::forward<Args>( args )... );
+	return elem;
+}
+
+
 //-----------------------------------------------------------------------------
 // Adds multiple elements, uses default constructor
 //-----------------------------------------------------------------------------
@@ -24,6 +24,7 @@
 #include "utlstring.h"
 
 #include "tier1/lzmaDecoder.h"
+#include "vstdlib/jobthread.h"
 
 // Not every user of zip utils wants to link LZMA encoder
 #ifdef ZIP_SUPPORT_LZMA_ENCODE
@@ -340,6 +341,10 @@ public:
 	// Add buffer to zip as a file with given name
 	void			AddBufferToZip( const char *relativename, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType );
 
+	// Add several buffers, compressing them in parallel
+	void			AddBuffersToZip( int nBuffers, const char * const *ppRelativeNames, void * const *ppData, const int *pLengths,
+									 bool bTextMode, IZip::eCompressionType compressionType, IThreadPool *pThreadPool, int nMaxParallel );
+
 	// Check if a file already exists in the zip.
 	bool			FileExistsInZip( const char *relativename );
 
@@ -397,6 +402,10 @@ private:
 	bool			m_bForceAlignment;
 	bool			m_bCompatibleFormat;
 
+	struct ZipBuffer_t;
+	static void		PrepareBuffer( ZipBuffer_t &buffer );
+	void			AddPreparedBuffer( ZipBuffer_t &buffer );
+
 	unsigned short	CalculatePadding( unsigned int filenameLen, unsigned int pos );
 	void			SaveDirectory( IWriteStream& stream );
 	int				MakeXZipCommentString( char *pComment );
@@ -985,31 +994,44 @@ static void CopyTextData( char *pDst, const char *pSrc, int dstSize, int srcSize
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Adds a new lump, or overwrites existing one
-// Input  : *relativename - 
-//			*data - 
-//			length - 
+// A buffer on its way into the zip. The text conversion, CRC and compression
+// don't touch the zip itself, so AddBuffersToZip can run them in parallel.
 //-----------------------------------------------------------------------------
-void CZipFile::AddBufferToZip( const char *relativename, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType )
+struct CZipFile::ZipBuffer_t
 {
-	// Lower case only
-	char name[512];
-	Q_strcpy( name, relativename );
-	Q_strlower( name );
+	const char				*m_pRelativeName;
+	void					*m_pData;
+	int						m_nLength;
+	bool					m_bTextMode;
+	IZip::eCompressionType	m_eCompressionType;
+
+	// Filled in by PrepareBuffer
+	bool					m_bOK;
+	void					*m_pOutData;
+	int						m_nOutLength;
+	int						m_nUncompressedLength;
+	CRC32_t					m_ZipCRC;
+	CUtlBuffer				m_TextTransform;
+	CUtlBuffer				m_CompressionTransform;
+};
 
-	int outLength = length;
-	int uncompressedLength = length;
-	void *outData = data;
-	CUtlBuffer textTransform;
-	CUtlBuffer compressionTransform;
+/* static */
+void CZipFile::PrepareBuffer( ZipBuffer_t &buffer )
+{
+	int outLength = buffer.m_nLength;
+	int uncompressedLength = buffer.m_nLength;
+	void *outData = buffer.m_pData;
+	IZip::eCompressionType compressionType = buffer.m_eCompressionType;
 
-	if ( bTextMode )
+	buffer.m_bOK = false;
+
+	if ( buffer.m_bTextMode )
 	{
 		int textLen = GetLengthOfBinStringAsText( ( const char * )outData, outLength );
-		textTransform.EnsureCapacity( textLen );
-		CopyTextData( (char *)textTransform.Base(), (char *)outData, textLen, outLength );
+		buffer.m_TextTransform.EnsureCapacity( textLen );
+		CopyTextData( (char *)buffer.m_TextTransform.Base(), (char *)outData, textLen, outLength );
 
-		outData = (void *)textTransform.Base();
+		outData = (void *)buffer.m_TextTransform.Base();
 		outLength = textLen;
 		uncompressedLength = textLen;
 	}
@@ -1040,6 +1062,7 @@ void CZipFile::AddBufferToZip( const char *relativename, void *data, int length,
 		//  LZMA Properties Data variable, defined by "LZMA Properties Size"
 		unsigned int nZIPHeader = 2 + 2 + sizeof( lzma_header_t().properties );
 		unsigned int finalCompressedSize = compressedSize - sizeof( lzma_header_t ) + nZIPHeader;
+		CUtlBuffer &compressionTransform = buffer.m_CompressionTransform;
 		compressionTransform.EnsureCapacity( finalCompressedSize );
 
 		// LZMA version
@@ -1065,10 +1088,43 @@ void CZipFile::AddBufferToZip( const char *relativename, void *data, int length,
 #endif
 	/* else from ifdef */ if ( compressionType != IZip::eCompressionType_None )
 	{
-		Error( "Calling AddBufferToZip with unknown compression type\n" );
+		// AddPreparedBuffer reports this, off the worker threads
 		return;
 	}
 
+	buffer.m_bOK = true;
+	buffer.m_pOutData = outData;
+	buffer.m_nOutLength = outLength;
+	buffer.m_nUncompressedLength = uncompressedLength;
+	buffer.m_ZipCRC = zipCRC;
+}
+
+void CZipFile::AddPreparedBuffer( ZipBuffer_t &buffer )
+{
+	if ( !buffer.m_bOK )
+	{
+#ifdef ZIP_SUPPORT_LZMA_ENCODE
+		if ( buffer.m_eCompressionType != IZip::eCompressionType_None && buffer.m_eCompressionType != IZip::eCompressionType_LZMA )
+#else
+		if ( buffer.m_eCompressionType != IZip::eCompressionType_None )
+#endif
+		{
+			Error( "Calling AddBufferToZip with unknown compression type\n" );
+		}
+		return;
+	}
+
+	// Lower case only
+	char name[512];
+	Q_strcpy( name, buffer.m_pRelativeName );
+	Q_strlower( name );
+
+	IZip::eCompressionType compressionType = buffer.m_eCompressionType;
+	void *outData = buffer.m_pOutData;
+	int outLength = buffer.m_nOutLength;
+	int uncompressedLength = buffer.m_nUncompressedLength;
+	CRC32_t zipCRC = buffer.m_ZipCRC;
+
 	// See if entry is in list already
 	CZipEntry e;
 	e.m_Name = name;
@@ -1128,6 +1184,56 @@ void CZipFile::AddBufferToZip( const char *relativename, void *data, int length,
 }
 
 
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a new lump, or overwrites existing one
+// Input  : *relativename - 
+//			*data - 
+//			length - 
+//-----------------------------------------------------------------------------
+void CZipFile::AddBufferToZip( const char *relativename, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType )
+{
+	ZipBuffer_t buffer;
+	buffer.m_pRelativeName = relativename;
+	buffer.m_pData = data;
+	buffer.m_nLength = length;
+	buffer.m_bTextMode = bTextMode;
+	buffer.m_eCompressionType = compressionType;
+
+	PrepareBuffer( buffer );
+	AddPreparedBuffer( buffer );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds several lumps, compressing them in parallel. They're added to
+//  the zip in order, so the result is the same as calling AddBufferToZip on each.
+//-----------------------------------------------------------------------------
+void CZipFile::AddBuffersToZip( int nBuffers, const char * const *ppRelativeNames, void * const *ppData, const int *pLengths,
+								bool bTextMode, IZip::eCompressionType compressionType, IThreadPool *pThreadPool, int nMaxParallel )
+{
+	CUtlVector< ZipBuffer_t > buffers;
+	buffers.SetCount( nBuffers );
+	for ( int i = 0; i < nBuffers; i++ )
+	{
+		buffers[i].m_pRelativeName = ppRelativeNames[i];
+		buffers[i].m_pData = ppData[i];
+		buffers[i].m_nLength = pLengths[i];
+		buffers[i].m_bTextMode = bTextMode;
+		buffers[i].m_eCompressionType = compressionType;
+	}
+
+	if ( !pThreadPool )
+	{
+		pThreadPool = g_pThreadPool;
+	}
+	ParallelProcess( "CZipFile::AddBuffersToZip", pThreadPool, buffers.Base(), buffers.Count(), &CZipFile::PrepareBuffer, NULL, NULL, nMaxParallel );
+
+	for ( int i = 0; i < nBuffers; i++ )
+	{
+		AddPreparedBuffer( buffers[i] );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Reads a file from the zip
 //-----------------------------------------------------------------------------
@@ -1740,6 +1846,10 @@ public:
 
 	virtual unsigned int	GetAlignment() OVERRIDE;
 
+	// Add several buffers, compressing them in parallel
+	virtual void			AddBuffersToZip( int nBuffers, const char * const *ppRelativeNames, void * const *ppData, const int *pLengths,
+											 bool bTextMode, eCompressionType compressionType, IThreadPool *pThreadPool, int nMaxParallel ) OVERRIDE;
+
 private:
 	CZipFile				m_ZipFile;
 };
@@ -1831,6 +1941,12 @@ void CZip::AddBufferToZip( const char *relativename, void *data, int length, boo
 	m_ZipFile.AddBufferToZip( relativename, data, length, bTextMode, compressionType );
 }
 
+void CZip::AddBuffersToZip( int nBuffers, const char * const *ppRelativeNames, void * const *ppData, const int *pLengths,
+							bool bTextMode, eCompressionType compressionType, IThreadPool *pThreadPool, int nMaxParallel )
+{
+	m_ZipFile.AddBuffersToZip( nBuffers, ppRelativeNames, ppData, pLengths, bTextMode, compressionType, pThreadPool, nMaxParallel );
+}
+
 void CZip::SaveToBuffer( CUtlBuffer& outbuf )
 {
 	m_ZipFile.SaveToBuffer( outbuf );
@@ -13,6 +13,7 @@
 #include "utlsymbol.h"
 
 class CUtlBuffer;
+class IThreadPool;
 #include "tier0/dbg.h"
 
 abstract_class IZip
@@ -79,6 +80,12 @@ public:
 	virtual void			SetBigEndian( bool bigEndian ) = 0;
 	virtual void			ActivateByteSwapping( bool bActivate ) = 0;
 
+	// Same as calling AddBufferToZip on each buffer in turn, but compresses them in parallel on
+	// pThreadPool (or g_pThreadPool if NULL), at most nMaxParallel at a time.
+	virtual void			AddBuffersToZip		( int nBuffers, const char * const *ppRelativeNames, void * const *ppData, const int *pLengths,
+												  bool bTextMode, eCompressionType compressionType = eCompressionType_None, IThreadPool *pThreadPool = NULL,
+												  int nMaxParallel = INT_MAX ) = 0;
+
 	// Create/Release additional instances
 	// Disk Caching is necessary for large zips
 	static IZip *CreateZip( const char *pDiskCacheWritePath = NULL, bool bSortByName = false );
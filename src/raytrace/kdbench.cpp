@@ -0,0 +1,191 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: kd-tree build and trace benchmark on a procedurally generated test scene.
+//
+//=============================================================================//
+
+#include "raytrace.h"
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+
+
+// Small LCG so the scene is the same on every machine and every run
+static uint32 s_nBenchSeed;
+
+static float BenchRandom( float flMin, float flMax )
+{
+	s_nBenchSeed = s_nBenchSeed * 1664525 + 1013904223;
+	return flMin + ( flMax - flMin ) * ( ( s_nBenchSeed >> 8 ) * ( 1.0f / 16777216.0f ) );
+}
+
+
+// Rolling terrain with a few thousand boxes of varying size scattered over it, which gives
+// roughly the mix of large open areas and dense detail of a real map.
+static void BuildBenchmarkScene( RayTracingEnvironment &env )
+{
+	s_nBenchSeed = 12345;
+
+	const int nGrid = 192;
+	const float flGridSize = 64.0f;
+	const Vector color( 1, 1, 1 );
+	env.MakeRoomForTriangles( nGrid * nGrid * 2 + 3000 * 12 );
+
+	int id = 0;
+	for ( int y = 0; y < nGrid; y++ )
+	{
+		for ( int x = 0; x < nGrid; x++ )
+		{
+			Vector v[4];
+			for ( int i = 0; i < 4; i++ )
+			{
+				float fx = ( x + ( i & 1 ) ) * flGridSize;
+				float fy = ( y + ( i >> 1 ) ) * flGridSize;
+				v[i].Init( fx, fy, 256.0f * sinf( fx * 0.0013f ) * cosf( fy * 0.0021f ) );
+			}
+			env.AddTriangle( id++, v[0], v[1], v[3], color );
+			env.AddTriangle( id++, v[0], v[3], v[2], color );
+		}
+	}
+
+	for ( int i = 0; i < 3000; i++ )
+	{
+		Vector mins( BenchRandom( 0, nGrid * flGridSize ), BenchRandom( 0, nGrid * flGridSize ), BenchRandom( -256, 256 ) );
+		float flSize = ( i % 10 ) ? BenchRandom( 8, 64 ) : BenchRandom( 256, 1024 );
+		Vector maxs = mins + Vector( flSize, BenchRandom( 8, flSize ), BenchRandom( 8, flSize ) );
+		env.AddAxisAlignedRectangularSolid( id++, mins, maxs, color );
+	}
+}
+
+
+static void GetTreeStats( RayTracingEnvironment const &env, int &nLeaves, int &nEmptyLeaves )
+{
+	nLeaves = nEmptyLeaves = 0;
+	for ( int i = 0; i < env.OptimizedKDTree.Count(); i++ )
+	{
+		CacheOptimizedKDNode const &node = env.OptimizedKDTree[i];
+		if ( node.NodeType() != KDNODE_STATE_LEAF )
+			continue;
+		++nLeaves;
+		if ( node.NumberOfTrianglesInLeaf() == 0 )
+			++nEmptyLeaves;
+	}
+}
+
+
+// Traces the same fixed set of rays through env, 4 or 8 at a time, returns the time taken and
+// the hit distances. Rays come in packets of 8 with nearby origins and similar directions, like
+// the shadow rays from a group of lightmap samples.
+static double TraceBenchmarkRays( RayTracingEnvironment &env, CUtlVector<float> &hitDistances, bool bEightWide )
+{
+	const int nRays = 65536;
+	s_nBenchSeed = 54321;
+	hitDistances.SetCount( nRays );
+
+	Vector vecMins = env.m_MinBound;
+	Vector vecMaxs = env.m_MaxBound;
+
+	EightRays rays;
+	fltx4 TMin[2] = { Four_Zeros, Four_Zeros };
+	fltx4 TMax[2] = { ReplicateX4( 1.0e6f ), ReplicateX4( 1.0e6f ) };
+	double flTime = 0;
+	for ( int i = 0; i < nRays; i += 8 )
+	{
+		Vector start( BenchRandom( vecMins.x, vecMaxs.x ), BenchRandom( vecMins.y, vecMaxs.y ), BenchRandom( vecMins.z, vecMaxs.z ) );
+		Vector dir( BenchRandom( -1, 1 ), BenchRandom( -1, 1 ), BenchRandom( -1, 1 ) );
+		for ( int r = 0; r < 8; r++ )
+		{
+			Vector rayStart = start + Vector( BenchRandom( -32, 32 ), BenchRandom( -32, 32 ), BenchRandom( -32, 32 ) );
+			Vector rayDir = dir + Vector( BenchRandom( -0.1f, 0.1f ), BenchRandom( -0.1f, 0.1f ), BenchRandom( -0.1f, 0.1f ) );
+			for ( int c = 0; c < 3; c++ )
+			{
+				// keep the packet's direction signs the same so it can be traced together
+				rayDir[c] = ( dir[c] < 0 ) ? -fabs( rayDir[c] ) : fabs( rayDir[c] );
+			}
+			VectorNormalize( rayDir );
+
+			FourRays &half = rays.m_Half[r >> 2];
+			half.origin.X( r & 3 ) = rayStart.x; half.origin.Y( r & 3 ) = rayStart.y; half.origin.Z( r & 3 ) = rayStart.z;
+			half.direction.X( r & 3 ) = rayDir.x; half.direction.Y( r & 3 ) = rayDir.y; half.direction.Z( r & 3 ) = rayDir.z;
+		}
+
+		RayTracingResult result[2];
+		double flStart = Plat_FloatTime();
+		if ( bEightWide )
+		{
+			env.Trace8Rays( rays, TMin, TMax, result );
+		}
+		else
+		{
+			env.Trace4Rays( rays.m_Half[0], TMin[0], TMax[0], &result[0] );
+			env.Trace4Rays( rays.m_Half[1], TMin[1], TMax[1], &result[1] );
+		}
+		flTime += Plat_FloatTime() - flStart;
+
+		for ( int r = 0; r < 8; r++ )
+			hitDistances[i + r] = ( result[r >> 2].HitIds[r & 3] == -1 ) ? -1.0f : SubFloat( result[r >> 2].HitDistance, r & 3 );
+	}
+	return flTime;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds the benchmark scene with the exhaustive builder, the binned
+//			builder on one thread and on nThreads threads, and reports build
+//			times, tree shape and trace times. Also checks that the thread count
+//			doesn't change the tree, that all trees find the same hits and that
+//			the 8-wide tracer agrees with the 4-wide one.
+//-----------------------------------------------------------------------------
+void RunKDTreeBuildBenchmark( int nThreads )
+{
+	if ( nThreads <= 0 )
+		nThreads = GetCPUInformation()->m_nLogicalProcessors;
+
+	const char *pszNames[3] = { "exhaustive", "binned, 1 thread", "binned, threaded" };
+	RayTracingEnvironment envs[3];
+	CUtlVector<float> hitDistances[3];
+	for ( int i = 0; i < 3; i++ )
+	{
+		BuildBenchmarkScene( envs[i] );
+
+		double flStart = Plat_FloatTime();
+		if ( i == 0 )
+			envs[i].SetupAccelerationStructureExhaustive();
+		else
+			envs[i].SetupAccelerationStructure( ( i == 1 ) ? 1 : nThreads );
+		double flBuild = Plat_FloatTime() - flStart;
+
+		double flTrace = TraceBenchmarkRays( envs[i], hitDistances[i], false );
+
+		int nLeaves, nEmptyLeaves;
+		GetTreeStats( envs[i], nLeaves, nEmptyLeaves );
+		Msg( "%-18s %d tris: build %.3fs, %d nodes, %d leaves (%d empty), %d tri refs, trace %d rays %.3fs\n",
+			pszNames[i], envs[i].OptimizedTriangleList.Count(), flBuild, envs[i].OptimizedKDTree.Count(),
+			nLeaves, nEmptyLeaves, envs[i].TriangleIndexList.Count(), hitDistances[i].Count(), flTrace );
+	}
+
+	bool bSameLayout = envs[1].OptimizedKDTree.Count() == envs[2].OptimizedKDTree.Count() &&
+		envs[1].TriangleIndexList.Count() == envs[2].TriangleIndexList.Count() &&
+		!memcmp( envs[1].OptimizedKDTree.Base(), envs[2].OptimizedKDTree.Base(), envs[1].OptimizedKDTree.Count() * sizeof( CacheOptimizedKDNode ) ) &&
+		!memcmp( envs[1].TriangleIndexList.Base(), envs[2].TriangleIndexList.Base(), envs[1].TriangleIndexList.Count() * sizeof( int32 ) );
+	Msg( "%d threads %s the 1 thread node layout\n", nThreads, bSameLayout ? "reproduced" : "DID NOT reproduce" );
+
+	int nMismatches = 0;
+	for ( int i = 0; i < hitDistances[0].Count(); i++ )
+	{
+		if ( fabs( hitDistances[0][i] - hitDistances[2][i] ) > 0.01f )
+			++nMismatches;
+	}
+	Msg( "%d of %d rays hit differently in the exhaustive and binned trees\n", nMismatches, hitDistances[0].Count() );
+
+	// same rays again, 8 at a time
+	CUtlVector<float> hitDistances8;
+	double flTrace8 = TraceBenchmarkRays( envs[2], hitDistances8, true );
+	nMismatches = 0;
+	for ( int i = 0; i < hitDistances8.Count(); i++ )
+	{
+		if ( hitDistances8[i] != hitDistances[2][i] )
+			++nMismatches;
+	}
+	Msg( "8-wide trace (%s): %d rays %.3fs, %d rays hit differently than 4-wide\n",
+		RayTrace_UseAVX() ? "AVX" : "SSE fallback", hitDistances8.Count(), flTrace8, nMismatches );
+}
@@ -5,6 +5,7 @@
 #include <filesystem_tools.h>
 #include <cmdlib.h>
 #include <stdio.h>
+#include "tier0/threadtools.h"
 
 static bool SameSign(float a, float b)
 {
@@ -592,6 +593,338 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 }
 
 
+//-----------------------------------------------------------------------------
+// 8-wide AVX tracing.
+//
+// The kernel is Trace4Rays with the packet widened to 8 rays; the tree, the triangle format and
+// the intersection math are unchanged, so both tracers return the same results. Only this part
+// of the file is compiled for AVX, and it is only entered after RayTrace_UseAVX() has checked
+// the CPU, so the tools still run on machines without it.
+//-----------------------------------------------------------------------------
+#if defined( _MSC_VER )
+#include <intrin.h>
+#define AVX_FUNCTION
+#else
+#include <cpuid.h>
+#define AVX_FUNCTION __attribute__(( target( "avx" ) ))
+#endif
+#include <immintrin.h>
+
+static bool s_bAllowAVX = true;
+
+static bool CPUSupportsAVX( void )
+{
+	// AVX needs both the CPU flag and an OS that saves the ymm registers (OSXSAVE + XCR0 bits 1,2)
+	unsigned int nECX;
+#if defined( _MSC_VER )
+	int cpuInfo[4];
+	__cpuid( cpuInfo, 1 );
+	nECX = cpuInfo[2];
+#else
+	unsigned int nEAX, nEBX, nEDX;
+	if ( !__get_cpuid( 1, &nEAX, &nEBX, &nECX, &nEDX ) )
+		return false;
+#endif
+	if ( ( nECX & ( ( 1 << 27 ) | ( 1 << 28 ) ) ) != ( ( 1 << 27 ) | ( 1 << 28 ) ) )
+		return false;
+
+#if defined( _MSC_VER )
+	uint64 nXCR0 = _xgetbv( 0 );
+#else
+	unsigned int nXCR0Lo, nXCR0Hi;
+	__asm__ __volatile__ ( "xgetbv" : "=a" ( nXCR0Lo ), "=d" ( nXCR0Hi ) : "c" ( 0 ) );
+	uint64 nXCR0 = nXCR0Lo | ( (uint64)nXCR0Hi << 32 );
+#endif
+	return ( nXCR0 & 6 ) == 6;
+}
+
+bool RayTrace_UseAVX( void )
+{
+	static bool s_bCPUSupportsAVX = CPUSupportsAVX();
+	return s_bAllowAVX && s_bCPUSupportsAVX;
+}
+
+void RayTrace_AllowAVX( bool bAllow )
+{
+	s_bAllowAVX = bAllow;
+}
+
+
+int EightRays::CalculateDirectionSignMask(void) const
+{
+	int msk=m_Half[0].CalculateDirectionSignMask();
+	if ( msk != m_Half[1].CalculateDirectionSignMask() )
+		return -1;
+	return msk;
+}
+
+
+void RayTracingEnvironment::Trace8Rays(const EightRays &rays, const fltx4 *pTMin, const fltx4 *pTMax,
+									   RayTracingResult *rslt_out,
+									   int32 skip_id, ITransparentTriangleCallback **ppCallbacks)
+{
+	if ( RayTrace_UseAVX() )
+	{
+		int msk=rays.CalculateDirectionSignMask();
+		if (msk!=-1)
+		{
+			Trace8RaysAVX(rays,pTMin,pTMax,msk,rslt_out,skip_id,ppCallbacks);
+			return;
+		}
+	}
+
+	for ( int h = 0; h < 2; h++ )
+		Trace4Rays(rays.m_Half[h],pTMin[h],pTMax[h],&rslt_out[h],skip_id,ppCallbacks ? ppCallbacks[h] : NULL);
+}
+
+
+struct NodeToVisit8 {
+	CacheOptimizedKDNode const *node;
+	__m256 TMin;
+	__m256 TMax;
+};
+
+AVX_FUNCTION static FORCEINLINE __m256 Combine8( fltx4 lo, fltx4 hi )
+{
+	return _mm256_insertf128_ps( _mm256_castps128_ps256( lo ), hi, 1 );
+}
+
+AVX_FUNCTION static FORCEINLINE fltx4 Half8( __m256 v, int h )
+{
+	return h ? _mm256_extractf128_ps( v, 1 ) : _mm256_castps256_ps128( v );
+}
+
+AVX_FUNCTION static FORCEINLINE bool IsAnyNegative8( __m256 v )
+{
+	return _mm256_movemask_ps( v ) != 0;
+}
+
+AVX_FUNCTION static FORCEINLINE __m256 Select8( __m256 a, __m256 b, __m256 mask )
+{
+	// mask ? b : a
+	return _mm256_blendv_ps( a, b, mask );
+}
+
+AVX_FUNCTION void RayTracingEnvironment::Trace8RaysAVX(const EightRays &rays, const fltx4 *pTMin, const fltx4 *pTMax,
+														int DirectionSignMask, RayTracingResult *rslt_out,
+														int32 skip_id, ITransparentTriangleCallback **ppCallbacks)
+{
+	rays.m_Half[0].Check();
+	rays.m_Half[1].Check();
+
+	__m256 origin[3], direction[3], OneOverRayDir[3];
+	for(int c=0;c<3;c++)
+	{
+		origin[c]=Combine8(rays.m_Half[0].origin[c],rays.m_Half[1].origin[c]);
+		direction[c]=Combine8(rays.m_Half[0].direction[c],rays.m_Half[1].direction[c]);
+		OneOverRayDir[c]=Combine8(ReciprocalSaturateSIMD(rays.m_Half[0].direction[c]),
+								  ReciprocalSaturateSIMD(rays.m_Half[1].direction[c]));
+	}
+
+	__m256 HitIds=_mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	__m256 HitDistance=_mm256_set1_ps(1.0e23);
+	__m256 HitNormal[3];
+	HitNormal[0]=HitNormal[1]=HitNormal[2]=_mm256_setzero_ps();
+
+	const __m256 Epsilons=_mm256_set1_ps(1.0e-10);
+	const __m256 NegativeEpsilons=_mm256_set1_ps(-1.0e-10);
+	const __m256 Ones=_mm256_set1_ps(1.0);
+
+	__m256 TMin=Combine8(pTMin[0],pTMin[1]);
+	__m256 TMax=Combine8(pTMax[0],pTMax[1]);
+
+	// now, clip rays against bounding box
+	for(int c=0;c<3;c++)
+	{
+		__m256 isect_min_t=_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(m_MinBound[c]),origin[c]),OneOverRayDir[c]);
+		__m256 isect_max_t=_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(m_MaxBound[c]),origin[c]),OneOverRayDir[c]);
+		TMin=_mm256_max_ps(TMin,_mm256_min_ps(isect_min_t,isect_max_t));
+		TMax=_mm256_min_ps(TMax,_mm256_max_ps(isect_min_t,isect_max_t));
+	}
+	__m256 active=_mm256_cmp_ps(TMin,TMax,_CMP_LE_OQ);
+	if ( IsAnyNegative8( active ) )
+	{
+		int32 mailboxids[MAILBOX_HASH_SIZE];				// used to avoid redundant triangle tests
+		memset(mailboxids,0xff,sizeof(mailboxids));
+
+		// based on ray direction, whether to visit left or right node first
+		int front_idx[3],back_idx[3];
+		for(int c=0;c<3;c++)
+		{
+			back_idx[c]=(DirectionSignMask & (1<<c)) ? 0 : 1;
+			front_idx[c]=1-back_idx[c];
+		}
+
+		NodeToVisit8 NodeQueue[MAX_NODE_STACK_LEN];
+		CacheOptimizedKDNode const *CurNode=&(OptimizedKDTree[0]);
+		NodeToVisit8 *stack_ptr=&NodeQueue[MAX_NODE_STACK_LEN];
+		while(1)
+		{
+			while (CurNode->NodeType() != KDNODE_STATE_LEAF)	// traverse until next leaf
+			{
+				int split_plane_number=CurNode->NodeType();
+				CacheOptimizedKDNode const *FrontChild=&(OptimizedKDTree[CurNode->LeftChild()]);
+
+				__m256 dist_to_sep_plane=					// dist=(split-org)/dir
+					_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(CurNode->SplittingPlaneValue),
+												origin[split_plane_number]),
+								  OneOverRayDir[split_plane_number]);
+				active=_mm256_cmp_ps(TMin,TMax,_CMP_LE_OQ);
+
+				// now, decide how to traverse children. can either do front,back, or do front
+				// and push back.
+				__m256 hits_front=_mm256_and_ps(active,_mm256_cmp_ps(dist_to_sep_plane,TMin,_CMP_GE_OQ));
+				if (! IsAnyNegative8(hits_front))
+				{
+					// missed the front. only traverse back
+					CurNode=FrontChild+back_idx[split_plane_number];
+					TMin=_mm256_max_ps(TMin,dist_to_sep_plane);
+				}
+				else
+				{
+					__m256 hits_back=_mm256_and_ps(active,_mm256_cmp_ps(dist_to_sep_plane,TMax,_CMP_LE_OQ));
+					if (! IsAnyNegative8(hits_back))
+					{
+						// missed the back - only need to traverse front node
+						CurNode=FrontChild+front_idx[split_plane_number];
+						TMax=_mm256_min_ps(TMax,dist_to_sep_plane);
+					}
+					else
+					{
+						// at least some rays hit both nodes.
+						// must push far, traverse near
+						assert(stack_ptr>NodeQueue);
+						--stack_ptr;
+						stack_ptr->node=FrontChild+back_idx[split_plane_number];
+						stack_ptr->TMin=_mm256_max_ps(TMin,dist_to_sep_plane);
+						stack_ptr->TMax=TMax;
+						CurNode=FrontChild+front_idx[split_plane_number];
+						TMax=_mm256_min_ps(TMax,dist_to_sep_plane);
+					}
+				}
+			}
+			// hit a leaf! must do intersection check
+			int ntris=CurNode->NumberOfTrianglesInLeaf();
+			if (ntris)
+			{
+				int32 const *tlist=&(TriangleIndexList[CurNode->TriangleIndexStart()]);
+				do
+				{
+					int tnum=*(tlist++);
+					// check mailbox
+					int mbox_slot=tnum & (MAILBOX_HASH_SIZE-1);
+					TriIntersectData_t const *tri = &( OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+					if ( ( mailboxids[mbox_slot] == tnum ) || ( tri->m_nTriangleID == skip_id ) )
+						continue;
+					mailboxids[mbox_slot] = tnum;
+
+					// compute plane intersection
+					__m256 Nx=_mm256_set1_ps(tri->m_flNx);
+					__m256 Ny=_mm256_set1_ps(tri->m_flNy);
+					__m256 Nz=_mm256_set1_ps(tri->m_flNz);
+
+					__m256 DDotN=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(direction[0],Nx),
+															 _mm256_mul_ps(direction[1],Ny)),
+											   _mm256_mul_ps(direction[2],Nz));
+					// mask off zero or near zero (ray parallel to surface)
+					__m256 did_hit=_mm256_or_ps(_mm256_cmp_ps(DDotN,Epsilons,_CMP_GT_OQ),
+												_mm256_cmp_ps(DDotN,NegativeEpsilons,_CMP_LT_OQ));
+
+					__m256 ODotN=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(origin[0],Nx),
+															 _mm256_mul_ps(origin[1],Ny)),
+											   _mm256_mul_ps(origin[2],Nz));
+					__m256 isect_t=_mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(tri->m_flD),ODotN),DDotN);
+					// now, we have the distance to the plane. lets update our mask
+					did_hit=_mm256_and_ps(did_hit,_mm256_cmp_ps(isect_t,Epsilons,_CMP_GT_OQ));
+					did_hit=_mm256_and_ps(did_hit,_mm256_cmp_ps(isect_t,HitDistance,_CMP_LT_OQ));
+					if (! IsAnyNegative8(did_hit))
+						continue;
+
+					// now, check 3 edges
+					__m256 hitc1=_mm256_add_ps(origin[tri->m_nCoordSelect0],
+											   _mm256_mul_ps(isect_t,direction[tri->m_nCoordSelect0]));
+					__m256 hitc2=_mm256_add_ps(origin[tri->m_nCoordSelect1],
+											   _mm256_mul_ps(isect_t,direction[tri->m_nCoordSelect1]));
+
+					// do barycentric coordinate check
+					__m256 B0=_mm256_mul_ps(_mm256_set1_ps(tri->m_ProjectedEdgeEquations[0]),hitc1);
+					B0=_mm256_add_ps(B0,_mm256_mul_ps(_mm256_set1_ps(tri->m_ProjectedEdgeEquations[1]),hitc2));
+					B0=_mm256_add_ps(B0,_mm256_set1_ps(tri->m_ProjectedEdgeEquations[2]));
+					did_hit=_mm256_and_ps(did_hit,_mm256_cmp_ps(B0,Epsilons,_CMP_GE_OQ));
+
+					__m256 B1=_mm256_mul_ps(_mm256_set1_ps(tri->m_ProjectedEdgeEquations[3]),hitc1);
+					B1=_mm256_add_ps(B1,_mm256_mul_ps(_mm256_set1_ps(tri->m_ProjectedEdgeEquations[4]),hitc2));
+					B1=_mm256_add_ps(B1,_mm256_set1_ps(tri->m_ProjectedEdgeEquations[5]));
+					did_hit=_mm256_and_ps(did_hit,_mm256_cmp_ps(B1,Epsilons,_CMP_GE_OQ));
+
+					__m256 B2=_mm256_add_ps(B1,B0);
+					did_hit=_mm256_and_ps(did_hit,_mm256_cmp_ps(B2,Ones,_CMP_LE_OQ));
+
+					if (! IsAnyNegative8(did_hit))
+						continue;
+
+					// if the triangle is transparent, let each half's callback have its say,
+					// with the barycentrics in the same 1, 2, 0 order as Trace4Rays
+					if ( ( tri->m_nFlags & FCACHETRI_TRANSPARENT ) && ppCallbacks )
+					{
+						__m256 b2=_mm256_sub_ps(Ones,B2);
+						fltx4 did_hit_half[2];
+						for ( int h = 0; h < 2; h++ )
+						{
+							did_hit_half[h]=Half8(did_hit,h);
+							if ( !IsAnyNegative( did_hit_half[h] ) )
+								continue;
+							fltx4 B1_half=Half8(B1,h);
+							fltx4 b2_half=Half8(b2,h);
+							fltx4 B0_half=Half8(B0,h);
+							if ( ppCallbacks[h]->VisitTriangle_ShouldContinue( *tri, rays.m_Half[h], &did_hit_half[h],
+																			   &B1_half, &b2_half, &B0_half, tnum ) )
+							{
+								did_hit_half[h]=Four_Zeros;
+							}
+						}
+						did_hit=Combine8(did_hit_half[0],did_hit_half[1]);
+					}
+
+					// now, set the hit_id and closest_hit fields for any enabled rays
+					HitIds=Select8(HitIds,_mm256_castsi256_ps(_mm256_set1_epi32(tnum)),did_hit);
+					HitDistance=Select8(HitDistance,isect_t,did_hit);
+					HitNormal[0]=Select8(HitNormal[0],Nx,did_hit);
+					HitNormal[1]=Select8(HitNormal[1],Ny,did_hit);
+					HitNormal[2]=Select8(HitNormal[2],Nz,did_hit);
+				} while (--ntris);
+
+				// now, check if all rays have terminated
+				__m256 raydone=_mm256_cmp_ps(TMax,HitDistance,_CMP_LE_OQ);
+				if (! IsAnyNegative8(raydone))
+					break;
+			}
+
+			if (stack_ptr==&NodeQueue[MAX_NODE_STACK_LEN])
+				break;
+
+			// pop stack!
+			CurNode=stack_ptr->node;
+			TMin=stack_ptr->TMin;
+			TMax=stack_ptr->TMax;
+			stack_ptr++;
+		}
+	}
+
+	for ( int h = 0; h < 2; h++ )
+	{
+		StoreAlignedSIMD((float *) rslt_out[h].HitIds,Half8(HitIds,h));
+		rslt_out[h].HitDistance=Half8(HitDistance,h);
+		rslt_out[h].surface_normal.x=Half8(HitNormal[0],h);
+		rslt_out[h].surface_normal.y=Half8(HitNormal[1],h);
+		rslt_out[h].surface_normal.z=Half8(HitNormal[2],h);
+	}
+
+	// the rest of the tools are built for SSE, avoid the AVX->SSE transition penalty
+	_mm256_zeroupper();
+}
+
+
 int RayTracingEnvironment::MakeLeafNode(int first_tri, int last_tri)
 {
 	CacheOptimizedKDNode ret;
@@ -869,7 +1202,7 @@ void RayTracingEnvironment::RefineNode(int node_number,int32 const *tri_list,int
 }
 
 
-void RayTracingEnvironment::SetupAccelerationStructure(void)
+void RayTracingEnvironment::SetupAccelerationStructureExhaustive(void)
 {
 	CacheOptimizedKDNode root{};
 	OptimizedKDTree.AddToTail(root);
@@ -887,6 +1220,439 @@ void RayTracingEnvironment::SetupAccelerationStructure(void)
 }
 
 
+//-----------------------------------------------------------------------------
+// Binned SAH kd-tree builder.
+//
+// Same cost model, empty space growing and termination rules as RefineNode, but instead of
+// trying (a tenth of) the triangle vertices as split candidates, each axis is cut into
+// KDBUILD_SAH_BINS bins and only the bin boundaries plus the two empty space cuts at the
+// triangle extents are evaluated. Finding the split is O(n) per node instead of O(n^2), and
+// it only reads precomputed triangle bounds, so nodes can be built on several threads.
+//
+// The top of the tree is built on the calling thread until the nodes get below a size
+// threshold that only depends on the triangle count; the subtrees below that are built
+// in parallel and appended in the order they were deferred. The resulting node layout is
+// identical no matter how many threads were used.
+//-----------------------------------------------------------------------------
+#define KDBUILD_SAH_BINS 32
+#define KDBUILD_MIN_PARALLEL_TRIS 2048						// smaller subtrees aren't worth a task
+#define KDBUILD_TARGET_TASKS 256							// number of subtrees to aim for
+
+struct KDBuildTriBounds_t
+{
+	Vector m_Mins;
+	Vector m_Maxs;
+};
+
+// Root is node 0, children of a split node are adjacent, leaves index into m_TriIndices;
+// the same layout as OptimizedKDTree/TriangleIndexList.
+struct KDBuildTree_t
+{
+	CUtlVector<CacheOptimizedKDNode> m_Nodes;
+	CUtlVector<int32> m_TriIndices;
+};
+
+// A subtree deferred from the top of the tree, to be built by a worker
+struct KDBuildTask_t
+{
+	int m_nNode;											// slot in the top tree
+	CUtlVector<int32> m_Tris;
+	Vector m_MinBound;
+	Vector m_MaxBound;
+	int m_nDepth;
+	KDBuildTree_t m_Tree;
+};
+
+class CKDTreeBuilder
+{
+public:
+	CKDTreeBuilder( RayTracingEnvironment *pEnv );
+	~CKDTreeBuilder();
+
+	void Build( int nThreads );
+
+private:
+	float FindSplit( int32 const *pTris, int ntris, Vector const &MinBound, Vector const &MaxBound,
+					 int &split_plane, float &split_value ) const;
+	void BuildNode( KDBuildTree_t &tree, int node_number, int32 *pTris, int ntris,
+					Vector const &MinBound, Vector const &MaxBound, int depth, bool bDefer );
+	void MakeLeaf( KDBuildTree_t &tree, int node_number, int32 const *pTris, int ntris,
+				   Vector const &MinBound, Vector const &MaxBound );
+
+	void RunTasks( int nThreads );
+	static uintp WorkerThread( void *pParam );
+
+	RayTracingEnvironment *m_pEnv;
+	CUtlVector<KDBuildTriBounds_t> m_TriBounds;
+	int m_nDeferTris;										// subtrees this small become tasks
+	CUtlVector<KDBuildTask_t *> m_Tasks;
+	CInterlockedInt m_nNextTask;
+};
+
+
+CKDTreeBuilder::CKDTreeBuilder( RayTracingEnvironment *pEnv )
+{
+	m_pEnv = pEnv;
+	m_nDeferTris = 0;
+}
+
+
+CKDTreeBuilder::~CKDTreeBuilder()
+{
+	m_Tasks.PurgeAndDeleteElements();
+}
+
+
+static float SplitCost( int split_plane, float split_value, int nleft, int nright, int nboth,
+						Vector const &MinBound, Vector const &MaxBound )
+{
+	Vector LeftMaxes=MaxBound;
+	Vector RightMins=MinBound;
+	LeftMaxes[split_plane]=split_value;
+	RightMins[split_plane]=split_value;
+	float SA_L=BoxSurfaceArea(MinBound,LeftMaxes);
+	float SA_R=BoxSurfaceArea(RightMins,MaxBound);
+	float ISA=1.0/BoxSurfaceArea(MinBound,MaxBound);
+	return COST_OF_TRAVERSAL+COST_OF_INTERSECTION*(nboth+(SA_L*ISA*(nleft))+(SA_R*ISA*(nright)));
+}
+
+
+static int ClassifyBoundsAgainstAxisSplit( KDBuildTriBounds_t const &bounds, int split_plane, float split_value )
+{
+	// matches CacheOptimizedTriangle::ClassifyAgainstAxisSplit
+	float minc=bounds.m_Mins[split_plane];
+	float maxc=bounds.m_Maxs[split_plane];
+	if (minc>=split_value)
+		return PLANECHECK_POSITIVE;
+	if (maxc<=split_value)
+		return PLANECHECK_NEGATIVE;
+	return PLANECHECK_STRADDLING;
+}
+
+
+float CKDTreeBuilder::FindSplit( int32 const *pTris, int ntris, Vector const &MinBound, Vector const &MaxBound,
+								 int &split_plane, float &split_value ) const
+{
+	float best_cost=1.0e23;
+	for(int axis=0;axis<3;axis++)
+	{
+		float flLo=MinBound[axis];
+		float flHi=MaxBound[axis];
+		if (flHi<=flLo)
+			continue;
+
+		// Count where each triangle starts and ends, and remember the outermost start and end
+		// coordinate in every bin. Triangles sticking out of the node (they are never clipped)
+		// land in the outer bins, which is where they belong for the sweep.
+		int nStartBins[KDBUILD_SAH_BINS];
+		int nEndBins[KDBUILD_SAH_BINS];
+		float flBinMinStart[KDBUILD_SAH_BINS];
+		float flBinMaxEnd[KDBUILD_SAH_BINS];
+		for(int b=0;b<KDBUILD_SAH_BINS;b++)
+		{
+			nStartBins[b]=nEndBins[b]=0;
+			flBinMinStart[b]=1.0e23;
+			flBinMaxEnd[b]=-1.0e23;
+		}
+		float min_coord=1.0e23,max_coord=-1.0e23;
+		float flBinScale=KDBUILD_SAH_BINS/(flHi-flLo);
+		for(int t=0;t<ntris;t++)
+		{
+			KDBuildTriBounds_t const &bounds=m_TriBounds[pTris[t]];
+			float minc=bounds.m_Mins[axis];
+			float maxc=bounds.m_Maxs[axis];
+			min_coord=min(min_coord,minc);
+			max_coord=max(max_coord,maxc);
+			int nStartBin=clamp((int)((minc-flLo)*flBinScale),0,KDBUILD_SAH_BINS-1);
+			int nEndBin=clamp((int)((maxc-flLo)*flBinScale),0,KDBUILD_SAH_BINS-1);
+			nStartBins[nStartBin]++;
+			nEndBins[nEndBin]++;
+			flBinMinStart[nStartBin]=min(flBinMinStart[nStartBin],minc);
+			flBinMaxEnd[nEndBin]=max(flBinMaxEnd[nEndBin],maxc);
+		}
+
+		// Smallest start at or above each bin boundary
+		float flStartAbove[KDBUILD_SAH_BINS+1];
+		flStartAbove[KDBUILD_SAH_BINS]=1.0e23;
+		for(int b=KDBUILD_SAH_BINS-1;b>=0;b--)
+			flStartAbove[b]=min(flStartAbove[b+1],flBinMinStart[b]);
+
+		// Sweep the bin boundaries. Everything that ends in a bin below the boundary is on the
+		// left, everything that starts in a bin above it on the right, the rest straddles. The
+		// plane can slide down to the last end on the left or up to the first start on the right
+		// without changing that, and those are the planes tried (they are triangle vertices, as
+		// in RefineNode); any straddling triangle that ends up on one side only makes it cheaper.
+		int nleft=0;
+		int nright=ntris;
+		float flEndBelow=-1.0e23;
+		for(int b=1;b<KDBUILD_SAH_BINS;b++)
+		{
+			nleft+=nEndBins[b-1];
+			nright-=nStartBins[b-1];
+			flEndBelow=max(flEndBelow,flBinMaxEnd[b-1]);
+			int nboth=ntris-nleft-nright;
+			for(int nCandidate=0;nCandidate<2;nCandidate++)
+			{
+				float trial_splitvalue=nCandidate ? flStartAbove[b] : flEndBelow;
+				if ((trial_splitvalue<=flLo) || (trial_splitvalue>=flHi))
+					continue;
+				// "grow" the empty half, as CalculateCostsOfSplit does
+				if (nleft && (nboth==0) && (nright==0))
+					trial_splitvalue=max_coord;
+				if (nright && (nboth==0) && (nleft==0))
+					trial_splitvalue=min_coord;
+				float trial_cost=SplitCost(axis,trial_splitvalue,nleft,nright,nboth,MinBound,MaxBound);
+				if (trial_cost<best_cost)
+				{
+					best_cost=trial_cost;
+					split_plane=axis;
+					split_value=trial_splitvalue;
+				}
+			}
+		}
+
+		// Cutting off the empty space on either side is usually the best split of all
+		if ((max_coord<flHi) && (max_coord>flLo))
+		{
+			float trial_cost=SplitCost(axis,max_coord,ntris,0,0,MinBound,MaxBound);
+			if (trial_cost<best_cost)
+			{
+				best_cost=trial_cost;
+				split_plane=axis;
+				split_value=max_coord;
+			}
+		}
+		if ((min_coord>flLo) && (min_coord<flHi))
+		{
+			float trial_cost=SplitCost(axis,min_coord,0,ntris,0,MinBound,MaxBound);
+			if (trial_cost<best_cost)
+			{
+				best_cost=trial_cost;
+				split_plane=axis;
+				split_value=min_coord;
+			}
+		}
+	}
+	return best_cost;
+}
+
+
+void CKDTreeBuilder::MakeLeaf( KDBuildTree_t &tree, int node_number, int32 const *pTris, int ntris,
+							   Vector const &MinBound, Vector const &MaxBound )
+{
+	tree.m_Nodes[node_number].Children=KDNODE_STATE_LEAF+(tree.m_TriIndices.Count()<<2);
+	tree.m_Nodes[node_number].SetNumberOfTrianglesInLeafNode(ntris);
+#ifdef DEBUG_RAYTRACE
+	tree.m_Nodes[node_number].vecMins = MinBound;
+	tree.m_Nodes[node_number].vecMaxs = MaxBound;
+#endif
+	tree.m_TriIndices.AddMultipleToTail(ntris,pTris);
+}
+
+
+void CKDTreeBuilder::BuildNode( KDBuildTree_t &tree, int node_number, int32 *pTris, int ntris,
+								Vector const &MinBound, Vector const &MaxBound, int depth, bool bDefer )
+{
+	if ( bDefer && ( ntris <= m_nDeferTris ) && ( ntris >= KDBUILD_MIN_PARALLEL_TRIS ) )
+	{
+		KDBuildTask_t *pTask = new KDBuildTask_t;
+		pTask->m_nNode = node_number;
+		pTask->m_Tris.CopyArray( pTris, ntris );
+		pTask->m_MinBound = MinBound;
+		pTask->m_MaxBound = MaxBound;
+		pTask->m_nDepth = depth;
+		m_Tasks.AddToTail( pTask );
+		return;
+	}
+
+	if (ntris<3)											// never split empty lists
+	{
+		MakeLeaf(tree,node_number,pTris,ntris,MinBound,MaxBound);
+		return;
+	}
+
+	int split_plane=0;
+	float split_value=0;
+	float best_cost=FindSplit(pTris,ntris,MinBound,MaxBound,split_plane,split_value);
+	float cost_of_no_split=COST_OF_INTERSECTION*ntris;
+	if ( (cost_of_no_split<=best_cost) || NEVER_SPLIT || (depth>MAX_TREE_DEPTH))
+	{
+		MakeLeaf(tree,node_number,pTris,ntris,MinBound,MaxBound);
+		return;
+	}
+
+	// partition exactly, in the same left/both/right order as RefineNode
+	int32 *new_triangle_list=new int32[ntris];
+	int nleft=0,nright=0,nboth=0;
+	for(int t=0;t<ntris;t++)
+	{
+		if (ClassifyBoundsAgainstAxisSplit(m_TriBounds[pTris[t]],split_plane,split_value)==PLANECHECK_NEGATIVE)
+			new_triangle_list[nleft++]=pTris[t];
+	}
+	for(int t=0;t<ntris;t++)
+	{
+		switch(ClassifyBoundsAgainstAxisSplit(m_TriBounds[pTris[t]],split_plane,split_value))
+		{
+			case PLANECHECK_POSITIVE:
+				nright++;
+				new_triangle_list[ntris-nright]=pTris[t];
+				break;
+			case PLANECHECK_STRADDLING:
+				new_triangle_list[nleft+nboth]=pTris[t];
+				nboth++;
+				break;
+		}
+	}
+
+	if (nboth==ntris)
+	{
+		// the bins promised something the triangles can't deliver
+		delete[] new_triangle_list;
+		MakeLeaf(tree,node_number,pTris,ntris,MinBound,MaxBound);
+		return;
+	}
+
+	Vector LeftMaxes=MaxBound;
+	Vector RightMins=MinBound;
+	LeftMaxes[split_plane]=split_value;
+	RightMins[split_plane]=split_value;
+
+	int left_child=tree.m_Nodes.Count();
+	tree.m_Nodes[node_number].Children=split_plane+(left_child<<2);
+	tree.m_Nodes[node_number].SplittingPlaneValue=split_value;
+#ifdef DEBUG_RAYTRACE
+	tree.m_Nodes[node_number].vecMins = MinBound;
+	tree.m_Nodes[node_number].vecMaxs = MaxBound;
+#endif
+	CacheOptimizedKDNode newnode{};
+	tree.m_Nodes.AddToTail(newnode);
+	tree.m_Nodes.AddToTail(newnode);
+	if ( (ntris<20) && ((nleft==0) || (nright==0)) )
+		depth+=100;
+	BuildNode(tree,left_child,new_triangle_list,nleft+nboth,MinBound,LeftMaxes,depth+1,bDefer);
+	BuildNode(tree,left_child+1,new_triangle_list+nleft,nright+nboth,RightMins,MaxBound,depth+1,bDefer);
+	delete[] new_triangle_list;
+}
+
+
+uintp CKDTreeBuilder::WorkerThread( void *pParam )
+{
+	CKDTreeBuilder *pBuilder = (CKDTreeBuilder *)pParam;
+	for ( ;; )
+	{
+		int iTask = pBuilder->m_nNextTask++;
+		if ( iTask >= pBuilder->m_Tasks.Count() )
+			break;
+
+		KDBuildTask_t *pTask = pBuilder->m_Tasks[iTask];
+		CacheOptimizedKDNode root{};
+		pTask->m_Tree.m_Nodes.AddToTail( root );
+		pBuilder->BuildNode( pTask->m_Tree, 0, pTask->m_Tris.Base(), pTask->m_Tris.Count(),
+							 pTask->m_MinBound, pTask->m_MaxBound, pTask->m_nDepth, false );
+		pTask->m_Tris.Purge();
+	}
+	return 0;
+}
+
+
+void CKDTreeBuilder::RunTasks( int nThreads )
+{
+	m_nNextTask = 0;
+	nThreads = MIN( nThreads, m_Tasks.Count() );
+
+	CUtlVector<ThreadHandle_t> threads;
+	for ( int i=1; i < nThreads; i++ )
+	{
+		ThreadHandle_t hThread = CreateSimpleThread( WorkerThread, this );
+		if ( hThread )
+			threads.AddToTail( hThread );
+	}
+
+	// the calling thread works too, and picks up everything if no threads could be made
+	WorkerThread( this );
+
+	for ( int i=0; i < threads.Count(); i++ )
+	{
+		ThreadJoin( threads[i] );
+		ReleaseThreadHandle( threads[i] );
+	}
+}
+
+
+void CKDTreeBuilder::Build( int nThreads )
+{
+	int ntris=m_pEnv->OptimizedTriangleList.Count();
+
+	m_TriBounds.SetCount( ntris );
+	for(int t=0;t<ntris;t++)
+	{
+		CacheOptimizedTriangle const &tri=m_pEnv->OptimizedTriangleList[t];
+		KDBuildTriBounds_t &bounds=m_TriBounds[t];
+		VectorMin(tri.Vertex(0),tri.Vertex(1),bounds.m_Mins);
+		VectorMin(tri.Vertex(2),bounds.m_Mins,bounds.m_Mins);
+		VectorMax(tri.Vertex(0),tri.Vertex(1),bounds.m_Maxs);
+		VectorMax(tri.Vertex(2),bounds.m_Maxs,bounds.m_Maxs);
+	}
+
+	CUtlVector<int32> root_triangle_list;
+	root_triangle_list.SetCount( ntris );
+	for(int t=0;t<ntris;t++)
+		root_triangle_list[t]=t;
+	m_pEnv->CalculateTriangleListBounds(root_triangle_list.Base(),ntris,m_pEnv->m_MinBound,
+										m_pEnv->m_MaxBound);
+
+	// The deferral threshold must not depend on nThreads, or the layout would change with it
+	KDBuildTree_t top;
+	m_nDeferTris = MAX( ntris / KDBUILD_TARGET_TASKS, KDBUILD_MIN_PARALLEL_TRIS );
+	CacheOptimizedKDNode root{};
+	top.m_Nodes.AddToTail( root );
+	BuildNode( top, 0, root_triangle_list.Base(), ntris, m_pEnv->m_MinBound, m_pEnv->m_MaxBound, 0, true );
+
+	RunTasks( nThreads );
+
+	// Stitch the subtrees in, in the order they were deferred. A subtree's root goes into the
+	// slot it was deferred from, the rest of its nodes are appended in order.
+	for ( int i=0; i < m_Tasks.Count(); i++ )
+	{
+		KDBuildTree_t &sub = m_Tasks[i]->m_Tree;
+		int nNodeBase = top.m_Nodes.Count() - 1;
+		int nTriBase = top.m_TriIndices.Count();
+		for ( int n=0; n < sub.m_Nodes.Count(); n++ )
+		{
+			CacheOptimizedKDNode node = sub.m_Nodes[n];
+			if ( node.NodeType() == KDNODE_STATE_LEAF )
+				node.Children = KDNODE_STATE_LEAF + ( ( node.TriangleIndexStart() + nTriBase ) << 2 );
+			else
+				node.Children = node.NodeType() + ( ( node.LeftChild() + nNodeBase ) << 2 );
+
+			if ( n == 0 )
+				top.m_Nodes[m_Tasks[i]->m_nNode] = node;
+			else
+				top.m_Nodes.AddToTail( node );
+		}
+		top.m_TriIndices.AddVectorToTail( sub.m_TriIndices );
+		sub.m_Nodes.Purge();
+		sub.m_TriIndices.Purge();
+	}
+
+	m_pEnv->OptimizedKDTree.Swap( top.m_Nodes );
+	m_pEnv->TriangleIndexList.Swap( top.m_TriIndices );
+}
+
+
+void RayTracingEnvironment::SetupAccelerationStructure( int nThreads )
+{
+	if ( nThreads <= 0 )
+		nThreads = GetCPUInformation()->m_nLogicalProcessors;
+
+	CKDTreeBuilder builder( this );
+	builder.Build( nThreads );
+
+	// now, convert all triangles to "intersection format"
+	for(int i=0;i<OptimizedTriangleList.Count();i++)
+		OptimizedTriangleList[i].ChangeIntoIntersectionFormat();
+}
+
 
 void RayTracingEnvironment::AddInfinitePointLight(Vector position, Vector intensity)
 {
@@ -303,7 +303,7 @@ private:
 		// The hash function.
 		unsigned int operator()( int nItem ) const
 		{
-			return HashStringCaseless( m_pchCurString );
+			return FastHashStringCaseless( m_pchCurString );
 		}
 
 	private:
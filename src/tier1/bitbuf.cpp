@@ -12,6 +12,7 @@
 #include "mathlib/mathlib.h"
 #include "tier1/strtools.h"
 #include "bitvec.h"
+#include "tier1/convar.h"
 
 // FIXME: Can't use this until we get multithreaded allocations in tier0 working for tools
 // This is used by VVIS and fails to link
@@ -485,34 +486,31 @@ bool bf_write::WriteBits(const void *pInData, int nBits)
 	// X360TBD: Can't write dwords in WriteBits because they'll get swapped
 	if ( IsPC() && nBitsLeft >= 32 )
 	{
+		// Carry the bits that spill past each output dword into the next one through a
+		// 64-bit accumulator, so each dword is stored once instead of masked in twice
 		uint32 iBitsRight = (m_iCurBit & 31);
-		uint32 iBitsLeft = 32 - iBitsRight;
-		uint32 bitMaskLeft = g_BitWriteMasks[iBitsRight][32];
-		uint32 bitMaskRight = g_BitWriteMasks[0][iBitsRight];
+		uint32 bitMaskRight = ( 1u << iBitsRight ) - 1;
 
 		uint32 *pData = &m_pData[m_iCurBit>>5];
+		uint64 nAccum = *pData & bitMaskRight;
 
-		// Read dwords.
 		while(nBitsLeft >= 32)
 		{
-			uint32 curData = *(uint32*)pOut;
+			nAccum |= (uint64)*(uint32*)pOut << iBitsRight;
 			pOut += sizeof(uint32);
 
-			*pData &= bitMaskLeft;
-			*pData |= curData << iBitsRight;
-
-			pData++; 
-
-			if ( iBitsLeft < 32 )
-			{
-				curData >>= iBitsLeft;
-				*pData &= bitMaskRight;
-				*pData |= curData;
-			}
+			*pData++ = (uint32)nAccum;
+			nAccum >>= 32;
 
 			nBitsLeft -= 32;
 			m_iCurBit += 32;
 		}
+
+		// The carried bits go under whatever is already past them in the last dword
+		if ( iBitsRight )
+		{
+			*pData = ( *pData & ~bitMaskRight ) | (uint32)nAccum;
+		}
 	}
 
 
@@ -893,6 +891,42 @@ void bf_read::ReadBits(void *pOutData, int nBits)
 	}
 
 	// X360TBD: Can't read dwords in ReadBits because they'll get swapped
+	// Reads that would overrun are left to the ReadUBitLong loops below to flag.
+	if ( IsPC() && nBitsLeft >= 32 && GetNumBitsLeft() >= nBitsLeft )
+	{
+		if ( ( m_iCurBit & 7 ) == 0 )
+		{
+			// current bit is byte aligned, do block copy
+			int numbytes = nBitsLeft >> 3;
+			int numbits = numbytes << 3;
+
+			Q_memcpy( pOut, m_pData+(m_iCurBit>>3), numbytes );
+			pOut += numbytes;
+			nBitsLeft -= numbits;
+			m_iCurBit += numbits;
+		}
+		else
+		{
+			// Each output dword straddles two input dwords; keep the next one loaded
+			// above the current one in a 64-bit accumulator
+			uint32 iBitsRight = (m_iCurBit & 31);
+			uint32 *pData = (uint32*)m_pData + (m_iCurBit>>5);
+			uint64 nAccum = LoadLittleDWord( pData, 0 );
+
+			while ( nBitsLeft >= 32 )
+			{
+				nAccum |= (uint64)LoadLittleDWord( pData, 1 ) << 32;
+				*((uint32*)pOut) = (uint32)( nAccum >> iBitsRight );
+				nAccum >>= 32;
+
+				++pData;
+				pOut += sizeof(uint32);
+				nBitsLeft -= 32;
+				m_iCurBit += 32;
+			}
+		}
+	}
+
 	if ( IsPC() )
 	{
 		// read dwords
@@ -1488,3 +1522,139 @@ int bf_read::CompareBitsAt( int offset, bf_read * RESTRICT other, int otherOffse
 	x ^= LoadLittleDWord( (uint32*)pData2End, 0 ) << (32 - iStartBit2);
 	return x & g_ExtraMasks[ numbits ];
 }
+
+#ifdef _DEBUG
+static uint32 BitbufTestRandom( uint32 &nState )
+{
+	nState ^= nState << 13;
+	nState ^= nState >> 17;
+	nState ^= nState << 5;
+	return nState;
+}
+
+//-----------------------------------------------------------------------------
+// Writes random fields and blocks both normally and one bit at a time, checks
+// the two buffers match bit for bit, then reads the fields back.
+//-----------------------------------------------------------------------------
+CON_COMMAND( test_bitbuf, "Fuzzes bf_write/bf_read against bit-at-a-time writes" )
+{
+	struct Field_t
+	{
+		int		m_nBits;
+		int		m_nOffset;	// into payload, for blocks
+		uint32	m_nValue;	// for single fields
+		bool	m_bBlock;
+	};
+
+	static uint32 s_Data[256];
+	static uint32 s_Reference[256];
+	unsigned char payload[1024 + 8];
+	unsigned char readback[1024 + 8];
+	Field_t fields[64];
+
+	uint32 nRandom = 1;
+	int nFailures = 0;
+	const int nTests = 5000;
+	for ( int nTest = 0; nTest < nTests; nTest++ )
+	{
+		// Same garbage in both, so stray writes past a field show up too
+		for ( int i = 0; i < ARRAYSIZE( s_Data ); i++ )
+		{
+			s_Data[i] = s_Reference[i] = BitbufTestRandom( nRandom );
+		}
+		for ( int i = 0; i < ARRAYSIZE( payload ); i++ )
+		{
+			payload[i] = (unsigned char)BitbufTestRandom( nRandom );
+		}
+
+		int nMaxBits = sizeof( s_Data ) * 8 - BitbufTestRandom( nRandom ) % 64;
+		bf_write buf( s_Data, sizeof( s_Data ), nMaxBits );
+		bf_write reference( s_Reference, sizeof( s_Reference ), nMaxBits );
+
+		int nStartBit = BitbufTestRandom( nRandom ) % 64;
+		buf.SeekToBit( nStartBit );
+		reference.SeekToBit( nStartBit );
+
+		int nFields = 0;
+		int nTotalBits = nStartBit;
+		while ( nFields < ARRAYSIZE( fields ) )
+		{
+			Field_t &field = fields[nFields];
+			field.m_bBlock = ( BitbufTestRandom( nRandom ) & 3 ) == 0;
+			if ( field.m_bBlock )
+			{
+				int nMaxBlockBits = ( BitbufTestRandom( nRandom ) & 7 ) ? 300 : 8000;
+				field.m_nBits = BitbufTestRandom( nRandom ) % nMaxBlockBits;
+			}
+			else
+			{
+				field.m_nBits = 1 + BitbufTestRandom( nRandom ) % 32;
+			}
+			field.m_nOffset = BitbufTestRandom( nRandom ) % 8;
+			field.m_nValue = BitbufTestRandom( nRandom ) & ( 0xFFFFFFFF >> ( 32 - MIN( field.m_nBits, 32 ) ) );
+			if ( nTotalBits + field.m_nBits > nMaxBits )
+				break;
+
+			if ( field.m_bBlock )
+			{
+				buf.WriteBits( payload + field.m_nOffset, field.m_nBits );
+				for ( int i = 0; i < field.m_nBits; i++ )
+				{
+					reference.WriteOneBit( ( payload[field.m_nOffset + ( i >> 3 )] >> ( i & 7 ) ) & 1 );
+				}
+			}
+			else
+			{
+				buf.WriteUBitLong( field.m_nValue, field.m_nBits );
+				for ( int i = 0; i < field.m_nBits; i++ )
+				{
+					reference.WriteOneBit( ( field.m_nValue >> i ) & 1 );
+				}
+			}
+
+			nTotalBits += field.m_nBits;
+			++nFields;
+		}
+
+		bool bFailed = buf.IsOverflowed() || buf.GetNumBitsWritten() != reference.GetNumBitsWritten() ||
+			V_memcmp( s_Data, s_Reference, sizeof( s_Data ) ) != 0;
+
+		bf_read read( s_Data, sizeof( s_Data ), nMaxBits );
+		read.Seek( nStartBit );
+		for ( int i = 0; i < nFields && !bFailed; i++ )
+		{
+			const Field_t &field = fields[i];
+			if ( field.m_bBlock )
+			{
+				V_memset( readback, 0, sizeof( readback ) );
+				read.ReadBits( readback + field.m_nOffset, field.m_nBits );
+				int nBytes = field.m_nBits >> 3;
+				bFailed = V_memcmp( readback + field.m_nOffset, payload + field.m_nOffset, nBytes ) != 0;
+				if ( field.m_nBits & 7 )
+				{
+					int nMask = ( 1 << ( field.m_nBits & 7 ) ) - 1;
+					bFailed |= ( ( readback[field.m_nOffset + nBytes] ^ payload[field.m_nOffset + nBytes] ) & nMask ) != 0;
+				}
+			}
+			else
+			{
+				bFailed = read.ReadUBitLong( field.m_nBits ) != field.m_nValue;
+			}
+		}
+
+		if ( bFailed || read.IsOverflowed() || read.GetNumBitsRead() != nTotalBits )
+		{
+			++nFailures;
+		}
+	}
+
+	if ( nFailures )
+	{
+		Warning( "Failed %d of %d.\n", nFailures, nTests );
+	}
+	else
+	{
+		Msg( "Pass.\n" );
+	}
+}
+#endif
@@ -7,6 +7,18 @@
 #include "basetypes.h"
 #include "commonmacros.h"
 #include "checksum_crc.h"
+#include "tier1/processor_detect.h"
+
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ )
+#define CRC32_CLMUL 1
+#if defined( _MSC_VER )
+#include <intrin.h>
+#define CRC32_CLMUL_FUNCTION
+#else
+#define CRC32_CLMUL_FUNCTION __attribute__(( target( "pclmul,sse2" ) ))
+#endif
+#include <immintrin.h>
+#endif
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -98,6 +110,99 @@ CRC32_t	CRC32_GetTableEntry( unsigned int slot )
 	return pulCRCTable[(unsigned char)slot];
 }
 
+#ifdef CRC32_CLMUL
+//-----------------------------------------------------------------------------
+// CRC32 by folding with carry-less multiplies, after Intel's "Fast CRC Computation
+// for Generic Polynomials Using PCLMULQDQ Instruction". Four 128-bit lanes fold
+// 64 bytes at a time, then fold into one lane, and a Barrett reduction takes that
+// to 32 bits. The constants are for the bit-reflected polynomial the table uses.
+// nBuffer must be a multiple of 16 and at least 64. ulCrc is the running value,
+// between CRC32_Init and CRC32_Final.
+//-----------------------------------------------------------------------------
+#define CRC32_CLMUL_MIN_LENGTH	64
+
+static bool s_bCRC32UseCLMUL = CheckPCLMULTechnology();
+
+static CRC32_CLMUL_FUNCTION CRC32_t CRC32_ProcessCLMUL( CRC32_t ulCrc, const unsigned char *pb, int nBuffer )
+{
+	const __m128i k1k2 = _mm_set_epi64x( 0x01c6e41596LL, 0x0154442bd4LL );
+	const __m128i k3k4 = _mm_set_epi64x( 0x00ccaa009eLL, 0x01751997d0LL );
+	const __m128i k5k0 = _mm_set_epi64x( 0, 0x0163cd6124LL );
+	const __m128i poly = _mm_set_epi64x( 0x01f7011641LL, 0x01db710641LL );
+	const __m128i mask32 = _mm_setr_epi32( ~0, 0, ~0, 0 );
+
+	__m128i x1 = _mm_loadu_si128( (const __m128i *)( pb + 0x00 ) );
+	__m128i x2 = _mm_loadu_si128( (const __m128i *)( pb + 0x10 ) );
+	__m128i x3 = _mm_loadu_si128( (const __m128i *)( pb + 0x20 ) );
+	__m128i x4 = _mm_loadu_si128( (const __m128i *)( pb + 0x30 ) );
+	x1 = _mm_xor_si128( x1, _mm_cvtsi32_si128( (int)ulCrc ) );
+	pb += 64;
+	nBuffer -= 64;
+
+	// Fold 64 bytes at a time
+	while ( nBuffer >= 64 )
+	{
+		__m128i x5 = _mm_clmulepi64_si128( x1, k1k2, 0x00 );
+		__m128i x6 = _mm_clmulepi64_si128( x2, k1k2, 0x00 );
+		__m128i x7 = _mm_clmulepi64_si128( x3, k1k2, 0x00 );
+		__m128i x8 = _mm_clmulepi64_si128( x4, k1k2, 0x00 );
+		x1 = _mm_clmulepi64_si128( x1, k1k2, 0x11 );
+		x2 = _mm_clmulepi64_si128( x2, k1k2, 0x11 );
+		x3 = _mm_clmulepi64_si128( x3, k1k2, 0x11 );
+		x4 = _mm_clmulepi64_si128( x4, k1k2, 0x11 );
+		x1 = _mm_xor_si128( _mm_xor_si128( x1, x5 ), _mm_loadu_si128( (const __m128i *)( pb + 0x00 ) ) );
+		x2 = _mm_xor_si128( _mm_xor_si128( x2, x6 ), _mm_loadu_si128( (const __m128i *)( pb + 0x10 ) ) );
+		x3 = _mm_xor_si128( _mm_xor_si128( x3, x7 ), _mm_loadu_si128( (const __m128i *)( pb + 0x20 ) ) );
+		x4 = _mm_xor_si128( _mm_xor_si128( x4, x8 ), _mm_loadu_si128( (const __m128i *)( pb + 0x30 ) ) );
+		pb += 64;
+		nBuffer -= 64;
+	}
+
+	// Fold the four lanes into one
+	__m128i x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+	x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x5 ), x2 );
+	x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+	x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x5 ), x3 );
+	x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+	x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x5 ), x4 );
+
+	// Then the remaining 16 byte blocks
+	while ( nBuffer >= 16 )
+	{
+		x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+		x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x5 ), _mm_loadu_si128( (const __m128i *)pb ) );
+		pb += 16;
+		nBuffer -= 16;
+	}
+
+	// 128 bits to 64
+	x2 = _mm_clmulepi64_si128( x1, k3k4, 0x10 );
+	x1 = _mm_xor_si128( _mm_srli_si128( x1, 8 ), x2 );
+	x2 = _mm_srli_si128( x1, 4 );
+	x1 = _mm_and_si128( x1, mask32 );
+	x1 = _mm_xor_si128( _mm_clmulepi64_si128( x1, k5k0, 0x00 ), x2 );
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128( x1, mask32 );
+	x2 = _mm_clmulepi64_si128( x2, poly, 0x10 );
+	x2 = _mm_and_si128( x2, mask32 );
+	x2 = _mm_clmulepi64_si128( x2, poly, 0x00 );
+	x1 = _mm_xor_si128( x1, x2 );
+
+	return (CRC32_t)_mm_cvtsi128_si32( _mm_srli_si128( x1, 4 ) );
+}
+#endif // CRC32_CLMUL
+
+bool CRC32_EnableHardware( bool bEnable )
+{
+#ifdef CRC32_CLMUL
+	s_bCRC32UseCLMUL = bEnable && CheckPCLMULTechnology();
+	return s_bCRC32UseCLMUL;
+#else
+	return false;
+#endif
+}
+
 void CRC32_ProcessBuffer(CRC32_t *pulCRC, const void *pBuffer, int nBuffer)
 {
 	CRC32_t ulCrc = *pulCRC;
@@ -105,6 +210,18 @@ void CRC32_ProcessBuffer(CRC32_t *pulCRC, const void *pBuffer, int nBuffer)
     unsigned int nFront;
     int nMain;
 
+#ifdef CRC32_CLMUL
+	// Big buffers go through the carry-less multiply path a multiple of 16 bytes at a time;
+	// what's left over goes through the table below
+	if ( nBuffer >= CRC32_CLMUL_MIN_LENGTH && s_bCRC32UseCLMUL )
+	{
+		int nFolded = nBuffer & ~15;
+		ulCrc = CRC32_ProcessCLMUL( ulCrc, pb, nFolded );
+		pb += nFolded;
+		nBuffer -= nFolded;
+	}
+#endif
+
 JustAfew:
 
     switch (nBuffer)
@@ -33,6 +33,19 @@
 
 #define MAX_FILE_READ_BUFFER 8000
 
+// The SHA extensions path stays out of the minimum builds, which can't pull in processor_detect
+#if !defined(_MINIMUM_BUILD_) && ( defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ ) )
+#define SHA1_SHANI 1
+#include "tier1/processor_detect.h"
+#if defined( _MSC_VER )
+#include <intrin.h>
+#define SHA1_SHANI_FUNCTION
+#else
+#define SHA1_SHANI_FUNCTION __attribute__(( target( "sha,ssse3" ) ))
+#endif
+#include <immintrin.h>
+#endif
+
 // Rotate x bits to the left
 #ifndef ROL32
 #define ROL32(_val32, _nBits) (((_val32)<<(_nBits))|((_val32)>>(32-(_nBits))))
@@ -55,6 +68,93 @@
 #define _R3(v,w,x,y,z,i) { z+=(((w|x)&y)|(w&x))+SHABLK(i)+0x8F1BBCDC+ROL32(v,5); w=ROL32(w,30); }
 #define _R4(v,w,x,y,z,i) { z+=(w^x^y)+SHABLK(i)+0xCA62C1D6+ROL32(v,5); w=ROL32(w,30); }
 
+#ifdef SHA1_SHANI
+static bool s_bSHA1UseSHANI = CheckSHATechnology();
+
+//-----------------------------------------------------------------------------
+// Runs nBlocks 64 byte blocks through the SHA-1 compression function with the
+// SHA extensions. Each sha1rnds4 does four rounds, and sha1msg1/sha1msg2 extend
+// the message schedule four words at a time.
+//-----------------------------------------------------------------------------
+#define SHA1_SHANI_ROUNDS( i, f ) \
+	W[(i) & 3] = _mm_sha1msg2_epu32( _mm_xor_si128( _mm_sha1msg1_epu32( W[(i) & 3], W[((i) + 1) & 3] ), W[((i) + 2) & 3] ), W[((i) + 3) & 3] ); \
+	E = _mm_sha1nexte_epu32( ABCDPrev, W[(i) & 3] ); \
+	ABCDPrev = ABCD; \
+	ABCD = _mm_sha1rnds4_epu32( ABCD, E, f );
+
+static SHA1_SHANI_FUNCTION void SHA1_TransformSHANI( uint32 state[5], const unsigned char *pData, unsigned int nBlocks )
+{
+	// Message words are big endian
+	const __m128i byteSwap = _mm_set_epi64x( 0x0001020304050607LL, 0x08090a0b0c0d0e0fLL );
+
+	// a in the top lane down to d in the bottom; e rides in the top lane of its own register
+	__m128i ABCD = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *)state ), 0x1B );
+	__m128i E0 = _mm_set_epi32( (int)state[4], 0, 0, 0 );
+
+	for ( ; nBlocks; --nBlocks, pData += 64 )
+	{
+		__m128i ABCDSave = ABCD;
+		__m128i E0Save = E0;
+		__m128i W[4], E, ABCDPrev;
+
+		for ( int i = 0; i < 4; i++ )
+		{
+			W[i] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( pData + i * 16 ) ), byteSwap );
+		}
+
+		// Rounds 0-15, straight from the block
+		E = _mm_add_epi32( E0, W[0] );
+		ABCDPrev = ABCD;
+		ABCD = _mm_sha1rnds4_epu32( ABCD, E, 0 );
+		E = _mm_sha1nexte_epu32( ABCDPrev, W[1] );
+		ABCDPrev = ABCD;
+		ABCD = _mm_sha1rnds4_epu32( ABCD, E, 0 );
+		E = _mm_sha1nexte_epu32( ABCDPrev, W[2] );
+		ABCDPrev = ABCD;
+		ABCD = _mm_sha1rnds4_epu32( ABCD, E, 0 );
+		E = _mm_sha1nexte_epu32( ABCDPrev, W[3] );
+		ABCDPrev = ABCD;
+		ABCD = _mm_sha1rnds4_epu32( ABCD, E, 0 );
+
+		// Rounds 16-79 on the extended schedule
+		SHA1_SHANI_ROUNDS( 4, 0 );
+		SHA1_SHANI_ROUNDS( 5, 1 );
+		SHA1_SHANI_ROUNDS( 6, 1 );
+		SHA1_SHANI_ROUNDS( 7, 1 );
+		SHA1_SHANI_ROUNDS( 8, 1 );
+		SHA1_SHANI_ROUNDS( 9, 1 );
+		SHA1_SHANI_ROUNDS( 10, 2 );
+		SHA1_SHANI_ROUNDS( 11, 2 );
+		SHA1_SHANI_ROUNDS( 12, 2 );
+		SHA1_SHANI_ROUNDS( 13, 2 );
+		SHA1_SHANI_ROUNDS( 14, 2 );
+		SHA1_SHANI_ROUNDS( 15, 3 );
+		SHA1_SHANI_ROUNDS( 16, 3 );
+		SHA1_SHANI_ROUNDS( 17, 3 );
+		SHA1_SHANI_ROUNDS( 18, 3 );
+		SHA1_SHANI_ROUNDS( 19, 3 );
+
+		E0 = _mm_sha1nexte_epu32( ABCDPrev, E0Save );
+		ABCD = _mm_add_epi32( ABCD, ABCDSave );
+	}
+
+	_mm_storeu_si128( (__m128i *)state, _mm_shuffle_epi32( ABCD, 0x1B ) );
+	state[4] = (uint32)_mm_cvtsi128_si32( _mm_srli_si128( E0, 12 ) );
+}
+#endif // SHA1_SHANI
+
+#if !defined(_MINIMUM_BUILD_)
+bool SHA1_EnableHardware( bool bEnable )
+{
+#ifdef SHA1_SHANI
+	s_bSHA1UseSHANI = bEnable && CheckSHATechnology();
+	return s_bSHA1UseSHANI;
+#else
+	return false;
+#endif
+}
+#endif
+
 #ifdef	_MINIMUM_BUILD_
 Minimum_CSHA1::Minimum_CSHA1()
 #else
@@ -96,6 +196,14 @@ void Minimum_CSHA1::Transform(uint32 state[5], unsigned char buffer[64])
 void CSHA1::Transform(uint32 state[5], unsigned char buffer[64])
 #endif
 {
+#ifdef SHA1_SHANI
+	if ( s_bSHA1UseSHANI )
+	{
+		SHA1_TransformSHANI( state, buffer, 1 );
+		return;
+	}
+#endif
+
 	uint32 a = 0, b = 0, c = 0, d = 0, e = 0;
 
 	memcpy(m_block, buffer, 64);
@@ -160,6 +268,15 @@ void CSHA1::Update(unsigned char *data, unsigned int len)
 		memcpy(&m_buffer[j], data, (i = 64 - j));
 		Transform(m_state, m_buffer);
 
+#ifdef SHA1_SHANI
+		// Keep the state in registers across the whole run of blocks
+		if ( s_bSHA1UseSHANI && i + 63 < len )
+		{
+			unsigned int nBlocks = ( len - i ) / 64;
+			SHA1_TransformSHANI( m_state, &data[i], nBlocks );
+			i += nBlocks * 64;
+		}
+#endif
 		for (; i+63 < len; i += 64)
 			Transform(m_state, &data[i]);
 
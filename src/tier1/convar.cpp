@@ -16,6 +16,8 @@
 #include "tier1/utlbuffer.h"
 #include "tier1/tier1.h"
 #include "tier1/convar_serverbounded.h"
+#include "tier1/utlhashtable.h"
+#include "tier0/threadtools.h"
 #include "icvar.h"
 #include "tier0/dbg.h"
 #include "Color.h"
@@ -90,12 +92,100 @@ void ConVar_Unregister( )
 		return;
 
 	Assert( s_nDLLIdentifier >= 0 );
+	ConVar_FlushLookupCache();
 	g_pCVar->UnregisterConCommands( s_nDLLIdentifier );
 	s_nDLLIdentifier = -1;
 	s_bRegistered = false;
 }
 
 
+//-----------------------------------------------------------------------------
+// ConVar name lookups.
+//
+// ICvar::FindVar walks the engine's whole command list with a caseless compare,
+// which adds up when game code builds ConVarRefs on the stack in hot functions or
+// scripts read convars by name every frame. Each module keeps its own caseless hash
+// from name to ConVar, filled in as names are looked up.
+//
+// Only convars owned by a module that registered no later than this one are kept.
+// That covers the engine, its DLLs and the other game DLL, which are all loaded for as
+// long as this module is. Anything loaded afterwards, such as a server plugin, can be
+// unloaded under us, so its convars are looked up by name every time. So are missing
+// names, since the convar may be registered later. The cache is emptied when this
+// module unregisters, or unregisters any single command.
+//-----------------------------------------------------------------------------
+struct ConVarLookupCache_t
+{
+	CUtlHashtable< const char *, ConVar *, FastCaselessStringHashFunctor, CaselessStringEqualFunctor > m_Vars;
+	CThreadSpinRWLock m_Lock;
+};
+
+static ConVarLookupCache_t &ConVarLookupCache()
+{
+	// Function static so ConVarRefs constructed during static initialization can use it
+	static ConVarLookupCache_t s_Cache;
+	return s_Cache;
+}
+
+static CInterlockedInt s_nConVarLookups;
+static CInterlockedInt s_nConVarResolves;
+
+ConVar *ConVar_FindVar( const char *pName )
+{
+	if ( !g_pCVar || !pName )
+		return NULL;
+
+	++s_nConVarLookups;
+
+	ConVarLookupCache_t &cache = ConVarLookupCache();
+	cache.m_Lock.LockForRead();
+	UtlHashHandle_t h = cache.m_Vars.Find( pName );
+	ConVar *pVar = ( h != cache.m_Vars.InvalidHandle() ) ? cache.m_Vars.Element( h ) : NULL;
+	cache.m_Lock.UnlockRead();
+	if ( pVar )
+		return pVar;
+
+	++s_nConVarResolves;
+	pVar = g_pCVar->FindVar( pName );
+	if ( pVar && s_bRegistered && pVar->GetDLLIdentifier() <= s_nDLLIdentifier )
+	{
+		cache.m_Lock.LockForWrite();
+		cache.m_Vars.Insert( pVar->GetName(), pVar );
+		cache.m_Lock.UnlockWrite();
+	}
+	return pVar;
+}
+
+void ConVar_FlushLookupCache()
+{
+	ConVarLookupCache_t &cache = ConVarLookupCache();
+	cache.m_Lock.LockForWrite();
+	cache.m_Vars.RemoveAll();
+	cache.m_Lock.UnlockWrite();
+}
+
+void ConVar_GetLookupStats( int *pnLookups, int *pnResolves, bool bReset )
+{
+	int nLookups = s_nConVarLookups;
+	int nResolves = s_nConVarResolves;
+	if ( bReset )
+	{
+		// Subtract rather than zero so lookups made meanwhile on other threads still count next time
+		s_nConVarLookups += -nLookups;
+		s_nConVarResolves += -nResolves;
+	}
+
+	if ( pnLookups )
+	{
+		*pnLookups = nLookups;
+	}
+	if ( pnResolves )
+	{
+		*pnResolves = nResolves;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Default constructor
 //-----------------------------------------------------------------------------
@@ -204,6 +294,7 @@ void ConCommandBase::Shutdown()
 {
 	if ( g_pCVar )
 	{
+		ConVar_FlushLookupCache();
 		g_pCVar->UnregisterConCommand( this );
 	}
 }
@@ -1266,7 +1357,7 @@ ConVarRef::ConVarRef( const char *pName, bool bIgnoreMissing )
 
 void ConVarRef::Init( const char *pName, bool bIgnoreMissing )
 {
-	m_pConVar = g_pCVar ? g_pCVar->FindVar( pName ) : &s_EmptyConVar;
+	m_pConVar = g_pCVar ? ConVar_FindVar( pName ) : &s_EmptyConVar;
 	if ( !m_pConVar )
 	{
 		m_pConVar = &s_EmptyConVar;
@@ -11,7 +11,7 @@
 
 DECLARE_POINTER_HANDLE( memhandle_t );
 
-CDataManagerBase::CDataManagerBase( unsigned int maxSize )
+CDataManagerBase::CDataManagerBase( unsigned int maxSize, bool bApproximateLRU )
 {
 	m_targetMemorySize = maxSize;
 	m_memUsed = 0;
@@ -19,11 +19,38 @@ CDataManagerBase::CDataManagerBase( unsigned int maxSize )
 	m_lockList = m_memoryLists.CreateList();
 	m_freeList = m_memoryLists.CreateList();
 	m_listsAreFreed = 0;
+	m_ppAccessChunks = NULL;
+	if ( bApproximateLRU )
+	{
+		m_ppAccessChunks = new int32 volatile *[NUM_ACCESS_CHUNKS];
+		memset( (void *)m_ppAccessChunks, 0, NUM_ACCESS_CHUNKS * sizeof( int32 volatile * ) );
+	}
 }
 
 CDataManagerBase::~CDataManagerBase() 
 {
 	Assert( m_listsAreFreed );
+	if ( m_ppAccessChunks )
+	{
+		for ( int i = 0; i < NUM_ACCESS_CHUNKS; i++ )
+		{
+			delete [] m_ppAccessChunks[i];
+		}
+		delete [] m_ppAccessChunks;
+	}
+}
+
+// The access word for a handle's slot, NULL if the slot has never been used
+inline int32 volatile *CDataManagerBase::AccessWord( unsigned short memoryIndex )
+{
+	int32 volatile *pChunk = m_ppAccessChunks[memoryIndex / ACCESS_CHUNK_SIZE];
+	return pChunk ? &pChunk[memoryIndex % ACCESS_CHUNK_SIZE] : NULL;
+}
+
+// Must lock first. Also refreshes the serial, so call this whenever it changes
+inline void CDataManagerBase::SetAccessed( unsigned short memoryIndex, bool bAccessed )
+{
+	*AccessWord( memoryIndex ) = ( (int32)m_memoryLists[memoryIndex].serial << 16 ) | ( bAccessed ? 1 : 0 );
 }
 
 void CDataManagerBase::NotifySizeChanged( memhandle_t handle, unsigned int oldSize, unsigned int newSize )
@@ -217,6 +244,22 @@ void *CDataManagerBase::GetResource_NoLock( memhandle_t handle )
 
 void CDataManagerBase::TouchResource( memhandle_t handle )
 {
+	if ( m_ppAccessChunks )
+	{
+		// No lock: only sets the bit if the slot still has the handle's serial, so a stale
+		// handle can't give whatever reused its slot a second chance
+		unsigned int fullWord = (unsigned int)reinterpret_cast<uintp>( handle );
+		if ( !( fullWord & 0xFFFF ) )
+			return;
+		int32 volatile *pAccess = AccessWord( (unsigned short)( ( fullWord & 0xFFFF ) - 1 ) );
+		if ( pAccess )
+		{
+			int32 nUntouched = (int32)( fullWord & 0xFFFF0000 );
+			ThreadInterlockedCompareExchange( pAccess, nUntouched | 1, nUntouched );
+		}
+		return;
+	}
+
 	AUTO_LOCK( *this );
 	TouchByIndex( FromHandle(handle) );
 }
@@ -231,6 +274,10 @@ void CDataManagerBase::MarkAsStale( memhandle_t handle )
 		{
 			m_memoryLists.Unlink( m_lruList, memoryIndex );
 			m_memoryLists.LinkToHead( m_lruList, memoryIndex );
+			if ( m_ppAccessChunks )
+			{
+				SetAccessed( memoryIndex, false );
+			}
 		}
 	}
 }
@@ -286,6 +333,17 @@ unsigned short CDataManagerBase::CreateHandle( bool bCreateLocked )
 	else
 	{
 		memoryIndex = m_memoryLists.AddToTail( list );
+		if ( m_ppAccessChunks && !m_ppAccessChunks[memoryIndex / ACCESS_CHUNK_SIZE] )
+		{
+			int32 *pChunk = new int32[ACCESS_CHUNK_SIZE];
+			memset( pChunk, 0, ACCESS_CHUNK_SIZE * sizeof( int32 ) );
+			m_ppAccessChunks[memoryIndex / ACCESS_CHUNK_SIZE] = pChunk;
+		}
+	}
+
+	if ( m_ppAccessChunks )
+	{
+		SetAccessed( memoryIndex, false );
 	}
 
 	if ( bCreateLocked )
@@ -309,7 +367,11 @@ void CDataManagerBase::TouchByIndex( unsigned short memoryIndex )
 {
 	if ( memoryIndex != m_memoryLists.InvalidIndex() )
 	{
-		if ( m_memoryLists[memoryIndex].lockCount == 0 )
+		if ( m_ppAccessChunks )
+		{
+			SetAccessed( memoryIndex, true );
+		}
+		else if ( m_memoryLists[memoryIndex].lockCount == 0 )
 		{
 			m_memoryLists.Unlink( m_lruList, memoryIndex );
 			m_memoryLists.LinkToTail( m_lruList, memoryIndex );
@@ -349,6 +411,20 @@ unsigned int CDataManagerBase::EnsureCapacity( unsigned int size )
 	{
 		Lock();
 		int lruIndex = m_memoryLists.Head( m_lruList );
+		if ( m_ppAccessChunks )
+		{
+			// Anything touched since it was last passed over goes to the tail instead.
+			// Each one clears its byte, so this stops within one trip around the list
+			for ( int nPassed = m_memoryLists.Count( m_lruList ); nPassed > 0; nPassed-- )
+			{
+				if ( !( *AccessWord( lruIndex ) & 1 ) )
+					break;
+				SetAccessed( lruIndex, false );
+				m_memoryLists.Unlink( m_lruList, lruIndex );
+				m_memoryLists.LinkToTail( m_lruList, lruIndex );
+				lruIndex = m_memoryLists.Head( m_lruList );
+			}
+		}
 		if ( lruIndex == m_memoryLists.InvalidIndex() )
 		{
 			Unlock();
@@ -381,6 +457,10 @@ void *CDataManagerBase::GetForFreeByIndex( unsigned short memoryIndex )
 		p = mem.pStore;
 		mem.pStore = NULL;
 		mem.serial++;
+		if ( m_ppAccessChunks )
+		{
+			SetAccessed( memoryIndex, false );
+		}
 		m_memoryLists.LinkToTail( m_freeList, memoryIndex );
 	}
 	return p;
@@ -10,6 +10,10 @@
 #include "tier0/platform.h"
 #include "generichash.h"
 #include <ctype.h>
+#include <string.h>
+#if defined( _MSC_VER ) && defined( _M_X64 )
+#include <intrin.h>
+#endif
 #include "tier0/dbg.h"
 
 // NOTE: This has to be the last file included!
@@ -307,6 +311,153 @@ unsigned FASTCALL HashBlock( const void *pKey, unsigned size )
 }
 
 
+//-----------------------------------------------------------------------------
+// Fast hash. This is wyhash (final version 4) by Wang Yi, which is public domain.
+// The caseless variant lowers 'A'-'Z' a whole word at a time as it reads.
+//-----------------------------------------------------------------------------
+static const uint64 g_nFastHashSecret[4] = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6dbull, 0x589965cc75374cc3ull };
+
+// 64x64 -> 128 bit multiply, low half into a and high half into b
+static FORCEINLINE void FastHashMum( uint64 &a, uint64 &b )
+{
+#if defined( __SIZEOF_INT128__ )
+	unsigned __int128 r = (unsigned __int128)a * b;
+	a = (uint64)r;
+	b = (uint64)( r >> 64 );
+#elif defined( _MSC_VER ) && defined( _M_X64 )
+	a = _umul128( a, b, &b );
+#else
+	uint64 ha = a >> 32, hb = b >> 32, la = (uint32)a, lb = (uint32)b;
+	uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64 t = rl + ( rm0 << 32 );
+	uint64 c = t < rl;
+	uint64 lo = t + ( rm1 << 32 );
+	c += lo < t;
+	a = lo;
+	b = rh + ( rm0 >> 32 ) + ( rm1 >> 32 ) + c;
+#endif
+}
+
+static FORCEINLINE uint64 FastHashMix( uint64 a, uint64 b )
+{
+	FastHashMum( a, b );
+	return a ^ b;
+}
+
+// Adds 32 to every byte in 'A'-'Z'. No byte can carry into the next one.
+static FORCEINLINE uint64 FastHashLower( uint64 v )
+{
+	uint64 nHeptets = v & 0x7f7f7f7f7f7f7f7full;
+	uint64 nAtLeastA = nHeptets + 0x3f3f3f3f3f3f3f3full;	// top bit set if >= 'A'
+	uint64 nPastZ = nHeptets + 0x2525252525252525ull;		// top bit set if > 'Z'
+	uint64 nUpper = nAtLeastA & ~nPastZ & ~v & 0x8080808080808080ull;
+	return v | ( nUpper >> 2 );
+}
+
+template < bool CASELESS >
+static FORCEINLINE uint64 FastHashRead8( const uint8 *p )
+{
+	uint64 v;
+	memcpy( &v, p, sizeof( v ) );
+	return CASELESS ? FastHashLower( v ) : v;
+}
+
+template < bool CASELESS >
+static FORCEINLINE uint64 FastHashRead4( const uint8 *p )
+{
+	uint32 v;
+	memcpy( &v, p, sizeof( v ) );
+	return CASELESS ? FastHashLower( v ) : v;
+}
+
+// 1 to 3 bytes
+template < bool CASELESS >
+static FORCEINLINE uint64 FastHashRead3( const uint8 *p, size_t nLength )
+{
+	uint64 v = ( ( (uint64)p[0] ) << 16 ) | ( ( (uint64)p[nLength >> 1] ) << 8 ) | p[nLength - 1];
+	return CASELESS ? FastHashLower( v ) : v;
+}
+
+template < bool CASELESS >
+static uint64 FastHash( const uint8 *p, size_t nLength, uint64 nSeed )
+{
+	const uint64 *s = g_nFastHashSecret;
+	nSeed ^= FastHashMix( nSeed ^ s[0], s[1] );
+
+	uint64 a, b;
+	if ( nLength <= 16 )
+	{
+		if ( nLength >= 4 )
+		{
+			// Two overlapping pairs of words cover everything from 4 to 16 bytes
+			size_t nMid = ( nLength >> 3 ) << 2;
+			a = ( FastHashRead4<CASELESS>( p ) << 32 ) | FastHashRead4<CASELESS>( p + nMid );
+			b = ( FastHashRead4<CASELESS>( p + nLength - 4 ) << 32 ) | FastHashRead4<CASELESS>( p + nLength - 4 - nMid );
+		}
+		else if ( nLength > 0 )
+		{
+			a = FastHashRead3<CASELESS>( p, nLength );
+			b = 0;
+		}
+		else
+		{
+			a = b = 0;
+		}
+	}
+	else
+	{
+		size_t i = nLength;
+		if ( i > 48 )
+		{
+			uint64 nSeed1 = nSeed, nSeed2 = nSeed;
+			do
+			{
+				nSeed = FastHashMix( FastHashRead8<CASELESS>( p ) ^ s[1], FastHashRead8<CASELESS>( p + 8 ) ^ nSeed );
+				nSeed1 = FastHashMix( FastHashRead8<CASELESS>( p + 16 ) ^ s[2], FastHashRead8<CASELESS>( p + 24 ) ^ nSeed1 );
+				nSeed2 = FastHashMix( FastHashRead8<CASELESS>( p + 32 ) ^ s[3], FastHashRead8<CASELESS>( p + 40 ) ^ nSeed2 );
+				p += 48;
+				i -= 48;
+			} while ( i > 48 );
+			nSeed ^= nSeed1 ^ nSeed2;
+		}
+		while ( i > 16 )
+		{
+			nSeed = FastHashMix( FastHashRead8<CASELESS>( p ) ^ s[1], FastHashRead8<CASELESS>( p + 8 ) ^ nSeed );
+			p += 16;
+			i -= 16;
+		}
+		// The last 16 bytes, which may overlap ones already hashed
+		a = FastHashRead8<CASELESS>( p + i - 16 );
+		b = FastHashRead8<CASELESS>( p + i - 8 );
+	}
+
+	a ^= s[1];
+	b ^= nSeed;
+	FastHashMum( a, b );
+	return FastHashMix( a ^ s[0] ^ nLength, b ^ s[1] );
+}
+
+uint64 FastHash64( const void *pKey, int nLength, uint64 nSeed )
+{
+	return FastHash<false>( (const uint8 *)pKey, nLength, nSeed );
+}
+
+uint64 FastHash64Caseless( const void *pKey, int nLength, uint64 nSeed )
+{
+	return FastHash<true>( (const uint8 *)pKey, nLength, nSeed );
+}
+
+uint32 FastHashString( const char *pszKey )
+{
+	return (uint32)FastHash<false>( (const uint8 *)pszKey, strlen( pszKey ), 0 );
+}
+
+uint32 FastHashStringCaseless( const char *pszKey )
+{
+	return (uint32)FastHash<true>( (const uint8 *)pszKey, strlen( pszKey ), 0 );
+}
+
+
 //-----------------------------------------------------------------------------
 // Murmur hash
 //-----------------------------------------------------------------------------
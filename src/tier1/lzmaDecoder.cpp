@@ -134,27 +134,17 @@ unsigned int CLZMA::Uncompress( unsigned char *pInput, unsigned char *pOutput )
 		return false;
 	}
 
-	CLzmaDec state;
-
-	LzmaDec_Construct(&state);
-
-	if ( LzmaDec_Allocate(&state, pHeader->properties, LZMA_PROPS_SIZE, &g_Alloc) != SZ_OK )
-	{
-		Assert( false );
-		return 0;
-	}
+	// LzmaDecode uses the output buffer as its dictionary, so the only thing it allocates is
+	// the (small) probability model; no need for a dictionary sized LzmaDec_Allocate here.
 
 	// These are in/out variables
-	SizeT outProcessed = pHeader->actualSize;
-	SizeT inProcessed = pHeader->lzmaSize;
+	SizeT outProcessed = LittleLong( pHeader->actualSize );
+	SizeT inProcessed = LittleLong( pHeader->lzmaSize );
 	ELzmaStatus status;
 	SRes result = LzmaDecode( (Byte *)pOutput, &outProcessed, (Byte *)(pInput + sizeof( lzma_header_t ) ),
 	                          &inProcessed, (Byte *)pHeader->properties, LZMA_PROPS_SIZE, LZMA_FINISH_END, &status, &g_Alloc );
 
-
-	LzmaDec_Free(&state, &g_Alloc);
-
-	if ( result != SZ_OK || pHeader->actualSize != outProcessed )
+	if ( result != SZ_OK || LittleLong( pHeader->actualSize ) != outProcessed )
 	{
 		Warning( "LZMA Decompression failed (%i)\n", result );
 		return 0;
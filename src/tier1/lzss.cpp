@@ -5,6 +5,7 @@
 //
 //=====================================================================================//
 
+#include <limits.h>
 #include "tier0/platform.h"
 #include "tier0/dbg.h"
 #include "tier0/vprof.h"
@@ -49,41 +50,13 @@ unsigned int CLZSS::GetActualSize( const unsigned char *pInput )
 	return 0;
 }
 
-void CLZSS::BuildHash( const unsigned char *pData )
-{
-	lzss_list_t *pList;
-	lzss_node_t *pTarget;
-
-	int targetindex = (unsigned int)( uintp( pData ) & 0xFFFFFFFF ) & ( m_nWindowSize - 1 );
-	pTarget = &m_pHashTarget[targetindex];
-	if ( pTarget->pData )
-	{
-		pList = &m_pHashTable[*pTarget->pData];
-		if ( pTarget->pPrev )
-		{
-			pList->pEnd = pTarget->pPrev;
-			pTarget->pPrev->pNext = 0;
-		}
-		else
-		{
-			pList->pEnd = 0;
-			pList->pStart = 0;
-		}
-	}
+// Chain entry that is too far back to ever be in the window
+#define LZSS_NO_POSITION	( INT_MIN / 2 )
 
-	pList = &m_pHashTable[*pData];
-	pTarget->pData = pData;
-	pTarget->pPrev = 0;
-	pTarget->pNext = pList->pStart;
-	if ( pList->pStart )
-	{
-		pList->pStart->pPrev = pTarget;
-	}
-	else
-	{
-		pList->pEnd = pTarget;
-	}
-	pList->pStart = pTarget;
+static FORCEINLINE unsigned int LZSSHash( const unsigned char *pData, int nHashBits )
+{
+	unsigned int nBytes = ( pData[0] << 16 ) | ( pData[1] << 8 ) | pData[2];
+	return ( nBytes * 2654435761u ) >> ( 32 - nHashBits );
 }
 
 unsigned char *CLZSS::CompressNoAlloc( const unsigned char *pInput, int inputLength, unsigned char *pOutputBuf, unsigned int *pOutputSize )
@@ -95,11 +68,16 @@ unsigned char *CLZSS::CompressNoAlloc( const unsigned char *pInput, int inputLen
 	VPROF( "CLZSS::CompressNoAlloc" );
 	ETWMark1I("CompressNoAlloc", inputLength );
 
-	// create the compression work buffers, small enough (~64K) for stack
-	m_pHashTable = (lzss_list_t *)stackalloc( 256 * sizeof( lzss_list_t ) );
-	memset( m_pHashTable, 0, 256 * sizeof( lzss_list_t ) );
-	m_pHashTarget = (lzss_node_t *)stackalloc( m_nWindowSize * sizeof( lzss_node_t ) );
-	memset( m_pHashTarget, 0, m_nWindowSize * sizeof( lzss_node_t ) );
+	// offsets are stored in 12 bits
+	Assert( m_nWindowSize <= ( 1 << ( 16 - LZSS_LOOKSHIFT ) ) && !( m_nWindowSize & ( m_nWindowSize - 1 ) ) );
+
+	// create the compression work buffers, small enough (~32K) for stack
+	m_pHashHead = (int *)stackalloc( HASH_SIZE * sizeof( int ) );
+	for ( int i = 0; i < HASH_SIZE; i++ )
+	{
+		m_pHashHead[i] = LZSS_NO_POSITION;
+	}
+	m_pHashPrev = (int *)stackalloc( m_nWindowSize * sizeof( int ) );
 
 	// allocate the output buffer, compressed buffer is expected to be less, caller will free
 	unsigned char *pStart = pOutputBuf;
@@ -112,19 +90,16 @@ unsigned char *CLZSS::CompressNoAlloc( const unsigned char *pInput, int inputLen
 	pHeader->actualSize = LittleLong( inputLength );
 
 	unsigned char *pOutput = pStart + sizeof (lzss_header_t);
-	const unsigned char *pLookAhead = pInput; 
-	const unsigned char *pWindow = pInput;
-	const unsigned char *pEncodedPosition = NULL;
+	const int nTotalLength = inputLength;
+	const int nWindowMask = m_nWindowSize - 1;
+	int nPosition = 0;
+	int nEncodedPosition = 0;
 	unsigned char *pCmdByte = NULL;
 	int putCmdByte = 0;
 
 	while ( inputLength > 0 )
 	{
-		pWindow = pLookAhead - m_nWindowSize;
-		if ( pWindow < pInput )
-		{
-			pWindow = pInput;
-		}
+		const unsigned char *pLookAhead = pInput + nPosition;
 
 		if ( !putCmdByte )
 		{
@@ -136,32 +111,43 @@ unsigned char *CLZSS::CompressNoAlloc( const unsigned char *pInput, int inputLen
 		int encodedLength = 0;
 		int lookAheadLength = inputLength < LZSS_LOOKAHEAD ? inputLength : LZSS_LOOKAHEAD;
 
-		lzss_node_t *pHash = m_pHashTable[pLookAhead[0]].pStart;
-		while ( pHash )
+		// Walk back through the earlier positions that share our first three bytes,
+		// newest first, until we run out of window or effort
+		if ( lookAheadLength >= 3 )
 		{
-			int matchLength = 0;
-			int length = lookAheadLength;
-			while ( length-- && pHash->pData[matchLength] == pLookAhead[matchLength] )
-			{
-				matchLength++;
-			}
-			if ( matchLength > encodedLength )
+			int nCandidate = m_pHashHead[LZSSHash( pLookAhead, HASH_BITS )];
+			for ( int nTries = m_nEffort; nTries > 0 && nPosition - nCandidate <= m_nWindowSize; nTries-- )
 			{
-				encodedLength = matchLength;
-				pEncodedPosition = pHash->pData;
-			}
-			if ( matchLength == lookAheadLength )
-			{
-				break;
+				const unsigned char *pCandidate = pInput + nCandidate;
+
+				// Can only beat the best so far if the byte just past it matches too
+				if ( pCandidate[encodedLength] == pLookAhead[encodedLength] )
+				{
+					int matchLength = 0;
+					while ( matchLength < lookAheadLength && pCandidate[matchLength] == pLookAhead[matchLength] )
+					{
+						matchLength++;
+					}
+					if ( matchLength > encodedLength )
+					{
+						encodedLength = matchLength;
+						nEncodedPosition = nCandidate;
+						if ( matchLength == lookAheadLength )
+						{
+							break;
+						}
+					}
+				}
+
+				nCandidate = m_pHashPrev[nCandidate & nWindowMask];
 			}
-			pHash = pHash->pNext;
 		}
 
 		if ( encodedLength >= 3 )
 		{
 			*pCmdByte = ( *pCmdByte >> 1 ) | 0x80;
-			*pOutput++ = ( ( pLookAhead-pEncodedPosition-1 ) >> LZSS_LOOKSHIFT );
-			*pOutput++ = ( ( pLookAhead-pEncodedPosition-1 ) << LZSS_LOOKSHIFT ) | ( encodedLength-1 );
+			*pOutput++ = ( ( nPosition-nEncodedPosition-1 ) >> LZSS_LOOKSHIFT );
+			*pOutput++ = ( ( nPosition-nEncodedPosition-1 ) << LZSS_LOOKSHIFT ) | ( encodedLength-1 );
 		} 
 		else 
 		{ 
@@ -170,9 +156,16 @@ unsigned char *CLZSS::CompressNoAlloc( const unsigned char *pInput, int inputLen
 			*pOutput++ = *pLookAhead;
 		}
 
-		for ( int i=0; i<encodedLength; i++ )
+		// Link every position we just covered into its chain. The last two bytes of
+		// the input can't start a match, so they never need to be found.
+		for ( int i=0; i<encodedLength; i++, nPosition++ )
 		{
-			BuildHash( pLookAhead++ );
+			if ( nPosition + 3 <= nTotalLength )
+			{
+				unsigned int nHash = LZSSHash( pInput + nPosition, HASH_BITS );
+				m_pHashPrev[nPosition & nWindowMask] = m_pHashHead[nHash];
+				m_pHashHead[nHash] = nPosition;
+			}
 		}
 
 		inputLength -= encodedLength;
@@ -294,6 +287,43 @@ unsigned int CLZSS::Uncompress( unsigned char *pInput, CUtlBuffer &buf )
 }
 */
 
+//-----------------------------------------------------------------------------
+// Copies a match of up to LZSS_LOOKAHEAD bytes from earlier in the output. Given
+// room past the end, whole 16 or 8 byte blocks are copied when the source is far
+// enough back not to overlap them; the extra bytes are overwritten by what follows.
+// pOutputEnd must be the end of the decoded data, not of the caller's buffer, so
+// nothing is ever written past the decoded end and callers need no slack. Matches
+// within 16 bytes of the end are copied a byte at a time.
+//-----------------------------------------------------------------------------
+static FORCEINLINE void LZSSCopyMatch( unsigned char *pOutput, const unsigned char *pSource, int count, const unsigned char *pOutputEnd )
+{
+	if ( pOutputEnd - pOutput >= LZSS_LOOKAHEAD )
+	{
+		intp nDistance = pOutput - pSource;
+		if ( nDistance >= LZSS_LOOKAHEAD )
+		{
+			memcpy( pOutput, pSource, LZSS_LOOKAHEAD );
+			return;
+		}
+		if ( nDistance >= 8 )
+		{
+			memcpy( pOutput, pSource, 8 );
+			memcpy( pOutput + 8, pSource + 8, 8 );
+			return;
+		}
+		if ( nDistance == 1 )
+		{
+			memset( pOutput, *pSource, LZSS_LOOKAHEAD );
+			return;
+		}
+	}
+
+	for ( int i=0; i<count; i++ )
+	{
+		*pOutput++ = *pSource++;
+	}
+}
+
 unsigned int CLZSS::SafeUncompress( const unsigned char *pInput, unsigned int inputlen, unsigned char *pOutput, unsigned int unBufSize )
 {
 	if ( inputlen <= sizeof( lzss_header_t ) )
@@ -317,6 +347,8 @@ unsigned int CLZSS::SafeUncompress( const unsigned char *pInput, unsigned int in
 		return 0;
 	}
 
+	const unsigned char *pOutputEnd = pOutput + actualSize;
+
 	// safe to advance: upon entering the function we checked inputlen > sizeof( lzss_header_t )
 	pInput += sizeof( lzss_header_t );
 	inputlen -= sizeof( lzss_header_t );
@@ -379,10 +411,8 @@ unsigned int CLZSS::SafeUncompress( const unsigned char *pInput, unsigned int in
 				return 0;
 			}
 
-			for ( int i=0; i<count; i++ )
-			{
-				*pOutput++ = *pSource++;
-			}
+			LZSSCopyMatch( pOutput, pSource, count, pOutputEnd );
+			pOutput += count;
 			totalBytes += count;
 		} 
 		else 
@@ -426,6 +456,7 @@ unsigned int CLZSS::Uncompress( const unsigned char *pInput, unsigned char *pOut
 		return 0;
 	}
 
+	const unsigned char *pOutputEnd = pOutput + actualSize;
 	pInput += sizeof( lzss_header_t );
 
 	for ( ;; )
@@ -446,10 +477,8 @@ unsigned int CLZSS::Uncompress( const unsigned char *pInput, unsigned char *pOut
 				break;
 			}
 			unsigned char *pSource = pOutput - position - 1;
-			for ( int i=0; i<count; i++ )
-			{
-				*pOutput++ = *pSource++;
-			}
+			LZSSCopyMatch( pOutput, pSource, count, pOutputEnd );
+			pOutput += count;
 			totalBytes += count;
 		} 
 		else 
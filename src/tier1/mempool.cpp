@@ -11,6 +11,7 @@
 #include "tier0/dbg.h"
 #include <ctype.h>
 #include "tier1/strtools.h"
+#include "tier1/generichash.h"
 
 // Should be last include
 #include "tier0/memdbgon.h"
@@ -273,6 +274,21 @@ void *CUtlMemoryPool::AllocZero( size_t amount )
 	return mem;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Checks that memory is inside one of the blobs
+//-----------------------------------------------------------------------------
+bool CUtlMemoryPool::IsAllocationWithinPool( void *pMem ) const
+{
+	for( const CBlob *pCur=m_BlobHead.m_pNext; pCur != &m_BlobHead; pCur=pCur->m_pNext )
+	{
+		if (pMem >= pCur->m_Data && (char*)pMem < (pCur->m_Data + pCur->m_NumBytes))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Frees a block of memory
 // Input  : *memBlock - the memory to free
@@ -282,18 +298,8 @@ void CUtlMemoryPool::Free( void *memBlock )
 	if ( !memBlock )
 		return;  // trying to delete NULL pointer, ignore
 
-#ifdef _DEBUG
 	// check to see if the memory is from the allocated range
-	bool bOK = false;
-	for( CBlob *pCur=m_BlobHead.m_pNext; pCur != &m_BlobHead; pCur=pCur->m_pNext )
-	{
-		if (memBlock >= pCur->m_Data && (char*)memBlock < (pCur->m_Data + pCur->m_NumBytes))
-		{
-			bOK = true;
-		}
-	}
-	Assert (bOK);
-#endif // _DEBUG
+	Assert( IsAllocationWithinPool( memBlock ) );
 
 #ifdef _DEBUG	
 	// invalidate the memory
@@ -310,3 +316,289 @@ void CUtlMemoryPool::Free( void *memBlock )
 }
 
 
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor
+//-----------------------------------------------------------------------------
+CMemoryPoolMT::CMemoryPoolMT( int blockSize, int numElements, int growMode, const char *pszAllocOwner, int nAlignment )
+	: CUtlMemoryPool( blockSize, numElements, growMode, pszAllocOwner, nAlignment )
+{
+	COMPILE_TIME_ASSERT( sizeof( Magazine_t ) == 64 );
+
+	m_nMagazineBatch = Clamp<int>( MAGAZINE_BATCH_BYTES / m_BlockSize, MIN_MAGAZINE_BATCH, MAX_MAGAZINE_BATCH );
+	m_nPeakInUse = 0;
+	m_nRefills = 0;
+	m_nDrains = 0;
+	m_nLockContention = 0;
+	m_nLockedAllocs = 0;
+	m_nLockedFrees = 0;
+	m_nMagazineContention = 0;
+	memset( m_Magazines, 0, sizeof( m_Magazines ) );
+}
+
+CMemoryPoolMT::~CMemoryPoolMT()
+{
+	// Give the magazines' blocks back so the base class only reports real leaks
+	for ( int i = 0; i < NUM_MAGAZINES; i++ )
+	{
+		DrainMagazine( &m_Magazines[i], 0 );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Returns this thread's magazine locked, or NULL if it's in use by another
+// thread that hashed to the same one.
+//-----------------------------------------------------------------------------
+CMemoryPoolMT::Magazine_t *CMemoryPoolMT::LockMagazine()
+{
+	uint64 nThreadId = (uint64)ThreadGetCurrentId();
+	Magazine_t *pMagazine = &m_Magazines[ HashIntAlternate( (uint32)( nThreadId ^ ( nThreadId >> 32 ) ) ) % NUM_MAGAZINES ];
+
+	if ( !ThreadInterlockedAssignIf( &pMagazine->m_nLock, 1, 0 ) )
+	{
+		++m_nMagazineContention;
+		return NULL;
+	}
+
+	return pMagazine;
+}
+
+void CMemoryPoolMT::UnlockMagazine( Magazine_t *pMagazine )
+{
+	ThreadMemoryBarrier();
+	pMagazine->m_nLock = 0;
+}
+
+void CMemoryPoolMT::LockPool()
+{
+	if ( !m_mutex.TryLock() )
+	{
+		m_mutex.Lock();
+		m_nLockContention++;
+	}
+}
+
+int CMemoryPoolMT::CachedCount() const
+{
+	// Unlocked reads, the result is only as current as the caller needs
+	int nCached = 0;
+	for ( int i = 0; i < NUM_MAGAZINES; i++ )
+	{
+		nCached += m_Magazines[i].m_nCount;
+	}
+	return nCached;
+}
+
+int CMemoryPoolMT::InUseCount() const
+{
+	return m_BlocksAllocated - CachedCount();
+}
+
+bool CMemoryPoolMT::IsAllocationWithinPool( void *pMem ) const
+{
+	AUTO_LOCK( m_mutex );
+	return CUtlMemoryPool::IsAllocationWithinPool( pMem );
+}
+
+
+//-----------------------------------------------------------------------------
+// Straight to the pool, for when the magazine is busy or the pool can't grow
+// (a fixed number of blocks shouldn't be tied up in other threads' magazines).
+//-----------------------------------------------------------------------------
+void *CMemoryPoolMT::LockedAlloc( size_t amount )
+{
+	LockPool();
+	void *pMem = CUtlMemoryPool::Alloc( amount );
+	if ( pMem )
+	{
+		m_nLockedAllocs++;
+		m_nPeakInUse = Max( m_nPeakInUse, m_BlocksAllocated - CachedCount() );
+	}
+	m_mutex.Unlock();
+	return pMem;
+}
+
+void CMemoryPoolMT::LockedFree( void *pMem )
+{
+	LockPool();
+	CUtlMemoryPool::Free( pMem );
+	m_nLockedFrees++;
+	m_mutex.Unlock();
+}
+
+
+//-----------------------------------------------------------------------------
+// Moves a batch of blocks from the pool into an empty magazine
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::RefillMagazine( Magazine_t *pMagazine )
+{
+	LockPool();
+	for ( int i = 0; i < m_nMagazineBatch; i++ )
+	{
+		void *pMem = CUtlMemoryPool::Alloc( m_BlockSize );
+		if ( !pMem )
+			break;
+
+		*( (void**)pMem ) = pMagazine->m_pHead;
+		pMagazine->m_pHead = pMem;
+		pMagazine->m_nCount++;
+	}
+	m_nRefills++;
+
+	// Counting the block the caller is about to take
+	m_nPeakInUse = Max( m_nPeakInUse, m_BlocksAllocated - CachedCount() + 1 );
+	m_mutex.Unlock();
+}
+
+//-----------------------------------------------------------------------------
+// Gives a magazine's blocks back to the pool until nKeep are left
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::DrainMagazine( Magazine_t *pMagazine, int nKeep )
+{
+	if ( pMagazine->m_nCount <= nKeep )
+		return;
+
+	LockPool();
+	while ( pMagazine->m_nCount > nKeep )
+	{
+		void *pMem = pMagazine->m_pHead;
+		pMagazine->m_pHead = *( (void**)pMem );
+		pMagazine->m_nCount--;
+		CUtlMemoryPool::Free( pMem );
+	}
+	m_nDrains++;
+	m_mutex.Unlock();
+}
+
+
+void *CMemoryPoolMT::Alloc( size_t amount )
+{
+	if ( amount > (unsigned int)m_BlockSize )
+		return NULL;
+
+	Magazine_t *pMagazine = ( m_GrowMode != UTLMEMORYPOOL_GROW_NONE ) ? LockMagazine() : NULL;
+	if ( !pMagazine )
+		return LockedAlloc( amount );
+
+	if ( !pMagazine->m_pHead )
+	{
+		RefillMagazine( pMagazine );
+	}
+
+	void *pMem = pMagazine->m_pHead;
+	if ( pMem )
+	{
+		pMagazine->m_pHead = *( (void**)pMem );
+		pMagazine->m_nCount--;
+		pMagazine->m_nAllocs++;
+	}
+	UnlockMagazine( pMagazine );
+
+	return pMem;
+}
+
+void *CMemoryPoolMT::AllocZero( size_t amount )
+{
+	void *mem = Alloc( amount );
+	if ( mem )
+	{
+		memset( mem, 0x00, amount );
+	}
+	return mem;
+}
+
+void CMemoryPoolMT::Free( void *pMem )
+{
+	if ( !pMem )
+		return;
+
+	Magazine_t *pMagazine = ( m_GrowMode != UTLMEMORYPOOL_GROW_NONE ) ? LockMagazine() : NULL;
+	if ( !pMagazine )
+	{
+		LockedFree( pMem );
+		return;
+	}
+
+#ifdef _DEBUG
+	// invalidate the memory; it's checked against the blobs when it's drained
+	memset( pMem, 0xDD, m_BlockSize );
+#endif
+
+	*( (void**)pMem ) = pMagazine->m_pHead;
+	pMagazine->m_pHead = pMem;
+	pMagazine->m_nCount++;
+	pMagazine->m_nFrees++;
+
+	// Keep a batch around so alternating frees and allocs don't go back and forth to the pool
+	if ( pMagazine->m_nCount >= 2 * m_nMagazineBatch )
+	{
+		DrainMagazine( pMagazine, m_nMagazineBatch );
+	}
+
+	UnlockMagazine( pMagazine );
+}
+
+
+//-----------------------------------------------------------------------------
+// Frees everything
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::Clear()
+{
+	for ( int i = 0; i < NUM_MAGAZINES; i++ )
+	{
+		Magazine_t &magazine = m_Magazines[i];
+		while ( !ThreadInterlockedAssignIf( &magazine.m_nLock, 1, 0 ) )
+		{
+			ThreadPause();
+		}
+		magazine.m_pHead = NULL;
+		magazine.m_nCount = 0;
+	}
+
+	LockPool();
+	CUtlMemoryPool::Clear();
+	m_mutex.Unlock();
+
+	for ( int i = 0; i < NUM_MAGAZINES; i++ )
+	{
+		UnlockMagazine( &m_Magazines[i] );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Statistics
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::GetStats( Stats_t &stats ) const
+{
+	stats.m_nAllocs = m_nLockedAllocs;
+	stats.m_nFrees = m_nLockedFrees;
+	stats.m_nCached = 0;
+	for ( int i = 0; i < NUM_MAGAZINES; i++ )
+	{
+		stats.m_nAllocs += m_Magazines[i].m_nAllocs;
+		stats.m_nFrees += m_Magazines[i].m_nFrees;
+		stats.m_nCached += m_Magazines[i].m_nCount;
+	}
+
+	stats.m_nInUse = m_BlocksAllocated - stats.m_nCached;
+	stats.m_nPeakInUse = m_nPeakInUse;
+	stats.m_nRefills = m_nRefills;
+	stats.m_nDrains = m_nDrains;
+	stats.m_nLockContention = m_nLockContention;
+	stats.m_nMagazineContention = m_nMagazineContention;
+}
+
+void CMemoryPoolMT::ReportStats( MemoryPoolReportFunc_t func ) const
+{
+	if ( !func )
+		return;
+
+	Stats_t stats;
+	GetStats( stats );
+	func( "%s: %d in use (peak %d), %d cached, %lld allocs, %lld frees, %d refills, %d drains, contention %d pool / %d magazine\n",
+		m_pszAllocOwner, stats.m_nInUse, stats.m_nPeakInUse, stats.m_nCached, stats.m_nAllocs, stats.m_nFrees,
+		stats.m_nRefills, stats.m_nDrains, stats.m_nLockContention, stats.m_nMagazineContention );
+}
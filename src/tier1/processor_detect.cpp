@@ -272,3 +272,57 @@ bool Check3DNowTechnology(void)
 #pragma optimize( "", on )
 
 #endif // _WIN32
+
+#if defined( _X360 )
+
+bool CheckAVX2Technology(void) { return false; }
+bool CheckPCLMULTechnology(void) { return false; }
+bool CheckSHATechnology(void) { return false; }
+
+#elif defined( _WIN32 )
+
+#include <intrin.h>
+
+bool CheckAVX2Technology(void)
+{
+	int cpuInfo[4];
+	__cpuid( cpuInfo, 0 );
+	int nMaxLeaf = cpuInfo[0];
+
+	// AVX and OSXSAVE, then make sure the OS saves the ymm registers (XCR0 bits 1 and 2)
+	__cpuid( cpuInfo, 1 );
+	if ( ( cpuInfo[2] & ( ( 1 << 27 ) | ( 1 << 28 ) ) ) != ( ( 1 << 27 ) | ( 1 << 28 ) ) )
+		return false;
+
+	if ( ( _xgetbv( 0 ) & 6 ) != 6 )
+		return false;
+
+	if ( nMaxLeaf < 7 )
+		return false;
+
+	__cpuidex( cpuInfo, 7, 0 );
+	return ( cpuInfo[1] & ( 1 << 5 ) ) != 0;
+}
+
+bool CheckPCLMULTechnology(void)
+{
+	int cpuInfo[4];
+	__cpuid( cpuInfo, 1 );
+	return ( cpuInfo[2] & ( 1 << 1 ) ) != 0;
+}
+
+bool CheckSHATechnology(void)
+{
+	int cpuInfo[4];
+	__cpuid( cpuInfo, 0 );
+	int nMaxLeaf = cpuInfo[0];
+
+	__cpuid( cpuInfo, 1 );
+	if ( !( cpuInfo[2] & ( 1 << 9 ) ) || nMaxLeaf < 7 )
+		return false;
+
+	__cpuidex( cpuInfo, 7, 0 );
+	return ( cpuInfo[1] & ( 1 << 29 ) ) != 0;
+}
+
+#endif
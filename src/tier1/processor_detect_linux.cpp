@@ -71,3 +71,49 @@ bool Check3DNowTechnology(void)
 }
 
 #endif
+
+#include <cpuid.h>
+
+bool CheckAVX2Technology(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+		return false;
+
+	// AVX and OSXSAVE, then make sure the OS saves the ymm registers (XCR0 bits 1 and 2)
+	if ( ( ecx & ( ( 1 << 27 ) | ( 1 << 28 ) ) ) != ( ( 1 << 27 ) | ( 1 << 28 ) ) )
+		return false;
+
+	unsigned int xcr0Lo, xcr0Hi;
+	__asm__ __volatile__ ( "xgetbv" : "=a" ( xcr0Lo ), "=d" ( xcr0Hi ) : "c" ( 0 ) );
+	if ( ( xcr0Lo & 6 ) != 6 )
+		return false;
+
+	if ( __get_cpuid_max( 0, 0 ) < 7 )
+		return false;
+
+	__cpuid_count( 7, 0, eax, ebx, ecx, edx );
+	return ( ebx & ( 1 << 5 ) ) != 0;
+}
+
+bool CheckPCLMULTechnology(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+		return false;
+
+	return ( ecx & ( 1 << 1 ) ) != 0;
+}
+
+bool CheckSHATechnology(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) || !( ecx & ( 1 << 9 ) ) )
+		return false;
+
+	if ( __get_cpuid_max( 0, 0 ) < 7 )
+		return false;
+
+	__cpuid_count( 7, 0, eax, ebx, ecx, edx );
+	return ( ebx & ( 1 << 29 ) ) != 0;
+}
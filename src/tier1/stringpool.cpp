@@ -14,21 +14,12 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
-//-----------------------------------------------------------------------------
-// Purpose: Comparison function for string sorted associative data structures
-//-----------------------------------------------------------------------------
-
-bool StrLess( const char * const &pszLeft, const char * const &pszRight )
-{
-	return ( Q_stricmp( pszLeft, pszRight) < 0 );
-}
-
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 
 template< typename K >
 CStringPoolBase< K >::CStringPoolBase()
-  : m_Strings( 32, 256, StrLess )
+  : m_Strings( 256 )
 {
 }
 
@@ -55,9 +46,9 @@ unsigned int CStringPoolBase< K >::Count() const
 template< typename K >
 const char * CStringPoolBase< K >::Find( const char *pszValue )
 {
-	KeyType i = m_Strings.Find(pszValue);
-	if ( m_Strings.IsValidIndex(i) )
-		return m_Strings[i];
+	UtlHashHandle_t i = m_Strings.Find(pszValue);
+	if ( i != m_Strings.InvalidHandle() )
+		return m_Strings.Key(i);
 
 	return NULL;
 }
@@ -65,18 +56,14 @@ const char * CStringPoolBase< K >::Find( const char *pszValue )
 template< typename K >
 const char * CStringPoolBase< K >::Allocate( const char *pszValue )
 {
-	char	*pszNew;
-
-	KeyType i    = m_Strings.Find(pszValue);
-	bool    bNew = (i == m_Strings.InvalidIndex());
-
-	if ( !bNew )
-		return m_Strings[i];
+	unsigned int nHash = m_Strings.GetHashRef()( pszValue );
+	UtlHashHandle_t i  = m_Strings.Find( pszValue, nHash );
 
-	pszNew = strdup( pszValue );
+	if ( i != m_Strings.InvalidHandle() )
+		return m_Strings.Key(i);
 
-	if ( bNew )
-		m_Strings.Insert( pszNew );
+	char *pszNew = strdup( pszValue );
+	m_Strings.Insert( pszNew, empty_t(), nHash );
 
 	return pszNew;
 }
@@ -87,11 +74,9 @@ const char * CStringPoolBase< K >::Allocate( const char *pszValue )
 template< typename K >
 void CStringPoolBase< K >::FreeAll()
 {
-	KeyType i = m_Strings.FirstInorder();
-	while ( i != m_Strings.InvalidIndex() )
+	for ( UtlHashHandle_t i = m_Strings.FirstHandle(); i != m_Strings.InvalidHandle(); i = m_Strings.NextHandle(i) )
 	{
-		free( (void *)m_Strings[i] );
-		i = m_Strings.NextInorder(i);
+		free( (void *)m_Strings.Key(i) );
 	}
 	m_Strings.RemoveAll();
 }
@@ -160,7 +145,7 @@ unsigned short CCountedStringPool::FindStringHandle( const char* pIntrinsic )
 	if( pIntrinsic == NULL )
 		return INVALID_ELEMENT;
 
-	unsigned short nHashBucketIndex = (HashStringCaseless(pIntrinsic ) %HASH_TABLE_SIZE);
+	unsigned short nHashBucketIndex = (FastHashStringCaseless(pIntrinsic ) %HASH_TABLE_SIZE);
 	unsigned short nCurrentBucket = m_HashTable[ nHashBucketIndex ];
 
 	// Does the bucket already exist?
@@ -193,7 +178,7 @@ unsigned short CCountedStringPool::ReferenceStringHandle( const char* pIntrinsic
 	if( pIntrinsic == NULL )
 		return INVALID_ELEMENT;
 
-	unsigned short nHashBucketIndex = (HashStringCaseless( pIntrinsic ) % HASH_TABLE_SIZE);
+	unsigned short nHashBucketIndex = (FastHashStringCaseless( pIntrinsic ) % HASH_TABLE_SIZE);
 	unsigned short nCurrentBucket =  m_HashTable[ nHashBucketIndex ];
 
 	// Does the bucket already exist?
@@ -250,7 +235,7 @@ void CCountedStringPool::DereferenceString( const char* pIntrinsic )
 	if (!pIntrinsic)
 		return;
 
-	unsigned short nHashBucketIndex = (HashStringCaseless( pIntrinsic ) % m_HashTable.Count());
+	unsigned short nHashBucketIndex = (FastHashStringCaseless( pIntrinsic ) % m_HashTable.Count());
 	unsigned short nCurrentBucket =  m_HashTable[ nHashBucketIndex ];
 
 	// If there isn't anything in the bucket, just return.
@@ -75,6 +75,20 @@
 #include "tier1/utlbuffer.h"
 #include "tier1/utlstring.h"
 #include "tier1/fmtstr.h"
+#include "tier1/processor_detect.h"
+#include "tier1/convar.h"
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ )
+#define STRTOOLS_SIMD 1
+#if defined( _MSC_VER )
+#include <intrin.h>
+#define STRTOOLS_SSE2
+#define STRTOOLS_AVX2
+#else
+#define STRTOOLS_SSE2 __attribute__(( target( "sse2" ) ))
+#define STRTOOLS_AVX2 __attribute__(( target( "avx2" ) ))
+#endif
+#include <immintrin.h>
+#endif
 #if defined( _X360 )
 #include "xbox/xbox_win32stubs.h"
 #endif
@@ -301,7 +315,7 @@ char *V_strnlwr(char *s, size_t count)
 	return pRet;
 }
 
-int V_stricmp( const char *str1, const char *str2 )
+static int V_stricmp_Scalar( const char *str1, const char *str2 )
 {
 	// It is not uncommon to compare a string to itself. See
 	// VPanelWrapper::GetPanel which does this a lot. Since stricmp
@@ -334,7 +348,7 @@ int V_stricmp( const char *str1, const char *str2 )
 	return *s2 ? -1 : 0;
 }
 
-int V_strnicmp( const char *str1, const char *str2, int n )
+static int V_strnicmp_Scalar( const char *str1, const char *str2, int n )
 {
 	const unsigned char *s1 = (const unsigned char*)str1;
 	const unsigned char *s2 = (const unsigned char*)str2;
@@ -732,7 +746,7 @@ void V_normalizeFloatString( char* pFloat )
 //-----------------------------------------------------------------------------
 // Finds a string in another string with a case insensitive test
 //-----------------------------------------------------------------------------
-char const* V_stristr( char const* pStr, char const* pSearch )
+static char const* V_stristr_Scalar( char const* pStr, char const* pSearch )
 {
 	Assert( pStr );
 	Assert( pSearch );
@@ -774,6 +788,404 @@ char const* V_stristr( char const* pStr, char const* pSearch )
 	return 0;
 }
 
+//-----------------------------------------------------------------------------
+// Vectorized V_stricmp, V_strnicmp and V_stristr.
+//
+// The vector loops only skip over bytes that compare equal, or, for stristr, bytes that
+// can't start a match. The byte where the strings differ or end goes to the scalar
+// version above, so every version returns the same result, including the CRT fallback
+// for non-ASCII bytes. A 16 or 32 byte load never crosses into a page the string may
+// not own. The compares go one byte at a time near the end of a page, and stristr
+// only does aligned loads.
+//
+// The version is picked on first use from what processor_detect reports. The AVX2
+// functions get a function-level target attribute on GCC, so the build flags don't
+// change and the library still runs on CPUs without AVX2.
+//-----------------------------------------------------------------------------
+static int V_stricmp_Resolve( const char *s1, const char *s2 );
+static int V_strnicmp_Resolve( const char *s1, const char *s2, int n );
+static const char *V_stristr_Resolve( const char *pStr, const char *pSearch );
+
+static int ( *s_pfnStricmp )( const char *, const char * ) = V_stricmp_Resolve;
+static int ( *s_pfnStrnicmp )( const char *, const char *, int ) = V_strnicmp_Resolve;
+static const char *( *s_pfnStristr )( const char *, const char * ) = V_stristr_Resolve;
+static EStringSIMDLevel s_eStringSIMDLevel = STRINGSIMD_NONE;
+
+#ifdef STRTOOLS_SIMD
+
+#define STRTOOLS_PAGE_SIZE 4096
+
+static FORCEINLINE int StrSIMDFirstBit( unsigned int nMask )
+{
+#if defined( _MSC_VER )
+	unsigned long nBit;
+	_BitScanForward( &nBit, nMask );
+	return (int)nBit;
+#else
+	return __builtin_ctz( nMask );
+#endif
+}
+
+// Is an nBytes load at p going to run into the next page?
+static FORCEINLINE bool StrSIMDNearPageEnd( const char *p, int nBytes )
+{
+	return ( (uintp)p & ( STRTOOLS_PAGE_SIZE - 1 ) ) > (uintp)( STRTOOLS_PAGE_SIZE - nBytes );
+}
+
+// Do the two bytes compare equal, ignoring ASCII case, with s1 not at its end?
+static FORCEINLINE bool StrSIMDSameChar( const char *s1, const char *s2 )
+{
+	return *s1 && FastASCIIToLower( *s1 ) == FastASCIIToLower( *s2 );
+}
+
+// For stristr: 1 if pSearch matches at pMatch, 0 if not, -1 if pMatch ran out first
+static FORCEINLINE int StrSIMDMatchesAt( const char *pMatch, const char *pTest )
+{
+	for ( ; *pTest; ++pMatch, ++pTest )
+	{
+		if ( !*pMatch )
+			return -1;
+		if ( FastASCIIToLower( *pMatch ) != FastASCIIToLower( *pTest ) )
+			return 0;
+	}
+	return 1;
+}
+
+// 'A'-'Z' to 'a'-'z'. Bytes >= 0x80 are negative as signed chars so are left alone.
+static STRTOOLS_SSE2 FORCEINLINE __m128i FoldCaseSSE2( __m128i v )
+{
+	__m128i isUpper = _mm_and_si128( _mm_cmpgt_epi8( v, _mm_set1_epi8( 'A' - 1 ) ), _mm_cmplt_epi8( v, _mm_set1_epi8( 'Z' + 1 ) ) );
+	return _mm_or_si128( v, _mm_and_si128( isUpper, _mm_set1_epi8( 0x20 ) ) );
+}
+
+// Bit set for each of the 16 bytes where the strings differ or s1 ends
+static STRTOOLS_SSE2 FORCEINLINE unsigned int StopMaskSSE2( const char *s1, const char *s2 )
+{
+	__m128i v1 = _mm_loadu_si128( (const __m128i *)s1 );
+	__m128i v2 = _mm_loadu_si128( (const __m128i *)s2 );
+	__m128i same = _mm_cmpeq_epi8( FoldCaseSSE2( v1 ), FoldCaseSSE2( v2 ) );
+	__m128i end = _mm_cmpeq_epi8( v1, _mm_setzero_si128() );
+	return (unsigned int)_mm_movemask_epi8( _mm_andnot_si128( end, same ) ) ^ 0xFFFF;
+}
+
+static STRTOOLS_SSE2 int V_stricmp_SSE2( const char *s1, const char *s2 )
+{
+	if ( s1 == s2 )
+		return 0;
+
+	// Most compares that fail do so on the first character; don't set up the vectors for those
+	if ( !StrSIMDSameChar( s1, s2 ) )
+		return V_stricmp_Scalar( s1, s2 );
+
+	for ( ;; )
+	{
+		if ( StrSIMDNearPageEnd( s1, 16 ) || StrSIMDNearPageEnd( s2, 16 ) )
+		{
+			if ( !StrSIMDSameChar( s1, s2 ) )
+				break;
+			++s1;
+			++s2;
+			continue;
+		}
+
+		unsigned int nStop = StopMaskSSE2( s1, s2 );
+		if ( nStop )
+		{
+			int i = StrSIMDFirstBit( nStop );
+			s1 += i;
+			s2 += i;
+			break;
+		}
+		s1 += 16;
+		s2 += 16;
+	}
+
+	return V_stricmp_Scalar( s1, s2 );
+}
+
+static STRTOOLS_SSE2 int V_strnicmp_SSE2( const char *s1, const char *s2, int n )
+{
+	if ( n <= 0 || !StrSIMDSameChar( s1, s2 ) )
+		return V_strnicmp_Scalar( s1, s2, n );
+
+	while ( n >= 16 )
+	{
+		if ( StrSIMDNearPageEnd( s1, 16 ) || StrSIMDNearPageEnd( s2, 16 ) )
+		{
+			if ( !StrSIMDSameChar( s1, s2 ) )
+				break;
+			++s1;
+			++s2;
+			--n;
+			continue;
+		}
+
+		unsigned int nStop = StopMaskSSE2( s1, s2 );
+		if ( nStop )
+		{
+			int i = StrSIMDFirstBit( nStop );
+			s1 += i;
+			s2 += i;
+			n -= i;
+			break;
+		}
+		s1 += 16;
+		s2 += 16;
+		n -= 16;
+	}
+
+	return V_strnicmp_Scalar( s1, s2, n );
+}
+
+static STRTOOLS_SSE2 const char *V_stristr_SSE2( const char *pStr, const char *pSearch )
+{
+	// The scalar version never matches an empty search string; leave that to it
+	if ( !pStr || !pSearch || !*pSearch )
+		return V_stristr_Scalar( pStr, pSearch );
+
+	const __m128i first = _mm_set1_epi8( FastASCIIToLower( *pSearch ) );
+	const __m128i zero = _mm_setzero_si128();
+
+	// Aligned loads stay inside one page, so the bytes read before pStr and past its end are harmless
+	const char *pBlock = (const char *)( (uintp)pStr & ~(uintp)15 );
+	unsigned int nValid = ~0u << ( pStr - pBlock );
+	for ( ;; pBlock += 16, nValid = ~0u )
+	{
+		__m128i v = _mm_load_si128( (const __m128i *)pBlock );
+		unsigned int nEnd = (unsigned int)_mm_movemask_epi8( _mm_cmpeq_epi8( v, zero ) ) & nValid;
+		unsigned int nCandidates = (unsigned int)_mm_movemask_epi8( _mm_cmpeq_epi8( FoldCaseSSE2( v ), first ) ) & nValid;
+		if ( nEnd )
+		{
+			// Only the candidates before the terminator
+			nCandidates &= ( nEnd ^ ( nEnd - 1 ) ) >> 1;
+		}
+
+		for ( ; nCandidates; nCandidates &= nCandidates - 1 )
+		{
+			const char *pLetter = pBlock + StrSIMDFirstBit( nCandidates );
+			int nMatch = StrSIMDMatchesAt( pLetter + 1, pSearch + 1 );
+			if ( nMatch > 0 )
+				return pLetter;
+			if ( nMatch < 0 )
+				return NULL;
+		}
+
+		if ( nEnd )
+			return NULL;
+	}
+}
+
+static STRTOOLS_AVX2 FORCEINLINE __m256i FoldCaseAVX2( __m256i v )
+{
+	__m256i isUpper = _mm256_and_si256( _mm256_cmpgt_epi8( v, _mm256_set1_epi8( 'A' - 1 ) ), _mm256_cmpgt_epi8( _mm256_set1_epi8( 'Z' + 1 ), v ) );
+	return _mm256_or_si256( v, _mm256_and_si256( isUpper, _mm256_set1_epi8( 0x20 ) ) );
+}
+
+static STRTOOLS_AVX2 FORCEINLINE unsigned int StopMaskAVX2( const char *s1, const char *s2 )
+{
+	__m256i v1 = _mm256_loadu_si256( (const __m256i *)s1 );
+	__m256i v2 = _mm256_loadu_si256( (const __m256i *)s2 );
+	__m256i same = _mm256_cmpeq_epi8( FoldCaseAVX2( v1 ), FoldCaseAVX2( v2 ) );
+	__m256i end = _mm256_cmpeq_epi8( v1, _mm256_setzero_si256() );
+	return ~(unsigned int)_mm256_movemask_epi8( _mm256_andnot_si256( end, same ) );
+}
+
+static STRTOOLS_AVX2 int V_stricmp_AVX2( const char *s1, const char *s2 )
+{
+	if ( s1 == s2 )
+		return 0;
+
+	if ( !StrSIMDSameChar( s1, s2 ) )
+		return V_stricmp_Scalar( s1, s2 );
+
+	for ( ;; )
+	{
+		if ( StrSIMDNearPageEnd( s1, 32 ) || StrSIMDNearPageEnd( s2, 32 ) )
+		{
+			if ( !StrSIMDSameChar( s1, s2 ) )
+				break;
+			++s1;
+			++s2;
+			continue;
+		}
+
+		unsigned int nStop = StopMaskAVX2( s1, s2 );
+		if ( nStop )
+		{
+			int i = StrSIMDFirstBit( nStop );
+			s1 += i;
+			s2 += i;
+			break;
+		}
+		s1 += 32;
+		s2 += 32;
+	}
+
+	return V_stricmp_Scalar( s1, s2 );
+}
+
+static STRTOOLS_AVX2 int V_strnicmp_AVX2( const char *s1, const char *s2, int n )
+{
+	if ( n <= 0 || !StrSIMDSameChar( s1, s2 ) )
+		return V_strnicmp_Scalar( s1, s2, n );
+
+	while ( n >= 32 )
+	{
+		if ( StrSIMDNearPageEnd( s1, 32 ) || StrSIMDNearPageEnd( s2, 32 ) )
+		{
+			if ( !StrSIMDSameChar( s1, s2 ) )
+				break;
+			++s1;
+			++s2;
+			--n;
+			continue;
+		}
+
+		unsigned int nStop = StopMaskAVX2( s1, s2 );
+		if ( nStop )
+		{
+			int i = StrSIMDFirstBit( nStop );
+			s1 += i;
+			s2 += i;
+			n -= i;
+			break;
+		}
+		s1 += 32;
+		s2 += 32;
+		n -= 32;
+	}
+
+	return V_strnicmp_Scalar( s1, s2, n );
+}
+
+static STRTOOLS_AVX2 const char *V_stristr_AVX2( const char *pStr, const char *pSearch )
+{
+	if ( !pStr || !pSearch || !*pSearch )
+		return V_stristr_Scalar( pStr, pSearch );
+
+	const __m256i first = _mm256_set1_epi8( FastASCIIToLower( *pSearch ) );
+	const __m256i zero = _mm256_setzero_si256();
+
+	const char *pBlock = (const char *)( (uintp)pStr & ~(uintp)31 );
+	unsigned int nValid = ~0u << ( pStr - pBlock );
+	for ( ;; pBlock += 32, nValid = ~0u )
+	{
+		__m256i v = _mm256_load_si256( (const __m256i *)pBlock );
+		unsigned int nEnd = (unsigned int)_mm256_movemask_epi8( _mm256_cmpeq_epi8( v, zero ) ) & nValid;
+		unsigned int nCandidates = (unsigned int)_mm256_movemask_epi8( _mm256_cmpeq_epi8( FoldCaseAVX2( v ), first ) ) & nValid;
+		if ( nEnd )
+		{
+			nCandidates &= ( nEnd ^ ( nEnd - 1 ) ) >> 1;
+		}
+
+		for ( ; nCandidates; nCandidates &= nCandidates - 1 )
+		{
+			const char *pLetter = pBlock + StrSIMDFirstBit( nCandidates );
+			int nMatch = StrSIMDMatchesAt( pLetter + 1, pSearch + 1 );
+			if ( nMatch > 0 )
+				return pLetter;
+			if ( nMatch < 0 )
+				return NULL;
+		}
+
+		if ( nEnd )
+			return NULL;
+	}
+}
+
+#endif // STRTOOLS_SIMD
+
+static EStringSIMDLevel GetSupportedStringSIMDLevel()
+{
+#ifdef STRTOOLS_SIMD
+	if ( CheckAVX2Technology() )
+		return STRINGSIMD_AVX2;
+#ifdef PLATFORM_64BITS
+	return STRINGSIMD_SSE2;
+#else
+	return CheckSSE2Technology() ? STRINGSIMD_SSE2 : STRINGSIMD_NONE;
+#endif
+#else
+	return STRINGSIMD_NONE;
+#endif
+}
+
+void V_SetStringSIMDLevel( EStringSIMDLevel eLevel )
+{
+	eLevel = MIN( eLevel, GetSupportedStringSIMDLevel() );
+	s_eStringSIMDLevel = eLevel;
+
+	switch ( eLevel )
+	{
+#ifdef STRTOOLS_SIMD
+	case STRINGSIMD_AVX2:
+		s_pfnStricmp = V_stricmp_AVX2;
+		s_pfnStrnicmp = V_strnicmp_AVX2;
+		s_pfnStristr = V_stristr_AVX2;
+		break;
+
+	case STRINGSIMD_SSE2:
+		s_pfnStricmp = V_stricmp_SSE2;
+		s_pfnStrnicmp = V_strnicmp_SSE2;
+		s_pfnStristr = V_stristr_SSE2;
+		break;
+#endif
+
+	default:
+		s_pfnStricmp = V_stricmp_Scalar;
+		s_pfnStrnicmp = V_strnicmp_Scalar;
+		s_pfnStristr = V_stristr_Scalar;
+		break;
+	}
+}
+
+EStringSIMDLevel V_GetStringSIMDLevel()
+{
+	// Make sure the first-use selection has happened
+	if ( s_pfnStricmp == V_stricmp_Resolve )
+	{
+		V_SetStringSIMDLevel( STRINGSIMD_AVX2 );
+	}
+	return s_eStringSIMDLevel;
+}
+
+// These start out in the function pointers and swap in the best version on the first call.
+// Threads racing through here all store the same values.
+static int V_stricmp_Resolve( const char *s1, const char *s2 )
+{
+	V_SetStringSIMDLevel( STRINGSIMD_AVX2 );
+	return s_pfnStricmp( s1, s2 );
+}
+
+static int V_strnicmp_Resolve( const char *s1, const char *s2, int n )
+{
+	V_SetStringSIMDLevel( STRINGSIMD_AVX2 );
+	return s_pfnStrnicmp( s1, s2, n );
+}
+
+static const char *V_stristr_Resolve( const char *pStr, const char *pSearch )
+{
+	V_SetStringSIMDLevel( STRINGSIMD_AVX2 );
+	return s_pfnStristr( pStr, pSearch );
+}
+
+int V_stricmp( const char *s1, const char *s2 )
+{
+	return s_pfnStricmp( s1, s2 );
+}
+
+int V_strnicmp( const char *s1, const char *s2, int n )
+{
+	return s_pfnStrnicmp( s1, s2, n );
+}
+
+char const* V_stristr( char const* pStr, char const* pSearch )
+{
+	Assert( pStr );
+	Assert( pSearch );
+	return s_pfnStristr( pStr, pSearch );
+}
+
 char* V_stristr( char* pStr, char const* pSearch )
 {
 	AssertValidStringPtr( pStr );
@@ -4614,3 +5026,111 @@ void V_StripAndPreserveHTML( CUtlBuffer *pbuffer, const char *pchHTML, const cha
 	const char *rgszNoCloseTags[] = { "br", "img" };
 	V_StripAndPreserveHTMLCore( pbuffer, pchHTML, rgszPreserveTags, cPreserveTags, rgszNoCloseTags, V_ARRAYSIZE( rgszNoCloseTags ), cMaxResultSize );
 }
+
+#if defined( _DEBUG ) && defined( STRTOOLS_SIMD )
+static uint32 StrtoolsTestRandom( uint32 &nState )
+{
+	nState ^= nState << 13;
+	nState ^= nState >> 17;
+	nState ^= nState << 5;
+	return nState;
+}
+
+// Mostly letters of both cases so the compares get a long way in, plus the characters either
+// side of 'A'-'Z' and 'a'-'z' and some high bytes to exercise the CRT fallback
+static const char s_StrtoolsTestChars[] = "aAbBmMzZ@[`{_/ 09\xC0\xE0\xFF";
+
+static char StrtoolsTestChar( uint32 &nState )
+{
+	return s_StrtoolsTestChars[ StrtoolsTestRandom( nState ) % ( sizeof( s_StrtoolsTestChars ) - 1 ) ];
+}
+
+// Copies nLen chars of pSrc to end just before pPageEnd with random case flips and, sometimes,
+// a changed character
+static char *StrtoolsTestCopy( char *pPageEnd, const char *pSrc, int nLen, uint32 &nState )
+{
+	char *pDest = pPageEnd - nLen - 1 - (int)( StrtoolsTestRandom( nState ) % 40 );
+	for ( int i = 0; i < nLen; i++ )
+	{
+		char c = pSrc[i];
+		if ( ( ( c | 0x20 ) >= 'a' && ( c | 0x20 ) <= 'z' ) && ( StrtoolsTestRandom( nState ) & 1 ) )
+		{
+			c ^= 0x20;
+		}
+		pDest[i] = c;
+	}
+	pDest[nLen] = 0;
+
+	if ( nLen && ( StrtoolsTestRandom( nState ) & 1 ) )
+	{
+		pDest[ StrtoolsTestRandom( nState ) % nLen ] = StrtoolsTestChar( nState );
+	}
+	return pDest;
+}
+
+//-----------------------------------------------------------------------------
+// Runs random strings through each vectorized V_stricmp, V_strnicmp and V_stristr
+// the CPU supports and checks they agree with the scalar loops. The strings end
+// right before page boundaries in the test buffer so the page-end handling runs.
+//-----------------------------------------------------------------------------
+CON_COMMAND( test_strtools, "Checks the vectorized string compares and searches against the scalar ones" )
+{
+	static char s_Buffer[4 * STRTOOLS_PAGE_SIZE];
+	char *pPages = (char *)( ( (uintp)s_Buffer + STRTOOLS_PAGE_SIZE - 1 ) & ~(uintp)( STRTOOLS_PAGE_SIZE - 1 ) );
+
+	EStringSIMDLevel eSupported = GetSupportedStringSIMDLevel();
+	int nTests = 0;
+	int nFailures = 0;
+	uint32 nState = 0x2545F491;
+
+	for ( int nLevel = STRINGSIMD_SSE2; nLevel <= eSupported; nLevel++ )
+	{
+		V_SetStringSIMDLevel( (EStringSIMDLevel)nLevel );
+
+		for ( int i = 0; i < 50000; i++ )
+		{
+			char source[128];
+			int nLen = StrtoolsTestRandom( nState ) % 100;
+			for ( int j = 0; j < nLen; j++ )
+			{
+				source[j] = StrtoolsTestChar( nState );
+			}
+			source[nLen] = 0;
+
+			// Sometimes a different length, so one string is a prefix of the other
+			int nLen2 = ( StrtoolsTestRandom( nState ) & 3 ) ? nLen : StrtoolsTestRandom( nState ) % ( nLen + 1 );
+			const char *s1 = StrtoolsTestCopy( pPages + STRTOOLS_PAGE_SIZE, source, nLen, nState );
+			const char *s2 = StrtoolsTestCopy( pPages + 2 * STRTOOLS_PAGE_SIZE, source, nLen2, nState );
+
+			int nStart = nLen ? StrtoolsTestRandom( nState ) % nLen : 0;
+			int nSearchLen = MIN( (int)( StrtoolsTestRandom( nState ) % 8 ), nLen - nStart );
+			const char *pSearch = StrtoolsTestCopy( pPages + 3 * STRTOOLS_PAGE_SIZE, source + nStart, nSearchLen, nState );
+
+			int n = StrtoolsTestRandom( nState ) % 110;
+
+			++nTests;
+			if ( V_stricmp( s1, s2 ) != V_stricmp_Scalar( s1, s2 ) ||
+				 V_strnicmp( s1, s2, n ) != V_strnicmp_Scalar( s1, s2, n ) ||
+				 V_stristr( s1, pSearch ) != V_stristr_Scalar( s1, pSearch ) )
+			{
+				if ( !nFailures )
+				{
+					Warning( "Level %d mismatch: \"%s\" \"%s\" %d \"%s\"\n", nLevel, s1, s2, n, pSearch );
+				}
+				++nFailures;
+			}
+		}
+	}
+
+	V_SetStringSIMDLevel( STRINGSIMD_AVX2 );
+
+	if ( nFailures )
+	{
+		Warning( "Failed %d of %d.\n", nFailures, nTests );
+	}
+	else
+	{
+		Msg( "Pass (%d tests).\n", nTests );
+	}
+}
+#endif // _DEBUG && STRTOOLS_SIMD
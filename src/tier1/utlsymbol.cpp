@@ -36,10 +36,11 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
-#define INVALID_STRING_INDEX CStringPoolIndex( 0xFFFF, 0xFFFF )
-
 #define MIN_STRING_POOL_SIZE	2048
 
+// Symbols added before the hash table is grown, as a fraction of its slots
+#define MAX_HASH_TABLE_LOAD( nSlots )	( (nSlots) / 2 )
+
 //-----------------------------------------------------------------------------
 // globals
 //-----------------------------------------------------------------------------
@@ -126,37 +127,25 @@ bool CUtlSymbol::operator==( const char* pStr ) const
 // symbol table stuff
 //-----------------------------------------------------------------------------
 
-inline const char* CUtlSymbolTable::StringFromIndex( const CStringPoolIndex &index ) const
+inline const CUtlSymbolTable::Symbol_t &CUtlSymbolTable::SymbolFromId( UtlSymId_t id ) const
 {
-	Assert( index.m_iPool < m_StringPools.Count() );
-	Assert( index.m_iOffset < m_StringPools[index.m_iPool]->m_TotalLen );
+	Assert( id < m_nSymbols );
+
+	// Block i starts at FIRST_BLOCK_SIZE * ( ( 1 << i ) - 1 )
+	unsigned int nBlockStart = ( (unsigned int)id / FIRST_BLOCK_SIZE ) + 1;
+	int iBlock = 0;
+	while ( nBlockStart >>= 1 )
+	{
+		++iBlock;
+	}
 
-	return &m_StringPools[index.m_iPool]->m_Data[index.m_iOffset];
+	return m_pBlocks[iBlock][ id - FIRST_BLOCK_SIZE * ( ( 1 << iBlock ) - 1 ) ];
 }
 
 
-bool CUtlSymbolTable::CLess::operator()( const CStringPoolIndex &i1, const CStringPoolIndex &i2 ) const
+unsigned int CUtlSymbolTable::HashSymbolString( const char *pString ) const
 {
-	// Need to do pointer math because CUtlSymbolTable is used in CUtlVectors, and hence
-	// can be arbitrarily moved in memory on a realloc. Yes, this is portable. In reality,
-	// right now at least, because m_LessFunc is the first member of CUtlRBTree, and m_Lookup
-	// is the first member of CUtlSymbolTabke, this == pTable
-	CUtlSymbolTable *pTable = (CUtlSymbolTable *)( (byte *)this - offsetof(CUtlSymbolTable::CTree, m_LessFunc) ) - offsetof(CUtlSymbolTable, m_Lookup );
-	const char* str1 = (i1 == INVALID_STRING_INDEX) ? pTable->m_pUserSearchString :
-													  pTable->StringFromIndex( i1 );
-	const char* str2 = (i2 == INVALID_STRING_INDEX) ? pTable->m_pUserSearchString :
-													  pTable->StringFromIndex( i2 );
-
-	if ( !str1 && str2 )
-		return false;
-	if ( !str2 && str1 )
-		return true;
-	if ( !str1 && !str2 )
-		return false;
-	if ( !pTable->m_bInsensitive )
-		return V_strcmp( str1, str2 ) < 0;
-	else
-		return V_stricmp( str1, str2 ) < 0;
+	return m_bInsensitive ? FastHashStringCaseless( pString ) : FastHashString( pString );
 }
 
 
@@ -164,8 +153,12 @@ bool CUtlSymbolTable::CLess::operator()( const CStringPoolIndex &i1, const CStri
 // constructor, destructor
 //-----------------------------------------------------------------------------
 CUtlSymbolTable::CUtlSymbolTable( int growSize, int initSize, bool caseInsensitive ) : 
-	m_Lookup( growSize, initSize ), m_bInsensitive( caseInsensitive ), m_StringPools( 8 )
+	m_pHashTable( NULL ), m_nSymbols( 0 ), m_nInitSize( initSize ), m_bInsensitive( caseInsensitive ), m_StringPools( 8 )
 {
+	for ( int i = 0; i < NUM_BLOCKS; i++ )
+	{
+		m_pBlocks[i] = NULL;
+	}
 }
 
 CUtlSymbolTable::~CUtlSymbolTable()
@@ -180,18 +173,39 @@ CUtlSymbol CUtlSymbolTable::Find( const char* pString ) const
 	if (!pString)
 		return CUtlSymbol();
 	
-	// Store a special context used to help with insertion
-	m_pUserSearchString = pString;
-	
-	// Passing this special invalid symbol makes the comparison function
-	// use the string passed in the context
-	UtlSymId_t idx = m_Lookup.Find( INVALID_STRING_INDEX );
+	return FindHashed( pString, HashSymbolString( pString ) );
+}
 
-#ifdef _DEBUG
-	m_pUserSearchString = NULL;
-#endif
 
-	return CUtlSymbol( idx );
+//-----------------------------------------------------------------------------
+// Probes the hash table without locking. Slots are only ever filled in after
+// the symbol they point at is written, and a grown table is only published once
+// it's complete, so whatever table we see is consistent.
+//-----------------------------------------------------------------------------
+CUtlSymbol CUtlSymbolTable::FindHashed( const char *pString, unsigned int nHash ) const
+{
+	const HashTable_t *pTable = m_pHashTable;
+	if ( !pTable )
+		return CUtlSymbol();
+
+	unsigned int nTag = nHash & HASH_TAG_MASK;
+	for ( unsigned int i = nHash & pTable->m_nMask; ; i = ( i + 1 ) & pTable->m_nMask )
+	{
+		unsigned int nSlot = pTable->m_Slots[i];
+		if ( nSlot == HASH_SLOT_EMPTY )
+			return CUtlSymbol();
+
+		if ( ( nSlot & HASH_TAG_MASK ) != nTag )
+			continue;
+
+		UtlSymId_t id = (UtlSymId_t)nSlot;
+		const Symbol_t &symbol = SymbolFromId( id );
+		if ( symbol.m_nHash != nHash )
+			continue;
+
+		if ( m_bInsensitive ? !V_stricmp( symbol.m_pString, pString ) : !V_strcmp( symbol.m_pString, pString ) )
+			return CUtlSymbol( id );
+	}
 }
 
 
@@ -211,6 +225,49 @@ int CUtlSymbolTable::FindPoolWithSpace( int len )	const
 }
 
 
+//-----------------------------------------------------------------------------
+// Replaces the hash table with one twice the size. The old one stays allocated
+// since readers may still be using it.
+//-----------------------------------------------------------------------------
+void CUtlSymbolTable::GrowHashTable()
+{
+	HashTable_t *pOldTable = m_pHashTable;
+
+	unsigned int nSlots = 16;
+	if ( pOldTable )
+	{
+		nSlots = ( pOldTable->m_nMask + 1 ) * 2;
+	}
+	else
+	{
+		while ( MAX_HASH_TABLE_LOAD( nSlots ) < (unsigned int)m_nInitSize )
+		{
+			nSlots *= 2;
+		}
+	}
+
+	HashTable_t *pTable = (HashTable_t*)malloc( sizeof( HashTable_t ) + ( nSlots - 1 ) * sizeof( unsigned int ) );
+	pTable->m_pRetired = pOldTable;
+	pTable->m_nMask = nSlots - 1;
+	memset( pTable->m_Slots, 0xFF, nSlots * sizeof( unsigned int ) );
+
+	for ( int id = 0; id < m_nSymbols; id++ )
+	{
+		unsigned int nHash = SymbolFromId( id ).m_nHash;
+		unsigned int i = nHash & pTable->m_nMask;
+		while ( pTable->m_Slots[i] != HASH_SLOT_EMPTY )
+		{
+			i = ( i + 1 ) & pTable->m_nMask;
+		}
+		pTable->m_Slots[i] = ( nHash & HASH_TAG_MASK ) | id;
+	}
+
+	// Finish filling it in before anyone can see it
+	ThreadMemoryBarrier();
+	m_pHashTable = pTable;
+}
+
+
 //-----------------------------------------------------------------------------
 // Finds and/or creates a symbol based on the string
 //-----------------------------------------------------------------------------
@@ -220,11 +277,24 @@ CUtlSymbol CUtlSymbolTable::AddString( const char* pString )
 	if (!pString) 
 		return CUtlSymbol( UTL_INVAL_SYMBOL );
 
-	CUtlSymbol id = Find( pString );
+	unsigned int nHash = HashSymbolString( pString );
+	CUtlSymbol id = FindHashed( pString, nHash );
 	
 	if (id.IsValid())
 		return id;
 
+	return AddHashed( pString, nHash );
+}
+
+
+CUtlSymbol CUtlSymbolTable::AddHashed( const char *pString, unsigned int nHash )
+{
+	int nId = m_nSymbols;
+	if ( nId >= UTL_INVAL_SYMBOL )
+	{
+		Error( "CUtlSymbolTable overflow!\n" );
+	}
+
 	int len = V_strlen(pString) + 1;
 
 	// Find a pool with space for this string, or allocate a new one.
@@ -241,21 +311,48 @@ CUtlSymbol CUtlSymbolTable::AddString( const char* pString )
 
 	// Copy the string in.
 	StringPool_t *pPool = m_StringPools[iPool];
-	Assert( pPool->m_SpaceUsed < 0xFFFF );	// This should never happen, because if we had a string > 64k, it
-											// would have been given its entire own pool.
-	
-	unsigned short iStringOffset = pPool->m_SpaceUsed;
-
-	memcpy( &pPool->m_Data[pPool->m_SpaceUsed], pString, len );
+	char *pPoolString = &pPool->m_Data[pPool->m_SpaceUsed];
+	memcpy( pPoolString, pString, len );
 	pPool->m_SpaceUsed += len;
 
-	// didn't find, insert the string into the vector.
-	CStringPoolIndex index;
-	index.m_iPool = iPool;
-	index.m_iOffset = iStringOffset;
+	// Find the symbol's block, allocating it if this is its first symbol
+	int iBlock = 0;
+	int nBlockStart = 0;
+	while ( nId >= nBlockStart + ( FIRST_BLOCK_SIZE << iBlock ) )
+	{
+		nBlockStart += FIRST_BLOCK_SIZE << iBlock;
+		++iBlock;
+	}
+
+	if ( !m_pBlocks[iBlock] )
+	{
+		m_pBlocks[iBlock] = (Symbol_t*)malloc( ( FIRST_BLOCK_SIZE << iBlock ) * sizeof( Symbol_t ) );
+	}
+
+	Symbol_t &symbol = m_pBlocks[iBlock][nId - nBlockStart];
+	symbol.m_pString = pPoolString;
+	symbol.m_nHash = nHash;
+	m_nSymbols = nId + 1;
 
-	UtlSymId_t idx = m_Lookup.Insert( index );
-	return CUtlSymbol( idx );
+	HashTable_t *pTable = m_pHashTable;
+	if ( !pTable || (unsigned int)m_nSymbols > MAX_HASH_TABLE_LOAD( pTable->m_nMask + 1 ) )
+	{
+		// The new table is built from the symbols, including this one
+		GrowHashTable();
+		return CUtlSymbol( (UtlSymId_t)nId );
+	}
+
+	unsigned int i = nHash & pTable->m_nMask;
+	while ( pTable->m_Slots[i] != HASH_SLOT_EMPTY )
+	{
+		i = ( i + 1 ) & pTable->m_nMask;
+	}
+
+	// The symbol must be visible before the slot that points at it
+	ThreadMemoryBarrier();
+	pTable->m_Slots[i] = ( nHash & HASH_TAG_MASK ) | nId;
+
+	return CUtlSymbol( (UtlSymId_t)nId );
 }
 
 
@@ -268,8 +365,7 @@ const char* CUtlSymbolTable::String( CUtlSymbol id ) const
 	if (!id.IsValid()) 
 		return "";
 	
-	Assert( m_Lookup.IsValidIndex((UtlSymId_t)id) );
-	return StringFromIndex( m_Lookup[id] );
+	return SymbolFromId( id ).m_pString;
 }
 
 
@@ -279,7 +375,21 @@ const char* CUtlSymbolTable::String( CUtlSymbol id ) const
 
 void CUtlSymbolTable::RemoveAll()
 {
-	m_Lookup.Purge();
+	HashTable_t *pTable = m_pHashTable;
+	while ( pTable )
+	{
+		HashTable_t *pRetired = pTable->m_pRetired;
+		free( pTable );
+		pTable = pRetired;
+	}
+	m_pHashTable = NULL;
+
+	for ( int i = 0; i < NUM_BLOCKS; i++ )
+	{
+		free( m_pBlocks[i] );
+		m_pBlocks[i] = NULL;
+	}
+	m_nSymbols = 0;
 	
 	for ( int i=0; i < m_StringPools.Count(); i++ )
 		free( m_StringPools[i] );
@@ -28,6 +28,7 @@
 #include "vtf/vtf.h"
 #include "lzma/lzma.h"
 #include "tier1/lzmaDecoder.h"
+#include "vstdlib/jobthread.h"
 
 #include "tier0/memdbgon.h"
 
@@ -4452,7 +4453,56 @@ int SortLumpsByOffset( const SortedLump_t *pSortedLumpA, const SortedLump_t *pSo
 	return 0;
 }
 
-bool CompressGameLump( dheader_t *pInBSPHeader, dheader_t *pOutBSPHeader, CUtlBuffer &outputBuffer, CompressFunc_t pCompressFunc )
+//-----------------------------------------------------------------------------
+// A lump (or game lump) being repacked. Lumps are independent of each other, so
+// all of them are uncompressed and then recompressed on the thread pool before
+// any are written out in order.
+//-----------------------------------------------------------------------------
+struct RepackLump_t
+{
+	byte			*pCompressedInput;	// LZMA compressed input to uncompress into data
+	CUtlBuffer		data;				// uncompressed lump
+	CompressFunc_t	pCompressFunc;		// set for lumps that should be compressed
+	CUtlBuffer		compressed;
+	bool			bCompressed;
+};
+
+//-----------------------------------------------------------------------------
+// LZMA_Compress needs ~190MB of encoder state per call with the default props,
+// so only a few lumps (or pakfile entries) are compressed at once no matter how
+// many threads the pool has; the 32-bit tools would run out of address space.
+//-----------------------------------------------------------------------------
+#ifdef PLATFORM_64BITS
+#define REPACK_MAX_PARALLEL_COMPRESS	8
+#else
+#define REPACK_MAX_PARALLEL_COMPRESS	2
+#endif
+
+// Pakfile entries are read out and compressed in batches of about this many bytes
+#define REPACK_PAKFILE_BATCH_SIZE		( 32 * 1024 * 1024 )
+
+static void UncompressRepackLump( RepackLump_t &lump )
+{
+	if ( !lump.pCompressedInput )
+		return;
+
+	// LzmaDecode uses the output buffer as its dictionary, so decoding in parallel only costs the outputs
+	unsigned int nActualSize = CLZMA::GetActualSize( lump.pCompressedInput );
+	lump.data.EnsureCapacity( nActualSize );
+	unsigned int nOutputSize = CLZMA::Uncompress( lump.pCompressedInput, (unsigned char *)lump.data.Base() );
+	lump.data.SeekPut( CUtlBuffer::SEEK_CURRENT, nOutputSize );
+	if ( nOutputSize != nActualSize )
+	{
+		Warning( "Decompressed size differs from header, BSP may be corrupt\n" );
+	}
+}
+
+static void CompressRepackLump( RepackLump_t &lump )
+{
+	lump.bCompressed = lump.pCompressFunc ? lump.pCompressFunc( lump.data, lump.compressed ) : false;
+}
+
+bool CompressGameLump( dheader_t *pInBSPHeader, dheader_t *pOutBSPHeader, CUtlBuffer &outputBuffer, CompressFunc_t pCompressFunc, IThreadPool *pThreadPool )
 {
 	CByteswap	byteSwap;
 
@@ -4484,54 +4534,60 @@ bool CompressGameLump( dheader_t *pInBSPHeader, dheader_t *pOutBSPHeader, CUtlBu
 	dgamelump_t dummyLump = { 0 };
 	outputBuffer.Put( &dummyLump, sizeof( dgamelump_t ) );
 
+	CUtlVector< RepackLump_t > lumps;
+	lumps.SetCount( pInGameLumpHeader->lumpCount );
 	for ( int i = 0; i < pInGameLumpHeader->lumpCount; i++ )
 	{
-		CUtlBuffer inputBuffer;
-		CUtlBuffer compressedBuffer;
+		lumps[i].pCompressedInput = NULL;
+		lumps[i].pCompressFunc = NULL;
+		lumps[i].bCompressed = false;
 
-		sOutGameLump[i].fileofs = AlignBuffer( outputBuffer, 4 );
+		if ( !pInGameLump[i].filelen )
+			continue;
 
-		if ( pInGameLump[i].filelen )
+		lumps[i].pCompressFunc = pCompressFunc;
+
+		if ( pInGameLump[i].flags & GAMELUMPFLAG_COMPRESSED )
 		{
-			if ( pInGameLump[i].flags & GAMELUMPFLAG_COMPRESSED )
+			byte *pCompressedLump = ((byte *)pInBSPHeader) + pInGameLump[i].fileofs;
+			if ( CLZMA::IsCompressed( pCompressedLump ) )
 			{
-				byte *pCompressedLump = ((byte *)pInBSPHeader) + pInGameLump[i].fileofs;
-				if ( CLZMA::IsCompressed( pCompressedLump ) )
-				{
-					inputBuffer.EnsureCapacity( CLZMA::GetActualSize( pCompressedLump ) );
-					unsigned int outSize = CLZMA::Uncompress( pCompressedLump, (unsigned char *)inputBuffer.Base() );
-					inputBuffer.SeekPut( CUtlBuffer::SEEK_CURRENT, outSize );
-					if ( outSize != CLZMA::GetActualSize( pCompressedLump ) )
-					{
-						Warning( "Decompressed size differs from header, BSP may be corrupt\n" );
-					}
-				}
-				else
-				{
-					Assert( CLZMA::IsCompressed( pCompressedLump ) );
-					Warning( "Unsupported BSP: Unrecognized compressed game lump\n" );
-				}
-
+				lumps[i].pCompressedInput = pCompressedLump;
 			}
 			else
 			{
-				inputBuffer.SetExternalBuffer( ((byte *)pInBSPHeader) + pInGameLump[i].fileofs,
-				                               pInGameLump[i].filelen, pInGameLump[i].filelen );
+				Assert( CLZMA::IsCompressed( pCompressedLump ) );
+				Warning( "Unsupported BSP: Unrecognized compressed game lump\n" );
 			}
+		}
+		else
+		{
+			lumps[i].data.SetExternalBuffer( ((byte *)pInBSPHeader) + pInGameLump[i].fileofs,
+			                                 pInGameLump[i].filelen, pInGameLump[i].filelen );
+		}
+	}
 
-			bool bCompressed = pCompressFunc ? pCompressFunc( inputBuffer, compressedBuffer ) : false;
-			if ( bCompressed )
+	ParallelProcess( "CompressGameLump", pThreadPool, lumps.Base(), lumps.Count(), UncompressRepackLump );
+	ParallelProcess( "CompressGameLump", pThreadPool, lumps.Base(), lumps.Count(), CompressRepackLump, NULL, NULL, REPACK_MAX_PARALLEL_COMPRESS );
+
+	for ( int i = 0; i < pInGameLumpHeader->lumpCount; i++ )
+	{
+		sOutGameLump[i].fileofs = AlignBuffer( outputBuffer, 4 );
+
+		if ( pInGameLump[i].filelen )
+		{
+			if ( lumps[i].bCompressed )
 			{
 				sOutGameLump[i].flags |= GAMELUMPFLAG_COMPRESSED;
 
-				outputBuffer.Put( compressedBuffer.Base(), compressedBuffer.TellPut() );
-				compressedBuffer.Purge();
+				outputBuffer.Put( lumps[i].compressed.Base(), lumps[i].compressed.TellPut() );
+				lumps[i].compressed.Purge();
 			}
 			else
 			{
 				// as is, clear compression flag from input lump
 				sOutGameLump[i].flags &= ~GAMELUMPFLAG_COMPRESSED;
-				outputBuffer.Put( inputBuffer.Base(), inputBuffer.TellPut() );
+				outputBuffer.Put( lumps[i].data.Base(), lumps[i].data.TellPut() );
 			}
 		}
 	}
@@ -4625,6 +4681,69 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 	}
 	sortedLumps.Sort( SortLumpsByOffset );
 
+	// The tools don't start g_pThreadPool, so bring up a pool of our own if it isn't running
+	IThreadPool *pThreadPool = g_pThreadPool;
+	IThreadPool *pOwnThreadPool = NULL;
+	if ( !pThreadPool || pThreadPool->NumThreads() == 0 )
+	{
+		pOwnThreadPool = CreateThreadPool();
+		if ( pOwnThreadPool->Start( ThreadPoolStartParams_t() ) )
+		{
+			pThreadPool = pOwnThreadPool;
+		}
+		else
+		{
+			DestroyThreadPool( pOwnThreadPool );
+			pOwnThreadPool = NULL;
+		}
+	}
+
+	// Uncompress the input lumps, and compress every lump but the game lump and pakfile,
+	// all at once before writing any of them out
+	CUtlVector< RepackLump_t > lumps;
+	lumps.SetCount( HEADER_LUMPS );
+	for ( int i = 0; i < HEADER_LUMPS; ++i )
+	{
+		SortedLump_t *pSortedLump = &sortedLumps[i];
+		int lumpNum = pSortedLump->lumpNum;
+
+		lumps[i].pCompressedInput = NULL;
+		lumps[i].pCompressFunc = NULL;
+		lumps[i].bCompressed = false;
+
+		if ( !pSortedLump->pLump->filelen )
+			continue;
+
+		if ( pSortedLump->pLump->uncompressedSize )
+		{
+			byte *pCompressedLump = ((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs;
+			if ( CLZMA::IsCompressed( pCompressedLump ) && pSortedLump->pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) )
+			{
+				lumps[i].pCompressedInput = pCompressedLump;
+			}
+			else
+			{
+				Assert( CLZMA::IsCompressed( pCompressedLump ) &&
+				        pSortedLump->pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) );
+				Warning( "Unsupported BSP: Unrecognized compressed lump\n" );
+			}
+		}
+		else
+		{
+			// Just use input
+			lumps[i].data.SetExternalBuffer( ((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs,
+			                                 pSortedLump->pLump->filelen, pSortedLump->pLump->filelen );
+		}
+
+		if ( lumpNum != LUMP_GAME_LUMP && lumpNum != LUMP_PAKFILE )
+		{
+			lumps[i].pCompressFunc = pCompressFunc;
+		}
+	}
+
+	ParallelProcess( "RepackBSP", pThreadPool, lumps.Base(), lumps.Count(), UncompressRepackLump );
+	ParallelProcess( "RepackBSP", pThreadPool, lumps.Base(), lumps.Count(), CompressRepackLump, NULL, NULL, REPACK_MAX_PARALLEL_COMPRESS );
+
 	// iterate in sorted order
 	for ( int i = 0; i < HEADER_LUMPS; ++i )
 	{
@@ -4646,38 +4765,12 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 			}
 			unsigned int newOffset = AlignBuffer( outputBuffer, alignment );
 
-			CUtlBuffer inputBuffer;
-			if ( pSortedLump->pLump->uncompressedSize )
-			{
-				byte *pCompressedLump = ((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs;
-				if ( CLZMA::IsCompressed( pCompressedLump ) && pSortedLump->pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) )
-				{
-					inputBuffer.EnsureCapacity( CLZMA::GetActualSize( pCompressedLump ) );
-					unsigned int outSize = CLZMA::Uncompress( pCompressedLump, (unsigned char *)inputBuffer.Base() );
-					inputBuffer.SeekPut( CUtlBuffer::SEEK_CURRENT, outSize );
-					if ( outSize != pSortedLump->pLump->uncompressedSize )
-					{
-						Warning( "Decompressed size differs from header, BSP may be corrupt\n" );
-					}
-				}
-				else
-				{
-					Assert( CLZMA::IsCompressed( pCompressedLump ) &&
-					        pSortedLump->pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) );
-					Warning( "Unsupported BSP: Unrecognized compressed lump\n" );
-				}
-			}
-			else
-			{
-				// Just use input
-				inputBuffer.SetExternalBuffer( ((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs,
-				                               pSortedLump->pLump->filelen, pSortedLump->pLump->filelen );
-			}
+			CUtlBuffer &inputBuffer = lumps[i].data;
 
 			if ( lumpNum == LUMP_GAME_LUMP )
 			{
 				// the game lump has to have each of its components individually compressed
-				CompressGameLump( pInBSPHeader, &sOutBSPHeader, outputBuffer, pCompressFunc );
+				CompressGameLump( pInBSPHeader, &sOutBSPHeader, outputBuffer, pCompressFunc, pThreadPool );
 			}
 			else if ( lumpNum == LUMP_PAKFILE )
 			{
@@ -4685,28 +4778,58 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 				IZip *oldPakFile = IZip::CreateZip( NULL );
 				oldPakFile->ParseFromBuffer( inputBuffer.Base(), inputBuffer.Size() );
 
+				// Read the files out a batch at a time so each batch can be compressed in parallel
+				// without holding the whole uncompressed pakfile in memory
+				CUtlVector< CUtlString > names;
+				CUtlVector< CUtlBuffer * > sourceBufs;
+				int nBatchSize = 0;
 				int id = -1;
 				int fileSize;
 				while ( 1 )
 				{
 					char relativeName[MAX_PATH];
 					id = GetNextFilename( oldPakFile, id, relativeName, sizeof( relativeName ), fileSize );
-					if ( id == -1 )
-						break;
-
-					CUtlBuffer sourceBuf;
-					CUtlBuffer targetBuf;
-
-					bool bOK = ReadFileFromPak( oldPakFile, relativeName, false, sourceBuf );
-					if ( !bOK )
+					if ( id != -1 )
 					{
-						Error( "Failed to load '%s' from lump pak for repacking.\n", relativeName );
-						continue;
+						CUtlBuffer *pSourceBuf = new CUtlBuffer;
+						bool bOK = ReadFileFromPak( oldPakFile, relativeName, false, *pSourceBuf );
+						if ( !bOK )
+						{
+							delete pSourceBuf;
+							Error( "Failed to load '%s' from lump pak for repacking.\n", relativeName );
+							continue;
+						}
+
+						names.AddToTail( relativeName );
+						sourceBufs.AddToTail( pSourceBuf );
+						nBatchSize += pSourceBuf->TellMaxPut();
 					}
 
-					AddBufferToPak( newPakFile, relativeName, sourceBuf.Base(), sourceBuf.TellMaxPut(), false, packfileCompression );
+					if ( names.Count() && ( id == -1 || nBatchSize >= REPACK_PAKFILE_BATCH_SIZE ) )
+					{
+						CUtlVector< const char * > pNames;
+						CUtlVector< void * > pDatas;
+						CUtlVector< int > lengths;
+						for ( int j = 0; j < names.Count(); j++ )
+						{
+							pNames.AddToTail( names[j].Get() );
+							pDatas.AddToTail( sourceBufs[j]->Base() );
+							lengths.AddToTail( sourceBufs[j]->TellMaxPut() );
+						}
+						newPakFile->AddBuffersToZip( names.Count(), pNames.Base(), pDatas.Base(), lengths.Base(), false, packfileCompression,
+													 pThreadPool, REPACK_MAX_PARALLEL_COMPRESS );
+
+						for ( int j = 0; j < names.Count(); j++ )
+						{
+							DevMsg( "Repacking BSP: Created '%s' in lump pak\n", names[j].Get() );
+						}
+						names.Purge();
+						sourceBufs.PurgeAndDeleteElements();
+						nBatchSize = 0;
+					}
 
-					DevMsg( "Repacking BSP: Created '%s' in lump pak\n", relativeName );
+					if ( id == -1 )
+						break;
 				}
 
 				// save new pack to buffer
@@ -4721,9 +4844,8 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 			}
 			else
 			{
-				CUtlBuffer compressedBuffer;
-				bool bCompressed = pCompressFunc ? pCompressFunc( inputBuffer, compressedBuffer ) : false;
-				if ( bCompressed )
+				CUtlBuffer &compressedBuffer = lumps[i].compressed;
+				if ( lumps[i].bCompressed )
 				{
 					sOutBSPHeader.lumps[lumpNum].uncompressedSize = inputBuffer.TellPut();
 					sOutBSPHeader.lumps[lumpNum].filelen = compressedBuffer.TellPut();
@@ -4742,6 +4864,12 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 		}
 	}
 
+	if ( pOwnThreadPool )
+	{
+		pOwnThreadPool->Stop();
+		DestroyThreadPool( pOwnThreadPool );
+	}
+
 	if ( IsX360() )
 	{
 		// fix the output for 360, swapping it back
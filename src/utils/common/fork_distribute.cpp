@@ -0,0 +1,290 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Local multi-process work distribution, see fork_distribute.h.
+//
+//=============================================================================//
+
+#include "cmdlib.h"
+#include "threads.h"
+#include "pacifier.h"
+#include "fork_distribute.h"
+#include "tier0/platform.h"
+#include "tier0/threadtools.h"
+#include "tier1/utlvector.h"
+
+#ifdef FORK_DISTRIBUTE
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+
+int g_nForkWorkers = 0;
+static bool g_bIsForkWorker = false;
+
+
+bool ForkDistribute_IsActive()
+{
+#ifdef FORK_DISTRIBUTE
+	return g_nForkWorkers > 0 && !g_bIsForkWorker;
+#else
+	return false;
+#endif
+}
+
+
+bool ForkDistribute_IsWorker()
+{
+	return g_bIsForkWorker;
+}
+
+
+#ifdef FORK_DISTRIBUTE
+
+// Every result a worker sends back is this header followed by nBytes of MessageBuffer data.
+struct ForkResultHeader_t
+{
+	uint64	m_iWorkUnit;
+	int		m_nBytes;
+};
+
+struct ForkWorker_t
+{
+	pid_t	m_Pid;
+	int		m_Socket;		// master's end of the socketpair, -1 once the worker is done
+	int		m_nResults;
+};
+
+
+static bool WriteAll( int fd, const void *pData, int nBytes )
+{
+	const char *p = (const char*)pData;
+	while ( nBytes > 0 )
+	{
+		ssize_t n = write( fd, p, nBytes );
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		p += n;
+		nBytes -= n;
+	}
+	return true;
+}
+
+
+static bool ReadAll( int fd, void *pData, int nBytes )
+{
+	char *p = (char*)pData;
+	while ( nBytes > 0 )
+	{
+		ssize_t n = read( fd, p, nBytes );
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		p += n;
+		nBytes -= n;
+	}
+	return true;
+}
+
+
+// Runs in the forked process. Never returns.
+static void RunForkWorker( int fd, volatile int32 *pNextWorkUnit, int nWorkUnits, ProcessWorkUnitFn processFn )
+{
+	g_bIsForkWorker = true;
+
+	// The master is the only one who should be drawing a pacifier.
+	SuppressPacifier( true );
+
+	MessageBuffer mb;
+	for ( ;; )
+	{
+		int iWorkUnit = ThreadInterlockedExchangeAdd( pNextWorkUnit, 1 );
+		if ( iWorkUnit >= nWorkUnits )
+			break;
+
+		mb.reset( 0 );
+		processFn( 0, iWorkUnit, &mb );
+
+		ForkResultHeader_t header;
+		header.m_iWorkUnit = iWorkUnit;
+		header.m_nBytes = mb.getLen();
+		if ( !WriteAll( fd, &header, sizeof( header ) ) || !WriteAll( fd, mb.data, header.m_nBytes ) )
+			break;
+	}
+
+	close( fd );
+
+	// Skip atexit handlers and stdio flushing; they belong to the master.
+	_exit( 0 );
+}
+
+
+double ForkDistributeWork( uint64 nWorkUnits, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn )
+{
+	double flStart = Plat_FloatTime();
+	if ( nWorkUnits == 0 )
+		return 0;
+
+	if ( nWorkUnits > INT_MAX )
+		Error( "ForkDistributeWork: too many work units (%llu)\n", nWorkUnits );
+
+	int nWorkers = MIN( g_nForkWorkers, (int)nWorkUnits );
+
+	// The work unit counter lives in a shared page so every worker claims from the same sequence.
+	volatile int32 *pNextWorkUnit = (volatile int32*)mmap( NULL, sizeof( int32 ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+	if ( pNextWorkUnit == MAP_FAILED )
+		Error( "ForkDistributeWork: mmap failed (%s)\n", strerror( errno ) );
+	*pNextWorkUnit = 0;
+
+	// Anything buffered now would be printed again by every worker.
+	fflush( stdout );
+	fflush( stderr );
+
+	CUtlVector<ForkWorker_t> workers;
+	for ( int i=0; i < nWorkers; i++ )
+	{
+		int fds[2];
+		if ( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) != 0 )
+			Error( "ForkDistributeWork: socketpair failed (%s)\n", strerror( errno ) );
+
+		pid_t pid = fork();
+		if ( pid < 0 )
+			Error( "ForkDistributeWork: fork failed (%s)\n", strerror( errno ) );
+
+		if ( pid == 0 )
+		{
+			close( fds[0] );
+			for ( int j=0; j < workers.Count(); j++ )
+				close( workers[j].m_Socket );
+
+			RunForkWorker( fds[1], pNextWorkUnit, (int)nWorkUnits, processFn );
+		}
+
+		close( fds[1] );
+
+		ForkWorker_t &worker = workers[workers.AddToTail()];
+		worker.m_Pid = pid;
+		worker.m_Socket = fds[0];
+		worker.m_nResults = 0;
+	}
+
+	CUtlVector<bool> completed;
+	completed.SetCount( (int)nWorkUnits );
+	memset( completed.Base(), 0, completed.Count() * sizeof( bool ) );
+	int nCompleted = 0;
+
+	// Collect results until every worker has closed its socket.
+	CUtlVector<pollfd> pollFds;
+	CUtlVector<int> pollWorkers;
+	MessageBuffer mb;
+	for ( ;; )
+	{
+		pollFds.RemoveAll();
+		pollWorkers.RemoveAll();
+		for ( int i=0; i < workers.Count(); i++ )
+		{
+			if ( workers[i].m_Socket < 0 )
+				continue;
+
+			pollfd pfd = { workers[i].m_Socket, POLLIN, 0 };
+			pollFds.AddToTail( pfd );
+			pollWorkers.AddToTail( i );
+		}
+
+		if ( pollFds.Count() == 0 )
+			break;
+
+		if ( poll( pollFds.Base(), pollFds.Count(), -1 ) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			Error( "ForkDistributeWork: poll failed (%s)\n", strerror( errno ) );
+		}
+
+		for ( int i=0; i < pollFds.Count(); i++ )
+		{
+			if ( !pollFds[i].revents )
+				continue;
+
+			ForkWorker_t &worker = workers[pollWorkers[i]];
+
+			// Workers only ever write whole results, so once there's data we can block for the rest of it.
+			ForkResultHeader_t header;
+			bool bOk = ReadAll( worker.m_Socket, &header, sizeof( header ) ) && header.m_iWorkUnit < nWorkUnits && header.m_nBytes >= 0;
+			if ( bOk )
+			{
+				mb.reset( header.m_nBytes );
+				mb.setLen( header.m_nBytes );
+				bOk = ReadAll( worker.m_Socket, mb.data, header.m_nBytes );
+			}
+
+			if ( !bOk )
+			{
+				// EOF: the worker is out of work units (or died, and the master picks up its leftovers)
+				close( worker.m_Socket );
+				worker.m_Socket = -1;
+				continue;
+			}
+
+			if ( !completed[(int)header.m_iWorkUnit] )
+			{
+				completed[(int)header.m_iWorkUnit] = true;
+				++nCompleted;
+				++worker.m_nResults;
+				receiveFn( header.m_iWorkUnit, &mb, pollWorkers[i] );
+				UpdatePacifier( (float)nCompleted / nWorkUnits );
+			}
+		}
+	}
+
+	int nFailedWorkers = 0;
+	for ( int i=0; i < workers.Count(); i++ )
+	{
+		int status = 0;
+		while ( waitpid( workers[i].m_Pid, &status, 0 ) < 0 && errno == EINTR )
+			;
+
+		if ( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+			++nFailedWorkers;
+	}
+
+	munmap( (void*)pNextWorkUnit, sizeof( int32 ) );
+
+	// Anything a dead worker claimed but never sent back gets done here.
+	if ( nCompleted < (int)nWorkUnits )
+	{
+		Warning( "\n%d of %d worker processes failed, computing %d work units locally\n",
+			nFailedWorkers, workers.Count(), (int)nWorkUnits - nCompleted );
+
+		for ( int i=0; i < (int)nWorkUnits; i++ )
+		{
+			if ( completed[i] )
+				continue;
+
+			// Go through the buffer rather than passing NULL; not every processFn handles that.
+			mb.reset( 0 );
+			processFn( 0, i, &mb );
+			receiveFn( i, &mb, -1 );
+			++nCompleted;
+			UpdatePacifier( (float)nCompleted / nWorkUnits );
+		}
+	}
+
+	return Plat_FloatTime() - flStart;
+}
+
+#else
+
+double ForkDistributeWork( uint64 nWorkUnits, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn )
+{
+	Error( "ForkDistributeWork: -fork is not supported on this platform\n" );
+	return 0;
+}
+
+#endif
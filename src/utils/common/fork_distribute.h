@@ -0,0 +1,44 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Runs DistributeWork-style work units in forked worker processes
+//			on the local machine. This is the VMPI replacement for Linux
+//			compile farms: the workers inherit the loaded BSP and all tool
+//			state copy-on-write from the master, claim work units from a
+//			shared counter and stream their results back over a socket.
+//
+//=============================================================================//
+
+#ifndef FORK_DISTRIBUTE_H
+#define FORK_DISTRIBUTE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "vmpi_distribute_work.h"
+
+#ifdef POSIX
+#define FORK_DISTRIBUTE
+#endif
+
+
+// Number of worker processes requested with -fork. 0 means run threaded in this process.
+extern int g_nForkWorkers;
+
+// True in the master when -fork was given and this platform supports it.
+bool ForkDistribute_IsActive();
+
+// True inside a forked worker while it's running work units.
+bool ForkDistribute_IsWorker();
+
+// Same contract as DistributeWork: processFn runs in the workers and appends its results
+// to pBuf, receiveFn runs in the master for each result. Work units whose worker died are
+// processed and received in the master afterwards, with iWorker == -1.
+// Returns the time it took to finish the work.
+double ForkDistributeWork(
+	uint64 nWorkUnits,
+	ProcessWorkUnitFn processFn,
+	ReceiveWorkUnitFn receiveFn
+	);
+
+
+#endif // FORK_DISTRIBUTE_H
@@ -13,13 +13,21 @@
 
 #define	USED
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 #include "cmdlib.h"
 #define NO_THREAD_NAMES
 #include "threads.h"
 #include "pacifier.h"
-
-#define	MAX_THREADS	16
+#include "tier0/threadtools.h"
+#include "tier1/utlvector.h"
 
 
 class CRunThreadsData
@@ -28,21 +36,144 @@ public:
 	int m_iThread;
 	void *m_pUserData;
 	RunThreadsFn m_Fn;
+	ERunThreadsPriority m_ePriority;
+	double m_flFinishTime;		// when m_Fn returned, for the utilization report
 };
 
-CRunThreadsData g_RunThreadsData[MAX_THREADS];
+static CUtlVector<CRunThreadsData> g_RunThreadsData;
 
 
-int		dispatch;
 int		workcount;
 qboolean		pacifier;
 
 qboolean	threaded;
 bool g_bLowPriorityThreads = false;
+bool g_bPinThreadsToNUMANodes = false;
+
+
+/*
+===================================================================
+
+WORK DISPATCH
+
+Work items are handed out a chunk at a time. Each thread keeps the
+unclaimed part of its chunk as a [next,end) range packed into one 64-bit
+word and pops items off the front with a compare-and-swap, so the common
+case never takes a lock. When its range is empty it grabs the next chunk
+from the shared counter; once that runs dry it steals the back half of
+another thread's range, trying threads on its own NUMA node first.
+
+===================================================================
+*/
+
+struct CThreadWorkRange
+{
+	volatile int64	m_Range;	// low 32 bits: next item, high 32 bits: end
+	int				m_nNode;	// NUMA node the thread is pinned to (0 when not pinning)
+	int				m_nCPU;		// CPU the thread is pinned to, -1 for none
+	int				m_nSteals;
+	byte			m_Pad[44];	// keep each thread's range on its own cache line
+};
+
+static CUtlVector<CThreadWorkRange> g_WorkRanges;
+static CInterlockedInt g_iNextChunk;
+static int g_nChunkSize = 1;
+
+// 1-based index of the RunThreadsOn worker running on this thread, 0 elsewhere
+static CTHREADLOCALINT g_iWorkThread;
+
+static inline int64 PackWorkRange( int iNext, int iEnd )
+{
+	return (int64)(uint32)iNext | ( (int64)iEnd << 32 );
+}
+
+static inline int WorkRangeNext( int64 nRange )
+{
+	return (int)(uint32)nRange;
+}
 
-HANDLE g_ThreadHandles[MAX_THREADS];
+static inline int WorkRangeEnd( int64 nRange )
+{
+	return (int)( nRange >> 32 );
+}
 
 
+static bool PopThreadWork( CThreadWorkRange &range, int &iWork )
+{
+	for ( ;; )
+	{
+		int64 nRange = range.m_Range;
+		int iNext = WorkRangeNext( nRange );
+		int iEnd = WorkRangeEnd( nRange );
+		if ( iNext >= iEnd )
+			return false;
+
+		if ( ThreadInterlockedAssignIf64( &range.m_Range, PackWorkRange( iNext + 1, iEnd ), nRange ) )
+		{
+			iWork = iNext;
+			return true;
+		}
+	}
+}
+
+
+static bool RefillThreadWork( CThreadWorkRange &range )
+{
+	if ( g_iNextChunk >= workcount )
+		return false;
+
+	int iStart = g_iNextChunk.AtomicAdd( g_nChunkSize );
+	if ( iStart >= workcount )
+		return false;
+
+	int iEnd = MIN( iStart + g_nChunkSize, workcount );
+
+	// Only the owner refills its range, and only once it is empty, so nobody else can be mid-update
+	ThreadInterlockedExchange64( &range.m_Range, PackWorkRange( iStart, iEnd ) );
+
+	ThreadLock();
+	UpdatePacifier( (float)iStart / workcount );
+	ThreadUnlock();
+	return true;
+}
+
+
+static bool StealThreadWork( int iThread )
+{
+	CThreadWorkRange &thief = g_WorkRanges[iThread];
+	int nThreads = g_WorkRanges.Count();
+
+	// Pass 0 only looks at threads on the same node, pass 1 at everyone else
+	for ( int iPass = 0; iPass < 2; iPass++ )
+	{
+		for ( int i = 1; i < nThreads; i++ )
+		{
+			CThreadWorkRange &victim = g_WorkRanges[( iThread + i ) % nThreads];
+			if ( ( victim.m_nNode == thief.m_nNode ) != ( iPass == 0 ) )
+				continue;
+
+			for ( ;; )
+			{
+				int64 nRange = victim.m_Range;
+				int iNext = WorkRangeNext( nRange );
+				int iEnd = WorkRangeEnd( nRange );
+				if ( iNext >= iEnd )
+					break;
+
+				int iSplit = iNext + ( iEnd - iNext ) / 2;
+				if ( ThreadInterlockedAssignIf64( &victim.m_Range, PackWorkRange( iNext, iSplit ), nRange ) )
+				{
+					ThreadInterlockedExchange64( &thief.m_Range, PackWorkRange( iSplit, iEnd ) );
+					thief.m_nSteals++;
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
 
 /*
 =============
@@ -52,23 +183,26 @@ GetThreadWork
 */
 int	GetThreadWork (void)
 {
-	int	r;
-
-	ThreadLock ();
-
-	if (dispatch == workcount)
+	int iThread = g_iWorkThread - 1;
+	if ( iThread < 0 || iThread >= g_WorkRanges.Count() )
 	{
-		ThreadUnlock ();
-		return -1;
+		// Not one of our workers; just take single items off the shared counter
+		if ( g_iNextChunk >= workcount )
+			return -1;
+		int iWork = g_iNextChunk.AtomicAdd( 1 );
+		return ( iWork < workcount ) ? iWork : -1;
 	}
 
-	UpdatePacifier( (float)dispatch / workcount );
-
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock ();
+	CThreadWorkRange &range = g_WorkRanges[iThread];
+	for ( ;; )
+	{
+		int iWork;
+		if ( PopThreadWork( range, iWork ) )
+			return iWork;
 
-	return r;
+		if ( !RefillThreadWork( range ) && !StealThreadWork( iThread ) )
+			return -1;
+	}
 }
 
 
@@ -83,7 +217,7 @@ void ThreadWorkerFunction( int iThread, void *pUserData )
 		work = GetThreadWork ();
 		if (work == -1)
 			break;
-		 
+
 		workfunction( iThread, work );
 	}
 }
@@ -92,7 +226,7 @@ void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn
 {
 	if (numthreads == -1)
 		ThreadSetDefault ();
-	
+
 	workfunction = func;
 	RunThreadsOn (workcnt, showpacifier, ThreadWorkerFunction);
 }
@@ -101,15 +235,154 @@ void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn
 /*
 ===================================================================
 
-WIN32
+NUMA PLACEMENT
+
+===================================================================
+*/
+
+#ifdef LINUX
+// Parses a sysfs cpu list such as "0-7,16-23"
+static void ParseCPUList( const char *pszList, CUtlVector<int> &cpus )
+{
+	const char *p = pszList;
+	while ( *p )
+	{
+		char *pEnd;
+		int iFirst = strtol( p, &pEnd, 10 );
+		if ( pEnd == p )
+			break;
+
+		int iLast = iFirst;
+		p = pEnd;
+		if ( *p == '-' )
+		{
+			iLast = strtol( p + 1, &pEnd, 10 );
+			p = pEnd;
+		}
+
+		for ( int i = iFirst; i <= iLast; i++ )
+		{
+			cpus.AddToTail( i );
+		}
+
+		if ( *p != ',' )
+			break;
+		p++;
+	}
+}
+#endif
+
+
+// Spreads the threads round-robin over the NUMA nodes, one CPU each, so
+// every node's memory bandwidth is used and stealing can stay node-local.
+static void AssignThreadPlacement()
+{
+	for ( int i = 0; i < g_WorkRanges.Count(); i++ )
+	{
+		g_WorkRanges[i].m_nNode = 0;
+		g_WorkRanges[i].m_nCPU = -1;
+	}
+
+	if ( !g_bPinThreadsToNUMANodes )
+		return;
+
+#ifdef LINUX
+	CUtlVector< CUtlVector<int> > nodeCPUs;
+	for ( int iNode = 0; ; iNode++ )
+	{
+		char szPath[MAX_PATH];
+		Q_snprintf( szPath, sizeof( szPath ), "/sys/devices/system/node/node%d/cpulist", iNode );
+		FILE *fp = fopen( szPath, "r" );
+		if ( !fp )
+			break;
+
+		char szList[1024] = { 0 };
+		fgets( szList, sizeof( szList ), fp );
+		fclose( fp );
+
+		int iIndex = nodeCPUs.AddToTail();
+		ParseCPUList( szList, nodeCPUs[iIndex] );
+		if ( nodeCPUs[iIndex].Count() == 0 )
+		{
+			nodeCPUs.Remove( iIndex );
+		}
+	}
+
+	if ( nodeCPUs.Count() == 0 )
+	{
+		Warning( "-numa: no NUMA topology found, threads will not be pinned\n" );
+		return;
+	}
+
+	for ( int i = 0; i < g_WorkRanges.Count(); i++ )
+	{
+		int iNode = i % nodeCPUs.Count();
+		const CUtlVector<int> &cpus = nodeCPUs[iNode];
+		g_WorkRanges[i].m_nNode = iNode;
+		g_WorkRanges[i].m_nCPU = cpus[( i / nodeCPUs.Count() ) % cpus.Count()];
+	}
+#else
+	Warning( "-numa: thread pinning is only supported on Linux\n" );
+#endif
+}
+
+
+/*
+===================================================================
+
+PHASE TIMING
+
+===================================================================
+*/
+
+struct ThreadPhaseTime_t
+{
+	char	m_szName[64];
+	int		m_nWorkItems;
+	int		m_nThreads;
+	int		m_nSteals;
+	double	m_flWallTime;
+	float	m_flUtilization;
+};
+
+static CUtlVector<ThreadPhaseTime_t> g_ThreadPhaseTimes;
+static char g_szThreadPhaseName[64] = "";
+
+void ThreadSetPhaseName( const char *pszName )
+{
+	Q_strncpy( g_szThreadPhaseName, pszName, sizeof( g_szThreadPhaseName ) );
+}
+
+void ThreadPrintPhaseTimes()
+{
+	if ( g_ThreadPhaseTimes.Count() == 0 )
+		return;
+
+	Msg( "\nThreaded phases:\n" );
+	Msg( "  %-32s %10s %10s %8s %8s\n", "phase", "items", "seconds", "util", "steals" );
+	for ( int i = 0; i < g_ThreadPhaseTimes.Count(); i++ )
+	{
+		const ThreadPhaseTime_t &phase = g_ThreadPhaseTimes[i];
+		Msg( "  %-32s %10d %10.2f %7.1f%% %8d\n", phase.m_szName, phase.m_nWorkItems, phase.m_flWallTime,
+			phase.m_flUtilization * 100.0f, phase.m_nSteals );
+	}
+}
+
+
+/*
+===================================================================
+
+WIN32 / POSIX
 
 ===================================================================
 */
 
 int		numthreads = -1;
-CRITICAL_SECTION		crit;
 static int enter;
 
+#ifdef _WIN32
+CRITICAL_SECTION		crit;
+static CUtlVector<HANDLE> g_ThreadHandles;
 
 class CCritInit
 {
@@ -119,27 +392,44 @@ public:
 		InitializeCriticalSection (&crit);
 	}
 } g_CritInit;
+#else
+static pthread_mutex_t crit = PTHREAD_MUTEX_INITIALIZER;
+static CUtlVector<pthread_t> g_ThreadHandles;
+#endif
 
 
 
 void SetLowPriority()
 {
+#ifdef _WIN32
 	SetPriorityClass( GetCurrentProcess(), IDLE_PRIORITY_CLASS );
+#else
+	setpriority( PRIO_PROCESS, 0, 19 );
+#endif
 }
 
 
 void ThreadSetDefault (void)
 {
-	SYSTEM_INFO info;
-
 	if (numthreads == -1)	// not set manually
 	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
 		GetSystemInfo (&info);
 		numthreads = info.dwNumberOfProcessors;
-		if (numthreads < 1 || numthreads > 32)
+#else
+		numthreads = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+		if (numthreads < 1)
 			numthreads = 1;
 	}
 
+	if ( numthreads > MAX_TOOL_THREADS )
+	{
+		Warning( "%i threads requested, limiting to %i\n", numthreads, MAX_TOOL_THREADS );
+		numthreads = MAX_TOOL_THREADS;
+	}
+
 	Msg ("%i threads\n", numthreads);
 }
 
@@ -148,7 +438,11 @@ void ThreadLock (void)
 {
 	if (!threaded)
 		return;
+#ifdef _WIN32
 	EnterCriticalSection (&crit);
+#else
+	pthread_mutex_lock (&crit);
+#endif
 	if (enter)
 		Error ("Recursive ThreadLock\n");
 	enter = 1;
@@ -161,17 +455,69 @@ void ThreadUnlock (void)
 	if (!enter)
 		Error ("ThreadUnlock without lock\n");
 	enter = 0;
+#ifdef _WIN32
 	LeaveCriticalSection (&crit);
+#else
+	pthread_mutex_unlock (&crit);
+#endif
+}
+
+bool RunThreadsActive()
+{
+	return threaded != false;
 }
 
 
 // This runs in the thread and dispatches a RunThreadsFn call.
-DWORD WINAPI InternalRunThreadsFn( LPVOID pParameter )
+static void InternalRunThreadsFn( CRunThreadsData *pData )
 {
-	CRunThreadsData *pData = (CRunThreadsData*)pParameter;
+	g_iWorkThread = pData->m_iThread + 1;
+
+#ifndef _WIN32
+	if ( pData->m_ePriority == k_eRunThreadsPriority_Idle )
+	{
+#ifdef LINUX
+		sched_param param = { 0 };
+		pthread_setschedparam( pthread_self(), SCHED_IDLE, &param );
+#endif
+	}
+	else if ( pData->m_ePriority == k_eRunThreadsPriority_UseGlobalState && g_bLowPriorityThreads )
+	{
+#ifdef LINUX
+		setpriority( PRIO_PROCESS, syscall( SYS_gettid ), 10 );
+#endif
+	}
+#endif
+
+#ifdef LINUX
+	if ( pData->m_iThread < g_WorkRanges.Count() && g_WorkRanges[pData->m_iThread].m_nCPU >= 0 )
+	{
+		cpu_set_t cpus;
+		CPU_ZERO( &cpus );
+		CPU_SET( g_WorkRanges[pData->m_iThread].m_nCPU, &cpus );
+		pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus );
+	}
+#endif
+
 	pData->m_Fn( pData->m_iThread, pData->m_pUserData );
+	pData->m_flFinishTime = Plat_FloatTime();
+
+	g_iWorkThread = 0;
+}
+
+#ifdef _WIN32
+DWORD WINAPI InternalRunThreadsFnWin32( LPVOID pParameter )
+{
+	InternalRunThreadsFn( (CRunThreadsData*)pParameter );
 	return 0;
 }
+#else
+static void *InternalRunThreadsFnPosix( void *pParameter )
+{
+	InternalRunThreadsFn( (CRunThreadsData*)pParameter );
+	return NULL;
+}
+#endif
 
 
 void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePriority )
@@ -182,17 +528,34 @@ void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePr
 	if ( numthreads > MAX_TOOL_THREADS )
 		numthreads = MAX_TOOL_THREADS;
 
+	g_RunThreadsData.SetCount( numthreads );
+	g_ThreadHandles.SetCount( numthreads );
+
+	if ( g_WorkRanges.Count() != numthreads )
+	{
+		g_WorkRanges.SetCount( numthreads );
+		for ( int i=0; i < numthreads; i++ )
+		{
+			g_WorkRanges[i].m_Range = 0;
+			g_WorkRanges[i].m_nSteals = 0;
+		}
+		AssignThreadPlacement();
+	}
+
 	for ( int i=0; i < numthreads ;i++ )
 	{
 		g_RunThreadsData[i].m_iThread = i;
 		g_RunThreadsData[i].m_pUserData = pUserData;
 		g_RunThreadsData[i].m_Fn = fn;
+		g_RunThreadsData[i].m_ePriority = ePriority;
+		g_RunThreadsData[i].m_flFinishTime = 0.0;
 
+#ifdef _WIN32
 		DWORD dwDummy;
 		g_ThreadHandles[i] = CreateThread(
 		   NULL,	// LPSECURITY_ATTRIBUTES lpsa,
 		   0,		// DWORD cbStack,
-		   InternalRunThreadsFn,	// LPTHREAD_START_ROUTINE lpStartAddr,
+		   InternalRunThreadsFnWin32,	// LPTHREAD_START_ROUTINE lpStartAddr,
 		   &g_RunThreadsData[i],	// LPVOID lpvThreadParm,
 		   0,			// DWORD fdwCreate,
 		   &dwDummy );
@@ -206,19 +569,37 @@ void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePr
 		{
 			SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_IDLE );
 		}
+#else
+		if ( pthread_create( &g_ThreadHandles[i], NULL, InternalRunThreadsFnPosix, &g_RunThreadsData[i] ) != 0 )
+		{
+			Error( "RunThreads_Start: pthread_create failed for thread %d\n", i );
+		}
+#endif
 	}
 }
 
 
 void RunThreads_End()
 {
-	WaitForMultipleObjects( numthreads, g_ThreadHandles, TRUE, INFINITE );
+#ifdef _WIN32
+	// WaitForMultipleObjects can only wait on MAXIMUM_WAIT_OBJECTS handles at a time
+	for ( int i=0; i < numthreads; i += MAXIMUM_WAIT_OBJECTS )
+		WaitForMultipleObjects( MIN( numthreads - i, MAXIMUM_WAIT_OBJECTS ), &g_ThreadHandles[i], TRUE, INFINITE );
 	for ( int i=0; i < numthreads; i++ )
 		CloseHandle( g_ThreadHandles[i] );
+#else
+	for ( int i=0; i < numthreads; i++ )
+		pthread_join( g_ThreadHandles[i], NULL );
+#endif
 
 	threaded = false;
 }
-	
+
+
+int GetThreadWorkChunkSize( int workcnt )
+{
+	return clamp( workcnt / ( MAX( numthreads, 1 ) * 32 ), 1, 256 );
+}
 
 /*
 =============
@@ -227,10 +608,9 @@ RunThreadsOn
 */
 void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pUserData )
 {
-	int		start, end;
+	double	start, end;
 
 	start = Plat_FloatTime();
-	dispatch = 0;
 	workcount = workcnt;
 	StartPacifier("");
 	pacifier = showpacifier;
@@ -241,16 +621,44 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 	return;
 #endif
 
-	
+	// Small chunks near the end keep the threads finishing together; stealing handles the rest
+	g_iNextChunk = 0;
+	g_nChunkSize = GetThreadWorkChunkSize( workcnt );
+	for ( int i=0; i < g_WorkRanges.Count(); i++ )
+	{
+		g_WorkRanges[i].m_Range = 0;
+		g_WorkRanges[i].m_nSteals = 0;
+	}
+
 	RunThreads_Start( fn, pUserData );
 	RunThreads_End();
 
 
 	end = Plat_FloatTime();
+
+	// Utilization is the share of thread-seconds spent before each thread ran out of work
+	double flBusy = 0.0;
+	int nSteals = 0;
+	for ( int i=0; i < g_RunThreadsData.Count(); i++ )
+	{
+		flBusy += MAX( g_RunThreadsData[i].m_flFinishTime - start, 0.0 );
+		nSteals += g_WorkRanges[i].m_nSteals;
+	}
+	float flUtilization = ( end > start ) ? (float)( flBusy / ( ( end - start ) * numthreads ) ) : 1.0f;
+
+	ThreadPhaseTime_t &phase = g_ThreadPhaseTimes[g_ThreadPhaseTimes.AddToTail()];
+	Q_strncpy( phase.m_szName, g_szThreadPhaseName[0] ? g_szThreadPhaseName : "(unnamed)", sizeof( phase.m_szName ) );
+	phase.m_nWorkItems = workcnt;
+	phase.m_nThreads = numthreads;
+	phase.m_nSteals = nSteals;
+	phase.m_flWallTime = end - start;
+	phase.m_flUtilization = flUtilization;
+	g_szThreadPhaseName[0] = 0;
+
 	if (pacifier)
 	{
 		EndPacifier(false);
-		printf (" (%i)\n", end-start);
+		printf (" (%i, %.0f%% thread utilization)\n", (int)(end-start), flUtilization * 100.0f);
 	}
 }
 
@@ -18,7 +18,7 @@
 
 // Arrays that are indexed by thread should always be MAX_TOOL_THREADS+1
 // large so THREADINDEX_MAIN can be used from the main thread.
-#define MAX_TOOL_THREADS	16
+#define MAX_TOOL_THREADS	256
 #define THREADINDEX_MAIN	(MAX_TOOL_THREADS)
 
 
@@ -27,6 +27,9 @@ extern	int		numthreads;
 // If set to true, then all the threads that are created are low priority.
 extern bool	g_bLowPriorityThreads;
 
+// If set to true, threads are spread over the NUMA nodes and pinned to a CPU each (Linux only).
+extern bool	g_bPinThreadsToNUMANodes;
+
 typedef void (*ThreadWorkerFn)( int iThread, int iWorkItem );
 typedef void (*RunThreadsFn)( int iThread, void *pUserData );
 
@@ -49,6 +52,10 @@ void RunThreadsOnIndividual ( int workcnt, qboolean showpacifier, ThreadWorkerFn
 
 void RunThreadsOn ( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pUserData=NULL );
 
+// How many consecutive work items RunThreadsOn hands a thread at a time for workcnt items.
+// Items at least this far apart start out in different threads' chunks.
+int GetThreadWorkChunkSize( int workcnt );
+
 // This version doesn't track work items - it just runs your function and waits for it to finish.
 void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePriority=k_eRunThreadsPriority_UseGlobalState );
 void RunThreads_End();
@@ -56,10 +63,20 @@ void RunThreads_End();
 void ThreadLock (void);
 void ThreadUnlock (void);
 
+// True while RunThreadsOn is running. RunThreadsOn can't be nested, so code that's called both
+// from worker threads and from the main thread checks this before handing out work of its own.
+bool RunThreadsActive();
+
+// Names the next RunThreadsOn call in the phase report. The RunThreadsOn macros do this for you.
+void ThreadSetPhaseName( const char *pszName );
+
+// Prints wall time, thread utilization and steal counts for every RunThreadsOn call so far.
+void ThreadPrintPhaseTimes();
+
 
 #ifndef NO_THREAD_NAMES
-#define RunThreadsOn(n,p,f) { if (p) printf("%-20s ", #f ":"); RunThreadsOn(n,p,f); }
-#define RunThreadsOnIndividual(n,p,f) { if (p) printf("%-20s ", #f ":"); RunThreadsOnIndividual(n,p,f); }
+#define RunThreadsOn(n,p,f) { if (p) printf("%-20s ", #f ":"); ThreadSetPhaseName(#f); RunThreadsOn(n,p,f); }
+#define RunThreadsOnIndividual(n,p,f) { if (p) printf("%-20s ", #f ":"); ThreadSetPhaseName(#f); RunThreadsOnIndividual(n,p,f); }
 #endif
 
 #endif // THREADS_H
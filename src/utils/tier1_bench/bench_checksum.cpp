@@ -0,0 +1,69 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Hashes a file (a map, say) with CRC32, SHA-1 and MD5, with and
+//			without the hardware paths, and checks they agree
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "tier0/platform.h"
+#include "tier1/checksum_crc.h"
+#include "tier1/checksum_md5.h"
+#include "tier1/checksum_sha1.h"
+#include "tier1/strtools.h"
+#include "tier1_bench.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+bool Benchmark_Checksum( int argc, char **argv )
+{
+	if ( argc < 1 )
+		return false;
+
+	CUtlBuffer buf;
+	if ( !LoadBenchFile( argv[0], buf ) )
+		return true;
+
+	unsigned char *pData = (unsigned char *)buf.Base();
+	int nLength = buf.TellPut();
+	float flMegabytes = nLength / ( 1024.0f * 1024.0f );
+	Msg( "%s: %.1f MB\n", argv[0], flMegabytes );
+
+	CRC32_t crc[2];
+	SHADigest_t sha[2];
+	for ( int nHardware = 0; nHardware < 2; nHardware++ )
+	{
+		bool bCRC32Hardware = CRC32_EnableHardware( nHardware != 0 );
+		double flStart = Plat_FloatTime();
+		crc[nHardware] = CRC32_ProcessSingleBuffer( pData, nLength );
+		double flCRC32 = Plat_FloatTime() - flStart;
+
+		bool bSHA1Hardware = SHA1_EnableHardware( nHardware != 0 );
+		flStart = Plat_FloatTime();
+		CSHA1 sha1;
+		sha1.Update( pData, nLength );
+		sha1.Final();
+		sha1.GetHash( sha[nHardware] );
+		double flSHA1 = Plat_FloatTime() - flStart;
+
+		Msg( "  CRC32 %-8s %8.1f MB/s   SHA-1 %-8s %8.1f MB/s\n",
+			bCRC32Hardware ? "PCLMUL" : "table", flMegabytes / MAX( flCRC32, 1e-9 ),
+			bSHA1Hardware ? "SHA-NI" : "scalar", flMegabytes / MAX( flSHA1, 1e-9 ) );
+	}
+
+	// MD5 has no hardware path; it's here for comparison
+	MD5Context_t md5;
+	unsigned char md5Digest[MD5_DIGEST_LENGTH];
+	double flStart = Plat_FloatTime();
+	MD5Init( &md5 );
+	MD5Update( &md5, pData, nLength );
+	MD5Final( md5Digest, &md5 );
+	Msg( "  MD5            %8.1f MB/s\n", flMegabytes / MAX( Plat_FloatTime() - flStart, 1e-9 ) );
+
+	if ( crc[0] != crc[1] || V_memcmp( sha[0], sha[1], sizeof( SHADigest_t ) ) )
+	{
+		Warning( "checksum: the hardware and portable checksums DIFFER\n" );
+	}
+	return true;
+}
@@ -0,0 +1,154 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Builds vectors and maps of attribute lists, the shape of the econ
+//			attribute lists and CNavArea connection lists, with copies, the old
+//			Swap() workaround, moves and emplace, and counts what each one
+//			copies. Every list copy is a heap allocation of its own.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include <stdlib.h>
+#include <utility>
+#include "tier0/platform.h"
+#include "tier1/utlmap.h"
+#include "tier1/utlvector.h"
+#include "tier1_bench.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static int s_nAttribCopies;
+static int s_nAttribMoves;
+static int s_nListCopies;
+
+struct BenchAttrib_t
+{
+	BenchAttrib_t() : m_iDefIndex( 0 ), m_flValue( 0.0f ) {}
+	BenchAttrib_t( int iDefIndex, float flValue ) : m_iDefIndex( iDefIndex ), m_flValue( flValue ) {}
+	BenchAttrib_t( const BenchAttrib_t &src ) : m_iDefIndex( src.m_iDefIndex ), m_flValue( src.m_flValue ) { ++s_nAttribCopies; }
+	BenchAttrib_t( BenchAttrib_t &&src ) : m_iDefIndex( src.m_iDefIndex ), m_flValue( src.m_flValue ) { ++s_nAttribMoves; }
+	BenchAttrib_t &operator=( const BenchAttrib_t &src ) { m_iDefIndex = src.m_iDefIndex; m_flValue = src.m_flValue; ++s_nAttribCopies; return *this; }
+
+	int		m_iDefIndex;
+	float	m_flValue;
+};
+
+class CBenchAttribList : public CCopyableUtlVector<BenchAttrib_t>
+{
+	typedef CCopyableUtlVector<BenchAttrib_t> BaseClass;
+public:
+	CBenchAttribList() {}
+	CBenchAttribList( const CBenchAttribList &src ) : BaseClass( src ) { ++s_nListCopies; }
+	CBenchAttribList( CBenchAttribList &&src ) : BaseClass( std::move( src ) ) {}
+	CBenchAttribList &operator=( const CBenchAttribList &src ) { BaseClass::operator=( src ); ++s_nListCopies; return *this; }
+	CBenchAttribList &operator=( CBenchAttribList &&src ) { BaseClass::operator=( std::move( src ) ); return *this; }
+};
+
+typedef CUtlVector<CBenchAttribList> BenchListVector_t;
+typedef CUtlMap<int, CBenchAttribList, int> BenchListMap_t;
+
+enum BenchBuild_t
+{
+	BENCH_BUILD_COPY,		// fill a local list, copy it in
+	BENCH_BUILD_SWAP,		// fill a local list, AddToTail() an empty one and Swap()
+	BENCH_BUILD_MOVE,		// fill a local list, move it in
+	BENCH_BUILD_EMPLACE,	// emplace the attributes, move the list in
+};
+
+static void FillList( CBenchAttribList &list, int iList, int nAttribs, bool bEmplace )
+{
+	for ( int i = 0; i < nAttribs; i++ )
+	{
+		if ( bEmplace )
+		{
+			list.EmplaceToTail( iList + i, (float)i );
+		}
+		else
+		{
+			const BenchAttrib_t attrib( iList + i, (float)i );
+			list.AddToTail( attrib );
+		}
+	}
+}
+
+static void BuildVector( BenchListVector_t &lists, int nLists, int nAttribs, BenchBuild_t build )
+{
+	for ( int i = 0; i < nLists; i++ )
+	{
+		CBenchAttribList list;
+		FillList( list, i, nAttribs, build == BENCH_BUILD_EMPLACE );
+
+		switch ( build )
+		{
+		case BENCH_BUILD_COPY:
+			lists.AddToTail( (const CBenchAttribList &)list );
+			break;
+		case BENCH_BUILD_SWAP:
+			lists[ lists.AddToTail() ].Swap( list );
+			break;
+		default:
+			lists.AddToTail( std::move( list ) );
+			break;
+		}
+	}
+}
+
+static void BuildMap( BenchListMap_t &lists, int nLists, int nAttribs, BenchBuild_t build )
+{
+	for ( int i = 0; i < nLists; i++ )
+	{
+		CBenchAttribList list;
+		FillList( list, i, nAttribs, build == BENCH_BUILD_EMPLACE );
+
+		switch ( build )
+		{
+		case BENCH_BUILD_COPY:
+			lists.Insert( i, (const CBenchAttribList &)list );
+			break;
+		case BENCH_BUILD_SWAP:
+			lists[ lists.Insert( i ) ].Swap( list );
+			break;
+		default:
+			lists.Insert( i, std::move( list ) );
+			break;
+		}
+	}
+}
+
+bool Benchmark_Containers( int argc, char **argv )
+{
+	int nLists = argc > 0 ? atoi( argv[0] ) : 10000;
+	int nAttribs = argc > 1 ? atoi( argv[1] ) : 8;
+	if ( nLists <= 0 || nAttribs <= 0 )
+		return false;
+
+	static const char *s_pszBuilds[] = { "copy", "swap", "move", "emplace" };
+
+	Msg( "%d lists of %d attributes, per list:\n", nLists, nAttribs );
+	for ( int nMap = 0; nMap < 2; nMap++ )
+	{
+		for ( int build = BENCH_BUILD_COPY; build <= BENCH_BUILD_EMPLACE; build++ )
+		{
+			s_nAttribCopies = s_nAttribMoves = s_nListCopies = 0;
+
+			double flStart = Plat_FloatTime();
+			if ( nMap )
+			{
+				BenchListMap_t lists( DefLessFunc( int ) );
+				BuildMap( lists, nLists, nAttribs, (BenchBuild_t)build );
+			}
+			else
+			{
+				BenchListVector_t lists;
+				BuildVector( lists, nLists, nAttribs, (BenchBuild_t)build );
+			}
+			double flNanoseconds = ( Plat_FloatTime() - flStart ) * 1e9 / nLists;
+
+			Msg( "  %-10s %-8s %7.1f ns  %5.2f list copies  %6.2f attribute copies  %6.2f attribute moves\n",
+				nMap ? "CUtlMap" : "CUtlVector", s_pszBuilds[build], flNanoseconds,
+				(float)s_nListCopies / nLists, (float)s_nAttribCopies / nLists, (float)s_nAttribMoves / nLists );
+		}
+	}
+	return true;
+}
@@ -0,0 +1,199 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Stress test of CDataManager: an exact LRU behind one mutex against
+//			the approximate LRU and the sharded manager
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include <stdlib.h>
+#include "tier0/platform.h"
+#include "tier0/threadtools.h"
+#include "tier1/datamanager.h"
+#include "tier1/strtools.h"
+#include "tier1_bench.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define DATAMANAGER_BENCH_RESOURCES		4096
+#define DATAMANAGER_BENCH_SHARED		3072	// the rest are churned
+#define DATAMANAGER_BENCH_RESOURCE_SIZE	100
+#define DATAMANAGER_BENCH_OPS			500000
+#define DATAMANAGER_BENCH_MAX_THREADS	64
+#define DATAMANAGER_BENCH_MAGIC			0x1234
+
+static CInterlockedInt s_nLiveResources;
+
+class CBenchResource
+{
+public:
+	static CBenchResource *CreateResource( const int &nSize )
+	{
+		++s_nLiveResources;
+		CBenchResource *pResource = new CBenchResource;
+		pResource->m_nSize = nSize;
+		pResource->m_nMagic = DATAMANAGER_BENCH_MAGIC;
+		return pResource;
+	}
+	static unsigned int EstimatedSize( const int &nSize ) { return nSize; }
+	void DestroyResource() { m_nMagic = 0; --s_nLiveResources; delete this; }
+	CBenchResource *GetData() { return this; }
+	unsigned int Size() const { return m_nSize; }
+
+	int m_nSize;
+	int m_nMagic;
+};
+
+//-----------------------------------------------------------------------------
+// Each thread mixes 80% touches of any resource, 15% lock/unlock pairs of the
+// shared ones and 5% destroy and recreate of one of its own churned ones, so
+// the others keep touching stale handles. Nothing is destroyed while another
+// thread could have it locked. The whole set fits, so flushing is rare.
+//-----------------------------------------------------------------------------
+template< class MANAGER >
+class CDataManagerStress
+{
+public:
+	CDataManagerStress( MANAGER &manager ) : m_Manager( manager ) {}
+
+	double Run( int nThreads )
+	{
+		for ( int i = 0; i < DATAMANAGER_BENCH_RESOURCES; i++ )
+		{
+			m_hResources[i] = m_Manager.CreateResource( DATAMANAGER_BENCH_RESOURCE_SIZE );
+		}
+
+		m_nThreads = nThreads;
+		m_nCorrupt = 0;
+
+		ThreadHandle_t hThreads[DATAMANAGER_BENCH_MAX_THREADS];
+		Thread_t threads[DATAMANAGER_BENCH_MAX_THREADS];
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < nThreads; i++ )
+		{
+			threads[i].m_pStress = this;
+			threads[i].m_iThread = i;
+			hThreads[i] = CreateSimpleThread( ThreadFunc, &threads[i] );
+		}
+		for ( int i = 0; i < nThreads; i++ )
+		{
+			ThreadJoin( hThreads[i] );
+			ReleaseThreadHandle( hThreads[i] );
+		}
+		double flSeconds = Plat_FloatTime() - flStart;
+
+		m_Manager.FlushAll();
+		return (double)nThreads * DATAMANAGER_BENCH_OPS / MAX( flSeconds, 1e-9 ) / 1e6;
+	}
+
+	int Corrupt() const { return m_nCorrupt; }
+
+private:
+	struct Thread_t
+	{
+		CDataManagerStress	*m_pStress;
+		int					m_iThread;
+	};
+
+	static uintp ThreadFunc( void *pParam )
+	{
+		Thread_t *pThread = (Thread_t *)pParam;
+		pThread->m_pStress->Work( pThread->m_iThread );
+		return 0;
+	}
+
+	void Work( int iThread )
+	{
+		unsigned int nRandom = iThread * 7919 + 1;
+		for ( int i = 0; i < DATAMANAGER_BENCH_OPS; i++ )
+		{
+			nRandom = nRandom * 1103515245 + 12345;
+			int iResource = ( nRandom >> 8 ) % DATAMANAGER_BENCH_RESOURCES;
+			int nOp = ( nRandom >> 20 ) % 100;
+			if ( nOp < 80 )
+			{
+				m_Manager.TouchResource( m_hResources[iResource] );
+			}
+			else if ( nOp < 95 )
+			{
+				memhandle_t hResource = m_hResources[iResource % DATAMANAGER_BENCH_SHARED];
+				CBenchResource *pResource = m_Manager.LockResource( hResource );
+				if ( pResource )
+				{
+					if ( pResource->m_nMagic != DATAMANAGER_BENCH_MAGIC )
+					{
+						++m_nCorrupt;
+					}
+					m_Manager.UnlockResource( hResource );
+				}
+			}
+			else
+			{
+				int nChurned = ( DATAMANAGER_BENCH_RESOURCES - DATAMANAGER_BENCH_SHARED ) / m_nThreads;
+				if ( !nChurned )
+					continue;
+
+				iResource = DATAMANAGER_BENCH_SHARED + ( iResource % nChurned ) * m_nThreads + iThread;
+				m_Manager.DestroyResource( m_hResources[iResource] );
+				m_hResources[iResource] = m_Manager.CreateResource( DATAMANAGER_BENCH_RESOURCE_SIZE );
+			}
+		}
+	}
+
+	MANAGER &m_Manager;
+	memhandle_t volatile m_hResources[DATAMANAGER_BENCH_RESOURCES];
+	int m_nThreads;
+	CInterlockedInt m_nCorrupt;
+};
+
+template< class MANAGER >
+static double StressDataManager( MANAGER &manager, int nThreads, int &nCorrupt )
+{
+	CDataManagerStress< MANAGER > *pStress = new CDataManagerStress< MANAGER >( manager );
+	double flMops = pStress->Run( nThreads );
+	nCorrupt += pStress->Corrupt();
+	delete pStress;
+	return flMops;
+}
+
+bool Benchmark_DataManager( int argc, char **argv )
+{
+	static const int s_nDefaultThreads[] = { 1, 2, 4, 8 };
+	int nThreadCounts = ARRAYSIZE( s_nDefaultThreads );
+	int nThreads[ARRAYSIZE( s_nDefaultThreads )];
+	V_memcpy( nThreads, s_nDefaultThreads, sizeof( nThreads ) );
+	if ( argc > 0 )
+	{
+		nThreads[0] = atoi( argv[0] );
+		nThreadCounts = 1;
+		if ( nThreads[0] < 1 || nThreads[0] > DATAMANAGER_BENCH_MAX_THREADS )
+			return false;
+	}
+
+	Msg( "%d resources, %d ops per thread: 80%% touch, 15%% lock+unlock, 5%% destroy+create\n",
+		DATAMANAGER_BENCH_RESOURCES, DATAMANAGER_BENCH_OPS );
+
+	unsigned int nTargetSize = DATAMANAGER_BENCH_RESOURCES * DATAMANAGER_BENCH_RESOURCE_SIZE;
+	int nCorrupt = 0;
+	for ( int i = 0; i < nThreadCounts; i++ )
+	{
+		CDataManager< CBenchResource, int, CBenchResource *, CThreadFastMutex > exact( nTargetSize );
+		double flExact = StressDataManager( exact, nThreads[i], nCorrupt );
+
+		CDataManager< CBenchResource, int, CBenchResource *, CThreadFastMutex > approximate( nTargetSize, true );
+		double flApproximate = StressDataManager( approximate, nThreads[i], nCorrupt );
+
+		CDataManagerSharded< CBenchResource, int > sharded( nTargetSize );
+		double flSharded = StressDataManager( sharded, nThreads[i], nCorrupt );
+
+		Msg( "  %2d threads: exact LRU %6.1f Mops/s  approximate LRU %6.1f Mops/s  sharded %6.1f Mops/s\n",
+			nThreads[i], flExact, flApproximate, flSharded );
+	}
+
+	if ( nCorrupt || s_nLiveResources != 0 )
+	{
+		Warning( "datamanager: %d locks returned a destroyed resource, %d resources leaked\n", nCorrupt, (int)s_nLiveResources );
+	}
+	return true;
+}
@@ -0,0 +1,139 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Times the string hashes on the names the game really looks up,
+//			and checks how well they spread them over a hash table twice
+//			the size of the set
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include <math.h>
+#include "tier0/platform.h"
+#include "tier1/generichash.h"
+#include "tier1/strtools.h"
+#include "tier1/utlcommon.h"
+#include "tier1_bench.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static unsigned int HashBench_Pearson( const char *pszKey )				{ return HashString( pszKey ); }
+static unsigned int HashBench_PearsonCaseless( const char *pszKey )		{ return HashStringCaseless( pszKey ); }
+static unsigned int HashBench_FNV( const char *pszKey )					{ return StringHashFunctor()( pszKey ); }
+static unsigned int HashBench_FNVCaseless( const char *pszKey )			{ return CaselessStringHashFunctor()( pszKey ); }
+static unsigned int HashBench_Fast( const char *pszKey )				{ return FastHashString( pszKey ); }
+static unsigned int HashBench_FastCaseless( const char *pszKey )		{ return FastHashStringCaseless( pszKey ); }
+
+static int __cdecl HashBench_Compare( const unsigned int *a, const unsigned int *b )
+{
+	return ( *a < *b ) ? -1 : ( *a > *b );
+}
+
+static volatile unsigned int s_nHashBenchSink;
+
+static void HashBenchmarkKeys( const char *pszSet, const CUtlVector<const char *> &keys )
+{
+	static const struct
+	{
+		const char *m_pszName;
+		unsigned int ( *m_pfnHash )( const char *pszKey );
+	} s_Hashes[] =
+	{
+		{ "HashString",				HashBench_Pearson },
+		{ "HashStringCaseless",		HashBench_PearsonCaseless },
+		{ "FNV-1a",					HashBench_FNV },
+		{ "FNV-1a caseless",		HashBench_FNVCaseless },
+		{ "FastHashString",			HashBench_Fast },
+		{ "FastHashStringCaseless",	HashBench_FastCaseless },
+	};
+
+	int nKeys = keys.Count();
+	if ( !nKeys )
+	{
+		Msg( "%s: no keys\n", pszSet );
+		return;
+	}
+
+	int nBuckets = 1;
+	while ( nBuckets < nKeys * 2 )
+	{
+		nBuckets <<= 1;
+	}
+
+	int nTotalLength = 0;
+	for ( int i = 0; i < nKeys; i++ )
+	{
+		nTotalLength += V_strlen( keys[i] );
+	}
+
+	// What a perfectly random hash would average
+	float flExpectedCollisions = nKeys - nBuckets * ( 1.0f - powf( 1.0f - 1.0f / nBuckets, nKeys ) );
+	Msg( "%s: %d keys, %.1f chars on average, %d buckets, %.1f bucket collisions expected\n", pszSet, nKeys, (float)nTotalLength / nKeys, nBuckets, flExpectedCollisions );
+
+	CUtlVector<unsigned int> values;
+	values.SetCount( nKeys );
+	CUtlVector<int> buckets;
+	buckets.SetCount( nBuckets );
+
+	int nPasses = MAX( 1, 1000000 / nKeys );
+	for ( int iHash = 0; iHash < ARRAYSIZE( s_Hashes ); iHash++ )
+	{
+		unsigned int ( *pfnHash )( const char *pszKey ) = s_Hashes[iHash].m_pfnHash;
+
+		unsigned int nSink = 0;
+		double flStart = Plat_FloatTime();
+		for ( int iPass = 0; iPass < nPasses; iPass++ )
+		{
+			for ( int i = 0; i < nKeys; i++ )
+			{
+				nSink += pfnHash( keys[i] );
+			}
+		}
+		double flNanoseconds = ( Plat_FloatTime() - flStart ) * 1e9 / ( (double)nPasses * nKeys );
+		s_nHashBenchSink = nSink;
+
+		buckets.FillWithValue( 0 );
+		int nLongestChain = 0;
+		int nBucketCollisions = 0;
+		for ( int i = 0; i < nKeys; i++ )
+		{
+			values[i] = pfnHash( keys[i] );
+			int nChain = ++buckets[values[i] & ( nBuckets - 1 )];
+			nLongestChain = MAX( nLongestChain, nChain );
+			if ( nChain > 1 )
+			{
+				++nBucketCollisions;
+			}
+		}
+
+		values.Sort( HashBench_Compare );
+		int nFullCollisions = 0;
+		for ( int i = 1; i < nKeys; i++ )
+		{
+			if ( values[i] == values[i - 1] )
+			{
+				++nFullCollisions;
+			}
+		}
+
+		Msg( "  %-24s %6.1f ns/key  %6d bucket collisions  longest chain %3d  %6d full collisions\n",
+			s_Hashes[iHash].m_pszName, flNanoseconds, nBucketCollisions, nLongestChain, nFullCollisions );
+	}
+}
+
+bool Benchmark_Hash( int argc, char **argv )
+{
+	if ( argc < 1 )
+		return false;
+
+	for ( int i = 0; i < argc; i++ )
+	{
+		CUtlBuffer buf;
+		CUtlVector<const char *> keys;
+		if ( LoadBenchKeys( argv[i], buf, keys ) )
+		{
+			HashBenchmarkKeys( argv[i], keys );
+		}
+	}
+	return true;
+}
@@ -0,0 +1,85 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compresses a file (a demo, say) with LZSS at each effort level, in
+//			pieces the size of the snapshots and other network payloads it's
+//			used for
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include <stdlib.h>
+#include "tier0/platform.h"
+#include "tier1/lzss.h"
+#include "tier1/strtools.h"
+#include "tier1_bench.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+bool Benchmark_LZSS( int argc, char **argv )
+{
+	if ( argc < 1 )
+		return false;
+
+	CUtlBuffer buf;
+	if ( !LoadBenchFile( argv[0], buf ) )
+		return true;
+
+	const unsigned char *pInput = (const unsigned char *)buf.Base();
+	int nInputLength = buf.TellPut();
+	int nChunkLength = argc > 1 ? atoi( argv[1] ) : 2048;
+	nChunkLength = clamp( nChunkLength, 64, nInputLength );
+
+	CUtlVector<unsigned char> compressed;
+	compressed.SetCount( nChunkLength );
+	CUtlVector<unsigned char> uncompressed;
+	uncompressed.SetCount( nChunkLength );
+
+	Msg( "%s: %d bytes in %d byte chunks\n", argv[0], nInputLength, nChunkLength );
+
+	static const int s_nEfforts[] = { LZSS_EFFORT_FASTEST, LZSS_EFFORT_DEFAULT, LZSS_EFFORT_BEST };
+	for ( int iEffort = 0; iEffort < ARRAYSIZE( s_nEfforts ); iEffort++ )
+	{
+		CLZSS lzss( DEFAULT_LZSS_WINDOW_SIZE, s_nEfforts[iEffort] );
+		int nOutputLength = 0;
+		int nUncompressedBytes = 0;
+		int nMismatches = 0;
+		double flCompressTime = 0.0;
+		double flUncompressTime = 0.0;
+
+		for ( int nOffset = 0; nOffset < nInputLength; nOffset += nChunkLength )
+		{
+			int nLength = MIN( nChunkLength, nInputLength - nOffset );
+
+			unsigned int nCompressedLength = 0;
+			double flStart = Plat_FloatTime();
+			bool bCompressed = lzss.CompressNoAlloc( pInput + nOffset, nLength, compressed.Base(), &nCompressedLength ) != NULL;
+			flCompressTime += Plat_FloatTime() - flStart;
+
+			// Incompressible chunks get sent as they are
+			if ( !bCompressed )
+			{
+				nOutputLength += nLength;
+				continue;
+			}
+			nOutputLength += nCompressedLength;
+
+			flStart = Plat_FloatTime();
+			unsigned int nUncompressedLength = lzss.SafeUncompress( compressed.Base(), nCompressedLength, uncompressed.Base(), nChunkLength );
+			flUncompressTime += Plat_FloatTime() - flStart;
+			nUncompressedBytes += nLength;
+
+			if ( nUncompressedLength != (unsigned int)nLength || V_memcmp( uncompressed.Base(), pInput + nOffset, nLength ) )
+			{
+				++nMismatches;
+			}
+		}
+
+		Msg( "  effort %4d: ratio %.3f, compress %6.1f MB/s, uncompress %6.1f MB/s%s\n", s_nEfforts[iEffort],
+			(float)nOutputLength / nInputLength,
+			nInputLength / ( 1024.0 * 1024.0 ) / MAX( flCompressTime, 1e-9 ),
+			nUncompressedBytes / ( 1024.0 * 1024.0 ) / MAX( flUncompressTime, 1e-9 ),
+			nMismatches ? " ROUNDTRIP FAILED" : "" );
+	}
+	return true;
+}
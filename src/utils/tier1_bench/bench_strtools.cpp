@@ -0,0 +1,94 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Times the case-insensitive string compares and searches at each
+//			vector width, on the kind of strings the game compares: classnames,
+//			as FClassnameIs does, and sound names
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "tier0/platform.h"
+#include "tier1/strtools.h"
+#include "tier1_bench.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define STRTOOLS_BENCH_MAX_PROBES	256
+
+static volatile unsigned int s_nStrToolsBenchSink;
+
+bool Benchmark_StrTools( int argc, char **argv )
+{
+	if ( argc < 2 )
+		return false;
+
+	CUtlBuffer classnameBuf;
+	CUtlVector<const char *> classnames;
+	CUtlBuffer soundBuf;
+	CUtlVector<const char *> sounds;
+	if ( !LoadBenchKeys( argv[0], classnameBuf, classnames ) || !LoadBenchKeys( argv[1], soundBuf, sounds ) )
+		return true;
+
+	if ( !classnames.Count() || !sounds.Count() )
+	{
+		Msg( "strtools: no classnames or sound names\n" );
+		return true;
+	}
+
+	// Compare an even spread of the classnames against all of them, as FClassnameIs would
+	CUtlVector<const char *> probes;
+	int nStride = MAX( 1, classnames.Count() / STRTOOLS_BENCH_MAX_PROBES );
+	for ( int i = 0; i < classnames.Count() && probes.Count() < STRTOOLS_BENCH_MAX_PROBES; i += nStride )
+	{
+		probes.AddToTail( classnames[i] );
+	}
+
+	static const char *s_pszSearches[] = { "weapon", "player.", "_impact", ".single" };
+	static const char *s_pszLevels[] = { "scalar", "SSE2", "AVX2" };
+
+	Msg( "%d classnames against %d of them, %d sound names\n", classnames.Count(), probes.Count(), sounds.Count() );
+
+	EStringSIMDLevel eDefault = V_GetStringSIMDLevel();
+	for ( int nLevel = STRINGSIMD_NONE; nLevel <= eDefault; nLevel++ )
+	{
+		V_SetStringSIMDLevel( (EStringSIMDLevel)nLevel );
+		unsigned int nSink = 0;
+
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < probes.Count(); i++ )
+		{
+			for ( int j = 0; j < classnames.Count(); j++ )
+			{
+				nSink += V_stricmp( probes[i], classnames[j] );
+			}
+		}
+		double flStricmp = ( Plat_FloatTime() - flStart ) * 1e9 / ( probes.Count() * classnames.Count() );
+
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < probes.Count(); i++ )
+		{
+			int nLength = V_strlen( probes[i] );
+			for ( int j = 0; j < classnames.Count(); j++ )
+			{
+				nSink += V_strnicmp( probes[i], classnames[j], nLength );
+			}
+		}
+		double flStrnicmp = ( Plat_FloatTime() - flStart ) * 1e9 / ( probes.Count() * classnames.Count() );
+
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < sounds.Count(); i++ )
+		{
+			for ( int j = 0; j < ARRAYSIZE( s_pszSearches ); j++ )
+			{
+				nSink += V_stristr( sounds[i], s_pszSearches[j] ) != NULL;
+			}
+		}
+		double flStristr = ( Plat_FloatTime() - flStart ) * 1e9 / ( sounds.Count() * ARRAYSIZE( s_pszSearches ) );
+
+		s_nStrToolsBenchSink = nSink;
+		Msg( "  %-6s  stricmp %5.1f ns  strnicmp %5.1f ns  stristr %5.1f ns\n", s_pszLevels[nLevel], flStricmp, flStrnicmp, flStristr );
+	}
+	V_SetStringSIMDLevel( eDefault );
+	return true;
+}
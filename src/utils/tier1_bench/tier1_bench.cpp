@@ -0,0 +1,129 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Microbenchmarks for tier1, run outside the game
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include <stdio.h>
+#include <string.h>
+#include "tier0/dbg.h"
+#include "tier0/icommandline.h"
+#include "tier1/strtools.h"
+#include "tier1_bench.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static const struct
+{
+	const char		*m_pszName;
+	BenchmarkFunc_t	m_pfnBenchmark;
+	const char		*m_pszUsage;
+} s_Benchmarks[] =
+{
+	{ "checksum",		Benchmark_Checksum,		"checksum <file>: CRC32, SHA-1 and MD5 throughput on a file, such as a map, with and without the hardware paths" },
+	{ "containers",		Benchmark_Containers,	"containers [lists] [attributes]: copies made building a CUtlVector and a CUtlMap of attribute lists by copy, Swap(), move and emplace" },
+	{ "datamanager",	Benchmark_DataManager,	"datamanager [threads]: touch and lock throughput of each CDataManager mode" },
+	{ "hash",			Benchmark_Hash,			"hash <key file> [...]: string hash speed and spread on keys, one per line, such as classnames or sound names" },
+	{ "lzss",			Benchmark_LZSS,			"lzss <file> [chunk bytes]: LZSS ratio and speed on a file, such as a demo, at each effort level" },
+	{ "strtools",		Benchmark_StrTools,		"strtools <classname file> <sound name file>: V_stricmp, V_strnicmp and V_stristr at each SIMD level" },
+};
+
+SpewRetval_t Tier1BenchOutputFunc( SpewType_t spewType, char const *pMsg )
+{
+	printf( "%s", pMsg );
+	fflush( stdout );
+
+	if ( spewType == SPEW_ERROR )
+		return SPEW_ABORT;
+	return ( spewType == SPEW_ASSERT ) ? SPEW_DEBUGGER : SPEW_CONTINUE;
+}
+
+bool LoadBenchFile( const char *pszFile, CUtlBuffer &buf )
+{
+	FILE *fp = fopen( pszFile, "rb" );
+	if ( !fp )
+	{
+		Warning( "Couldn't open %s\n", pszFile );
+		return false;
+	}
+
+	fseek( fp, 0, SEEK_END );
+	long nLength = ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+
+	buf.Purge();
+	buf.EnsureCapacity( nLength + 1 );
+	bool bOK = nLength > 0 && fread( buf.Base(), 1, nLength, fp ) == (size_t)nLength;
+	fclose( fp );
+	if ( !bOK )
+	{
+		Warning( "Couldn't read %s\n", pszFile );
+		return false;
+	}
+
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, nLength );
+	return true;
+}
+
+bool LoadBenchKeys( const char *pszFile, CUtlBuffer &buf, CUtlVector< const char * > &keys )
+{
+	if ( !LoadBenchFile( pszFile, buf ) )
+		return false;
+
+	// Terminate each line in place
+	buf.PutChar( '\0' );
+	char *pszLine = (char *)buf.Base();
+	while ( *pszLine )
+	{
+		char *pszEnd = pszLine + strcspn( pszLine, "\r\n" );
+		bool bLast = !*pszEnd;
+		*pszEnd = '\0';
+		if ( *pszLine )
+		{
+			keys.AddToTail( pszLine );
+		}
+		if ( bLast )
+			break;
+		pszLine = pszEnd + 1;
+	}
+	return true;
+}
+
+static void Usage( void )
+{
+	Msg( "Usage: tier1_bench <benchmark> [args]\n" );
+	for ( int i = 0; i < ARRAYSIZE( s_Benchmarks ); i++ )
+	{
+		Msg( "  %s\n", s_Benchmarks[i].m_pszUsage );
+	}
+}
+
+int main( int argc, char **argv )
+{
+	SpewOutputFunc( Tier1BenchOutputFunc );
+	CommandLine()->CreateCmdLine( argc, argv );
+
+	if ( argc < 2 )
+	{
+		Usage();
+		return -1;
+	}
+
+	for ( int i = 0; i < ARRAYSIZE( s_Benchmarks ); i++ )
+	{
+		if ( V_stricmp( argv[1], s_Benchmarks[i].m_pszName ) )
+			continue;
+
+		if ( !s_Benchmarks[i].m_pfnBenchmark( argc - 2, argv + 2 ) )
+		{
+			Msg( "Usage: tier1_bench %s\n", s_Benchmarks[i].m_pszUsage );
+			return -1;
+		}
+		return 0;
+	}
+
+	Usage();
+	return -1;
+}
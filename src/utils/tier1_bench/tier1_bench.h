@@ -0,0 +1,38 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Microbenchmarks for tier1, run outside the game
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef TIER1_BENCH_H
+#define TIER1_BENCH_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlbuffer.h"
+#include "tier1/utlvector.h"
+
+//-----------------------------------------------------------------------------
+// Each benchmark gets the arguments after its name and prints its own results.
+// Returns false if the arguments were bad, so the usage gets printed.
+//-----------------------------------------------------------------------------
+typedef bool (*BenchmarkFunc_t)( int argc, char **argv );
+
+bool Benchmark_Checksum( int argc, char **argv );
+bool Benchmark_Containers( int argc, char **argv );
+bool Benchmark_DataManager( int argc, char **argv );
+bool Benchmark_Hash( int argc, char **argv );
+bool Benchmark_LZSS( int argc, char **argv );
+bool Benchmark_StrTools( int argc, char **argv );
+
+//-----------------------------------------------------------------------------
+// Input for the benchmarks, read straight from disk rather than through the
+// filesystem. LoadBenchKeys splits a file into its lines, one key per line,
+// with the strings pointing into buf.
+//-----------------------------------------------------------------------------
+bool LoadBenchFile( const char *pszFile, CUtlBuffer &buf );
+bool LoadBenchKeys( const char *pszFile, CUtlBuffer &buf, CUtlVector< const char * > &keys );
+
+#endif // TIER1_BENCH_H
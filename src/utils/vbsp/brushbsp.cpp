@@ -9,10 +9,16 @@
 #include "vbsp.h"
 
 
-int		c_nodes;
-int		c_nonvis;
 int		c_active_brushes;
 
+// Node counts for the tree BrushBSP is building. Subtrees of one tree are built on several
+// threads, and blocks build their own trees at the same time, so each tree has its own.
+struct buildtreecounts_t
+{
+	CInterlockedInt	m_nNodes;
+	CInterlockedInt	m_nNonVis;
+};
+
 // if a brush just barely pokes onto the other side,
 // let it slide by without chopping
 #define	PLANESIDE_EPSILON	0.001
@@ -310,17 +316,15 @@ AllocNode
 */
 node_t *AllocNode (void)
 {
-	static int s_NodeCount = 0;
+	static CInterlockedInt s_NodeCount = 0;
 
 	node_t	*node;
 
 	node = (node_t*)malloc(sizeof(*node));
 	memset (node, 0, sizeof(*node));
-	node->id = s_NodeCount;
+	node->id = s_NodeCount++;
 	node->diskId = -1;
 
-	s_NodeCount++;
-
 	return node;
 }
 
@@ -332,7 +336,7 @@ AllocBrush
 */
 bspbrush_t *AllocBrush (int numsides)
 {
-	static int s_BrushId = 0;
+	static CInterlockedInt s_BrushId = 0;
 
 	bspbrush_t	*bb;
 	int			c;
@@ -849,7 +853,7 @@ Returns NULL if there are no valid planes to split with..
 ================
 */
 
-side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
+side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node, buildtreecounts_t &counts)
 {
 	int			value, bestvalue;
 	bspbrush_t	*brush, *test;
@@ -977,8 +981,7 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 		{
 			if (pass > 0)
 			{
-				if (numthreads == 1)
-					c_nonvis++;
+				counts.m_nNonVis++;
 			}
 			break;
 		}
@@ -1331,18 +1334,17 @@ BuildTree_r
 */
 
 
-node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
+// Splits node with the best plane for brushes, or makes it a leaf and returns false.
+static bool BuildNode (node_t *node, bspbrush_t *brushes, bspbrush_t *children[2], buildtreecounts_t &counts)
 {
 	node_t		*newnode;
 	side_t		*bestside;
 	int			i;
-	bspbrush_t	*children[2];
 
-	if (numthreads == 1)
-		c_nodes++;
+	counts.m_nNodes++;
 
 	// find the best plane to use as a splitter
-	bestside = SelectSplitSide (brushes, node);
+	bestside = SelectSplitSide (brushes, node, counts);
 
 	if (!bestside)
 	{
@@ -1350,7 +1352,7 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 		node->side = NULL;
 		node->planenum = -1;
 		LeafNode (node, brushes);
-		return node;
+		return false;
 	}
 			 
 	// this is a splitplane node
@@ -1371,14 +1373,100 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 	SplitBrush (node->volume, node->planenum, &node->children[0]->volume,
 		&node->children[1]->volume);
 
-	// recursively process children
-	for (i=0 ; i<2 ; i++)
+	return true;
+}
+
+node_t *BuildTree_r (node_t *node, bspbrush_t *brushes, buildtreecounts_t &counts)
+{
+	bspbrush_t	*children[2];
+
+	if (BuildNode (node, brushes, children, counts))
 	{
-		node->children[i] = BuildTree_r (node->children[i], children[i]);
+		// recursively process children
+		for (int i=0 ; i<2 ; i++)
+		{
+			node->children[i] = BuildTree_r (node->children[i], children[i], counts);
+		}
 	}
 
 	return node;
 }
+
+
+//-----------------------------------------------------------------------------
+// Big trees built on the main thread (a map with only a few blocks, or a large
+// brush model) are split near the top on this thread, then the subtrees below
+// are built on the worker threads. Each subtree comes out just as BuildTree_r
+// would have built it.
+//-----------------------------------------------------------------------------
+
+// Lists smaller than this are built on the calling thread.
+#define BUILDTREE_THREADS_MIN_BRUSHES	512
+
+struct buildtreetask_t
+{
+	node_t		*m_pNode;
+	bspbrush_t	*m_pBrushes;
+	int			m_nBrushes;
+};
+
+static CUtlVector<buildtreetask_t> g_BuildTreeTasks;
+static buildtreecounts_t *s_pBuildTreeCounts;
+
+static void BuildTree_Thread (int iThread, int iTask)
+{
+	buildtreetask_t &task = g_BuildTreeTasks[iTask];
+	BuildTree_r (task.m_pNode, task.m_pBrushes, *s_pBuildTreeCounts);
+}
+
+static int BuildTreeTaskSortFn (const void *p1, const void *p2)
+{
+	// biggest subtrees first so they don't finish last
+	return ((const buildtreetask_t *)p2)->m_nBrushes - ((const buildtreetask_t *)p1)->m_nBrushes;
+}
+
+// Builds the top of the tree until the lists are down to nMaxBrushes, and queues up what's left
+static void BuildTreeTop_r (node_t *node, bspbrush_t *brushes, int nMaxBrushes, buildtreecounts_t &counts)
+{
+	int nBrushes = CountBrushList (brushes);
+	if (nBrushes <= nMaxBrushes)
+	{
+		buildtreetask_t &task = g_BuildTreeTasks[g_BuildTreeTasks.AddToTail()];
+		task.m_pNode = node;
+		task.m_pBrushes = brushes;
+		task.m_nBrushes = nBrushes;
+		return;
+	}
+
+	bspbrush_t	*children[2];
+	if (BuildNode (node, brushes, children, counts))
+	{
+		for (int i=0 ; i<2 ; i++)
+		{
+			BuildTreeTop_r (node->children[i], children[i], nMaxBrushes, counts);
+		}
+	}
+}
+
+static void BuildTree (node_t *node, bspbrush_t *brushes, buildtreecounts_t &counts)
+{
+	int nBrushes = CountBrushList (brushes);
+	if (!g_bThreadedPhases || nBrushes < BUILDTREE_THREADS_MIN_BRUSHES || numthreads <= 1 || RunThreadsActive())
+	{
+		BuildTree_r (node, brushes, counts);
+		return;
+	}
+
+	// Aim for several subtrees per thread so the stealing can even them out
+	g_BuildTreeTasks.RemoveAll();
+	BuildTreeTop_r (node, brushes, MAX (nBrushes / (numthreads * 8), BUILDTREE_THREADS_MIN_BRUSHES / 4), counts);
+	qsort (g_BuildTreeTasks.Base(), g_BuildTreeTasks.Count(), sizeof(buildtreetask_t), BuildTreeTaskSortFn);
+
+	s_pBuildTreeCounts = &counts;
+	RunThreadsOnIndividual (g_BuildTreeTasks.Count(), false, BuildTree_Thread);
+	s_pBuildTreeCounts = NULL;
+	g_BuildTreeTasks.RemoveAll();
+}
 	  
 
 //===========================================================
@@ -1439,18 +1527,17 @@ tree_t *BrushBSP (bspbrush_t *brushlist, Vector& mins, Vector& maxs)
 	qprintf ("%5i visible faces\n", c_faces);
 	qprintf ("%5i nonvisible faces\n", c_nonvisfaces);
 
-	c_nodes = 0;
-	c_nonvis = 0;
+	buildtreecounts_t counts;
 	node = AllocNode ();
 
 	node->volume = BrushFromBounds (mins, maxs);
 
 	tree->headnode = node;
 
-	node = BuildTree_r (node, brushlist);
-	qprintf ("%5i visible nodes\n", c_nodes/2 - c_nonvis);
-	qprintf ("%5i nonvis nodes\n", c_nonvis);
-	qprintf ("%5i leafs\n", (c_nodes+1)/2);
+	BuildTree (node, brushlist, counts);
+	qprintf ("%5i visible nodes\n", counts.m_nNodes/2 - counts.m_nNonVis);
+	qprintf ("%5i nonvis nodes\n", (int)counts.m_nNonVis);
+	qprintf ("%5i leafs\n", (counts.m_nNodes+1)/2);
 #if 0
 {	// debug code
 static node_t	*tnode;
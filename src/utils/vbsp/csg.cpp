@@ -156,8 +156,12 @@ qboolean BrushesDisjoint (bspbrush_t *a, bspbrush_t *b)
 }
 
 
-int		minplanenums[3];
-int		maxplanenums[3];
+// The planes of the box MakeBspBrushList clips to. Blocks are clipped on several threads at once.
+struct clipplanes_t
+{
+	int		minplanenums[2];
+	int		maxplanenums[2];
+};
 
 /*
 ===============
@@ -166,8 +170,11 @@ ClipBrushToBox
 Any planes shared with the box edge will be set to no texinfo
 ===============
 */
-bspbrush_t	*ClipBrushToBox (bspbrush_t *brush, const Vector& clipmins, const Vector& clipmaxs)
+static bspbrush_t *ClipBrushToBox (bspbrush_t *brush, const Vector& clipmins, const Vector& clipmaxs, const clipplanes_t &planes)
 {
+	const int *minplanenums = planes.minplanenums;
+	const int *maxplanenums = planes.maxplanenums;
+
 	int		i, j;
 	bspbrush_t	*front,	*back;
 	int		p;
@@ -213,7 +220,7 @@ bspbrush_t	*ClipBrushToBox (bspbrush_t *brush, const Vector& clipmins, const Vec
 //-----------------------------------------------------------------------------
 // Creates a clipped brush from a map brush
 //-----------------------------------------------------------------------------
-static bspbrush_t *CreateClippedBrush( mapbrush_t *mb, const Vector& clipmins, const Vector& clipmaxs )
+static bspbrush_t *CreateClippedBrush( mapbrush_t *mb, const Vector& clipmins, const Vector& clipmaxs, const clipplanes_t &planes )
 {
 	int nNumSides = mb->numsides;
 	if (!nNumSides)
@@ -254,7 +261,7 @@ static bspbrush_t *CreateClippedBrush( mapbrush_t *mb, const Vector& clipmins, c
 	VectorCopy (mb->maxs, newbrush->maxs);
 
 	// carve off anything outside the clip box
-	newbrush = ClipBrushToBox (newbrush, clipmins, clipmaxs);
+	newbrush = ClipBrushToBox (newbrush, clipmins, clipmaxs, planes);
 	return newbrush;
 }
 
@@ -262,7 +269,7 @@ static bspbrush_t *CreateClippedBrush( mapbrush_t *mb, const Vector& clipmins, c
 //-----------------------------------------------------------------------------
 // Creates a clipped brush from a map brush
 //-----------------------------------------------------------------------------
-static void ComputeBoundingPlanes( const Vector& clipmins, const Vector& clipmaxs )
+static void ComputeBoundingPlanes( const Vector& clipmins, const Vector& clipmaxs, clipplanes_t &planes )
 {
 	Vector normal;
 	float dist;
@@ -271,9 +278,9 @@ static void ComputeBoundingPlanes( const Vector& clipmins, const Vector& clipmax
 		VectorClear (normal);
 		normal[i] = 1;
 		dist = clipmaxs[i];
-		maxplanenums[i] = g_MainMap->FindFloatPlane (normal, dist);
+		planes.maxplanenums[i] = g_MainMap->FindFloatPlane (normal, dist);
 		dist = clipmins[i];
-		minplanenums[i] = g_MainMap->FindFloatPlane (normal, dist);
+		planes.minplanenums[i] = g_MainMap->FindFloatPlane (normal, dist);
 	}
 }
 
@@ -365,6 +372,9 @@ void FixupAreaportalWaterBrushes( bspbrush_t *pList )
 			if ( !pIntersect )
 				continue;
 			FreeBrush( pIntersect );
+
+			// Blocks that share the map brushes are fixed up on several threads
+			ThreadLock();
 			pAreaportal->original->contents |= pWater->original->contents;
 
 			// HACKHACK: Ideally, this should have been done before the bspbrush_t was 
@@ -372,6 +382,7 @@ void FixupAreaportalWaterBrushes( bspbrush_t *pList )
 			// brush's sides
 			CopyMatchingTexinfos( pAreaportal->sides, pAreaportal->numsides, pWater );
 			CopyMatchingTexinfos( pAreaportal->original->original_sides, pAreaportal->original->numsides, pWater );
+			ThreadUnlock();
 		}
 	}
 }
@@ -383,7 +394,8 @@ void FixupAreaportalWaterBrushes( bspbrush_t *pList )
 // UNDONE: Put detail brushes in a separate brush array and pass that instead of "onlyDetail" ?
 bspbrush_t *MakeBspBrushList (int startbrush, int endbrush, const Vector& clipmins, const Vector& clipmaxs, int detailScreen)
 {
-	ComputeBoundingPlanes( clipmins, clipmaxs );
+	clipplanes_t planes;
+	ComputeBoundingPlanes( clipmins, clipmaxs, planes );
 
 	bspbrush_t	*pBrushList = NULL;
 
@@ -402,7 +414,7 @@ bspbrush_t *MakeBspBrushList (int startbrush, int endbrush, const Vector& clipmi
 			}
 		}
 
-		bspbrush_t *pNewBrush = CreateClippedBrush( mb, clipmins, clipmaxs );
+		bspbrush_t *pNewBrush = CreateClippedBrush( mb, clipmins, clipmaxs, planes );
 		if ( pNewBrush )
 		{
 			pNewBrush->next = pBrushList;
@@ -419,12 +431,13 @@ bspbrush_t *MakeBspBrushList (int startbrush, int endbrush, const Vector& clipmi
 //-----------------------------------------------------------------------------
 bspbrush_t *MakeBspBrushList (mapbrush_t **pBrushes, int nBrushCount, const Vector& clipmins, const Vector& clipmaxs)
 {
-	ComputeBoundingPlanes( clipmins, clipmaxs );
+	clipplanes_t planes;
+	ComputeBoundingPlanes( clipmins, clipmaxs, planes );
 
 	bspbrush_t	*pBrushList = NULL;
 	for ( int i=0; i < nBrushCount; ++i )
 	{
-		bspbrush_t *pNewBrush = CreateClippedBrush( pBrushes[i], clipmins, clipmaxs );
+		bspbrush_t *pNewBrush = CreateClippedBrush( pBrushes[i], clipmins, clipmaxs, planes );
 		if ( pNewBrush )
 		{
 			pNewBrush->next = pBrushList;
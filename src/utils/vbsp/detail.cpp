@@ -180,6 +180,17 @@ face_t *FilterFacesIntoTree( tree_t *out, face_t *pFaces )
 }
 
 
+// Merge the planes on the calling thread when there are fewer than this.
+#define MERGE_THREADS_MIN_PLANES	256
+
+static face_t **s_pMergePlaneList;
+static CUtlVector<int> s_MergePlanes;
+
+static void MergePlaneFaces_Thread( int iThread, int iPlane )
+{
+	MergeFaceList( &s_pMergePlaneList[ s_MergePlanes[iPlane] ] );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Splits the face list into faces from the same plane and tries to merge
 //			them if possible
@@ -215,15 +226,33 @@ void TryMergeFaceList( face_t **pFaceList )
 		pFaces = next;
 	}
 
-	// now merge each plane's list of faces
-	int merged = 0;
+	// now merge each plane's list of faces, which don't depend on each other
+	s_MergePlanes.RemoveAll();
 	for ( int i = 0; i < g_MainMap->nummapplanes; i++ )
 	{
 		if ( pPlaneList[i] )
 		{
-			MergeFaceList( &pPlaneList[i] );
+			s_MergePlanes.AddToTail( i );
+		}
+	}
+	if ( g_bThreadedPhases && s_MergePlanes.Count() >= MERGE_THREADS_MIN_PLANES && numthreads > 1 && !RunThreadsActive() )
+	{
+		s_pMergePlaneList = pPlaneList;
+		RunThreadsOnIndividual( s_MergePlanes.Count(), false, MergePlaneFaces_Thread );
+		s_pMergePlaneList = NULL;
+	}
+	else
+	{
+		for ( int i = 0; i < s_MergePlanes.Count(); i++ )
+		{
+			MergeFaceList( &pPlaneList[ s_MergePlanes[i] ] );
 		}
-		
+	}
+	s_MergePlanes.Purge();
+
+	int merged = 0;
+	for ( int i = 0; i < g_MainMap->nummapplanes; i++ )
+	{
 		// move these over to the output face list
 		face_t *list = pPlaneList[i];
 		while ( list )
@@ -316,10 +316,51 @@ void LoadEmitDetailObjectDictionary( const char* pGameDir )
 }
 
 
+//-----------------------------------------------------------------------------
+// Random numbers for placing the details on one face. Faces are placed on
+// several threads, so each one gets its own generator seeded with its hammer
+// face id. Rand() steps the same LCG as the MSVC rand() the placement used to
+// be seeded through, so maps come out the same as before on Windows (and now
+// also on Linux, where rand() is a different generator).
+//
+// The sprite scales aren't drawn here: the old Gaussian stream carried its
+// cached second value from one face to the next, so they're drawn in face
+// order when the placements are added to the lump.
+//-----------------------------------------------------------------------------
+class CDetailRandom
+{
+public:
+	CDetailRandom( int nSeed ) : m_nState( nSeed )
+	{
+	}
+
+	// Uniform in [0,1]
+	float Rand()
+	{
+		m_nState = m_nState * 214013 + 2531011;
+		return (float)( ( m_nState >> 16 ) & VALVE_RAND_MAX ) / (float)VALVE_RAND_MAX;
+	}
+
+private:
+	unsigned int			m_nState;
+};
+
+
+//-----------------------------------------------------------------------------
+// A detail placed on a face, added to the lump once all the faces are done
+//-----------------------------------------------------------------------------
+struct DetailPlacement_t
+{
+	DetailModel_t const	*m_pModel;
+	Vector				m_Origin;
+	QAngle				m_Angles;
+};
+
+
 //-----------------------------------------------------------------------------
 // Selects a detail group
 //-----------------------------------------------------------------------------
-static int SelectGroup( const DetailObject_t& detail, float alpha )
+static int SelectGroup( const DetailObject_t& detail, float alpha, CDetailRandom &random )
 {
 	// Find the two groups whose alpha we're between...
 	int start, end;
@@ -345,7 +386,7 @@ static int SelectGroup( const DetailObject_t& detail, float alpha )
 	}
 
 	// Pick a number, any number...
-	float r = rand() / (float)VALVE_RAND_MAX;
+	float r = random.Rand();
 
 	// When dist == 0, we *always* want start.
 	// When dist == 1, we *always* want end
@@ -357,10 +398,10 @@ static int SelectGroup( const DetailObject_t& detail, float alpha )
 //-----------------------------------------------------------------------------
 // Selects a detail object
 //-----------------------------------------------------------------------------
-static int SelectDetail( DetailObjectGroup_t const& group )
+static int SelectDetail( DetailObjectGroup_t const& group, CDetailRandom &random )
 {
 	// Pick a number, any number...
-	float r = rand() / (float)VALVE_RAND_MAX;
+	float r = random.Rand();
 
 	// Look through the list of models + pick the one associated with this number
 	for ( int i = 0; i < group.m_Models.Count(); ++i )
@@ -545,7 +586,8 @@ static void AddDetailSpriteToLump( const Vector &vecOrigin, const QAngle &vecAng
 // (only when not in the debugger?)
 // Printing the values of normal at the bottom of the function fixes it as does
 // disabling global optimizations.
-static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vector& normal )
+static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vector& normal,
+						CDetailRandom &random, CUtlVector<DetailPlacement_t> &placements )
 {
 	// But only place it on the surface if it meets the angle constraints...
 	float cosAngle = normal.z;
@@ -560,7 +602,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 		float probability = (cosAngle - model.m_MaxCosAngle) / 
 			(model.m_MinCosAngle - model.m_MaxCosAngle);
 
-		float t = rand() / (float)VALVE_RAND_MAX;
+		float t = random.Rand();
 		if (t > probability)
 			return;
 	}
@@ -570,7 +612,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 	if (model.m_Flags & MODELFLAG_UPRIGHT)
 	{
 		// If it's upright, we just select a random yaw
-		angles.Init( 0, 360.0f * rand() / (float)VALVE_RAND_MAX, 0.0f );
+		angles.Init( 0, 360.0f * random.Rand(), 0.0f );
 	}
 	else
 	{
@@ -594,7 +636,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 		matrix.SetBasisVectors( xaxis, yaxis, zaxis );
 		matrix.SetTranslation( vec3_origin );
 
-		float rotAngle = 360.0f * rand() / (float)VALVE_RAND_MAX;
+		float rotAngle = 360.0f * random.Rand();
 		VMatrix rot = SetupMatrixAxisRot( Vector( 0, 0, 1 ), rotAngle );
 		matrix = matrix * rot;
 
@@ -603,11 +645,26 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 
 	// FIXME: We may also want a purely random rotation too
 
+	DetailPlacement_t &placement = placements[ placements.AddToTail() ];
+	placement.m_pModel = &model;
+	placement.m_Origin = pt;
+	placement.m_Angles = angles;
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds a placed detail to the lump. Call in face order, after seeding the
+// random stream for the face, so sprite scales come out as they always have.
+//-----------------------------------------------------------------------------
+static void AddPlacementToLump( const DetailPlacement_t &placement )
+{
+	DetailModel_t const& model = *placement.m_pModel;
+
 	// Insert an element into the object dictionary if it aint there...
 	switch ( model.m_Type )
 	{
 	case DETAIL_PROP_TYPE_MODEL:
-		AddDetailToLump( model.m_ModelName.String(), pt, angles, model.m_Orientation );
+		AddDetailToLump( model.m_ModelName.String(), placement.m_Origin, placement.m_Angles, model.m_Orientation );
 		break;
 
 	// Sprites and procedural models made from sprites
@@ -620,7 +677,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 				flScale = fabs( RandomGaussianFloat( 1.0f, model.m_flRandomScaleStdDev ) );
 			}
 
-			AddDetailSpriteToLump( pt, angles, model, flScale );
+			AddDetailSpriteToLump( placement.m_Origin, placement.m_Angles, model, flScale );
 		}
 		break;
 	}
@@ -630,7 +687,8 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 //-----------------------------------------------------------------------------
 // Places Detail Objects on a face
 //-----------------------------------------------------------------------------
-static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
+static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail,
+									CDetailRandom &random, CUtlVector<DetailPlacement_t> &placements )
 {
 	if (pFace->numedges < 3)
 		return;
@@ -666,8 +724,8 @@ static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
 		for (int i = 0; i < numSamples; ++i )
 		{
 			// Create a random sample...
-			float u = rand() / (float)VALVE_RAND_MAX;
-			float v = rand() / (float)VALVE_RAND_MAX;
+			float u = random.Rand();
+			float v = random.Rand();
 			if (v > 1.0f - u)
 			{
 				u = 1.0f - u;
@@ -679,10 +737,10 @@ static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
 			float alpha = 1.0f;
 
 			// Select a group based on the alpha value
-			int group = SelectGroup( detail, alpha );
+			int group = SelectGroup( detail, alpha, random );
 
 			// Now that we've got a group, choose a detail
-			int model = SelectDetail( detail.m_Groups[group] );
+			int model = SelectDetail( detail.m_Groups[group], random );
 			if (model < 0)
 				continue;
 
@@ -692,7 +750,7 @@ static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
 			VectorMA( pt, v, e2, pt );
 			VectorDivide( areaVec, -normalLength, normal );
 
-			PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal );
+			PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal, random, placements );
 		}
 	}
 }
@@ -735,7 +793,8 @@ static float ComputeDisplacementFaceArea( dface_t* pFace )
 // Places Detail Objects on a face
 //-----------------------------------------------------------------------------
 static void EmitDetailObjectsOnDisplacementFace( dface_t* pFace, 
-						DetailObject_t& detail, CCoreDispInfo& coreDispInfo )
+						DetailObject_t& detail, CCoreDispInfo& coreDispInfo,
+						CDetailRandom &random, CUtlVector<DetailPlacement_t> &placements )
 {
 	assert(pFace->numedges == 4);
 
@@ -752,8 +811,8 @@ static void EmitDetailObjectsOnDisplacementFace( dface_t* pFace,
 	for (int i = 0; i < numSamples; ++i )
 	{
 		// Create a random sample...
-		float u = rand() / (float)VALVE_RAND_MAX;
-		float v = rand() / (float)VALVE_RAND_MAX;
+		float u = random.Rand();
+		float v = random.Rand();
 
 		// Compute alpha
 		float alpha;
@@ -762,15 +821,15 @@ static void EmitDetailObjectsOnDisplacementFace( dface_t* pFace,
 		alpha /= 255.0f;
 
 		// Select a group based on the alpha value
-		int group = SelectGroup( detail, alpha );
+		int group = SelectGroup( detail, alpha, random );
 
 		// Now that we've got a group, choose a detail
-		int model = SelectDetail( detail.m_Groups[group] );
+		int model = SelectDetail( detail.m_Groups[group], random );
 		if (model < 0)
 			continue;
 
 		// Got a detail! Place it on the surface...
-		PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal );
+		PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal, random, placements );
 	}
 }
 
@@ -829,19 +888,57 @@ static void SetLumpData( )
 }
 
 
+//-----------------------------------------------------------------------------
+// Faces with detail objects on them, placed on worker threads
+//-----------------------------------------------------------------------------
+struct DetailFace_t
+{
+	int				m_nFace;
+	DetailObject_t	*m_pDetail;
+};
+
+static CUtlVector<DetailFace_t> s_DetailFaces;
+static CUtlVector<DetailPlacement_t> *s_pDetailFacePlacements;
+
+static void EmitDetailObjectsOnFace_Thread( int iThread, int iDetailFace )
+{
+	const DetailFace_t &detailFace = s_DetailFaces[iDetailFace];
+	dface_t *pFace = &dfaces[detailFace.m_nFace];
+	CUtlVector<DetailPlacement_t> &placements = s_pDetailFacePlacements[iDetailFace];
+
+	// Seed the placement from the hammer face num so it doesn't change between compiles.
+	int	detailpropseed = dfaceids[detailFace.m_nFace].hammerfaceid;
+#ifdef WARNSEEDNUMBER
+	Warning( "[%d]\n",detailpropseed );
+#endif
+	CDetailRandom random( detailpropseed );
+
+	if (pFace->dispinfo < 0)
+	{
+		EmitDetailObjectsOnFace( pFace, *detailFace.m_pDetail, random, placements );
+	}
+	else
+	{
+		// Get a CCoreDispInfo. All we need is the triangles and lightmap texture coordinates.
+		mapdispinfo_t *pMapDisp = &mapdispinfo[pFace->dispinfo];
+		CCoreDispInfo coreDispInfo;
+		DispMapToCoreDispInfo( pMapDisp, &coreDispInfo, NULL, NULL );
+
+		EmitDetailObjectsOnDisplacementFace( pFace, *detailFace.m_pDetail, coreDispInfo, random, placements );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Places Detail Objects in the level
 //-----------------------------------------------------------------------------
 void EmitDetailModels()
 {
-	StartPacifier("Placing detail props : ");
-
-	// Place stuff on each face
+	// Find the faces with detail objects on them. The material lookups aren't thread safe.
+	s_DetailFaces.RemoveAll();
 	dface_t* pFace = dfaces;
 	for (int j = 0; j < numfaces; ++j)
 	{
-		UpdatePacifier( (float)j / (float)numfaces );
-
 		// Get at the material associated with this face
 		texinfo_t* pTexInfo = &texinfo[pFace[j].texinfo];
 		dtexdata_t* pTexData = GetTexData( pTexInfo->texdata );
@@ -871,32 +968,44 @@ void EmitDetailModels()
 			continue;
 		}
 
-		// Emit objects on a particular face
-		DetailObject_t& detail = s_DetailObjectDict[objectType];
-
-		// Initialize the Random Number generators for detail prop placement based on the hammer Face num.
-		int	detailpropseed = dfaceids[j].hammerfaceid;
-#ifdef WARNSEEDNUMBER
-		Warning( "[%d]\n",detailpropseed );
-#endif
-		srand( detailpropseed );
-		RandomSeed( detailpropseed );
+		DetailFace_t &detailFace = s_DetailFaces[ s_DetailFaces.AddToTail() ];
+		detailFace.m_nFace = j;
+		detailFace.m_pDetail = &s_DetailObjectDict[objectType];
+	}
 
-		if (pFace[j].dispinfo < 0)
+	// Place stuff on each face
+	Msg( "Placing detail props : " );
+	s_pDetailFacePlacements = new CUtlVector<DetailPlacement_t>[ MAX( s_DetailFaces.Count(), 1 ) ];
+	if ( g_bThreadedPhases )
+	{
+		RunThreadsOnIndividual( s_DetailFaces.Count(), true, EmitDetailObjectsOnFace_Thread );
+	}
+	else
+	{
+		for (int j = 0; j < s_DetailFaces.Count(); ++j)
 		{
-			EmitDetailObjectsOnFace( &pFace[j], detail );
+			EmitDetailObjectsOnFace_Thread( 0, j );
 		}
-		else
-		{
-			// Get a CCoreDispInfo. All we need is the triangles and lightmap texture coordinates.
-			mapdispinfo_t *pMapDisp = &mapdispinfo[pFace[j].dispinfo];
-			CCoreDispInfo coreDispInfo;
-			DispMapToCoreDispInfo( pMapDisp, &coreDispInfo, NULL, NULL );
+		Msg( "done\n" );
+	}
+
+	// Add them to the lump in face order so the lump doesn't depend on the thread count
+	for (int j = 0; j < s_DetailFaces.Count(); ++j)
+	{
+		// The sprite scales come from the global stream, seeded per face just as before
+		RandomSeed( dfaceids[s_DetailFaces[j].m_nFace].hammerfaceid );
 
-			EmitDetailObjectsOnDisplacementFace( &pFace[j], detail, coreDispInfo );
+		const CUtlVector<DetailPlacement_t> &placements = s_pDetailFacePlacements[j];
+		for (int k = 0; k < placements.Count(); ++k)
+		{
+			AddPlacementToLump( placements[k] );
 		}
 	}
 
+	delete [] s_pDetailFacePlacements;
+	s_pDetailFacePlacements = NULL;
+	s_DetailFaces.Purge();
+
 	// Emit specifically specified detail props
 	Vector origin;
 	QAngle angles;
@@ -944,8 +1053,6 @@ void EmitDetailModels()
 			continue;
 		}
 	}
-
-	EndPacifier( true );
 }
 
 
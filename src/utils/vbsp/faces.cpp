@@ -30,8 +30,8 @@
 #define	POINT_EPSILON		0.1
 #define	OFF_EPSILON			0.25
 
-int	c_merge;
-int	c_subdivide;
+CInterlockedInt	c_merge;
+CInterlockedInt	c_subdivide;
 
 int	c_totalverts;
 int	c_uniqueverts;
@@ -787,18 +787,17 @@ face_t *FixTjuncs (node_t *headnode, face_t *pLeafFaceList)
 
 //========================================================
 
-int		c_faces;
+CInterlockedInt	c_faces;
 
 face_t	*AllocFace (void)
 {
-	static int s_FaceId = 0;
+	static CInterlockedInt s_FaceId = 0;
 
 	face_t	*f;
 
 	f = (face_t*)malloc(sizeof(*f));
 	memset (f, 0, sizeof(*f));
-	f->id = s_FaceId;
-	++s_FaceId;
+	f->id = s_FaceId++;
 
 	c_faces++;
 
@@ -1412,7 +1411,7 @@ mark the side that originally created it
   water / water : none
 ===============
 */
-void MakeFaces_r (node_t *node)
+void MakeFaces_r (node_t *node, CUtlVector<node_t *> &faceNodes)
 {
 	portal_t	*p;
 	int			s;
@@ -1420,14 +1419,12 @@ void MakeFaces_r (node_t *node)
 	// recurse down to leafs
 	if (node->planenum != PLANENUM_LEAF)
 	{
-		MakeFaces_r (node->children[0]);
-		MakeFaces_r (node->children[1]);
+		MakeFaces_r (node->children[0], faceNodes);
+		MakeFaces_r (node->children[1], faceNodes);
 
-		// merge together all visible faces on the node
-		if (!nomerge)
-			MergeFaceList(&node->faces);
-		if (!nosubdiv)
-			SubdivideFaceList(&node->faces);
+		// the faces on the node are all in now, merge them afterwards
+		if (node->faces)
+			faceNodes.AddToTail (node);
 
 		return;
 	}
@@ -1795,6 +1792,25 @@ void SplitSubdividedFaces( face_t *pLeafFaceList, node_t *headnode )
 MakeFaces
 ============
 */
+// Merge faces on the calling thread when there are fewer nodes with faces than this.
+#define MERGE_THREADS_MIN_NODES		256
+
+static CUtlVector<node_t *> g_MergeFaceNodes;
+
+// merge together all visible faces on a node
+static void MergeNodeFaces (node_t *node)
+{
+	if (!nomerge)
+		MergeFaceList(&node->faces);
+	if (!nosubdiv)
+		SubdivideFaceList(&node->faces);
+}
+
+static void MergeNodeFaces_Thread (int iThread, int iNode)
+{
+	MergeNodeFaces (g_MergeFaceNodes[iNode]);
+}
+
 void MakeFaces (node_t *node)
 {
 	qprintf ("--- MakeFaces ---\n");
@@ -1802,9 +1818,26 @@ void MakeFaces (node_t *node)
 	c_subdivide = 0;
 	c_nodefaces = 0;
 
-	MakeFaces_r (node);
+	// FaceFromPortal can create texinfos, so the faces are built on this thread.
+	// Merging and subdividing a node's faces only touches that node.
+	CUtlVector<node_t *> faceNodes;
+	MakeFaces_r (node, faceNodes);
+
+	if (g_bThreadedPhases && faceNodes.Count() >= MERGE_THREADS_MIN_NODES && numthreads > 1 && !RunThreadsActive())
+	{
+		g_MergeFaceNodes.Swap (faceNodes);
+		RunThreadsOnIndividual (g_MergeFaceNodes.Count(), false, MergeNodeFaces_Thread);
+		g_MergeFaceNodes.Purge();
+	}
+	else
+	{
+		for (int i = 0; i < faceNodes.Count(); i++)
+		{
+			MergeNodeFaces (faceNodes[i]);
+		}
+	}
 
 	qprintf ("%5i makefaces\n", c_nodefaces);
-	qprintf ("%5i merged\n", c_merge);
-	qprintf ("%5i subdivided\n", c_subdivide);
+	qprintf ("%5i merged\n", (int)c_merge);
+	qprintf ("%5i subdivided\n", (int)c_subdivide);
 }
\ No newline at end of file
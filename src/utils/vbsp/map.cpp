@@ -197,6 +197,10 @@ void CMapFile::AddPlaneToHash (plane_t *p)
 	hash &= (PLANE_HASHES-1);
 
 	p->hash_chain = planehash[hash];
+
+	// FindFloatPlane walks the chains without the lock, so the plane has to be
+	// complete before it's linked in
+	ThreadMemoryBarrier();
 	planehash[hash] = p;
 }
 
@@ -339,37 +343,67 @@ int CMapFile::FindFloatPlane (Vector& normal, vec_t dist)
 	plane_t	*p;
 
 	SnapPlane(normal, dist);
+
+	// The per-block CSG and BSP look planes up from several threads
+	ThreadLock();
 	for (i=0, p=mapplanes ; i<nummapplanes ; i++, p++)
 	{
 		if (PlaneEqual (p, normal, dist, RENDER_NORMAL_EPSILON, RENDER_DIST_EPSILON))
+		{
+			ThreadUnlock();
 			return i;
+		}
 	}
 
-	return CreateNewFloatPlane (normal, dist);
+	i = CreateNewFloatPlane (normal, dist);
+	ThreadUnlock();
+	return i;
 }
 #else
+static plane_t *FindPlaneInHash (plane_t * const *planehash, Vector& normal, vec_t dist, int hash)
+{
+	// search the border bins as well
+	for (int i=-1 ; i<=1 ; i++)
+	{
+		int h = (hash+i)&(PLANE_HASHES-1);
+		for (plane_t *p = planehash[h] ; p ; p=p->hash_chain)
+		{
+			if (PlaneEqual (p, normal, dist, RENDER_NORMAL_EPSILON, RENDER_DIST_EPSILON))
+				return p;
+		}
+	}
+	return NULL;
+}
+
 int	CMapFile::FindFloatPlane (Vector& normal, vec_t dist)
 {
 	int		i;
 	plane_t	*p;
-	int		hash, h;
+	int		hash;
 
 	SnapPlane(normal, dist);
 	hash = (int)fabs(dist) / 8;
 	hash &= (PLANE_HASHES-1);
 
-	// search the border bins as well
-	for (i=-1 ; i<=1 ; i++)
+	// The per-block CSG and BSP look planes up from several threads. Planes are never
+	// removed or changed once they're in the hash, so most lookups don't need the lock.
+	p = FindPlaneInHash (planehash, normal, dist, hash);
+	if (p)
+		return p-mapplanes;
+
+	// Look again under the lock, another thread may have just added it
+	ThreadLock();
+	p = FindPlaneInHash (planehash, normal, dist, hash);
+	if (p)
 	{
-		h = (hash+i)&(PLANE_HASHES-1);
-		for (p = planehash[h] ; p ; p=p->hash_chain)
-		{
-			if (PlaneEqual (p, normal, dist, RENDER_NORMAL_EPSILON, RENDER_DIST_EPSILON))
-				return p-mapplanes;
-		}
+		i = p-mapplanes;
 	}
-
-	return CreateNewFloatPlane (normal, dist);
+	else
+	{
+		i = CreateNewFloatPlane (normal, dist);
+	}
+	ThreadUnlock();
+	return i;
 }
 #endif
 
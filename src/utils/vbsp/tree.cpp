@@ -7,8 +7,6 @@
 //=============================================================================//
 #include "vbsp.h"
 
-extern	int	c_nodes;
-
 void RemovePortalFromNode (portal_t *portal, node_t *l);
 
 node_t *NodeForPoint (node_t *node, Vector& origin)
@@ -90,8 +88,6 @@ void FreeTree_r (node_t *node)
 	if (node->volume)
 		FreeBrush (node->volume);
 
-	if (numthreads == 1)
-		c_nodes--;
 	free (node);
 }
 
@@ -56,6 +56,7 @@ bool		g_NodrawTriggers = false;
 bool		g_DisableWaterLighting = false;
 bool		g_bAllowDetailCracks = false;
 bool		g_bNoVirtualMesh = false;
+bool		g_bThreadedPhases = false;	// split tree building, face merging and detail props over the threads too
 
 float		g_defaultLuxelSize = DEFAULT_LUXEL_SIZE;
 float		g_luxelScale = 1.0f;
@@ -85,6 +86,53 @@ int			entity_num;
 node_t		*block_nodes[BLOCKS_SPACE+2][BLOCKS_SPACE+2];
 
 
+//-----------------------------------------------------------------------------
+// Phase timing report
+//-----------------------------------------------------------------------------
+struct vbspphasetime_t
+{
+	const char	*m_pName;
+	int			m_nCalls;
+	double		m_flSeconds;
+};
+
+static CUtlVector<vbspphasetime_t> g_VBSPPhaseTimes;
+
+void VBSP_AddPhaseTime( const char *pPhaseName, double flSeconds )
+{
+	int i;
+	for ( i = 0; i < g_VBSPPhaseTimes.Count(); i++ )
+	{
+		if ( !Q_strcmp( g_VBSPPhaseTimes[i].m_pName, pPhaseName ) )
+			break;
+	}
+	if ( i == g_VBSPPhaseTimes.Count() )
+	{
+		i = g_VBSPPhaseTimes.AddToTail();
+		g_VBSPPhaseTimes[i].m_pName = pPhaseName;
+		g_VBSPPhaseTimes[i].m_nCalls = 0;
+		g_VBSPPhaseTimes[i].m_flSeconds = 0.0;
+	}
+
+	g_VBSPPhaseTimes[i].m_nCalls++;
+	g_VBSPPhaseTimes[i].m_flSeconds += flSeconds;
+}
+
+void VBSP_PrintPhaseTimes()
+{
+	if ( g_VBSPPhaseTimes.Count() == 0 )
+		return;
+
+	Msg( "\nCompile phases (%d threads):\n", numthreads );
+	Msg( "  %-32s %10s %10s\n", "phase", "calls", "seconds" );
+	for ( int i = 0; i < g_VBSPPhaseTimes.Count(); i++ )
+	{
+		const vbspphasetime_t &phase = g_VBSPPhaseTimes[i];
+		Msg( "  %-32s %10d %10.2f\n", phase.m_pName, phase.m_nCalls, phase.m_flSeconds );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Assign occluder areas (must happen *after* the world model is processed)
 //-----------------------------------------------------------------------------
@@ -256,12 +304,44 @@ void ProcessWorldModel (void)
 		block_yh = BLOCKS_MAX;
 	}
 
+	// The blocks are processed on several threads and all look up their bounding planes.
+	// Create those here so the plane numbers don't depend on which block got there first.
+	Vector normal;
+	for ( int i = 0; i < 2; i++ )
+	{
+		int nLow = ( i == 0 ) ? block_xl : block_yl;
+		int nHigh = ( i == 0 ) ? block_xh : block_yh;
+		for ( int j = nLow; j <= nHigh + 1; j++ )
+		{
+			VectorClear( normal );
+			normal[i] = 1;
+			g_MainMap->FindFloatPlane( normal, j*BLOCKS_SIZE );
+		}
+	}
+	VectorClear( normal );
+	normal[2] = 1;
+	g_MainMap->FindFloatPlane( normal, MAX_COORD_INTEGER );
+	g_MainMap->FindFloatPlane( normal, MIN_COORD_INTEGER );
+
+	// Blocks that share an areaportal brush would each fix up its contents, so do it once
+	// for the whole world up front and the per-block fixups find nothing left to change.
+	{
+		Vector worldmins( block_xl*BLOCKS_SIZE, block_yl*BLOCKS_SIZE, MIN_COORD_INTEGER );
+		Vector worldmaxs( (block_xh+1)*BLOCKS_SIZE, (block_yh+1)*BLOCKS_SIZE, MAX_COORD_INTEGER );
+		bspbrush_t *pWorldBrushes = MakeBspBrushList( brush_start, brush_end, worldmins, worldmaxs, NO_DETAIL );
+		FixupAreaportalWaterBrushes( pWorldBrushes );
+		FreeBrushList( pWorldBrushes );
+	}
+
 	for (optimize = 0 ; optimize <= 1 ; optimize++)
 	{
 		qprintf ("--------------------------------------------\n");
 
-		RunThreadsOnIndividual ((block_xh-block_xl+1)*(block_yh-block_yl+1),
-			!verbose, ProcessBlock_Thread);
+		{
+			CVBSPPhaseTimer timer( "Block CSG and BSP" );
+			RunThreadsOnIndividual ((block_xh-block_xl+1)*(block_yh-block_yl+1),
+				!verbose, ProcessBlock_Thread);
+		}
 
 		//
 		// build the division tree
@@ -287,9 +367,17 @@ void ProcessWorldModel (void)
 		//
 
 		// make the portals/faces by traversing down to each empty leaf
-		MakeTreePortals (tree);
+		{
+			CVBSPPhaseTimer timer( "MakeTreePortals" );
+			MakeTreePortals (tree);
+		}
 
-		if (FloodEntities (tree))
+		qboolean flooded;
+		{
+			CVBSPPhaseTimer timer( "FloodEntities" );
+			flooded = FloodEntities (tree);
+		}
+		if (flooded)
 		{
 			// turns everthing outside into solid
 			FillOutside (tree->headnode);
@@ -307,7 +395,10 @@ void ProcessWorldModel (void)
 		}
 
 		// mark the brush sides that actually turned into faces
-		MarkVisibleSides (tree, brush_start, brush_end, NO_DETAIL);
+		{
+			CVBSPPhaseTimer timer( "MarkVisibleSides" );
+			MarkVisibleSides (tree, brush_start, brush_end, NO_DETAIL);
+		}
 		if (noopt || leaked)
 			break;
 		if (!optimize)
@@ -327,7 +418,10 @@ void ProcessWorldModel (void)
 	Msg("Building Faces...");
 	// this turns portals with one solid side into faces
 	// it also subdivides each face if necessary to fit max lightmap dimensions
-	MakeFaces (tree->headnode);
+	{
+		CVBSPPhaseTimer timer( "MakeFaces" );
+		MakeFaces (tree->headnode);
+	}
 	Msg("done (%d)\n", (int)(Plat_FloatTime() - start) );
 
 	if (glview)
@@ -340,6 +434,7 @@ void ProcessWorldModel (void)
 	face_t *pLeafFaceList = NULL;
 	if ( !nodetail )
 	{
+		CVBSPPhaseTimer timer( "MergeDetailTree" );
 		pLeafFaceList = MergeDetailTree( tree, brush_start, brush_end );
 	}
 
@@ -349,12 +444,16 @@ void ProcessWorldModel (void)
 	
 	// This unifies the vertex list for all edges (splits collinear edges to remove t-junctions)
 	// It also welds the list of vertices out of each winding/portal and rounds nearly integer verts to integer
-	pLeafFaceList = FixTjuncs (tree->headnode, pLeafFaceList);
+	{
+		CVBSPPhaseTimer timer( "FixTjuncs" );
+		pLeafFaceList = FixTjuncs (tree->headnode, pLeafFaceList);
+	}
 
 	// this merges all of the solid nodes that have separating planes
 	if (!noprune)
 	{
 		Msg("PruneNodes...\n");
+		CVBSPPhaseTimer timer( "PruneNodes" );
 		PruneNodes (tree->headnode);
 	}
 
@@ -362,11 +461,15 @@ void ProcessWorldModel (void)
 //	SplitSubdividedFaces( tree->headnode );
 
 	Msg("WriteBSP...\n");
-	WriteBSP (tree->headnode, pLeafFaceList);
+	{
+		CVBSPPhaseTimer timer( "WriteBSP" );
+		WriteBSP (tree->headnode, pLeafFaceList);
+	}
 	Msg("done (%d)\n", (int)(Plat_FloatTime() - start) );
 
 	if (!leaked)
 	{
+		CVBSPPhaseTimer timer( "WritePortalFile" );
 		WritePortalFile (tree);
 	}
 
@@ -869,6 +972,7 @@ void ProcessModels (void)
 		}
 		else
 		{
+			CVBSPPhaseTimer timer( "ProcessSubModel" );
 			ProcessSubModel( );
 		}
 
@@ -1114,6 +1218,14 @@ int RunVBSP( int argc, char **argv )
 		{
 			g_bLowPriority = true;
 		}
+		else if( !Q_stricmp( argv[i], "-numa" ) )
+		{
+			g_bPinThreadsToNUMANodes = true;
+		}
+		else if( !Q_stricmp( argv[i], "-threadedphases" ) )
+		{
+			g_bThreadedPhases = true;
+		}
 		else if( !Q_stricmp( argv[i], "-lightifmissing" ) )
 		{
 			g_bLightIfMissing = true;
@@ -1205,6 +1317,7 @@ int RunVBSP( int argc, char **argv )
 			"                what affects visibility.\n"
 			"  -nowater    : Get rid of water brushes.\n"
 			"  -low        : Run as an idle-priority process.\n"
+			"  -numa       : Spread threads over NUMA nodes and pin each to a CPU (Linux only).\n"
 			"  -embed <directory>  : Use <directory> as an additional search path for assets\n"
 			"                        and embed all assets in this directory into the compiled\n"
 			"                        map\n"
@@ -1220,6 +1333,8 @@ int RunVBSP( int argc, char **argv )
 				"  -novconfig   : Don't bring up graphical UI on vproject errors.\n"
 				"  -threads     : Control the number of threads vbsp uses (defaults to the # of\n"
 				"                 processors on your machine).\n"
+				"  -threadedphases: Also use the threads inside tree building, face merging and\n"
+				"                 detail prop placement, not just across blocks.\n"
 				"  -verboseentities: If -v is on, this disables verbose output for submodels.\n"
 				"  -noweld      : Don't join face vertices together.\n"
 				"  -nocsg       : Don't chop out intersecting brush areas.\n"
@@ -1299,7 +1414,6 @@ int RunVBSP( int argc, char **argv )
 	}
 
 	ThreadSetDefault ();
-	numthreads = 1;		// multiple threads aren't helping...
 
 	// Setup the logfile.
 	char logFile[512];
@@ -1439,6 +1553,8 @@ int RunVBSP( int argc, char **argv )
 	
 	char str[512];
 	GetHourMinuteSecondsString( (int)( end - start ), str, sizeof( str ) );
+	VBSP_PrintPhaseTimes();
+	ThreadPrintPhaseTimes();
 	Msg( "%s elapsed\n", str );
 
 	DeleteCmdLine( argc, argv );
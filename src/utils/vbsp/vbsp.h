@@ -365,6 +365,7 @@ extern	bool		g_NodrawTriggers;
 extern	bool		g_DisableWaterLighting;
 extern	bool		g_bAllowDetailCracks;
 extern	bool		g_bNoVirtualMesh;
+extern	bool		g_bThreadedPhases;
 extern	char		outbase[32];
 
 extern	char	source[1024];
@@ -375,6 +376,22 @@ bool 	LoadMapFile( const char *pszFileName );
 int		GetVertexnum( Vector& v );
 bool Is3DSkyboxArea( int area );
 
+// Wall clock time of the main compile phases, summed over every model and
+// printed at the end next to the threaded phase report.
+void VBSP_AddPhaseTime( const char *pPhaseName, double flSeconds );
+void VBSP_PrintPhaseTimes();
+
+class CVBSPPhaseTimer
+{
+public:
+	CVBSPPhaseTimer( const char *pPhaseName ) : m_pPhaseName( pPhaseName ), m_flStart( Plat_FloatTime() ) {}
+	~CVBSPPhaseTimer() { VBSP_AddPhaseTime( m_pPhaseName, Plat_FloatTime() - m_flStart ); }
+
+private:
+	const char	*m_pPhaseName;
+	double		m_flStart;
+};
+
 //=============================================================================
 
 // textures.c
@@ -1269,10 +1269,16 @@ void EndBSPFile (void)
 	ClearDistToClosestWater();
 
 	// Emit static props found in the .vmf file
-	EmitStaticProps();
+	{
+		CVBSPPhaseTimer timer( "EmitStaticProps" );
+		EmitStaticProps();
+	}
 
 	// Place detail props found in .vmf and based on material properties
-	EmitDetailObjects();
+	{
+		CVBSPPhaseTimer timer( "EmitDetailObjects" );
+		EmitDetailObjects();
+	}
 
 	// Compute bounds after creating disp info because we need to reference it
 	ComputeBoundsNoSkybox();
@@ -1294,6 +1300,7 @@ void EndBSPFile (void)
 	V_strncpy( fileName, source, sizeof( fileName ) );
 	V_DefaultExtension( fileName, ".bsp", sizeof( fileName ) );
 	Msg ("Writing %s\n", fileName);
+	CVBSPPhaseTimer timer( "WriteBSPFile" );
 	WriteBSPFile (fileName);
 }
 
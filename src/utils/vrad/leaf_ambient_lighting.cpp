@@ -16,6 +16,8 @@
 #include "messbuf.h"
 #include "vmpi.h"
 #include "vmpi_distribute_work.h"
+#include "fork_distribute.h"
+#include "lightcache.h"
 
 static TableVector g_BoxDirections[6] = 
 {
@@ -89,53 +91,100 @@ float Engine_WorldLightDistanceFalloff( const dworldlight_t *wl, const Vector& d
 }
 
 
+// The surface lights that go in the ambient cubes, set up by ComputePerLeafAmbientLighting.
+static CUtlVector<int> g_AmbientCubeLights;
+
 void AddEmitSurfaceLights( const Vector &vStart, Vector lightBoxColor[6] )
 {
-	fltx4 fractionVisible;
-
-	FourVectors vStart4, wlOrigin4;
-	vStart4.DuplicateVector ( vStart );
+	FourVectors vStart4[2], wlOrigin4[2];
+	vStart4[0].DuplicateVector( vStart );
+	vStart4[1] = vStart4[0];
 
-	for ( int iLight=0; iLight < *pNumworldlights; iLight++ )
+	// Test whether the point can see the lights eight at a time
+	int nAmbientCubeLights = g_AmbientCubeLights.Count();
+	for ( int iFirst = 0; iFirst < nAmbientCubeLights; iFirst += 8 )
 	{
-		dworldlight_t *wl = &dworldlights[iLight];
+		int nLights = min( 8, nAmbientCubeLights - iFirst );
+		dworldlight_t *pLights[8];
+		for ( int i = 0; i < 8; i++ )
+		{
+			// The last batch is padded out with its final light
+			pLights[i] = &dworldlights[ g_AmbientCubeLights[ iFirst + min( i, nLights - 1 ) ] ];
+			Assert( pLights[i]->type == emit_surface );
+
+			wlOrigin4[i >> 2].X( i & 3 ) = pLights[i]->origin.x;
+			wlOrigin4[i >> 2].Y( i & 3 ) = pLights[i]->origin.y;
+			wlOrigin4[i >> 2].Z( i & 3 ) = pLights[i]->origin.z;
+		}
 
-		// Should this light even go in the ambient cubes?
-		if ( !( wl->flags & DWL_FLAGS_INAMBIENTCUBE ) )
+		fltx4 fractionVisible[2];
+		TestLine8( vStart4, wlOrigin4, fractionVisible );
+		if ( !TestSignSIMD( OrSIMD( CmpGtSIMD( fractionVisible[0], Four_Zeros ), CmpGtSIMD( fractionVisible[1], Four_Zeros ) ) ) )
 			continue;
 
-		Assert( wl->type == emit_surface );
+		for ( int iLight = 0; iLight < nLights; iLight++ )
+		{
+			float flFractionVisible = SubFloat( fractionVisible[iLight >> 2], iLight & 3 );
+			if ( flFractionVisible <= 0 )
+				continue;
 
-		// Can this light see the point?
-		wlOrigin4.DuplicateVector ( wl->origin );
-		TestLine ( vStart4, wlOrigin4, &fractionVisible );
-		if ( !TestSignSIMD ( CmpGtSIMD ( fractionVisible, Four_Zeros ) ) )
-			continue;
+			dworldlight_t *wl = pLights[iLight];
 
-		// Add this light's contribution.
-		Vector vDelta = wl->origin - vStart;
-		float flDistanceScale = Engine_WorldLightDistanceFalloff( wl, vDelta );
+			// Add this light's contribution.
+			Vector vDelta = wl->origin - vStart;
+			float flDistanceScale = Engine_WorldLightDistanceFalloff( wl, vDelta );
 
-		Vector vDeltaNorm = vDelta;
-		VectorNormalize( vDeltaNorm );
-		float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm, vDeltaNorm );
+			Vector vDeltaNorm = vDelta;
+			VectorNormalize( vDeltaNorm );
+			float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm, vDeltaNorm );
 
-		float ratio = flDistanceScale * flAngleScale * SubFloat ( fractionVisible, 0 );
-		if ( ratio == 0 )
-			continue;
+			float ratio = flDistanceScale * flAngleScale * flFractionVisible;
+			if ( ratio == 0 )
+				continue;
 
-		for ( int i=0; i < 6; i++ )
-		{
-			float t = DotProduct( g_BoxDirections[i], vDeltaNorm );
-			if ( t > 0 )
+			for ( int i=0; i < 6; i++ )
 			{
-				lightBoxColor[i] += wl->intensity * (t * ratio);
+				float t = DotProduct( g_BoxDirections[i], vDeltaNorm );
+				if ( t > 0 )
+				{
+					lightBoxColor[i] += wl->intensity * (t * ratio);
+				}
 			}
 		}
-	}	
+	}
 }
 
 
+// The spherical sample directions that face each side of the ambient cube, and how much
+// they count towards it. These are the same for every sample, so they're built once.
+struct boxsampleweight_t
+{
+	int		nNormal;
+	float	flWeight;
+};
+static CUtlVector<boxsampleweight_t> g_BoxSampleWeights[6];
+static float g_flBoxSampleTotalWeight[6];
+
+static void BuildBoxSampleWeights()
+{
+	for ( int j = 0; j < 6; j++ )
+	{
+		g_BoxSampleWeights[j].RemoveAll();
+		g_flBoxSampleTotalWeight[j] = 0;
+		for ( int i = 0; i < NUMVERTEXNORMALS; i++ )
+		{
+			float c = DotProduct( g_anorms[i], g_BoxDirections[j] );
+			if ( c > 0 )
+			{
+				boxsampleweight_t &weight = g_BoxSampleWeights[j][ g_BoxSampleWeights[j].AddToTail() ];
+				weight.nNormal = i;
+				weight.flWeight = c;
+				g_flBoxSampleTotalWeight[j] += c;
+			}
+		}
+	}
+}
+
 void ComputeAmbientFromSphericalSamples( int iThread, const Vector &vStart, Vector lightBoxColor[6] )
 {
 	// Figure out the color that rays hit when shot out from this position.
@@ -157,21 +206,15 @@ void ComputeAmbientFromSphericalSamples( int iThread, const Vector &vStart, Vect
 	// accumulate samples into radiant box
 	for ( int j = 6; --j >= 0; )
 	{
-		float t = 0;
-
 		lightBoxColor[j].Init();
 
-		for (int i = 0; i < NUMVERTEXNORMALS; i++)
+		const boxsampleweight_t *pWeights = g_BoxSampleWeights[j].Base();
+		for ( int i = g_BoxSampleWeights[j].Count(); --i >= 0; )
 		{
-			float c = DotProduct( g_anorms[i], g_BoxDirections[j] );
-			if (c > 0)
-			{
-				t += c;
-				lightBoxColor[j] += radcolor[i] * c;
-			}
+			lightBoxColor[j] += radcolor[ pWeights[i].nNormal ] * pWeights[i].flWeight;
 		}
 		
-		lightBoxColor[j] *= 1/t;
+		lightBoxColor[j] *= 1/g_flBoxSampleTotalWeight[j];
 	}
 
 	// Now add direct light from the emit_surface lights. These go in the ambient cube because
@@ -428,6 +471,11 @@ void Mod_LeafAmbientColorAtPos( Vector *pOut, const Vector &pos, const CUtlVecto
 	}
 }
 
+// Adaptive sampling takes at least this many samples in a leaf, then stops once this
+// many new samples in a row match what the earlier ones predict.
+#define MIN_ADAPTIVE_AMBIENT_SAMPLES		4
+#define ADAPTIVE_AMBIENT_CONVERGED_SAMPLES	6
+
 // this samples the lighting at each sample and removes any unnecessary samples
 void CompressAmbientSampleList( CUtlVector<ambientsample_t> &list )
 {
@@ -522,13 +570,60 @@ static byte Fixed8Fraction( float t, float tMin, float tMax )
 
 CUtlVector< CUtlVector<ambientsample_t> > g_LeafAmbientSamples;
 
-void ComputeAmbientForLeaf( int iThread, int leafID, CUtlVector<ambientsample_t> &list )
+//-----------------------------------------------------------------------------
+// The light cache key for a leaf: its shape, plus everything visible from it.
+//-----------------------------------------------------------------------------
+static uint64 ComputeLeafAmbientCacheKey( int leafID, const CUtlVector<dplane_t> &leafPlanes )
+{
+	const dleaf_t &leaf = dleafs[leafID];
+
+	CLightCacheKey key( LIGHTCACHE_LEAFAMBIENT );
+	key.Add( g_bFastAmbient );
+	key.Add( g_bNoAdaptiveAmbient );
+	key.Add( leaf.contents );
+	key.Add( leaf.mins );
+	key.Add( leaf.maxs );
+	key.Add( leafPlanes.Base(), leafPlanes.Count() * sizeof( dplane_t ) );
+
+	Vector vMins( leaf.mins[0], leaf.mins[1], leaf.mins[2] );
+	Vector vMaxs( leaf.maxs[0], leaf.maxs[1], leaf.maxs[2] );
+	key.AddBox( vMins, vMaxs );
+
+	// The spherical samples pick up bounced light from the lightmaps
+	return key.Finish( true );
+}
+
+//-----------------------------------------------------------------------------
+// Fills in list for the leaf and returns true, or returns false if it came from
+// the light cache. *pCacheKey is the key to store a computed list under, or 0.
+//-----------------------------------------------------------------------------
+bool ComputeAmbientForLeaf( int iThread, int leafID, CUtlVector<ambientsample_t> &list, uint64 *pCacheKey )
 {
 	CUtlVector<dplane_t> leafPlanes;
 	CLeafSampler sampler( iThread );
 
 	GetLeafBoundaryPlanes( leafPlanes, leafID );
 	list.RemoveAll();
+	*pCacheKey = 0;
+
+	if ( g_bLightCache && !( dleafs[leafID].contents & CONTENTS_SOLID ) )
+	{
+		*pCacheKey = ComputeLeafAmbientCacheKey( leafID, leafPlanes );
+
+		MessageBuffer mb;
+		if ( LightCache_Find( LIGHTCACHE_LEAFAMBIENT, *pCacheKey, &mb ) )
+		{
+			int nSamples;
+			mb.read( &nSamples, sizeof( nSamples ) );
+			list.SetCount( nSamples );
+			if ( nSamples )
+			{
+				mb.read( list.Base(), nSamples * sizeof( ambientsample_t ) );
+			}
+			return false;
+		}
+	}
+
 	// this heuristic tries to generate at least one sample per volume (chosen to be similar to the size of a player) in the space
 	int xSize = (dleafs[leafID].maxs[0] - dleafs[leafID].mins[0]) / 32;
 	int ySize = (dleafs[leafID].maxs[1] - dleafs[leafID].mins[1]) / 32;
@@ -548,21 +643,47 @@ void ComputeAmbientForLeaf( int iThread, int leafID, CUtlVector<ambientsample_t>
 	{
 		// don't generate any samples in solid leaves
 		// NOTE: We copy the nearest non-solid leaf sample pointers into this leaf at the end
-		return;
+		return true;
 	}
-	Vector cube[6];
+	Vector cube[6], predictedCube[6];
+	int nConverged = 0;
 	for ( int i = 0; i < sampleCount; i++ )
 	{
 		// compute each candidate sample and add to the list
 		Vector samplePosition;
 		sampler.GenerateLeafSamplePosition( leafID, leafPlanes, samplePosition );
 		ComputeAmbientFromSphericalSamples( iThread, samplePosition, cube );
+
+		// Once the samples we have can predict several new ones in a row, more of them
+		// would just be thrown away by CompressAmbientSampleList, so stop here.
+		if ( !g_bNoAdaptiveAmbient && list.Count() >= MIN_ADAPTIVE_AMBIENT_SAMPLES )
+		{
+			Mod_LeafAmbientColorAtPos( predictedCube, samplePosition, list, -1 );
+			nConverged = ( CubeDeltaGammaSpace( predictedCube, cube ) < 3 ) ? nConverged + 1 : 0;
+		}
+
 		// note this will remove the least valuable sample once the limit is reached
 		AddSampleToList( list, samplePosition, cube );
+
+		if ( nConverged >= ADAPTIVE_AMBIENT_CONVERGED_SAMPLES )
+			break;
 	}
 
 	// remove any samples that can be reconstructed with the remaining data
 	CompressAmbientSampleList( list );
+	return true;
+}
+
+static void StoreLeafAmbientInLightCache( uint64 nCacheKey, const CUtlVector<ambientsample_t> &list )
+{
+	MessageBuffer mb;
+	int nSamples = list.Count();
+	mb.write( &nSamples, sizeof( nSamples ) );
+	if ( nSamples )
+	{
+		mb.write( list.Base(), nSamples * sizeof( ambientsample_t ) );
+	}
+	LightCache_Store( LIGHTCACHE_LEAFAMBIENT, nCacheKey, mb.data, mb.getLen() );
 }
 
 static void ThreadComputeLeafAmbient( int iThread, void *pUserData )
@@ -574,7 +695,11 @@ static void ThreadComputeLeafAmbient( int iThread, void *pUserData )
 		if (leafID == -1)
 			break;
 		list.RemoveAll();
-		ComputeAmbientForLeaf(iThread, leafID, list);
+		uint64 nCacheKey;
+		if ( ComputeAmbientForLeaf(iThread, leafID, list, &nCacheKey) && nCacheKey )
+		{
+			StoreLeafAmbientInLightCache( nCacheKey, list );
+		}
 		// copy to the output array
 		g_LeafAmbientSamples[leafID].SetCount( list.Count() );
 		for ( int i = 0; i < list.Count(); i++ )
@@ -584,13 +709,16 @@ static void ThreadComputeLeafAmbient( int iThread, void *pUserData )
 	}
 }
 
-#ifdef MPI
+#if defined( MPI ) || defined( FORK_DISTRIBUTE )
 void VMPI_ProcessLeafAmbient( int iThread, uint64 iLeaf, MessageBuffer *pBuf )
 {
 	CUtlVector<ambientsample_t> list;
-	ComputeAmbientForLeaf(iThread, (int)iLeaf, list);
+	uint64 nCacheKey;
+	ComputeAmbientForLeaf(iThread, (int)iLeaf, list, &nCacheKey);
 
+#ifdef MPI
 	VMPI_SetCurrentStage( "EncodeLeafAmbientResults" );
+#endif
 
 	// Encode the results.
 	int nSamples = list.Count();
@@ -599,6 +727,9 @@ void VMPI_ProcessLeafAmbient( int iThread, uint64 iLeaf, MessageBuffer *pBuf )
 	{
 		pBuf->write( list.Base(), list.Count() * sizeof( ambientsample_t ) );
 	}
+
+	// Hits too, so the master knows to keep them in the light cache.
+	pBuf->write( &nCacheKey, sizeof( nCacheKey ) );
 }
 
 //-----------------------------------------------------------------------------
@@ -615,6 +746,11 @@ void VMPI_ReceiveLeafAmbientResults( uint64 leafID, MessageBuffer *pBuf, int iWo
 	{
 		pBuf->read(g_LeafAmbientSamples[leafID].Base(), nSamples * sizeof(ambientsample_t) );
 	}
+
+	int nResultBytes = pBuf->getOffset();
+	uint64 nCacheKey = 0;
+	pBuf->read( &nCacheKey, sizeof( nCacheKey ) );
+	LightCache_Store( LIGHTCACHE_LEAFAMBIENT, nCacheKey, pBuf->data, nResultBytes );
 }
 #endif
 
@@ -641,6 +777,14 @@ void ComputePerLeafAmbientLighting()
 
 	Msg( "%d of %d (%d%% of) surface lights went in leaf ambient cubes.\n", nInAmbientCube, nSurfaceLights, nSurfaceLights ? ((nInAmbientCube*100) / nSurfaceLights) : 0 );
 
+	g_AmbientCubeLights.RemoveAll();
+	for ( int i=0; i < *pNumworldlights; i++ )
+	{
+		if ( dworldlights[i].flags & DWL_FLAGS_INAMBIENTCUBE )
+			g_AmbientCubeLights.AddToTail( i );
+	}
+	BuildBoxSampleWeights();
+
 	g_LeafAmbientSamples.SetCount(numleafs);
 
 #ifdef MPI
@@ -651,6 +795,17 @@ void ComputePerLeafAmbientLighting()
 		DistributeWork( numleafs, VMPI_ProcessLeafAmbient, VMPI_ReceiveLeafAmbientResults );
 	}
 	else
+#endif
+#ifdef FORK_DISTRIBUTE
+	if ( ForkDistribute_IsActive() )
+	{
+		Msg( "%-20s ", "ComputeLeafAmbient:" );
+		StartPacifier( "" );
+		double elapsed = ForkDistributeWork( numleafs, VMPI_ProcessLeafAmbient, VMPI_ReceiveLeafAmbientResults );
+		EndPacifier( false );
+		Msg( " (%d)\n", (int)elapsed );
+	}
+	else
 #endif
 	{
 		RunThreadsOn(numleafs, true, ThreadComputeLeafAmbient);
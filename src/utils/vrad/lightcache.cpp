@@ -0,0 +1,772 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Incremental relight cache.
+//
+// Direct face lighting, static prop lighting and leaf ambient samples are saved
+// to <map>.lightcache, or <map>_hdr.lightcache for HDR. Each result is keyed by a hash of its own inputs (sample
+// points, normals, model and so on), the lights whose PVS reaches the clusters
+// it's lit in and the geometry of every cluster those clusters can see. Shadow
+// rays can only be blocked by geometry along a line of sight, so anything a
+// change can affect has that change in its key, and everything else is loaded
+// from the cache instead of being traced again.
+//
+// Bounced light is global, so it's always recomputed. Results that sample it
+// (static props and leaf ambient) also hash the final lightmaps they can see.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightcache.h"
+#include "lightmap.h"
+#include "messbuf.h"
+#include "fork_distribute.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlmap.h"
+#include "tier0/threadtools.h"
+
+
+#define LIGHTCACHE_ID		(('C'<<24)+('L'<<16)+('R'<<8)+'V')
+#define LIGHTCACHE_VERSION	2
+
+// Geometry closer than this to a cluster is hashed into it too.
+#define LIGHTCACHE_GEOMETRY_EPSILON	1.0f
+
+struct LightCacheHeader_t
+{
+	int		m_nId;
+	int		m_nVersion;
+	uint64	m_nSettingsHash;
+	int		m_nEntries;
+	int		m_nUnused;
+};
+
+struct LightCacheEntry_t
+{
+	uint64	m_nKey;
+	int		m_nOffset;		// from the start of the result data
+	int		m_nBytes;
+};
+
+
+bool g_bLightCache = false;
+CUtlVector<uint64> g_FaceLightCacheKeys;
+
+static bool s_bActive = false;
+static char s_szFilename[MAX_PATH];
+
+// Everything that's the same for every key
+static uint64 s_nSettingsHash;
+
+// Per cluster: hash of the geometry in it, and of the geometry in its PVS
+static CUtlVector<uint64> s_ClusterGeometry;
+static CUtlVector<uint64> s_VisibleGeometry;
+static uint64 s_nTotalGeometry;
+
+// Geometry in leaves that have no cluster
+static uint64 s_nUnclusteredGeometry;
+
+// Same for the final lightmaps of the faces in each cluster
+static CUtlVector<uint64> s_ClusterLighting;
+static CUtlVector<uint64> s_VisibleLighting;
+static uint64 s_nTotalLighting;
+
+// Decompressed PVS rows
+static CUtlVector<byte> s_PVS;
+static int s_nPVSRowBytes;
+
+// Indexed by directlight_t::index
+static CUtlVector<uint64> s_LightHashes;
+static CUtlVector<uint64> s_LightPVSHashes;
+
+// The cache file that was loaded, sorted by key
+static CUtlVector<LightCacheEntry_t> s_LoadedEntries;
+static CUtlVector<byte> s_LoadedEntryUsed;
+static CUtlBuffer s_LoadedData;
+
+// Results that weren't in it
+static CUtlVector<LightCacheEntry_t> s_NewEntries;
+static CUtlMap<uint64, int> s_NewEntryMap( DefLessFunc( uint64 ) );
+static CUtlBuffer s_NewData;
+
+static CInterlockedInt s_nHits[LIGHTCACHE_NUM_TYPES];
+static CInterlockedInt s_nMisses[LIGHTCACHE_NUM_TYPES];
+
+
+//-----------------------------------------------------------------------------
+// Hashing
+//-----------------------------------------------------------------------------
+static inline uint64 MixHash64( uint64 h )
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static inline uint64 HashBytes64( uint64 h, const void *pData, int nBytes )
+{
+	// FNV-1a
+	const byte *p = (const byte*)pData;
+	for ( int i = 0; i < nBytes; i++ )
+	{
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+#define HASH64_INIT	0xcbf29ce484222325ULL
+
+template< class T > static inline uint64 HashValue64( uint64 h, const T &value )
+{
+	return HashBytes64( h, &value, sizeof( value ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Collects the clusters of every non-solid leaf a box touches
+//-----------------------------------------------------------------------------
+static void AddBoxClusters_r( int iNode, const Vector &vMins, const Vector &vMaxs, CUtlVector<int> &clusters, bool &bUnknownCluster )
+{
+	while ( iNode >= 0 )
+	{
+		dnode_t *pNode = &dnodes[iNode];
+		dplane_t *pPlane = &dplanes[pNode->planenum];
+
+		// Distances of the box corners nearest to and furthest along the plane normal
+		float flMin = 0, flMax = 0;
+		for ( int i = 0; i < 3; i++ )
+		{
+			if ( pPlane->normal[i] >= 0 )
+			{
+				flMin += pPlane->normal[i] * vMins[i];
+				flMax += pPlane->normal[i] * vMaxs[i];
+			}
+			else
+			{
+				flMin += pPlane->normal[i] * vMaxs[i];
+				flMax += pPlane->normal[i] * vMins[i];
+			}
+		}
+
+		// Same side convention as PointInLeaf
+		if ( flMin >= pPlane->dist )
+		{
+			iNode = pNode->children[0];
+		}
+		else if ( flMax < pPlane->dist )
+		{
+			iNode = pNode->children[1];
+		}
+		else
+		{
+			AddBoxClusters_r( pNode->children[0], vMins, vMaxs, clusters, bUnknownCluster );
+			iNode = pNode->children[1];
+		}
+	}
+
+	dleaf_t *pLeaf = &dleafs[-1 - iNode];
+	if ( pLeaf->contents & CONTENTS_SOLID )
+		return;
+
+	if ( pLeaf->cluster < 0 )
+	{
+		bUnknownCluster = true;
+		return;
+	}
+
+	if ( clusters.Find( pLeaf->cluster ) == -1 )
+	{
+		clusters.AddToTail( pLeaf->cluster );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Sums per-cluster hashes over each cluster's PVS
+//-----------------------------------------------------------------------------
+static uint64 SumVisible( const byte *pVisible, const CUtlVector<uint64> &clusterHashes )
+{
+	uint64 nSum = 0;
+	for ( int i = 0; i < s_nPVSRowBytes; i++ )
+	{
+		if ( !pVisible[i] )
+			continue;
+
+		for ( int j = 0; j < 8; j++ )
+		{
+			int iCluster = i * 8 + j;
+			if ( ( pVisible[i] & ( 1 << j ) ) && iCluster < clusterHashes.Count() )
+			{
+				nSum += clusterHashes[iCluster];
+			}
+		}
+	}
+	return nSum;
+}
+
+static void ComputeVisibleSums( const CUtlVector<uint64> &clusterHashes, CUtlVector<uint64> &visibleSums )
+{
+	int nClusters = clusterHashes.Count();
+	visibleSums.SetCount( nClusters );
+	for ( int i = 0; i < nClusters; i++ )
+	{
+		visibleSums[i] = SumVisible( &s_PVS[i * s_nPVSRowBytes], clusterHashes );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Command line options that change the lighting
+//-----------------------------------------------------------------------------
+static uint64 HashSettings()
+{
+	uint64 h = HASH64_INIT;
+	h = HashValue64( h, (int)LIGHTCACHE_VERSION );
+	h = HashValue64( h, g_bHDR );
+	h = HashValue64( h, (int)sizeof( sample_t ) );
+	h = HashValue64( h, (int)sizeof( facelight_t ) );
+	h = HashValue64( h, do_extra );
+	h = HashValue64( h, extrapasses );
+	h = HashValue64( h, do_fast );
+	h = HashValue64( h, do_centersamples );
+	h = HashValue64( h, numbounce );
+	h = HashValue64( h, smoothing_threshold );
+	h = HashValue64( h, dlight_map );
+	h = HashValue64( h, indirect_sun );
+	h = HashValue64( h, g_SunAngularExtent );
+	h = HashValue64( h, g_flSkySampleScale );
+	h = HashValue64( h, g_flMaxDispSampleSize );
+	h = HashValue64( h, g_bLargeDispSampleRadius );
+	h = HashValue64( h, g_bTextureShadows );
+	h = HashValue64( h, g_bStaticPropPolys );
+	h = HashValue64( h, g_bDisablePropSelfShadowing );
+	h = HashValue64( h, g_bShowStaticPropNormals );
+	h = HashValue64( h, g_bFastAmbient );
+	h = HashValue64( h, g_bNoAdaptiveAmbient );
+	h = HashValue64( h, g_bNoSkyRecurse );
+	return MixHash64( h );
+}
+
+
+void LightCache_HashGeometry()
+{
+	if ( !g_bLightCache )
+		return;
+
+	// These all light faces differently or leave the facelights in a state
+	// that can't be saved.
+	const char *pReason = NULL;
+	if ( g_pIncremental )
+		pReason = "incremental lighting";
+	else if ( g_bDumpPatches )
+		pReason = "-dump";
+#ifdef MPI
+	else if ( g_bUseMPI )
+		pReason = "-mpi";
+#endif
+
+	if ( pReason )
+	{
+		Warning( "-lightcache can't be used with %s, ignoring it.\n", pReason );
+		g_bLightCache = false;
+		return;
+	}
+
+	Msg( "Hashing geometry for the light cache... " );
+	double flStart = Plat_FloatTime();
+
+	int nClusters = dvis->numclusters;
+	s_ClusterGeometry.SetCount( nClusters );
+	memset( s_ClusterGeometry.Base(), 0, nClusters * sizeof( uint64 ) );
+	s_nTotalGeometry = 0;
+	s_nUnclusteredGeometry = 0;
+
+	// Every triangle is hashed on its own and summed into the clusters it touches,
+	// so the sums don't depend on the order the triangles were added in.
+	CUtlVector<int> clusters;
+	int nTriangles = g_RtEnv.OptimizedTriangleList.Count();
+	for ( int i = 0; i < nTriangles; i++ )
+	{
+		const TriGeometryData_t &tri = g_RtEnv.OptimizedTriangleList[i].m_Data.m_GeometryData;
+
+		uint64 h = HASH64_INIT;
+		h = HashBytes64( h, tri.m_VertexCoordData, sizeof( tri.m_VertexCoordData ) );
+		if ( tri.m_nTriangleID & TRACE_ID_STATICPROP )
+		{
+			// Prop ids are indices that shift whenever a prop is added or removed before them
+			int iStaticProp = tri.m_nTriangleID & ~( TRACE_ID_SKY | TRACE_ID_OPAQUE | TRACE_ID_STATICPROP );
+			h = HashValue64( h, StaticPropMgr()->GetLightCacheIdentity( iStaticProp ) );
+		}
+		else
+		{
+			h = HashValue64( h, tri.m_nTriangleID );
+		}
+		h = HashValue64( h, tri.m_nFlags );
+		if ( i < g_RtEnv.TriangleColors.Count() )
+			h = HashValue64( h, g_RtEnv.TriangleColors[i] );
+		if ( i < g_RtEnv.TriangleMaterials.Count() )
+			h = HashValue64( h, g_RtEnv.TriangleMaterials[i] );
+		h = MixHash64( h );
+
+		s_nTotalGeometry += h;
+
+		Vector vMins, vMaxs;
+		ClearBounds( vMins, vMaxs );
+		for ( int j = 0; j < 3; j++ )
+		{
+			AddPointToBounds( Vector( tri.m_VertexCoordData[j*3+0], tri.m_VertexCoordData[j*3+1], tri.m_VertexCoordData[j*3+2] ), vMins, vMaxs );
+		}
+		vMins -= Vector( LIGHTCACHE_GEOMETRY_EPSILON, LIGHTCACHE_GEOMETRY_EPSILON, LIGHTCACHE_GEOMETRY_EPSILON );
+		vMaxs += Vector( LIGHTCACHE_GEOMETRY_EPSILON, LIGHTCACHE_GEOMETRY_EPSILON, LIGHTCACHE_GEOMETRY_EPSILON );
+
+		bool bUnknownCluster = false;
+		clusters.RemoveAll();
+		AddBoxClusters_r( dmodels[0].headnode, vMins, vMaxs, clusters, bUnknownCluster );
+		for ( int j = 0; j < clusters.Count(); j++ )
+		{
+			s_ClusterGeometry[clusters[j]] += h;
+		}
+
+		// No PVS says who can see into a leaf without a cluster, so every key takes it
+		if ( bUnknownCluster )
+		{
+			s_nUnclusteredGeometry += h;
+		}
+	}
+
+	// Decompress the PVS once, every key needs it
+	s_nPVSRowBytes = ( nClusters + 7 ) >> 3;
+	s_PVS.SetCount( nClusters * s_nPVSRowBytes );
+	for ( int i = 0; i < nClusters; i++ )
+	{
+		byte *pRow = &s_PVS[i * s_nPVSRowBytes];
+		if ( !visdatasize || dvis->bitofs[i][DVIS_PVS] < 0 )
+		{
+			memset( pRow, 0xFF, s_nPVSRowBytes );
+		}
+		else
+		{
+			DecompressVis( &dvisdata[dvis->bitofs[i][DVIS_PVS]], pRow );
+		}
+	}
+
+	ComputeVisibleSums( s_ClusterGeometry, s_VisibleGeometry );
+
+	Msg( "done (%.2f seconds)\n", Plat_FloatTime() - flStart );
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashes the settings and lights, then loads the cache file
+//-----------------------------------------------------------------------------
+void LightCache_Init( const char *pFilename )
+{
+	if ( !g_bLightCache )
+		return;
+
+	s_bActive = true;
+	Q_strncpy( s_szFilename, pFilename, sizeof( s_szFilename ) );
+
+	g_FaceLightCacheKeys.SetCount( numfaces );
+	memset( g_FaceLightCacheKeys.Base(), 0, numfaces * sizeof( uint64 ) );
+
+	uint64 h = HashSettings();
+
+	// The 3D skybox is traced through from every sky face, so what the sky
+	// cameras can see goes into every key.
+	h = HashValue64( h, num_sky_cameras );
+	for ( int i = 0; i < num_sky_cameras; i++ )
+	{
+		h = HashValue64( h, sky_cameras[i].origin );
+		h = HashValue64( h, sky_cameras[i].world_to_sky );
+		h = HashValue64( h, sky_cameras[i].sky_to_world );
+		int iCluster = ClusterFromPoint( sky_cameras[i].origin );
+		h = HashValue64( h, iCluster >= 0 ? s_VisibleGeometry[iCluster] : s_nTotalGeometry );
+	}
+	s_nSettingsHash = MixHash64( h );
+
+	s_LightHashes.SetCount( numdlights );
+	s_LightPVSHashes.SetCount( numdlights );
+	memset( s_LightHashes.Base(), 0, numdlights * sizeof( uint64 ) );
+	memset( s_LightPVSHashes.Base(), 0, numdlights * sizeof( uint64 ) );
+	for ( directlight_t *dl = activelights; dl; dl = dl->next )
+	{
+		h = HASH64_INIT;
+		h = HashValue64( h, dl->light );
+		h = HashValue64( h, dl->facenum );
+		h = HashValue64( h, dl->texdata );
+		h = HashValue64( h, dl->snormal );
+		h = HashValue64( h, dl->tnormal );
+		h = HashValue64( h, dl->sscale );
+		h = HashValue64( h, dl->tscale );
+		h = HashValue64( h, dl->soffset );
+		h = HashValue64( h, dl->toffset );
+		h = HashValue64( h, dl->m_flStartFadeDistance );
+		h = HashValue64( h, dl->m_flEndFadeDistance );
+		h = HashValue64( h, dl->m_flCapDist );
+		s_LightHashes[dl->index] = MixHash64( h );
+		s_LightPVSHashes[dl->index] = MixHash64( HashBytes64( HASH64_INIT, dl->pvs, (dvis->numclusters / 8) + 1 ) );
+	}
+
+	// Load what the last compile saved
+	CUtlBuffer buf;
+	if ( !g_pFileSystem->FileExists( s_szFilename ) || !g_pFileSystem->ReadFile( s_szFilename, NULL, buf ) )
+	{
+		Msg( "No light cache in %s, lighting everything.\n", s_szFilename );
+		return;
+	}
+
+	LightCacheHeader_t header;
+	buf.Get( &header, sizeof( header ) );
+	if ( !buf.IsValid() || header.m_nId != LIGHTCACHE_ID || header.m_nVersion != LIGHTCACHE_VERSION || header.m_nEntries < 0 )
+	{
+		Warning( "%s isn't a light cache for this version of vrad, ignoring it.\n", s_szFilename );
+		return;
+	}
+
+	if ( header.m_nSettingsHash != s_nSettingsHash )
+	{
+		Msg( "%s was made with different settings or sky cameras, lighting everything.\n", s_szFilename );
+		return;
+	}
+
+	s_LoadedEntries.SetCount( header.m_nEntries );
+	buf.Get( s_LoadedEntries.Base(), header.m_nEntries * sizeof( LightCacheEntry_t ) );
+
+	int nDataBytes = buf.TellPut() - buf.TellGet();
+	for ( int i = 0; i < s_LoadedEntries.Count(); i++ )
+	{
+		const LightCacheEntry_t &entry = s_LoadedEntries[i];
+		bool bSorted = ( i == 0 || s_LoadedEntries[i-1].m_nKey < entry.m_nKey );
+		if ( !buf.IsValid() || !bSorted || entry.m_nOffset < 0 || entry.m_nBytes < 0 || entry.m_nOffset + entry.m_nBytes > nDataBytes )
+		{
+			Warning( "%s is corrupt, ignoring it.\n", s_szFilename );
+			s_LoadedEntries.Purge();
+			return;
+		}
+	}
+
+	s_LoadedData.Put( buf.PeekGet(), nDataBytes );
+	s_LoadedEntryUsed.SetCount( s_LoadedEntries.Count() );
+	memset( s_LoadedEntryUsed.Base(), 0, s_LoadedEntryUsed.Count() );
+
+	Msg( "Loaded %d lighting results from %s\n", s_LoadedEntries.Count(), s_szFilename );
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashes each face's final lightmap into the clusters of its patches
+//-----------------------------------------------------------------------------
+void LightCache_HashFinalLighting()
+{
+	if ( !s_bActive )
+		return;
+
+	int nClusters = dvis->numclusters;
+	s_ClusterLighting.SetCount( nClusters );
+	memset( s_ClusterLighting.Base(), 0, nClusters * sizeof( uint64 ) );
+	s_nTotalLighting = 0;
+
+	CUtlVector<int> clusters;
+	for ( int iFace = 0; iFace < numfaces; iFace++ )
+	{
+		dface_t *f = &g_pFaces[iFace];
+		if ( f->lightofs < 0 || g_FacePatches.Element( iFace ) == g_FacePatches.InvalidIndex() )
+			continue;
+
+		int nStyles;
+		for ( nStyles = 0; nStyles < MAXLIGHTMAPS && f->styles[nStyles] != 255; nStyles++ )
+			;
+
+		// Same layout as PrecompLightmapOffsets: the average colors, then the lightmaps
+		int nLuxels = ( f->m_LightmapTextureSizeInLuxels[0] + 1 ) * ( f->m_LightmapTextureSizeInLuxels[1] + 1 );
+		int nBumps = ( texinfo[f->texinfo].flags & SURF_BUMPLIGHT ) ? NUM_BUMP_VECTS + 1 : 1;
+		int nStart = f->lightofs - nStyles * 4;
+		int nBytes = nStyles * 4 + nLuxels * 4 * nStyles * nBumps;
+		if ( nStart < 0 || nStart + nBytes > pdlightdata->Count() )
+			continue;
+
+		uint64 h = HashValue64( HASH64_INIT, iFace );
+		h = HashBytes64( h, f->styles, sizeof( f->styles ) );
+		h = MixHash64( HashBytes64( h, pdlightdata->Base() + nStart, nBytes ) );
+
+		s_nTotalLighting += h;
+
+		clusters.RemoveAll();
+		for ( int iPatch = g_FacePatches.Element( iFace ); iPatch != g_Patches.InvalidIndex(); iPatch = g_Patches[iPatch].ndxNext )
+		{
+			int iCluster = g_Patches[iPatch].clusterNumber;
+			if ( iCluster >= 0 && iCluster < nClusters && clusters.Find( iCluster ) == -1 )
+			{
+				clusters.AddToTail( iCluster );
+				s_ClusterLighting[iCluster] += h;
+			}
+		}
+	}
+
+	ComputeVisibleSums( s_ClusterLighting, s_VisibleLighting );
+}
+
+
+//-----------------------------------------------------------------------------
+// CLightCacheKey
+//-----------------------------------------------------------------------------
+CLightCacheKey::CLightCacheKey( LightCacheType_t type )
+{
+	m_nHash = HashValue64( HASH64_INIT, (int)type );
+	m_bAllClusters = false;
+}
+
+void CLightCacheKey::Add( const void *pData, int nBytes )
+{
+	m_nHash = HashBytes64( m_nHash, pData, nBytes );
+}
+
+void CLightCacheKey::AddPoint( const Vector &vPos )
+{
+	int iCluster = ClusterFromPoint( vPos );
+	if ( iCluster < 0 )
+	{
+		// PVSCheck lets every light through for these
+		m_bAllClusters = true;
+	}
+	else if ( m_Clusters.Find( iCluster ) == -1 )
+	{
+		m_Clusters.AddToTail( iCluster );
+	}
+}
+
+void CLightCacheKey::AddBox( const Vector &vMins, const Vector &vMaxs )
+{
+	AddBoxClusters_r( dmodels[0].headnode, vMins, vMaxs, m_Clusters, m_bAllClusters );
+}
+
+uint64 CLightCacheKey::Finish( bool bFinalLighting )
+{
+	uint64 h = HashValue64( m_nHash, s_nSettingsHash );
+
+	bool bAll = m_bAllClusters || !m_Clusters.Count();
+	int nClusters = m_Clusters.Count();
+
+	// The lights that reach any of the clusters, and which ones they reach,
+	// in the order they're gathered in.
+	for ( directlight_t *dl = activelights; dl; dl = dl->next )
+	{
+		if ( bAll )
+		{
+			h = HashValue64( h, s_LightHashes[dl->index] );
+			h = HashValue64( h, s_LightPVSHashes[dl->index] );
+			continue;
+		}
+
+		uint64 nVisible = 0;
+		for ( int i = 0; i < nClusters; i++ )
+		{
+			if ( PVSCheck( dl->pvs, m_Clusters[i] ) )
+			{
+				nVisible = nVisible * 0x100000001b3ULL + i + 1;
+			}
+		}
+
+		if ( nVisible )
+		{
+			h = HashValue64( h, s_LightHashes[dl->index] );
+			h = HashValue64( h, nVisible );
+		}
+	}
+
+	// Everything those clusters can see
+	uint64 nGeometry, nLighting = 0;
+	if ( bAll )
+	{
+		nGeometry = s_nTotalGeometry;
+		nLighting = s_nTotalLighting;
+	}
+	else if ( nClusters == 1 )
+	{
+		nGeometry = s_VisibleGeometry[m_Clusters[0]];
+		if ( bFinalLighting )
+			nLighting = s_VisibleLighting[m_Clusters[0]];
+	}
+	else
+	{
+		CUtlVector<byte> visible;
+		visible.SetCount( s_nPVSRowBytes );
+		memset( visible.Base(), 0, s_nPVSRowBytes );
+		for ( int i = 0; i < nClusters; i++ )
+		{
+			const byte *pRow = &s_PVS[m_Clusters[i] * s_nPVSRowBytes];
+			for ( int j = 0; j < s_nPVSRowBytes; j++ )
+			{
+				visible[j] |= pRow[j];
+			}
+		}
+
+		nGeometry = SumVisible( visible.Base(), s_ClusterGeometry );
+		if ( bFinalLighting )
+			nLighting = SumVisible( visible.Base(), s_ClusterLighting );
+	}
+
+	if ( !bAll )
+	{
+		nGeometry += s_nUnclusteredGeometry;
+	}
+
+	h = HashValue64( h, nGeometry );
+	if ( bFinalLighting )
+		h = HashValue64( h, nLighting );
+
+	// 0 means "no key"
+	h = MixHash64( h );
+	return h ? h : 1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Lookups and results
+//-----------------------------------------------------------------------------
+static int FindLoadedEntry( uint64 nKey )
+{
+	int nLow = 0, nHigh = s_LoadedEntries.Count() - 1;
+	while ( nLow <= nHigh )
+	{
+		int nMid = ( nLow + nHigh ) / 2;
+		if ( s_LoadedEntries[nMid].m_nKey == nKey )
+			return nMid;
+
+		if ( s_LoadedEntries[nMid].m_nKey < nKey )
+			nLow = nMid + 1;
+		else
+			nHigh = nMid - 1;
+	}
+	return -1;
+}
+
+bool LightCache_Find( LightCacheType_t type, uint64 nKey, MessageBuffer *pBuf )
+{
+	if ( !s_bActive )
+		return false;
+
+	int iEntry = FindLoadedEntry( nKey );
+	if ( iEntry == -1 )
+		return false;
+
+	const LightCacheEntry_t &entry = s_LoadedEntries[iEntry];
+	pBuf->reset( entry.m_nBytes );
+	pBuf->write( (const byte*)s_LoadedData.Base() + entry.m_nOffset, entry.m_nBytes );
+
+	// -fork workers don't report hits; the master counts them when it gets the results
+	if ( !ForkDistribute_IsWorker() )
+	{
+		s_LoadedEntryUsed[iEntry] = true;
+		++s_nHits[type];
+	}
+	return true;
+}
+
+void LightCache_Store( LightCacheType_t type, uint64 nKey, const void *pData, int nBytes )
+{
+	if ( !s_bActive || !nKey || ForkDistribute_IsWorker() )
+		return;
+
+	ThreadLock();
+
+	int iEntry = FindLoadedEntry( nKey );
+	if ( iEntry != -1 )
+	{
+		s_LoadedEntryUsed[iEntry] = true;
+		++s_nHits[type];
+	}
+	else
+	{
+		++s_nMisses[type];
+
+		// Identical props share their result
+		if ( s_NewEntryMap.Find( nKey ) == s_NewEntryMap.InvalidIndex() )
+		{
+			LightCacheEntry_t entry;
+			entry.m_nKey = nKey;
+			entry.m_nOffset = s_NewData.TellPut();
+			entry.m_nBytes = nBytes;
+			s_NewData.Put( pData, nBytes );
+			s_NewEntryMap.Insert( nKey, s_NewEntries.AddToTail( entry ) );
+		}
+	}
+
+	ThreadUnlock();
+}
+
+
+//-----------------------------------------------------------------------------
+// Keeps the results this compile used and writes them out
+//-----------------------------------------------------------------------------
+static int __cdecl LightCacheEntryCompare( const LightCacheEntry_t *a, const LightCacheEntry_t *b )
+{
+	if ( a->m_nKey == b->m_nKey )
+		return 0;
+	return ( a->m_nKey < b->m_nKey ) ? -1 : 1;
+}
+
+void LightCache_Shutdown()
+{
+	if ( !s_bActive )
+		return;
+
+	static const char *s_pTypeNames[LIGHTCACHE_NUM_TYPES] = { "faces", "static props", "leaves" };
+	Msg( "Light cache reused" );
+	for ( int i = 0; i < LIGHTCACHE_NUM_TYPES; i++ )
+	{
+		int nTotal = s_nHits[i] + s_nMisses[i];
+		Msg( "%s %d of %d %s", i ? "," : "", (int)s_nHits[i], nTotal, s_pTypeNames[i] );
+	}
+	Msg( "\n" );
+
+	CUtlVector<LightCacheEntry_t> entries;
+	CUtlBuffer data;
+	for ( int i = 0; i < s_LoadedEntries.Count(); i++ )
+	{
+		if ( !s_LoadedEntryUsed[i] )
+			continue;
+
+		LightCacheEntry_t entry = s_LoadedEntries[i];
+		entry.m_nOffset = data.TellPut();
+		data.Put( (const byte*)s_LoadedData.Base() + s_LoadedEntries[i].m_nOffset, entry.m_nBytes );
+		entries.AddToTail( entry );
+	}
+
+	for ( int i = 0; i < s_NewEntries.Count(); i++ )
+	{
+		LightCacheEntry_t entry = s_NewEntries[i];
+		entry.m_nOffset = data.TellPut();
+		data.Put( (const byte*)s_NewData.Base() + s_NewEntries[i].m_nOffset, entry.m_nBytes );
+		entries.AddToTail( entry );
+	}
+
+	entries.Sort( LightCacheEntryCompare );
+
+	LightCacheHeader_t header;
+	header.m_nId = LIGHTCACHE_ID;
+	header.m_nVersion = LIGHTCACHE_VERSION;
+	header.m_nSettingsHash = s_nSettingsHash;
+	header.m_nEntries = entries.Count();
+	header.m_nUnused = 0;
+
+	CUtlBuffer buf;
+	buf.Put( &header, sizeof( header ) );
+	buf.Put( entries.Base(), entries.Count() * sizeof( LightCacheEntry_t ) );
+	buf.Put( data.Base(), data.TellPut() );
+
+	if ( !g_pFileSystem->WriteFile( s_szFilename, NULL, buf ) )
+	{
+		Warning( "Couldn't write the light cache to %s\n", s_szFilename );
+	}
+	else
+	{
+		Msg( "Wrote %d lighting results (%.1f MB) to %s\n", entries.Count(), buf.TellPut() / ( 1024.0f * 1024.0f ), s_szFilename );
+	}
+
+	s_bActive = false;
+}
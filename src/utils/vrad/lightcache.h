@@ -0,0 +1,91 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Incremental relight cache. Lighting results are saved next to the
+//			bsp keyed by a hash of everything that went into them, so a
+//			recompile after a small change only relights what it touched.
+//
+//=============================================================================//
+
+#ifndef LIGHTCACHE_H
+#define LIGHTCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlvector.h"
+
+class MessageBuffer;
+
+
+enum LightCacheType_t
+{
+	LIGHTCACHE_FACE = 0,		// direct lighting from BuildFacelights
+	LIGHTCACHE_STATICPROP,		// static prop vertex and texel lighting
+	LIGHTCACHE_LEAFAMBIENT,		// leaf ambient sample lists
+
+	LIGHTCACHE_NUM_TYPES
+};
+
+
+// Set by -lightcache.
+extern bool g_bLightCache;
+
+// The key each face was looked up with in BuildFacelights, 0 if it wasn't.
+extern CUtlVector<uint64> g_FaceLightCacheKeys;
+
+
+//-----------------------------------------------------------------------------
+// Builds a cache key. Add the data the result is computed from and the points or
+// boxes it's lit at; Finish folds in the lights that can reach those clusters and
+// the geometry (and for indirect lighting, the final lightmaps) they can see.
+//-----------------------------------------------------------------------------
+class CLightCacheKey
+{
+public:
+	CLightCacheKey( LightCacheType_t type );
+
+	void Add( const void *pData, int nBytes );
+	template< class T > void Add( const T &value ) { Add( &value, sizeof( value ) ); }
+
+	// A point that's lit with the PVS of ClusterFromPoint( vPos ).
+	void AddPoint( const Vector &vPos );
+
+	// Every cluster this box touches.
+	void AddBox( const Vector &vMins, const Vector &vMaxs );
+
+	// Returns the key. bFinalLighting also hashes the final lightmaps of everything
+	// visible, for results that sample bounced light.
+	uint64 Finish( bool bFinalLighting );
+
+	// Just the data that was added, for hashes that go into other keys.
+	uint64 GetDataHash() const { return m_nHash; }
+
+private:
+	uint64			m_nHash;
+	CUtlVector<int>	m_Clusters;
+	bool			m_bAllClusters;
+};
+
+
+// Hashes the ray trace triangles into the clusters they touch. Call after all the
+// polys have been added and before SetupAccelerationStructure.
+void LightCache_HashGeometry();
+
+// Loads the cache file. Call once the direct lights and sky cameras are set up.
+void LightCache_Init( const char *pFilename );
+
+// Hashes the final face lightmaps, for the keys of static props and leaf ambient.
+void LightCache_HashFinalLighting();
+
+// Copies the cached result for nKey into pBuf and returns true if there is one.
+bool LightCache_Find( LightCacheType_t type, uint64 nKey, MessageBuffer *pBuf );
+
+// Records the result for a key that LightCache_Find missed (or that a -fork worker
+// looked up) so it's written out by LightCache_Shutdown. Thread safe.
+void LightCache_Store( LightCacheType_t type, uint64 nKey, const void *pData, int nBytes );
+
+// Writes the results of this compile to the cache file and prints the hit rates.
+void LightCache_Shutdown();
+
+
+#endif // LIGHTCACHE_H
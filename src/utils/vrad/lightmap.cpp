@@ -22,6 +22,9 @@
 #include "mathlib/quantize.h"
 #include "bitmap/imageformat.h"
 #include "coordsize.h"
+#include "messbuf.h"
+#include "fork_distribute.h"
+#include "lightcache.h"
 
 enum
 {
@@ -1703,24 +1706,39 @@ void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, i
 
 	DirectionalSampler_t sampler;
 
-	for ( int d = 0; d < nsamples; d++ )
+	// Sun samples are traced in pairs, so each trace is an 8 ray packet
+	FourVectors start8[2] = { pos, pos };
+	for ( int d = 0; d < nsamples; d += 2 )
 	{
-		// determine visibility of skylight
-		// serach back to see if we can hit a sky brush
-		Vector delta;
-		VectorScale( dl->light.normal, -MAX_TRACE_LENGTH, delta );
-		if ( d )
+		int nPair = min( 2, nsamples - d );
+		FourVectors delta4[2];
+		for ( int p = 0; p < nPair; p++ )
 		{
-			// jitter light source location
-			Vector ofs = sampler.NextValue();
-			ofs *= MAX_TRACE_LENGTH * g_SunAngularExtent;
-			delta += ofs;
+			// determine visibility of skylight
+			// serach back to see if we can hit a sky brush
+			Vector delta;
+			VectorScale( dl->light.normal, -MAX_TRACE_LENGTH, delta );
+			if ( d + p )
+			{
+				// jitter light source location
+				Vector ofs = sampler.NextValue();
+				ofs *= MAX_TRACE_LENGTH * g_SunAngularExtent;
+				delta += ofs;
+			}
+			delta4[p].DuplicateVector ( delta );
+			delta4[p] += pos;
 		}
-		FourVectors delta4;
-		delta4.DuplicateVector ( delta );
-		delta4 += pos;
 
-		TestLine_DoesHitSky ( pos, delta4, &fractionVisible, true, static_prop_index_to_ignore );
+		if ( nPair == 2 )
+		{
+			fltx4 fractionVisible8[2];
+			TestLine_DoesHitSky8 ( start8, delta4, fractionVisible8, true, static_prop_index_to_ignore );
+			fractionVisible = AddSIMD ( fractionVisible8[0], fractionVisible8[1] );
+		}
+		else
+		{
+			TestLine_DoesHitSky ( pos, delta4[0], &fractionVisible, true, static_prop_index_to_ignore );
+		}
 
 		totalFractionVisible = AddSIMD ( totalFractionVisible, fractionVisible );
 	}
@@ -1832,11 +1850,19 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 
 }
 
-// Helper function - gathers light from area lights, spot lights, and point lights
-void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
-								  FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
-								  int nLFlags, int static_prop_index_to_ignore,
-								  float flEpsilon )
+// What a standard light keeps between its shading and its visibility trace
+struct SSE_StandardLightTrace_t
+{
+	FourVectors m_Src;				// where the shadow rays end
+	FourVectors m_Delta;			// normalized direction to the light
+	fltx4 m_flDot;
+};
+
+// Shading half of GatherSampleStandardLightSSE. Returns false if none of the samples can
+// receive any light, in which case there's nothing to trace.
+static bool SetupSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
+										 FourVectors const& pos, FourVectors *pNormals, int nLFlags,
+										 SSE_StandardLightTrace_t &trace )
 {
 	bool bIgnoreNormals = ( nLFlags & GATHERLFLAGS_IGNORE_NORMALS ) != 0;
 
@@ -1870,7 +1896,7 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 		fltx4 notPastFadeDist = CmpLeSIMD ( dist, ReplicateX4 ( dl->m_flEndFadeDistance ) );
 		dot = AndSIMD( dot, notPastFadeDist );  // dot = 0 if past fade distance
 		if ( !TestSignSIMD ( notPastFadeDist ) )
-			return;
+			return false;
 	}
 
 	dist = MaxSIMD( dist, Four_Ones );
@@ -1901,7 +1927,7 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 		// Light behind surface yields zero dot
 		dot2 = MaxSIMD( Four_Zeros, dot2 );
 		if ( TestSignSIMD( CmpEqSIMD( Four_Zeros, dot ) ) == 0xF )
-			return;
+			return false;
 
 		out.m_flFalloff = ReciprocalSIMD ( dist2 );
 		out.m_flFalloff = MulSIMD( out.m_flFalloff, dot2 );
@@ -1919,7 +1945,7 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 		// Affix dot2 to zero if outside light cone
 		inCone = CmpGtSIMD( dot2, ReplicateX4( dl->light.stopdot2 ) );
 		if ( !TestSignSIMD ( inCone ) )
-			return;
+			return false;
 		dot = AndSIMD( inCone, dot );
 
 		constant  = ReplicateX4( dl->light.constant_attn );
@@ -1976,11 +2002,19 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 		out.m_flFalloff = MulSIMD( mult, out.m_flFalloff );
 	}
 
-	// Raytrace for visibility function
-	fltx4 fractionVisible = Four_Ones;
-	TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
-	dot = MulSIMD( fractionVisible, dot );
-	out.m_flDot[0] = dot;
+	trace.m_Src = src;
+	trace.m_Delta = delta;
+	trace.m_flDot = dot;
+	return true;
+}
+
+// Visibility half of GatherSampleStandardLightSSE
+static void FinishSampleStandardLightSSE( SSE_sampleLightOutput_t &out, SSE_StandardLightTrace_t const &trace,
+										  fltx4 fractionVisible, FourVectors *pNormals, int normalCount, int nLFlags )
+{
+	bool bIgnoreNormals = ( nLFlags & GATHERLFLAGS_IGNORE_NORMALS ) != 0;
+
+	out.m_flDot[0] = MulSIMD( fractionVisible, trace.m_flDot );
 
 	for ( int i = 1; i < normalCount; i++ )
 	{
@@ -1988,29 +2022,65 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 			out.m_flDot[i] = ReplicateX4( (float) CONSTANT_DOT );
 		else
 		{
-			out.m_flDot[i] = pNormals[i] * delta;
+			out.m_flDot[i] = pNormals[i] * trace.m_Delta;
 			out.m_flDot[i] = MaxSIMD( Four_Zeros, out.m_flDot[i] );
 		}
 	}
 }
 
+// Helper function - gathers light from area lights, spot lights, and point lights
+void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
+								  FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
+								  int nLFlags, int static_prop_index_to_ignore,
+								  float flEpsilon )
+{
+	SSE_StandardLightTrace_t trace;
+	if ( !SetupSampleStandardLightSSE( out, dl, pos, pNormals, nLFlags, trace ) )
+		return;
+
+	// Raytrace for visibility function
+	fltx4 fractionVisible = Four_Ones;
+	TestLine( pos, trace.m_Src, &fractionVisible, static_prop_index_to_ignore);
+	FinishSampleStandardLightSSE( out, trace, fractionVisible, pNormals, normalCount, nLFlags );
+}
+
 // returns dot product with normal and delta
 // dl - light
 // pos - position of sample
 // normal - surface normal of sample
 // out.m_flDot[] - returned dot products with light vector and each normal
 // out.m_flFalloff - amount of light falloff
-void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
-					   FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
-					   int nLFlags,
-					   int static_prop_index_to_ignore,
-					   float flEpsilon )
+static void ClearSampleLightOutputSSE( SSE_sampleLightOutput_t &out, int normalCount )
 {
 	for ( int b = 0; b < normalCount; b++ )
 		out.m_flDot[b] = Four_Zeros;
 	out.m_flFalloff = Four_Zeros;
 	out.m_flSunAmount = Four_Zeros;
 	Assert( normalCount <= (NUM_BUMP_VECTS+1) );
+}
+
+static void ClampSampleLightDotsSSE( SSE_sampleLightOutput_t &out, int normalCount )
+{
+	// NOTE: Notice here that if the light is on the back side of the face
+	// (tested by checking the dot product of the face normal and the light position)
+	// we don't want it to contribute to *any* of the bumped lightmaps. It glows
+	// in disturbing ways if we don't do this.
+	out.m_flDot[0] = MaxSIMD ( out.m_flDot[0], Four_Zeros );
+	fltx4 notZero = CmpGtSIMD( out.m_flDot[0], Four_Zeros );
+	for ( int n = 1; n < normalCount; n++ )
+	{
+		out.m_flDot[n] = MaxSIMD( out.m_flDot[n], Four_Zeros );
+		out.m_flDot[n] = AndSIMD( out.m_flDot[n], notZero );
+	}
+}
+
+void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
+					   FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
+					   int nLFlags,
+					   int static_prop_index_to_ignore,
+					   float flEpsilon )
+{
+	ClearSampleLightOutputSSE( out, normalCount );
 
 	// skylights work fundamentally differently than normal lights
 	switch( dl->light.type )
@@ -2034,18 +2104,62 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
 		return;
 	}
 
-	// NOTE: Notice here that if the light is on the back side of the face
-	// (tested by checking the dot product of the face normal and the light position)
-	// we don't want it to contribute to *any* of the bumped lightmaps. It glows
-	// in disturbing ways if we don't do this.
-	out.m_flDot[0] = MaxSIMD ( out.m_flDot[0], Four_Zeros );
-	fltx4 notZero = CmpGtSIMD( out.m_flDot[0], Four_Zeros );
-	for ( int n = 1; n < normalCount; n++ )
+	ClampSampleLightDotsSSE( out, normalCount );
+}
+
+static bool IsStandardLight( directlight_t *dl )
+{
+	return ( dl->light.type == emit_point ) || ( dl->light.type == emit_surface ) || ( dl->light.type == emit_spotlight );
+}
+
+// GatherSampleLightSSE for two lights. When both are point, spot or surface lights, their
+// shadow rays go out together as one 8 ray trace.
+void GatherSampleLightPairSSE( SSE_sampleLightOutput_t *pOut, directlight_t **ppLights, int facenum,
+							   FourVectors const *pPos, FourVectors *pNormals, int normalCount, int iThread,
+							   int nLFlags,
+							   int static_prop_index_to_ignore,
+							   float flEpsilon )
+{
+	if ( !IsStandardLight( ppLights[0] ) || !IsStandardLight( ppLights[1] ) )
 	{
-		out.m_flDot[n] = MaxSIMD( out.m_flDot[n], Four_Zeros );
-		out.m_flDot[n] = AndSIMD( out.m_flDot[n], notZero );
+		for ( int l = 0; l < 2; l++ )
+		{
+			GatherSampleLightSSE( pOut[l], ppLights[l], facenum, pPos[l], pNormals, normalCount, iThread,
+								  nLFlags, static_prop_index_to_ignore, flEpsilon );
+		}
+		return;
+	}
+
+	SSE_StandardLightTrace_t trace[2];
+	bool bVisible[2];
+	for ( int l = 0; l < 2; l++ )
+	{
+		ClearSampleLightOutputSSE( pOut[l], normalCount );
+		bVisible[l] = SetupSampleStandardLightSSE( pOut[l], ppLights[l], pPos[l], pNormals, nLFlags, trace[l] );
+	}
+
+	// Raytrace for visibility function
+	fltx4 fractionVisible[2] = { Four_Ones, Four_Ones };
+	if ( bVisible[0] && bVisible[1] )
+	{
+		FourVectors src[2] = { trace[0].m_Src, trace[1].m_Src };
+		TestLine8( pPos, src, fractionVisible, static_prop_index_to_ignore );
+	}
+	else
+	{
+		for ( int l = 0; l < 2; l++ )
+		{
+			if ( bVisible[l] )
+				TestLine( pPos[l], trace[l].m_Src, &fractionVisible[l], static_prop_index_to_ignore );
+		}
 	}
 
+	for ( int l = 0; l < 2; l++ )
+	{
+		if ( bVisible[l] )
+			FinishSampleStandardLightSSE( pOut[l], trace[l], fractionVisible[l], pNormals, normalCount, nLFlags );
+		ClampSampleLightDotsSSE( pOut[l], normalCount );
+	}
 }
 
 /*
@@ -2486,81 +2600,119 @@ static void ComputeIlluminationPointAndNormalsSSE( lightinfo_t const& l, FourVec
 }
 
 //-----------------------------------------------------------------------------
-// Iterates over all lights and computes lighting at up to 4 sample points
+// Adds one light's contribution to up to 4 sample points
 //-----------------------------------------------------------------------------
-static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples )
+static void AddSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples,
+	directlight_t *dl, SSE_sampleLightOutput_t const &out, fltx4 dotMask )
 {
-	SSE_sampleLightOutput_t out;
+	// Apply the PVS check filter and compute falloff x dot
+	fltx4 fxdot[NUM_BUMP_VECTS + 1];
+	bool skipLight = true;
+	for ( int b = 0; b < info.m_NormalCount; b++ )
+	{
+		fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
+		fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
+		if ( !IsAllZeros( fxdot[b] ) )
+		{
+			skipLight = false;
+		}
+	}
+	if ( skipLight )
+		return;
 
-	// Iterate over all direct lights and add them to the particular sample
-	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
-	{	    
-		// is this lights cluster visible?
-		fltx4 dotMask = Four_Zeros;
-		bool skipLight = true;
-		for( int s = 0; s < numSamples; s++ )
+	// Figure out the lightstyle for this particular sample
+	int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
+		dl->light.style, info.m_NormalCount );
+	if (lightStyleIndex < 0)
+	{
+		if (info.m_WarnFace != info.m_FaceNum)
 		{
-			if( PVSCheck( dl->pvs, info.m_Clusters[s] ) )
-			{
-				dotMask = SetComponentSIMD( dotMask, s, 1.0f );
-				skipLight = false;
-			}
+			Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
+				info.m_Points.x.m128_f32[0], info.m_Points.y.m128_f32[0], info.m_Points.z.m128_f32[0] );
+			info.m_WarnFace = info.m_FaceNum;
 		}
-		if ( skipLight )
-			continue;
+		return;
+	}
 
-		GatherSampleLightSSE( out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
-		
-		// Apply the PVS check filter and compute falloff x dot
-		fltx4 fxdot[NUM_BUMP_VECTS + 1];
-		skipLight = true;
-		for ( int b = 0; b < info.m_NormalCount; b++ )
+	// pLightmaps is an array of the lightmaps for each normal direction,
+	// here's where the result of the sample gathering goes
+	LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+
+	// Incremental lighting only cares about lightstyle zero
+	if( g_pIncremental && (dl->light.style == 0) )
+	{
+		for ( int i = 0; i < numSamples; i++ )
 		{
-			fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
-			fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
-			if ( !IsAllZeros( fxdot[b] ) )
-			{
-				skipLight = false;
-			}
+			g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
+				info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
 		}
-		if ( skipLight )
-			continue;
+	}
 
-		// Figure out the lightstyle for this particular sample
-		int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
-			dl->light.style, info.m_NormalCount );
-		if (lightStyleIndex < 0)
+	for( int n = 0; n < info.m_NormalCount; ++n )
+	{
+		for ( int i = 0; i < numSamples; i++ )
 		{
-			if (info.m_WarnFace != info.m_FaceNum)
-			{
-				Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
-					info.m_Points.x.m128_f32[0], info.m_Points.y.m128_f32[0], info.m_Points.z.m128_f32[0] );
-				info.m_WarnFace = info.m_FaceNum;
-			}
-			continue;
+			pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
 		}
+	}
+}
 
-		// pLightmaps is an array of the lightmaps for each normal direction,
-		// here's where the result of the sample gathering goes
-		LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+//-----------------------------------------------------------------------------
+// Iterates over all lights and computes lighting at up to 4 sample points
+//-----------------------------------------------------------------------------
+static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples )
+{
+	// Visible lights are gathered two at a time so their shadow rays can share a trace.
+	// They are still added in list order, so the result doesn't change.
+	directlight_t *pLights[2];
+	fltx4 dotMasks[2];
+	int nLights = 0;
 
-		// Incremental lighting only cares about lightstyle zero
-		if( g_pIncremental && (dl->light.style == 0) )
+	// Iterate over all direct lights and add them to the particular sample
+	for (directlight_t *dl = activelights; ; dl = dl->next)
+	{
+		if ( dl )
 		{
-			for ( int i = 0; i < numSamples; i++ )
+			// is this lights cluster visible?
+			fltx4 dotMask = Four_Zeros;
+			bool skipLight = true;
+			for( int s = 0; s < numSamples; s++ )
 			{
-				g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
-					info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
+				if( PVSCheck( dl->pvs, info.m_Clusters[s] ) )
+				{
+					dotMask = SetComponentSIMD( dotMask, s, 1.0f );
+					skipLight = false;
+				}
 			}
+			if ( skipLight )
+				continue;
+
+			pLights[nLights] = dl;
+			dotMasks[nLights] = dotMask;
+			if ( ++nLights < 2 )
+				continue;
 		}
 
-		for( int n = 0; n < info.m_NormalCount; ++n )
+		if ( nLights == 0 )
+			break;
+
+		SSE_sampleLightOutput_t out[2];
+		if ( nLights == 2 )
 		{
-			for ( int i = 0; i < numSamples; i++ )
-			{
-				pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
-			}
+			FourVectors points[2] = { info.m_Points, info.m_Points };
+			GatherSampleLightPairSSE( out, pLights, info.m_FaceNum, points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
 		}
+		else
+		{
+			GatherSampleLightSSE( out[0], pLights[0], info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
+		}
+
+		for ( int l = 0; l < nLights; l++ )
+			AddSampleLightAt4Points( info, sampleIdx, numSamples, pLights[l], out[l], dotMasks[l] );
+
+		if ( !dl )
+			break;
+		nLights = 0;
 	}
 }
 
@@ -3056,6 +3208,122 @@ static void InitSampleInfo( lightinfo_t const& l, int iThread, SSE_SampleInfo_t&
 	}
 }
 
+//-----------------------------------------------------------------------------
+// The light cache key for a face: its samples, luxels and the normals they're
+// smoothed from, plus everything the sample clusters can see.
+//-----------------------------------------------------------------------------
+static uint64 ComputeFaceLightCacheKey( int facenum, lightinfo_t const &l, facelight_t const *fl )
+{
+	CLightCacheKey key( LIGHTCACHE_FACE );
+
+	dface_t *f = &g_pFaces[facenum];
+	key.Add( texinfo[f->texinfo] );
+	key.Add( f->dispinfo != -1 );
+	key.Add( l.facenormal );
+	key.Add( l.modelorg );
+	key.Add( l.isflat );
+
+	faceneighbor_t *fn = &faceneighbor[facenum];
+	for ( int i = 0; i < f->numedges; i++ )
+	{
+		int e = dsurfedges[f->firstedge + i];
+		int v = ( e >= 0 ) ? dedges[e].v[0] : dedges[-e].v[1];
+		key.Add( dvertexes[v].point );
+		if ( fn->normal )
+			key.Add( fn->normal[i] );
+	}
+
+	// Supersampling moves around inside each sample, so also take the clusters
+	// within a sample's width of them.
+	Vector vMins, vMaxs;
+	ClearBounds( vMins, vMaxs );
+	float flMaxArea = 0;
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		sample_t const &sample = fl->sample[i];
+		key.Add( sample.s );
+		key.Add( sample.t );
+		key.Add( sample.coord );
+		key.Add( sample.mins );
+		key.Add( sample.maxs );
+		key.Add( sample.pos );
+		key.Add( sample.normal );
+		key.Add( sample.area );
+
+		key.AddPoint( sample.pos );
+		AddPointToBounds( sample.pos, vMins, vMaxs );
+		flMaxArea = max( flMaxArea, sample.area );
+	}
+
+	if ( fl->numsamples )
+	{
+		float flExtent = sqrt( flMaxArea ) + 1.0f;
+		key.AddBox( vMins - Vector( flExtent, flExtent, flExtent ), vMaxs + Vector( flExtent, flExtent, flExtent ) );
+	}
+
+	if ( fl->luxel )
+		key.Add( fl->luxel, fl->numluxels * sizeof( Vector ) );
+	if ( fl->luxelNormals )
+		key.Add( fl->luxelNormals, fl->numluxels * sizeof( Vector ) );
+	key.Add( fl->worldAreaPerLuxel );
+
+	return key.Finish( false );
+}
+
+
+//-----------------------------------------------------------------------------
+// Replaces the facelight CalcPoints just built with the saved one
+//-----------------------------------------------------------------------------
+static bool RestoreFacelightFromCache( int facenum, facelight_t *fl, uint64 nKey )
+{
+	MessageBuffer mb;
+	if ( !LightCache_Find( LIGHTCACHE_FACE, nKey, &mb ) )
+		return false;
+
+	FreeSampleWindings( fl );
+	free( fl->sample );
+	free( fl->luxel );
+	free( fl->luxelNormals );
+
+	// The dface_t is this compile's, only the lightstyles come from the cache
+	dface_t face = g_pFaces[facenum];
+	UnSerializeFace( &mb, facenum, "the light cache" );
+	memcpy( face.styles, g_pFaces[facenum].styles, sizeof( face.styles ) );
+	g_pFaces[facenum] = face;
+
+	// The saved windings were freed before they were serialized
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		fl->sample[i].w = NULL;
+	}
+	return true;
+}
+
+
+static void FinishFacelights( int facenum, facelight_t *fl )
+{
+#ifdef MPI
+	if (!g_bUseMPI) 
+#endif
+	if ( !g_nForkWorkers )
+	{
+		//
+		// This is done on the master node when MPI or -fork is used
+		//
+		BuildPatchLights( facenum );
+	}
+
+	if( g_bDumpPatches )
+	{
+		DumpSamples( facenum, fl );
+	}
+	else
+	{
+		FreeSampleWindings( fl );
+	}
+}
+
+
 void BuildFacelights (int iThread, int facenum)
 {
 	int	i, j;
@@ -3104,6 +3372,20 @@ void BuildFacelights (int iThread, int facenum)
 
 	InitLightinfo( &l, facenum );
 	CalcPoints( &l, fl, facenum );
+
+	uint64 nCacheKey = 0;
+	if ( g_bLightCache )
+	{
+		nCacheKey = ComputeFaceLightCacheKey( facenum, l, fl );
+		g_FaceLightCacheKeys[facenum] = nCacheKey;
+
+		if ( RestoreFacelightFromCache( facenum, fl, nCacheKey ) )
+		{
+			FinishFacelights( facenum, fl );
+			return;
+		}
+	}
+
 	InitSampleInfo( l, iThread, sampleInfo );
 
 	// Allocate sample positions/normals to SSE
@@ -3174,25 +3456,15 @@ void BuildFacelights (int iThread, int facenum)
 		}
 	}
 
-#ifdef MPI
-	if (!g_bUseMPI) 
-#endif
-	{
-		//
-		// This is done on the master node when MPI is used
-		//
-		BuildPatchLights( facenum );
-	}
+	FinishFacelights( facenum, fl );
 
-	if( g_bDumpPatches )
-	{
-		DumpSamples( facenum, fl );
-	}
-	else
+	// -fork workers send the key back with the facelight and the master stores it
+	if ( nCacheKey && !ForkDistribute_IsWorker() )
 	{
-		FreeSampleWindings( fl );
+		MessageBuffer mb;
+		SerializeFace( &mb, facenum );
+		LightCache_Store( LIGHTCACHE_FACE, nCacheKey, mb.data, mb.getLen() );
 	}
-
 }
 
 void BuildPatchLights( int facenum )
@@ -3598,3 +3870,96 @@ void ConvertLinearToRGBA8888(const Vector *pSrcLinear, unsigned char *pDst)
 	pDst[2] = RoundFloatToByte(vertexColor[2] * 255.0f);
 	pDst[3] = 255;
 }
+
+
+template<class T> static void WriteValues( MessageBuffer *pmb, T const *pSrc, int nNumValues)
+{
+	pmb->write(pSrc, sizeof( pSrc[0]) * nNumValues );
+}
+
+template<class T> static int ReadValues( MessageBuffer *pmb, T *pDest, int nNumValues)
+{
+	return pmb->read( pDest, sizeof( pDest[0]) * nNumValues );
+}
+
+
+//--------------------------------------------------
+// Serialize face data for sending results back from an MPI or -fork worker
+void SerializeFace( MessageBuffer * pmb, int facenum )
+{
+	int i, n;
+
+	dface_t     * f  = &g_pFaces[facenum];
+	facelight_t * fl = &facelight[facenum];
+
+	pmb->write(f, sizeof(dface_t));
+	pmb->write(fl, sizeof(facelight_t));
+
+	WriteValues( pmb, fl->sample, fl->numsamples);
+
+	//
+	// Write the light information
+	// 
+	for (i=0; i<MAXLIGHTMAPS; ++i) {
+		for (n=0; n<NUM_BUMP_VECTS+1; ++n) {
+			if (fl->light[i][n])
+			{
+				WriteValues( pmb, fl->light[i][n], fl->numsamples);
+			}
+		}
+	}
+
+	if (fl->luxel)
+		WriteValues( pmb, fl->luxel, fl->numluxels);
+	
+	if (fl->luxelNormals) 
+		WriteValues( pmb, fl->luxelNormals, fl->numluxels);
+}
+
+//--------------------------------------------------
+// UnSerialize face data
+//
+void UnSerializeFace( MessageBuffer * pmb, int facenum, const char *pSourceName )
+{
+	int i, n;
+
+	dface_t     * f  = &g_pFaces[facenum];
+	facelight_t * fl = &facelight[facenum];
+
+	if (pmb->read(f, sizeof(dface_t)) < 0) 
+		Error("UnSerializeFace - invalid dface_t from %s (mb len: %d, offset: %d)", pSourceName, pmb->getLen(), pmb->getOffset() );
+
+	if (pmb->read(fl, sizeof(facelight_t)) < 0) 
+		Error("UnSerializeFace - invalid facelight_t from %s (mb len: %d, offset: %d)", pSourceName, pmb->getLen(), pmb->getOffset() );
+
+	fl->sample = (sample_t *) calloc(fl->numsamples, sizeof(sample_t));
+	if (pmb->read(fl->sample, sizeof(sample_t) * fl->numsamples) < 0) 
+		Error("UnSerializeFace - invalid sample_t from %s (mb len: %d, offset: %d, fl->numsamples: %d)", pSourceName, pmb->getLen(), pmb->getOffset(), fl->numsamples );
+
+	//
+	// Read the light information
+	// 
+	for (i=0; i<MAXLIGHTMAPS; ++i) {
+		for (n=0; n<NUM_BUMP_VECTS+1; ++n) {
+			if (fl->light[i][n])
+			{
+				fl->light[i][n] = (LightingValue_t *) calloc( fl->numsamples, sizeof(LightingValue_t ) );
+				if ( ReadValues( pmb, fl->light[i][n], fl->numsamples) < 0)
+					Error("UnSerializeFace - invalid fl->light from %s (mb len: %d, offset: %d)", pSourceName, pmb->getLen(), pmb->getOffset() );
+			}
+		}
+	}
+
+	if (fl->luxel) {
+		fl->luxel = (Vector *) calloc(fl->numluxels, sizeof(Vector));
+		if (ReadValues( pmb, fl->luxel, fl->numluxels) < 0)
+			Error("UnSerializeFace - invalid fl->luxel from %s (mb len: %d, offset: %d)", pSourceName, pmb->getLen(), pmb->getOffset() );
+	}
+
+	if (fl->luxelNormals) {
+		fl->luxelNormals = (Vector *) calloc(fl->numluxels, sizeof( Vector ));
+		if ( ReadValues( pmb, fl->luxelNormals, fl->numluxels) < 0)
+			Error("UnSerializeFace - invalid fl->luxelNormals from %s (mb len: %d, offset: %d)", pSourceName, pmb->getLen(), pmb->getOffset() );
+	}
+
+}
@@ -87,6 +87,11 @@ extern directlight_t	*freelights;
 extern facelight_t		facelight[MAX_MAP_FACES];
 extern int				numdlights;
 
+// Used to send BuildFacelights results from MPI and -fork workers back to the master.
+class MessageBuffer;
+void SerializeFace( MessageBuffer *pmb, int facenum );
+void UnSerializeFace( MessageBuffer *pmb, int facenum, const char *pSourceName );
+
 
 //==============================================
 
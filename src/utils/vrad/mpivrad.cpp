@@ -115,102 +115,9 @@ void VRAD_SetupMPI( int &argc, char **&argv )
 CCycleCount g_CPUTime;
 
 
-template<class T> void WriteValues( MessageBuffer *pmb, T const *pSrc, int nNumValues)
-{
-	pmb->write(pSrc, sizeof( pSrc[0]) * nNumValues );
-}
-
-template<class T> int ReadValues( MessageBuffer *pmb, T *pDest, int nNumValues)
-{
-	return pmb->read( pDest, sizeof( pDest[0]) * nNumValues );
-}
-
-
-//--------------------------------------------------
-// Serialize face data
-void SerializeFace( MessageBuffer * pmb, int facenum )
-{
-	int i, n;
-
-	dface_t     * f  = &g_pFaces[facenum];
-	facelight_t * fl = &facelight[facenum];
-
-	pmb->write(f, sizeof(dface_t));
-	pmb->write(fl, sizeof(facelight_t));
-
-	WriteValues( pmb, fl->sample, fl->numsamples);
-
-	//
-	// Write the light information
-	// 
-	for (i=0; i<MAXLIGHTMAPS; ++i) {
-		for (n=0; n<NUM_BUMP_VECTS+1; ++n) {
-			if (fl->light[i][n])
-			{
-				WriteValues( pmb, fl->light[i][n], fl->numsamples);
-			}
-		}
-	}
-
-	if (fl->luxel)
-		WriteValues( pmb, fl->luxel, fl->numluxels);
-	
-	if (fl->luxelNormals) 
-		WriteValues( pmb, fl->luxelNormals, fl->numluxels);
-}
-
-//--------------------------------------------------
-// UnSerialize face data
-//
-void UnSerializeFace( MessageBuffer * pmb, int facenum, int iSource )
-{
-	int i, n;
-
-	dface_t     * f  = &g_pFaces[facenum];
-	facelight_t * fl = &facelight[facenum];
-
-	if (pmb->read(f, sizeof(dface_t)) < 0) 
-		Error("UnSerializeFace - invalid dface_t from %s (mb len: %d, offset: %d)", VMPI_GetMachineName( iSource ), pmb->getLen(), pmb->getOffset() );
-
-	if (pmb->read(fl, sizeof(facelight_t)) < 0) 
-		Error("UnSerializeFace - invalid facelight_t from %s (mb len: %d, offset: %d)", VMPI_GetMachineName( iSource ), pmb->getLen(), pmb->getOffset() );
-
-	fl->sample = (sample_t *) calloc(fl->numsamples, sizeof(sample_t));
-	if (pmb->read(fl->sample, sizeof(sample_t) * fl->numsamples) < 0) 
-		Error("UnSerializeFace - invalid sample_t from %s (mb len: %d, offset: %d, fl->numsamples: %d)", VMPI_GetMachineName( iSource ), pmb->getLen(), pmb->getOffset(), fl->numsamples );
-
-	//
-	// Read the light information
-	// 
-	for (i=0; i<MAXLIGHTMAPS; ++i) {
-		for (n=0; n<NUM_BUMP_VECTS+1; ++n) {
-			if (fl->light[i][n])
-			{
-				fl->light[i][n] = (LightingValue_t *) calloc( fl->numsamples, sizeof(LightingValue_t ) );
-				if ( ReadValues( pmb, fl->light[i][n], fl->numsamples) < 0)
-					Error("UnSerializeFace - invalid fl->light from %s (mb len: %d, offset: %d)", VMPI_GetMachineName( iSource ), pmb->getLen(), pmb->getOffset() );
-			}
-		}
-	}
-
-	if (fl->luxel) {
-		fl->luxel = (Vector *) calloc(fl->numluxels, sizeof(Vector));
-		if (ReadValues( pmb, fl->luxel, fl->numluxels) < 0)
-			Error("UnSerializeFace - invalid fl->luxel from %s (mb len: %d, offset: %d)", VMPI_GetMachineName( iSource ), pmb->getLen(), pmb->getOffset() );
-	}
-
-	if (fl->luxelNormals) {
-		fl->luxelNormals = (Vector *) calloc(fl->numluxels, sizeof( Vector ));
-		if ( ReadValues( pmb, fl->luxelNormals, fl->numluxels) < 0)
-			Error("UnSerializeFace - invalid fl->luxelNormals from %s (mb len: %d, offset: %d)", VMPI_GetMachineName( iSource ), pmb->getLen(), pmb->getOffset() );
-	}
-
-}
-
-
 void MPI_ReceiveFaceResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWorker )
 {
-	UnSerializeFace( pBuf, iWorkUnit, iWorker );
+	UnSerializeFace( pBuf, iWorkUnit, VMPI_GetMachineName( iWorker ) );
 }
 
 
@@ -295,10 +202,11 @@ void MPI_ReceiveVisLeafsResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWor
 		int numtransfers;
 		pBuf->read( &numtransfers, sizeof(numtransfers) );
 		patch->numtransfers = numtransfers;
+		pBuf->read( &patch->transferbytes, sizeof(patch->transferbytes) );
 		if (numtransfers) 
 		{
-			patch->transfers = new transfer_t[numtransfers];
-			pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
+			patch->transfers = (byte*)malloc( patch->transferbytes );
+			pBuf->read(patch->transfers, patch->transferbytes);
 		}
 		
 		total_transfer += numtransfers;
@@ -333,7 +241,8 @@ void MPI_AddPatchData( int iThread, int patchnum, CPatch *patch )
 		++pData->m_nPatchesInCluster;
 		pData->m_pVisLeafsMB->write(&patchnum, sizeof(patchnum));
 		pData->m_pVisLeafsMB->write(&patch->numtransfers, sizeof(patch->numtransfers));
-		pData->m_pVisLeafsMB->write( patch->transfers, patch->numtransfers * sizeof(transfer_t) );
+		pData->m_pVisLeafsMB->write(&patch->transferbytes, sizeof(patch->transferbytes));
+		pData->m_pVisLeafsMB->write( patch->transfers, patch->transferbytes );
 	}
 }
 
@@ -148,6 +148,25 @@ public:
 	}
 };
 
+// Assume we can see the targets unless we get hits
+static fltx4 FractionVisibleFromTrace( fltx4 len, RayTracingResult const &rt_result, CCoverageCount &coverageCallback )
+{
+	float visibility[4];
+	for ( int i = 0; i < 4; i++ )
+	{
+		visibility[i] = 1.0f;
+		if ( ( rt_result.HitIds[i] != -1 ) &&
+		     ( rt_result.HitDistance.m128_f32[i] < len.m128_f32[i] ) )
+		{
+			visibility[i] = 0.0f;
+		}
+	}
+	fltx4 fractionVisible = LoadUnalignedSIMD( visibility );
+	if ( g_bTextureShadows )
+		fractionVisible = MinSIMD( fractionVisible, coverageCallback.GetFractionVisible() );
+	return fractionVisible;
+}
+
 void TestLine( const FourVectors& start, const FourVectors& stop,
                fltx4 *pFractionVisible, int static_prop_index_to_ignore )
 {
@@ -163,20 +182,32 @@ void TestLine( const FourVectors& start, const FourVectors& stop,
 
 	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore, g_bTextureShadows ? &coverageCallback : 0 );
 
-	// Assume we can see the targets unless we get hits
-	float visibility[4];
-	for ( int i = 0; i < 4; i++ )
+	*pFractionVisible = FractionVisibleFromTrace( len, rt_result, coverageCallback );
+}
+
+void TestLine8( FourVectors const *pStart, FourVectors const *pStop,
+				fltx4 *pFractionVisible, int static_prop_index_to_ignore )
+{
+	EightRays myrays;
+	fltx4 len[2];
+	for ( int h = 0; h < 2; h++ )
 	{
-		visibility[i] = 1.0f;
-		if ( ( rt_result.HitIds[i] != -1 ) &&
-		     ( rt_result.HitDistance.m128_f32[i] < len.m128_f32[i] ) )
-		{
-			visibility[i] = 0.0f;
-		}
+		myrays.m_Half[h].origin = pStart[h];
+		myrays.m_Half[h].direction = pStop[h];
+		myrays.m_Half[h].direction -= myrays.m_Half[h].origin;
+		len[h] = myrays.m_Half[h].direction.length();
+		myrays.m_Half[h].direction *= ReciprocalSIMD( len[h] );
 	}
-	*pFractionVisible = LoadUnalignedSIMD( visibility );
-	if ( g_bTextureShadows )
-		*pFractionVisible = MinSIMD( *pFractionVisible, coverageCallback.GetFractionVisible() );
+
+	RayTracingResult rt_result[2];
+	CCoverageCountTexture coverageCallback[2];
+	ITransparentTriangleCallback *pCallbacks[2] = { &coverageCallback[0], &coverageCallback[1] };
+
+	fltx4 tmin[2] = { Four_Zeros, Four_Zeros };
+	g_RtEnv.Trace8Rays( myrays, tmin, len, rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore, g_bTextureShadows ? pCallbacks : NULL );
+
+	for ( int h = 0; h < 2; h++ )
+		pFractionVisible[h] = FractionVisibleFromTrace( len[h], rt_result[h], coverageCallback[h] );
 }
 
 
@@ -349,25 +380,10 @@ void DM_ClipBoxToBrush( CToolTrace *trace, const Vector& mins, const Vector& max
 	}
 }
 
-void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
+static void SkyVisibilityFromTrace( FourVectors const& start, FourVectors const& stop, fltx4 len,
+	RayTracingResult const &rt_result, CCoverageCount &coverageCallback,
 	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
 {
-	FourRays myrays;
-	myrays.origin = start;
-	myrays.direction = stop;
-	myrays.direction -= myrays.origin;
-	fltx4 len = myrays.direction.length();
-	myrays.direction *= ReciprocalSIMD( len );
-	RayTracingResult rt_result;
-	CCoverageCountTexture coverageCallback;
-
-	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_to_skip, g_bTextureShadows? &coverageCallback : 0);
-
-	if ( bDoDebug )
-	{
-		WriteTrace( "trace.txt", myrays, rt_result );
-	}
-
 	float aOcclusion[4];
 	for ( int i = 0; i < 4; i++ )
 	{
@@ -428,6 +444,53 @@ void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
 	*pFractionVisible = SubSIMD( Four_Ones, occlusion );
 }
 
+void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
+	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
+{
+	FourRays myrays;
+	myrays.origin = start;
+	myrays.direction = stop;
+	myrays.direction -= myrays.origin;
+	fltx4 len = myrays.direction.length();
+	myrays.direction *= ReciprocalSIMD( len );
+	RayTracingResult rt_result;
+	CCoverageCountTexture coverageCallback;
+
+	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_to_skip, g_bTextureShadows? &coverageCallback : 0);
+
+	if ( bDoDebug )
+	{
+		WriteTrace( "trace.txt", myrays, rt_result );
+	}
+
+	SkyVisibilityFromTrace( start, stop, len, rt_result, coverageCallback, pFractionVisible, canRecurse, static_prop_to_skip, bDoDebug );
+}
+
+void TestLine_DoesHitSky8( FourVectors const *pStart, FourVectors const *pStop,
+	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip )
+{
+	EightRays myrays;
+	fltx4 len[2];
+	for ( int h = 0; h < 2; h++ )
+	{
+		myrays.m_Half[h].origin = pStart[h];
+		myrays.m_Half[h].direction = pStop[h];
+		myrays.m_Half[h].direction -= myrays.m_Half[h].origin;
+		len[h] = myrays.m_Half[h].direction.length();
+		myrays.m_Half[h].direction *= ReciprocalSIMD( len[h] );
+	}
+
+	RayTracingResult rt_result[2];
+	CCoverageCountTexture coverageCallback[2];
+	ITransparentTriangleCallback *pCallbacks[2] = { &coverageCallback[0], &coverageCallback[1] };
+
+	fltx4 tmin[2] = { Four_Zeros, Four_Zeros };
+	g_RtEnv.Trace8Rays( myrays, tmin, len, rt_result, TRACE_ID_STATICPROP | static_prop_to_skip, g_bTextureShadows ? pCallbacks : NULL );
+
+	for ( int h = 0; h < 2; h++ )
+		SkyVisibilityFromTrace( pStart[h], pStop[h], len[h], rt_result[h], coverageCallback[h], &pFractionVisible[h], canRecurse, static_prop_to_skip, false );
+}
+
 
 
 //-----------------------------------------------------------------------------
@@ -19,6 +19,8 @@
 #include "tools_minidump.h"
 #include "loadcmdline.h"
 #include "byteswap.h"
+#include "fork_distribute.h"
+#include "lightcache.h"
 
 #define ALLOWDEBUGOPTIONS (0 || _DEBUG)
 
@@ -57,8 +59,10 @@ float		g_MaxDispPatchRadius = 1500.0f;			// Maximum radius allowed for displacem
 qboolean	g_bDumpPatches;
 bool	    bDumpNormals = false;
 bool		g_bDumpRtEnv = false;
+bool		g_bRayTraceBuildBenchmark = false;
 bool		bRed2Black = true;
 bool		g_bFastAmbient = false;
+bool		g_bNoAdaptiveAmbient = false;
 bool        g_bNoSkyRecurse = false;
 bool		g_bDumpPropLightmaps = false;
 
@@ -1199,37 +1203,57 @@ void MakeTransfer( int ndxPatch1, int ndxPatch2, transfer_t *all_transfers )
 }
 
 
+static int TransferSortFn( const void *p1, const void *p2 )
+{
+	return ((const transfer_t*)p1)->patch - ((const transfer_t*)p2)->patch;
+}
+
+static int VarIntBytes( unsigned int n )
+{
+	int nBytes = 1;
+	while ( n >= 0x80 )
+	{
+		n >>= 7;
+		++nBytes;
+	}
+	return nBytes;
+}
+
+// Stats for the packed transfer report in MakeAllScales
+static double	g_flTransferWeightTotal;
+static double	g_flTransferWeightError;
+static int		g_nDroppedTransfers;
+
+//-----------------------------------------------------------------------------
+// Normalizes the transfers and packs them into patch->transfers, see CTransferReader.
+//-----------------------------------------------------------------------------
 void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 {
 	int		j;
 	float	total;
-	transfer_t	*t, *t2;
+	transfer_t	*t2;
 	total = 0;
 
 	if( ndxPatch == g_Patches.InvalidIndex() )
 		return;
 	CPatch *patch = &g_Patches.Element( ndxPatch );
 
+	double flWeightTotal = 0.0;
+	double flWeightError = 0.0;
+	int nDropped = 0;
+
 	// copy the transfers out
 	if (patch->numtransfers)
 	{
-		if (patch->numtransfers > max_transfer)
-		{
-			max_transfer = patch->numtransfers;
-		}
-
-
-		patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
-		if (!patch->transfers)
-			Error ("Memory allocation failure");
-
 		// get total transfer energy
 		t2 = all_transfers;
 
 		// overflow check!
+		float flMaxTransfer = 0.0f;
 		for (j=0 ; j<patch->numtransfers ; j++, t2++)
 		{
 			total += t2->transfer;
+			flMaxTransfer = MAX( flMaxTransfer, t2->transfer );
 		}
 
 		// the total transfer should be PI, but we need to correct errors due to overlaping surfaces
@@ -1238,16 +1262,66 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		else	
 			total = 1.0f/M_PI;
 
-		t = patch->transfers;
-		t2 = all_transfers;
-		for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+		// Sorted indices delta encode well and keep GatherLight walking emitlight forwards
+		qsort( all_transfers, patch->numtransfers, sizeof( transfer_t ), TransferSortFn );
+
+		float flScale = flMaxTransfer * total / 65535.0f;
+		float flInvScale = ( flScale > 0.0f ) ? 1.0f / flScale : 0.0f;
+
+		// Quantize the weights, dropping the ones that round to nothing
+		int nKept = 0;
+		int nDeltaBytes = 0;
+		int iLastPatch = 0;
+		for (j=0 ; j<patch->numtransfers ; j++)
 		{
-			t->transfer = t2->transfer*total;
-			t->patch = t2->patch;
+			float flWeight = all_transfers[j].transfer * total;
+			int nQuantized = (int)( flWeight * flInvScale + 0.5f );
+			nQuantized = MIN( nQuantized, 65535 );
+
+			flWeightTotal += flWeight;
+			flWeightError += fabs( flWeight - nQuantized * flScale );
+
+			if ( !nQuantized )
+			{
+				++nDropped;
+				continue;
+			}
+
+			nDeltaBytes += VarIntBytes( all_transfers[j].patch - iLastPatch );
+			iLastPatch = all_transfers[j].patch;
+
+			all_transfers[nKept].patch = all_transfers[j].patch;
+			all_transfers[nKept].transfer = nQuantized;
+			++nKept;
 		}
-		if (patch->numtransfers > max_transfer)
+
+		patch->numtransfers = nKept;
+		if ( nKept )
 		{
-			max_transfer = patch->numtransfers;
+			patch->transferbytes = sizeof( float ) + nKept * sizeof( unsigned short ) + nDeltaBytes;
+			patch->transfers = (byte*)malloc( patch->transferbytes );
+			if (!patch->transfers)
+				Error ("Memory allocation failure");
+
+			*(float*)patch->transfers = flScale;
+			unsigned short *pWeights = (unsigned short*)( patch->transfers + sizeof( float ) );
+			byte *pDeltas = (byte*)( pWeights + nKept );
+
+			iLastPatch = 0;
+			for (j=0 ; j<nKept ; j++)
+			{
+				pWeights[j] = (unsigned short)all_transfers[j].transfer;
+
+				unsigned int nDelta = all_transfers[j].patch - iLastPatch;
+				iLastPatch = all_transfers[j].patch;
+				while ( nDelta >= 0x80 )
+				{
+					*pDeltas++ = (byte)( nDelta | 0x80 );
+					nDelta >>= 7;
+				}
+				*pDeltas++ = (byte)nDelta;
+			}
+			Assert( pDeltas == patch->transfers + patch->transferbytes );
 		}
 	}
 	else
@@ -1258,6 +1332,13 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 
 	ThreadLock ();
 	total_transfer += patch->numtransfers;
+	if (patch->numtransfers > max_transfer)
+	{
+		max_transfer = patch->numtransfers;
+	}
+	g_flTransferWeightTotal += flWeightTotal;
+	g_flTransferWeightError += flWeightError;
+	g_nDroppedTransfers += nDropped;
 	ThreadUnlock ();
 }
 
@@ -1532,13 +1613,20 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 	vecV = vecTexV;
 }
 
+// emitlight * reflectivity for every patch, rebuilt by BounceLight before each GatherLight pass.
+// Aligned so GatherLight can pull four of them into a FourVectors at a time.
+static CUtlVector< Vector4DAligned, CUtlMemoryAligned< Vector4DAligned, 16 > > s_ShootLight;
+
+// Transfers are unpacked into these batches; a multiple of 4 for the SIMD gather.
+#define GATHER_BATCH_SIZE	64
+
 void GatherLight (int threadnum, void *pUserData)
 {
 	int			i, j, k;
-	transfer_t	*trans;
-	int			num;
 	CPatch		*patch;
-	Vector		sum, v;
+
+	ALIGN16 int		batchPatches[GATHER_BATCH_SIZE] ALIGN16_POST;
+	ALIGN16 float	batchWeights[GATHER_BATCH_SIZE] ALIGN16_POST;
 
 	while (1)
 	{
@@ -1548,8 +1636,8 @@ void GatherLight (int threadnum, void *pUserData)
 
 		patch = &g_Patches[j];
 
-		trans = patch->transfers;
-		num = patch->numtransfers;
+		CTransferReader reader( patch );
+		int num;
 		if ( patch->needsBumpmap )
 		{
 			Vector delta;
@@ -1589,33 +1677,33 @@ void GatherLight (int threadnum, void *pUserData)
 			}
 
 			float dot;
-			for (k=0 ; k<num ; k++, trans++)
+			while ( ( num = reader.Read( batchPatches, batchWeights, GATHER_BATCH_SIZE ) ) > 0 )
 			{
-				CPatch *patch2 = &g_Patches[trans->patch];
-
-				// get vector to other patch
-				VectorSubtract (patch2->origin, patch->origin, delta);
-				VectorNormalize (delta);
-				// find light emitted from other patch
-				for(i=0; i<3; i++)
+				for (k=0 ; k<num ; k++)
 				{
-					v[i] = emitlight[trans->patch][i] * patch2->reflectivity[i];
-				}
-				// remove normal already factored into transfer steradian
-				float scale = 1.0f / DotProduct (delta, patch->normal);
-				VectorScale( v, trans->transfer * scale, v );
-				
-				Vector bumpTransfer;
-				for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
-				{
-					dot = DotProduct( delta, normals[i] );
-					if ( dot <= 0 )
+					CPatch *patch2 = &g_Patches[batchPatches[k]];
+
+					// get vector to other patch
+					VectorSubtract (patch2->origin, patch->origin, delta);
+					VectorNormalize (delta);
+					// find light emitted from other patch
+					Vector v = s_ShootLight[batchPatches[k]].AsVector3D();
+					// remove normal already factored into transfer steradian
+					float scale = 1.0f / DotProduct (delta, patch->normal);
+					VectorScale( v, batchWeights[k] * scale, v );
+					
+					Vector bumpTransfer;
+					for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 					{
-//						Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
-						continue;
+						dot = DotProduct( delta, normals[i] );
+						if ( dot <= 0 )
+						{
+//							Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
+							continue;
+						}
+						bumpTransfer = v * dot;
+						VectorAdd( bumpSum[i], bumpTransfer, bumpSum[i] );
 					}
-					bumpTransfer = v * dot;
-					VectorAdd( bumpSum[i], bumpTransfer, bumpSum[i] );
 				}
 			}
 			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
@@ -1625,16 +1713,29 @@ void GatherLight (int threadnum, void *pUserData)
 		}
 		else
 		{
-			VectorFill( sum, 0 );
-			for (k=0 ; k<num ; k++, trans++)
+			// Sum four transfers at a time in SoA form
+			FourVectors sum4;
+			sum4.x = sum4.y = sum4.z = Four_Zeros;
+			while ( ( num = reader.Read( batchPatches, batchWeights, GATHER_BATCH_SIZE ) ) > 0 )
 			{
-				for(i=0; i<3; i++)
+				// pad the last group of four with zero weight transfers
+				for ( k = num; k & 3; k++ )
 				{
-					v[i] = emitlight[trans->patch][i] * g_Patches[trans->patch].reflectivity[i];
+					batchPatches[k] = batchPatches[0];
+					batchWeights[k] = 0.0f;
+				}
+
+				for ( i = 0; i < k; i += 4 )
+				{
+					FourVectors shoot;
+					shoot.LoadAndSwizzleAligned( s_ShootLight[batchPatches[i]].Base(), s_ShootLight[batchPatches[i+1]].Base(),
+						s_ShootLight[batchPatches[i+2]].Base(), s_ShootLight[batchPatches[i+3]].Base() );
+					shoot *= LoadAlignedSIMD( &batchWeights[i] );
+					sum4 += shoot;
 				}
-				VectorScale( v, trans->transfer, v );
-				VectorAdd( sum, v, sum );
 			}
+
+			Vector sum = sum4.Vec( 0 ) + sum4.Vec( 1 ) + sum4.Vec( 2 ) + sum4.Vec( 3 );
 			VectorCopy( sum, addlight[j].light[0] );
 		}
 	}
@@ -1706,6 +1807,12 @@ void BounceLight (void)
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
 		unsigned int uiPatchCount = g_Patches.Size();
+		s_ShootLight.SetCount( uiPatchCount );
+		for ( unsigned int iPatch = 0; iPatch < uiPatchCount; iPatch++ )
+		{
+			Vector vShoot = emitlight[iPatch] * g_Patches[iPatch].reflectivity;
+			s_ShootLight[iPatch].Init( vShoot.x, vShoot.y, vShoot.z, 0.0f );
+		}
 		RunThreadsOn (uiPatchCount, true, GatherLight);
 		// move newly received light (addlight) to light to be sent out (emitlight)
 		// start at children and pull light up to parents
@@ -1932,8 +2039,23 @@ void MakeAllScales (void)
 
 	Msg("transfers %d, max %d\n", total_transfer, max_transfer );
 
-	qprintf ("transfer lists: %5.1f megs\n"
-		, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	// Compare against the old layout of a full transfer_t per transfer
+	int64 nPackedBytes = 0;
+	for ( int i = 0; i < g_Patches.Count(); i++ )
+	{
+		nPackedBytes += g_Patches[i].transferbytes;
+	}
+	float flUnpackedMegs = (float)( total_transfer + g_nDroppedTransfers ) * sizeof(transfer_t) / (1024*1024);
+	float flPackedMegs = (float)nPackedBytes / (1024*1024);
+	Msg("transfer lists: %5.1f megs packed, %5.1f megs unpacked (%.0f%% saved)\n"
+		, flPackedMegs, flUnpackedMegs, flUnpackedMegs > 0 ? 100.0f * ( 1.0f - flPackedMegs / flUnpackedMegs ) : 0.0f );
+
+	// Only known when the scales were made in this process (not on the VMPI master)
+	if ( g_flTransferWeightTotal > 0 )
+	{
+		Msg("transfer quantization: %.4f%% of transfer weight lost, %d negligible transfers dropped\n"
+			, 100.0 * g_flTransferWeightError / g_flTransferWeightTotal, g_nDroppedTransfers );
+	}
 }
 
 
@@ -1998,6 +2120,52 @@ void MakeAllScales (void)
 #endif
 
 
+#ifdef FORK_DISTRIBUTE
+extern void BuildPatchLights( int facenum );
+
+static void Fork_ProcessFaces( int iThread, uint64 iWorkUnit, MessageBuffer *pBuf )
+{
+	BuildFacelights( iThread, iWorkUnit );
+	SerializeFace( pBuf, iWorkUnit );
+
+	uint64 nCacheKey = g_bLightCache ? g_FaceLightCacheKeys[iWorkUnit] : 0;
+	pBuf->write( &nCacheKey, sizeof( nCacheKey ) );
+}
+
+static void Fork_ReceiveFaceResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWorker )
+{
+	char szSource[32];
+	Q_snprintf( szSource, sizeof( szSource ), "worker %d", iWorker );
+	UnSerializeFace( pBuf, iWorkUnit, szSource );
+
+	int nFaceBytes = pBuf->getOffset();
+	uint64 nCacheKey;
+	pBuf->read( &nCacheKey, sizeof( nCacheKey ) );
+	LightCache_Store( LIGHTCACHE_FACE, nCacheKey, pBuf->data, nFaceBytes );
+}
+
+//-----------------------------------------------------------------------------
+// Same as RunMPIBuildFacelights, but with local worker processes: they send
+// the facelights back and the master builds the patch lights from them.
+//-----------------------------------------------------------------------------
+static void RunForkBuildFacelights()
+{
+	Msg( "%-20s ", "BuildFaceLights:" );
+	StartPacifier( "" );
+
+	double elapsed = ForkDistributeWork( numfaces, Fork_ProcessFaces, Fork_ReceiveFaceResults );
+
+	EndPacifier( false );
+	Msg( " (%d)\n", (int)elapsed );
+
+	for ( int i=0; i < numfaces; ++i )
+	{
+		BuildPatchLights( i );
+	}
+}
+#endif
+
+
 bool RadWorld_Go()
 {
 	g_iCurFace = 0;
@@ -2027,6 +2195,13 @@ bool RadWorld_Go()
 		RunMPIBuildFacelights();
 	}
 	else 
+#endif
+#ifdef FORK_DISTRIBUTE
+	if ( ForkDistribute_IsActive() )
+	{
+		RunForkBuildFacelights();
+	}
+	else
 #endif
 	{
 		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
@@ -2282,10 +2457,13 @@ void VRAD_LoadBSP( char const *pFilename )
 	if ( g_bDumpRtEnv )
 		WriteRTEnv("trace.txt");
 
+	// The light cache needs the triangles before they're converted for tracing
+	LightCache_HashGeometry();
+
 	// Build acceleration structure
 	printf ( "Setting up ray-trace acceleration structure... ");
 	float start = Plat_FloatTime();
-	g_RtEnv.SetupAccelerationStructure();
+	g_RtEnv.SetupAccelerationStructure( numthreads );
 	float end = Plat_FloatTime();
 	printf ( "Done (%.2f seconds)\n", end-start );
 
@@ -2304,11 +2482,20 @@ void VRAD_LoadBSP( char const *pFilename )
 			return;
 		}
 	}
+
+	char szLightCacheFile[MAX_PATH];
+	Q_StripExtension( source, szLightCacheFile, sizeof( szLightCacheFile ) );
+	// -ldr and -hdr runs light differently, so each keeps its own cache rather than evicting the other's
+	Q_strncat( szLightCacheFile, g_bHDR ? "_hdr.lightcache" : ".lightcache", sizeof( szLightCacheFile ), COPY_ALL_CHARACTERS );
+	LightCache_Init( szLightCacheFile );
 }
 
 
 void VRAD_ComputeOtherLighting()
 {
+	// Leaf ambient and static props sample the final lightmaps
+	LightCache_HashFinalLighting();
+
 	// Compute lighting for the bsp file
 	if ( !g_bNoDetailLighting )
 	{
@@ -2342,6 +2529,8 @@ void VRAD_Finish()
 #endif
 	WriteBSPFile(source);
 
+	LightCache_Shutdown();
+
 	if ( g_bDumpPatches )
 	{
 		for ( int iStyle = 0; iStyle < 4; ++iStyle )
@@ -2361,6 +2550,7 @@ void VRAD_Finish()
 	
 	char str[512];
 	GetHourMinuteSecondsString( (int)( end - g_flStartTime ), str, sizeof( str ) );
+	ThreadPrintPhaseTimes();
 	Msg( "%s elapsed\n", str );
 
 	ReleasePakFileLumps();
@@ -2432,6 +2622,18 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bDumpRtEnv = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-rtbuildbench" ) )
+		{
+			g_bRayTraceBuildBenchmark = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-noavx" ) )
+		{
+			RayTrace_AllowAVX( false );
+		}
+		else if ( !Q_stricmp( argv[i], "-lightcache" ) )
+		{
+			g_bLightCache = true;
+		}
 		else if ( !Q_stricmp( argv[i], "-LargeDispSampleRadius" ) )
 		{
 			g_bLargeDispSampleRadius = true;
@@ -2479,6 +2681,25 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 				return -1;
 			}
 		}
+#ifdef FORK_DISTRIBUTE
+		else if (!Q_stricmp(argv[i],"-fork"))
+		{
+			if ( ++i < argc )
+			{
+				g_nForkWorkers = atoi (argv[i]);
+				if ( g_nForkWorkers <= 0 )
+				{
+					Warning("Error: expected positive value after '-fork'\n" );
+					return -1;
+				}
+			}
+			else
+			{
+				Warning("Error: expected a value after '-fork'\n" );
+				return -1;
+			}
+		}
+#endif
 		else if ( !Q_stricmp(argv[i], "-lights" ) )
 		{
 			if ( ++i < argc && *argv[i] )
@@ -2503,6 +2724,10 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bFastAmbient = true;
 		}
+		else if ( !Q_stricmp(argv[i], "-noadaptiveambient") )
+		{
+			g_bNoAdaptiveAmbient = true;
+		}
 		else if (!Q_stricmp(argv[i],"-fast"))
 		{
 			do_fast = true;
@@ -2565,6 +2790,10 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bLowPriority = true;
 		}
+		else if( !Q_stricmp( argv[i], "-numa" ) )
+		{
+			g_bPinThreadsToNUMANodes = true;
+		}
 		else if( !Q_stricmp( argv[i], "-loghash" ) )
 		{
 			g_bLogHashData = true;
@@ -2823,6 +3052,7 @@ void PrintUsage( int argc, char **argv )
 		"  -final          : High quality processing. equivalent to -extrasky 16.\n"
 		"  -extrasky n     : trace N times as many rays for indirect light and sky ambient.\n"
 		"  -low            : Run as an idle-priority process.\n"
+		"  -numa           : Spread threads over NUMA nodes and pin each to a CPU (Linux only).\n"
 #ifdef MPI
 		"  -mpi            : Use VMPI to distribute computations.\n"
 #endif
@@ -2836,10 +3066,18 @@ void PrintUsage( int argc, char **argv )
 		"  -dump           : Write debugging .txt files.\n"
 		"  -dumpnormals    : Write normals to debug files.\n"
 		"  -dumptrace      : Write ray-tracing environment to debug files.\n"
+		"  -rtbuildbench   : Time the ray-tracing acceleration structure builders on a test scene and exit.\n"
+		"  -noavx          : Trace 4 rays at a time with SSE even if the CPU supports AVX.\n"
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
+		"  -fork <n>       : Run BuildFacelights, leaf ambient and static prop lighting\n"
+		"                    in n worker processes instead of threads (Linux only).\n"
 		"  -lights <file>  : Load a lights file in addition to lights.rad and the\n"
 		"                    level lights file.\n"
+		"  -lightcache     : Save direct lighting, static prop lighting and leaf ambient\n"
+		"                    to <mapname>.lightcache (<mapname>_hdr.lightcache for HDR)\n"
+		"                    and reuse whatever a change didn't touch on the next\n"
+		"                    compile.\n"
 		"  -noextra        : Disable supersampling.\n"
 		"  -debugextra     : Places debugging data in lightmaps to visualize\n"
 		"                    supersampling.\n"
@@ -2852,6 +3090,8 @@ void PrintUsage( int argc, char **argv )
 		"  -mpi_pw <pw>    : Use a password to choose a specific set of VMPI workers.\n"
 #endif
 		"  -nodetaillight  : Don't light detail props.\n"
+		"  -noadaptiveambient : Take every per-leaf ambient sample instead of stopping\n"
+		"                    once a leaf's samples agree with each other.\n"
 		"  -centersamples  : Move sample centers.\n"
 		"  -luxeldensity # : Rescale all luxels by the specified amount (default: 1.0).\n"
 		"                    The number specified must be less than 1.0 or it will be\n"
@@ -2921,6 +3161,14 @@ int RunVRAD( int argc, char **argv )
 
 	bool onlydetail;
 	int i = ParseCommandLine( argc, argv, &onlydetail );
+	if ( g_bRayTraceBuildBenchmark )
+	{
+		ThreadSetDefault();
+		RunKDTreeBuildBenchmark( numthreads );
+		DeleteCmdLine( argc, argv );
+		CmdLib_Exit( 0 );
+	}
+
 	if (i == -1)
 	{
 		PrintUsage( argc, argv );
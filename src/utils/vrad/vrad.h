@@ -237,12 +237,67 @@ struct CPatch
 //	struct		patch_s		*nextclusterchild;		// next terminal child in cluster
 
 	int			numtransfers;
-	transfer_t	*transfers;
+	int			transferbytes;
+	byte		*transfers;				// packed by MakeScales, read back with CTransferReader
 
 	short		indices[3];				// displacement use these for subdivision
 };
 
 
+//-----------------------------------------------------------------------------
+// Packed transfer lists. The transfers of a patch are sorted by patch index;
+// the indices are stored as 7-bit varint deltas and the weights are quantized
+// to 16 bits against the largest weight in the list:
+//	[float weight scale][uint16 weights * numtransfers][varint index deltas]
+//-----------------------------------------------------------------------------
+class CTransferReader
+{
+public:
+	CTransferReader( const CPatch *pPatch )
+	{
+		m_nLeft = pPatch->numtransfers;
+		m_iPatch = 0;
+		if ( m_nLeft )
+		{
+			m_flScale = *(const float*)pPatch->transfers;
+			m_pWeights = (const unsigned short*)( pPatch->transfers + sizeof( float ) );
+			m_pDeltas = (const byte*)( m_pWeights + m_nLeft );
+		}
+	}
+
+	// Unpacks up to nMax transfers, returns how many it got.
+	int Read( int *pPatches, float *pWeights, int nMax )
+	{
+		int nRead = MIN( nMax, m_nLeft );
+		for ( int i = 0; i < nRead; i++ )
+		{
+			unsigned int nDelta = 0;
+			int nShift = 0;
+			byte b;
+			do
+			{
+				b = *m_pDeltas++;
+				nDelta |= (unsigned int)( b & 0x7f ) << nShift;
+				nShift += 7;
+			} while ( b & 0x80 );
+
+			m_iPatch += nDelta;
+			pPatches[i] = m_iPatch;
+			pWeights[i] = m_pWeights[i] * m_flScale;
+		}
+		m_pWeights += nRead;
+		m_nLeft -= nRead;
+		return nRead;
+	}
+
+private:
+	const unsigned short	*m_pWeights;
+	const byte				*m_pDeltas;
+	float					m_flScale;
+	int						m_nLeft;
+	int						m_iPatch;
+};
+
 extern CUtlVector<CPatch>	g_Patches;
 extern CUtlVector<int>		g_FacePatches;		// constains all patches, children first
 extern CUtlVector<int>		faceParents;		// contains only root patches, use next parent to iterate
@@ -275,6 +330,7 @@ extern bool			bRed2Black;
 extern bool         g_bNoSkyRecurse;
 extern bool			bDumpNormals;
 extern bool			g_bFastAmbient;
+extern bool			g_bNoAdaptiveAmbient;
 extern float		maxchop;
 extern FileHandle_t	pFileSamples[4][4];
 extern qboolean		g_bLowPriority;
@@ -390,6 +446,12 @@ void TestLine( FourVectors const& start, FourVectors const& stop, fltx4 *pFracti
 void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
                           fltx4 *pFractionVisible, bool canRecurse = true, int static_prop_to_skip=-1, bool bDoDebug = false );
 
+// 8 ray versions of the above, tracing two sets of four rays in one AVX packet when possible.
+// pStart, pStop and pFractionVisible each point at two elements.
+void TestLine8( FourVectors const *pStart, FourVectors const *pStop, fltx4 *pFractionVisible, int static_prop_index_to_ignore=-1 );
+void TestLine_DoesHitSky8( FourVectors const *pStart, FourVectors const *pStop,
+                           fltx4 *pFractionVisible, bool canRecurse = true, int static_prop_to_skip=-1 );
+
 // converts any marked brush entities to triangles for shadow casting
 void ExtractBrushEntityShadowCasters ( void );
 void AddBrushesForRayTrace ( void );
@@ -459,6 +521,13 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
 					   int nLFlags = 0,					// GATHERLFLAGS_xxx
 					   int static_prop_to_skip=-1,
 					   float flEpsilon = 0.0 );
+// Same for two lights, pOut, ppLights and pPos point at two elements each. Point, spot and
+// surface light pairs share one 8 ray visibility trace.
+void GatherSampleLightPairSSE( SSE_sampleLightOutput_t *pOut, directlight_t **ppLights, int facenum, 
+					   FourVectors const *pPos, FourVectors *pNormals, int normalCount, int iThread,
+					   int nLFlags = 0,					// GATHERLFLAGS_xxx
+					   int static_prop_to_skip=-1,
+					   float flEpsilon = 0.0 );
 //void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
 //							 FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
 //							 int nLFlags = 0,
@@ -602,6 +671,10 @@ public:
 	virtual void Shutdown() = 0;
 	virtual void ComputeLighting( int iThread ) = 0;
 	virtual void AddPolysForRayTrace() = 0;
+
+	// What a prop is and where, for the light cache; unlike its index this doesn't
+	// change when other props are added or removed.
+	virtual uint64 GetLightCacheIdentity( int iStaticProp ) = 0;
 };
 
 //extern PropTested_t s_PropTested[MAX_TOOL_THREADS+1];
@@ -38,6 +38,8 @@
 #include "messbuf.h"
 #include "vmpi.h"
 #include "vmpi_distribute_work.h"
+#include "fork_distribute.h"
+#include "lightcache.h"
 
 
 #define ALIGN_TO_POW2(x,y) (((x)+(y-1))&~(y-1))
@@ -74,6 +76,10 @@ struct colorTexel_t
 class CComputeStaticPropLightingResults
 {
 public:
+	CComputeStaticPropLightingResults() : m_nLightCacheKey( 0 ), m_bFromLightCache( false )
+	{
+	}
+
 	~CComputeStaticPropLightingResults()
 	{
 		m_ColorVertsArrays.PurgeAndDeleteElements();
@@ -82,6 +88,9 @@ public:
 	
 	CUtlVector< CUtlVector<colorVertex_t>* > m_ColorVertsArrays;
 	CUtlVector< CUtlVector<colorTexel_t>* > m_ColorTexelsArrays;
+
+	uint64	m_nLightCacheKey;		// 0 unless -lightcache is on
+	bool	m_bFromLightCache;		// loaded from the light cache instead of computed
 };
 
 //-----------------------------------------------------------------------------
@@ -260,7 +269,7 @@ public:
 
 private:
 	// VMPI stuff.
-#ifdef MPI
+#if defined( MPI ) || defined( FORK_DISTRIBUTE )
 	static void VMPI_ProcessStaticProp_Static( int iThread, uint64 iStaticProp, MessageBuffer *pBuf );
 	static void VMPI_ReceiveStaticPropResults_Static( uint64 iStaticProp, MessageBuffer *pBuf, int iWorker );
 	void VMPI_ProcessStaticProp( int iThread, int iStaticProp, MessageBuffer *pBuf );
@@ -338,11 +347,14 @@ private:
 	bool m_bIgnoreStaticPropTrace;
 
 	void ComputeLighting( CStaticProp &prop, int iThread, int prop_index, CComputeStaticPropLightingResults *pResults );
+	uint64 ComputeLightCacheKey( CStaticProp &prop, int prop_index, const matrix3x4_t &matPos, const matrix3x4_t &matNormal );
 	void ApplyLightingToStaticProp( int iStaticProp, CStaticProp &prop, const CComputeStaticPropLightingResults *pResults );
 
 	void SerializeLighting();
 	void AddPolysForRayTrace();
 	void BuildTriList( CStaticProp &prop );
+
+	uint64 GetLightCacheIdentity( int iStaticProp );
 };
 
 
@@ -1152,58 +1164,85 @@ bool PositionInSolid( Vector &position )
 void ComputeDirectLightingAtPoint( Vector &position, Vector &normal, Vector &outColor, int iThread,
 								   int static_prop_id_to_skip=-1, int nLFlags = 0)
 {
-	SSE_sampleLightOutput_t	sampleOutput;
+	SSE_sampleLightOutput_t	sampleOutput[2];
 
 	outColor.Init();
 
+	// Lights are gathered two at a time so their shadow rays share a trace
+	directlight_t *pLights[2];
+	FourVectors adjusted_pos4[2];
+	int nLights = 0;
+	float flEpsilon = 0.0;
+
+	FourVectors normal4;
+	normal4.DuplicateVector( normal );
+
 	// Iterate over all direct lights and accumulate their contribution
 	int cluster = ClusterFromPoint( position );
-	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	for ( directlight_t *dl = activelights; ; dl = dl->next )
 	{
-		if ( dl->light.style )
+		if ( dl )
 		{
-			// skip lights with style
-			continue;
-		}
+			if ( dl->light.style )
+			{
+				// skip lights with style
+				continue;
+			}
 
-		// is this lights cluster visible?
-		if ( !PVSCheck( dl->pvs, cluster ) )
-			continue;
+			// is this lights cluster visible?
+			if ( !PVSCheck( dl->pvs, cluster ) )
+				continue;
 
-		// push the vertex towards the light to avoid surface acne
-		Vector adjusted_pos = position;
-		float flEpsilon = 0.0;
+			// push the vertex towards the light to avoid surface acne
+			Vector adjusted_pos = position;
 
-		if  (dl->light.type != emit_skyambient)
-		{
-			// push towards the light
-			Vector fudge;
-			if ( dl->light.type == emit_skylight )
-				fudge = -( dl->light.normal);
-			else
+			if  (dl->light.type != emit_skyambient)
 			{
-				fudge = dl->light.origin-position;
-				VectorNormalize( fudge );
+				// push towards the light
+				Vector fudge;
+				if ( dl->light.type == emit_skylight )
+					fudge = -( dl->light.normal);
+				else
+				{
+					fudge = dl->light.origin-position;
+					VectorNormalize( fudge );
+				}
+				fudge *= 4.0;
+				adjusted_pos += fudge;
+			}
+			else 
+			{
+				// push out along normal
+				adjusted_pos += 4.0 * normal;
+//				flEpsilon = 1.0;
 			}
-			fudge *= 4.0;
-			adjusted_pos += fudge;
+
+			pLights[nLights] = dl;
+			adjusted_pos4[nLights].DuplicateVector( adjusted_pos );
+			if ( ++nLights < 2 )
+				continue;
 		}
-		else 
+
+		if ( nLights == 0 )
+			break;
+
+		if ( nLights == 2 )
+		{
+			GatherSampleLightPairSSE( sampleOutput, pLights, -1, adjusted_pos4, &normal4, 1, iThread, nLFlags | GATHERLFLAGS_FORCE_FAST,
+			                          static_prop_id_to_skip, flEpsilon );
+		}
+		else
 		{
-			// push out along normal
-			adjusted_pos += 4.0 * normal;
-//			flEpsilon = 1.0;
+			GatherSampleLightSSE( sampleOutput[0], pLights[0], -1, adjusted_pos4[0], &normal4, 1, iThread, nLFlags | GATHERLFLAGS_FORCE_FAST,
+			                      static_prop_id_to_skip, flEpsilon );
 		}
 
-		FourVectors adjusted_pos4;
-		FourVectors normal4;
-		adjusted_pos4.DuplicateVector( adjusted_pos );
-		normal4.DuplicateVector( normal );
+		for ( int l = 0; l < nLights; l++ )
+			VectorMA( outColor, sampleOutput[l].m_flFalloff.m128_f32[0] * sampleOutput[l].m_flDot[0].m128_f32[0], pLights[l]->light.intensity, outColor );
 
-		GatherSampleLightSSE( sampleOutput, dl, -1, adjusted_pos4, &normal4, 1, iThread, nLFlags | GATHERLFLAGS_FORCE_FAST,
-		                      static_prop_id_to_skip, flEpsilon );
-		
-		VectorMA( outColor, sampleOutput.m_flFalloff.m128_f32[0] * sampleOutput.m_flDot[0].m128_f32[0], dl->light.intensity, outColor );
+		if ( !dl )
+			break;
+		nLights = 0;
 	}
 }
 
@@ -1303,6 +1342,144 @@ void CVradStaticPropMgr::ApplyLightingToStaticProp( int iStaticProp, CStaticProp
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Lighting results in the format workers send them back in, which is also
+// what the light cache saves.
+//-----------------------------------------------------------------------------
+static void EncodeLightingResults( const CComputeStaticPropLightingResults *pResults, MessageBuffer *pBuf )
+{
+	int nLists = pResults->m_ColorVertsArrays.Count();
+	pBuf->write( &nLists, sizeof( nLists ) );
+	
+	for ( int i=0; i < nLists; i++ )
+	{
+		CUtlVector<colorVertex_t> &curList = *pResults->m_ColorVertsArrays[i];
+		int count = curList.Count();
+		pBuf->write( &count, sizeof( count ) );
+		pBuf->write( curList.Base(), curList.Count() * sizeof( colorVertex_t ) );
+	}
+
+	nLists = pResults->m_ColorTexelsArrays.Count();
+	pBuf->write(&nLists, sizeof(nLists));
+
+	for (int i = 0; i < nLists; i++)
+	{
+		CUtlVector<colorTexel_t> &curList = *pResults->m_ColorTexelsArrays[i];
+		int count = curList.Count();
+		pBuf->write(&count, sizeof(count));
+		pBuf->write(curList.Base(), curList.Count() * sizeof(colorTexel_t));
+	}
+}
+
+static void DecodeLightingResults( MessageBuffer *pBuf, CComputeStaticPropLightingResults *pResults )
+{
+	int nLists;
+	pBuf->read( &nLists, sizeof( nLists ) );
+	
+	for ( int i=0; i < nLists; i++ )
+	{
+		CUtlVector<colorVertex_t> *pList = new CUtlVector<colorVertex_t>;
+		pResults->m_ColorVertsArrays.AddToTail( pList );
+		
+		int count;
+		pBuf->read( &count, sizeof( count ) );
+		pList->SetSize( count );
+		pBuf->read( pList->Base(), count * sizeof( colorVertex_t ) );
+	}
+
+	pBuf->read(&nLists, sizeof(nLists));
+
+	for (int i = 0; i < nLists; i++)
+	{
+		CUtlVector<colorTexel_t> *pList = new CUtlVector<colorTexel_t>;
+		pResults->m_ColorTexelsArrays.AddToTail(pList);
+
+		int count;
+		pBuf->read(&count, sizeof(count));
+		pList->SetSize(count);
+		pBuf->read(pList->Base(), count * sizeof(colorTexel_t));
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Names a prop for the light cache by its model and placement. Its index can't be
+// used, since adding or removing one prop renumbers every prop after it.
+//-----------------------------------------------------------------------------
+uint64 CVradStaticPropMgr::GetLightCacheIdentity( int iStaticProp )
+{
+	CStaticProp &prop = m_StaticProps[iStaticProp];
+	studiohdr_t	*pStudioHdr = m_StaticPropDict[prop.m_ModelIdx].m_pStudioHdr;
+
+	CLightCacheKey key( LIGHTCACHE_STATICPROP );
+	if ( pStudioHdr )
+	{
+		key.Add( pStudioHdr->pszName(), V_strlen( pStudioHdr->pszName() ) );
+		key.Add( pStudioHdr->checksum );
+	}
+	key.Add( prop.m_Origin );
+	key.Add( prop.m_Angles );
+	key.Add( prop.m_Flags );
+	return key.GetDataHash();
+}
+
+//-----------------------------------------------------------------------------
+// The light cache key for a prop: the model, where it is and how it's lit,
+// plus everything visible from the box its vertexes and lighting origin are in.
+//-----------------------------------------------------------------------------
+uint64 CVradStaticPropMgr::ComputeLightCacheKey( CStaticProp &prop, int prop_index, const matrix3x4_t &matPos, const matrix3x4_t &matNormal )
+{
+	studiohdr_t	*pStudioHdr = m_StaticPropDict[prop.m_ModelIdx].m_pStudioHdr;
+
+	CLightCacheKey key( LIGHTCACHE_STATICPROP );
+	key.Add( pStudioHdr->pszName(), V_strlen( pStudioHdr->pszName() ) );
+	key.Add( pStudioHdr->checksum );
+	key.Add( GetLightCacheIdentity( prop_index ) );	// self shadowing skips this prop's own triangles
+	key.Add( prop.m_Flags );
+	key.Add( prop.m_bLightingOriginValid );
+	key.Add( prop.m_LightingOrigin );
+	key.Add( prop.m_LightmapImageFormat );
+	key.Add( prop.m_LightmapImageWidth );
+	key.Add( prop.m_LightmapImageHeight );
+
+	// Bad vertexes are relit somewhere between themselves and the lighting origin
+	// or another vertex, and texels lie on the triangles, so this box holds every
+	// point the prop is lit at.
+	Vector vMins, vMaxs;
+	ClearBounds( vMins, vMaxs );
+	if ( prop.m_bLightingOriginValid )
+	{
+		AddPointToBounds( prop.m_LightingOrigin, vMins, vMaxs );
+	}
+
+	for ( int bodyID = 0; bodyID < pStudioHdr->numbodyparts; ++bodyID )
+	{
+		mstudiobodyparts_t *pBodyPart = pStudioHdr->pBodypart( bodyID );
+		for ( int modelID = 0; modelID < pBodyPart->nummodels; ++modelID )
+		{
+			mstudiomodel_t *pStudioModel = pBodyPart->pModel( modelID );
+			for ( int meshID = 0; meshID < pStudioModel->nummeshes; ++meshID )
+			{
+				mstudiomesh_t *pStudioMesh = pStudioModel->pMesh( meshID );
+				const mstudio_meshvertexdata_t *vertData = pStudioMesh->GetVertexData((void *)pStudioHdr);
+				for ( int vertexID = 0; vertexID < pStudioMesh->numvertices; ++vertexID )
+				{
+					Vector samplePosition, sampleNormal;
+					VectorTransform(*vertData->Position(vertexID), matPos, samplePosition);
+					VectorTransform(*vertData->Normal(vertexID), matNormal, sampleNormal);
+					key.Add( samplePosition );
+					key.Add( sampleNormal );
+					AddPointToBounds( samplePosition, vMins, vMaxs );
+				}
+			}
+		}
+	}
+
+	key.AddBox( vMins, vMaxs );
+
+	// Indirect light, and bad vertexes even without bounces, sample the lightmaps
+	return key.Finish( true );
+}
+
 //-----------------------------------------------------------------------------
 // Trace rays from each unique vertex, accumulating direct and indirect
 // sources at each ray termination. Use the winding data to distribute the unique vertexes
@@ -1338,6 +1515,19 @@ void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int pr
 	matrix3x4_t	matPos, matNormal;
 	AngleMatrix(prop.m_Angles, prop.m_Origin, matPos);
 	AngleMatrix(prop.m_Angles, matNormal);
+
+	if ( g_bLightCache )
+	{
+		pResults->m_nLightCacheKey = ComputeLightCacheKey( prop, prop_index, matPos, matNormal );
+
+		MessageBuffer mb;
+		if ( LightCache_Find( LIGHTCACHE_STATICPROP, pResults->m_nLightCacheKey, &mb ) )
+		{
+			DecodeLightingResults( &mb, pResults );
+			pResults->m_bFromLightCache = true;
+			return;
+		}
+	}
 	
 	for ( int bodyID = 0; bodyID < pStudioHdr->numbodyparts; ++bodyID )
 	{
@@ -1659,7 +1849,7 @@ void CVradStaticPropMgr::SerializeLighting()
 	}
 }
 
-#ifdef MPI
+#if defined( MPI ) || defined( FORK_DISTRIBUTE )
 void CVradStaticPropMgr::VMPI_ProcessStaticProp_Static( int iThread, uint64 iStaticProp, MessageBuffer *pBuf )
 {
 	g_StaticPropMgr.VMPI_ProcessStaticProp( iThread, iStaticProp, pBuf );
@@ -1685,27 +1875,10 @@ void CVradStaticPropMgr::VMPI_ProcessStaticProp( int iThread, int iStaticProp, M
 #endif
 	
 	// Encode the results.
-	int nLists = results.m_ColorVertsArrays.Count();
-	pBuf->write( &nLists, sizeof( nLists ) );
-	
-	for ( int i=0; i < nLists; i++ )
-	{
-		CUtlVector<colorVertex_t> &curList = *results.m_ColorVertsArrays[i];
-		int count = curList.Count();
-		pBuf->write( &count, sizeof( count ) );
-		pBuf->write( curList.Base(), curList.Count() * sizeof( colorVertex_t ) );
-	}
-
-	nLists = results.m_ColorTexelsArrays.Count();
-	pBuf->write(&nLists, sizeof(nLists));
+	EncodeLightingResults( &results, pBuf );
 
-	for (int i = 0; i < nLists; i++)
-	{
-		CUtlVector<colorTexel_t> &curList = *results.m_ColorTexelsArrays[i];
-		int count = curList.Count();
-		pBuf->write(&count, sizeof(count));
-		pBuf->write(curList.Base(), curList.Count() * sizeof(colorTexel_t));
-	}
+	// Hits too, so the master knows to keep them in the light cache.
+	pBuf->write( &results.m_nLightCacheKey, sizeof( results.m_nLightCacheKey ) );
 }
 
 //-----------------------------------------------------------------------------
@@ -1715,33 +1888,12 @@ void CVradStaticPropMgr::VMPI_ReceiveStaticPropResults( int iStaticProp, Message
 {
 	// Read in the results.
 	CComputeStaticPropLightingResults results;
-	
-	int nLists;
-	pBuf->read( &nLists, sizeof( nLists ) );
-	
-	for ( int i=0; i < nLists; i++ )
-	{
-		CUtlVector<colorVertex_t> *pList = new CUtlVector<colorVertex_t>;
-		results.m_ColorVertsArrays.AddToTail( pList );
-		
-		int count;
-		pBuf->read( &count, sizeof( count ) );
-		pList->SetSize( count );
-		pBuf->read( pList->Base(), count * sizeof( colorVertex_t ) );
-	}
+	DecodeLightingResults( pBuf, &results );
 
-	pBuf->read(&nLists, sizeof(nLists));
-
-	for (int i = 0; i < nLists; i++)
-	{
-		CUtlVector<colorTexel_t> *pList = new CUtlVector<colorTexel_t>;
-		results.m_ColorTexelsArrays.AddToTail(pList);
-
-		int count;
-		pBuf->read(&count, sizeof(count));
-		pList->SetSize(count);
-		pBuf->read(pList->Base(), count * sizeof(colorTexel_t));
-	}
+	int nResultBytes = pBuf->getOffset();
+	uint64 nCacheKey = 0;
+	pBuf->read( &nCacheKey, sizeof( nCacheKey ) );
+	LightCache_Store( LIGHTCACHE_STATICPROP, nCacheKey, pBuf->data, nResultBytes );
 	
 	// Apply the results.
 	ApplyLightingToStaticProp( iStaticProp, m_StaticProps[iStaticProp], &results );
@@ -1753,6 +1905,14 @@ void CVradStaticPropMgr::ComputeLightingForProp( int iThread, int iStaticProp )
 	// Compute the lighting.
 	CComputeStaticPropLightingResults results;
 	ComputeLighting( m_StaticProps[iStaticProp], iThread, iStaticProp, &results );
+
+	if ( results.m_nLightCacheKey && !results.m_bFromLightCache )
+	{
+		MessageBuffer mb;
+		EncodeLightingResults( &results, &mb );
+		LightCache_Store( LIGHTCACHE_STATICPROP, results.m_nLightCacheKey, mb.data, mb.getLen() );
+	}
+
 	ApplyLightingToStaticProp( iStaticProp, m_StaticProps[iStaticProp], &results );
 }
 
@@ -1799,6 +1959,16 @@ void CVradStaticPropMgr::ComputeLighting( int iThread )
 			&CVradStaticPropMgr::VMPI_ReceiveStaticPropResults_Static );
 	}
 	else
+#endif
+#ifdef FORK_DISTRIBUTE
+	if ( ForkDistribute_IsActive() )
+	{
+		ForkDistributeWork( 
+			count, 
+			&CVradStaticPropMgr::VMPI_ProcessStaticProp_Static, 
+			&CVradStaticPropMgr::VMPI_ReceiveStaticPropResults_Static );
+	}
+	else
 #endif
 	{
 		RunThreadsOn(count, true, ThreadComputeStaticPropLighting);
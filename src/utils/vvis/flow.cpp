@@ -7,6 +7,15 @@
 //=============================================================================//
 #include "vis.h"
 #include "vmpi.h"
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined( _MSC_VER )
+#include <intrin.h>
+#define AVX2_FUNCTION
+#else
+#include <cpuid.h>
+#define AVX2_FUNCTION __attribute__(( target( "avx2" ) ))
+#endif
 
 int g_TraceClusterStart = -1;
 int g_TraceClusterStop = -1;
@@ -42,6 +51,146 @@ int CountBits (byte *bits, int numbits)
 	return c;
 }
 
+
+/*
+===============================================================================
+
+Portal bit vector ops for the flow. CombineMightSee sets might = prev & test over
+the blocks [first,end) of prev that can have bits in, narrows [first,end) to the
+blocks of might that do, and returns true if might has any bits that aren't in
+vis. Blocks of might outside the range are left alone, so anything reading a
+pstack_t's mightsee has to check its range first.
+
+===============================================================================
+*/
+
+typedef bool (*CombineMightSeeFn)( byte *might, const byte *prev, const byte *test, const byte *vis, int &first, int &end );
+
+static bool CombineMightSeeSSE2( byte *might, const byte *prev, const byte *test, const byte *vis, int &first, int &end )
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i more = zero;
+	int newFirst = -1, newEnd = 0;
+
+	for ( int i = first; i < end; i++ )
+	{
+		int ofs = i * PORTAL_BLOCK_BYTES;
+		__m128i m0 = _mm_and_si128( _mm_loadu_si128( (const __m128i *)( prev + ofs ) ), _mm_loadu_si128( (const __m128i *)( test + ofs ) ) );
+		__m128i m1 = _mm_and_si128( _mm_loadu_si128( (const __m128i *)( prev + ofs + 16 ) ), _mm_loadu_si128( (const __m128i *)( test + ofs + 16 ) ) );
+		_mm_storeu_si128( (__m128i *)( might + ofs ), m0 );
+		_mm_storeu_si128( (__m128i *)( might + ofs + 16 ), m1 );
+
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_or_si128( m0, m1 ), zero ) ) != 0xFFFF )
+		{
+			if ( newFirst < 0 )
+				newFirst = i;
+			newEnd = i + 1;
+			more = _mm_or_si128( more, _mm_andnot_si128( _mm_loadu_si128( (const __m128i *)( vis + ofs ) ), m0 ) );
+			more = _mm_or_si128( more, _mm_andnot_si128( _mm_loadu_si128( (const __m128i *)( vis + ofs + 16 ) ), m1 ) );
+		}
+	}
+
+	first = ( newFirst < 0 ) ? 0 : newFirst;
+	end = newEnd;
+	return _mm_movemask_epi8( _mm_cmpeq_epi8( more, zero ) ) != 0xFFFF;
+}
+
+AVX2_FUNCTION static bool CombineMightSeeAVX2( byte *might, const byte *prev, const byte *test, const byte *vis, int &first, int &end )
+{
+	__m256i more = _mm256_setzero_si256();
+	int newFirst = -1, newEnd = 0;
+
+	for ( int i = first; i < end; i++ )
+	{
+		int ofs = i * PORTAL_BLOCK_BYTES;
+		__m256i m = _mm256_and_si256( _mm256_loadu_si256( (const __m256i *)( prev + ofs ) ), _mm256_loadu_si256( (const __m256i *)( test + ofs ) ) );
+		_mm256_storeu_si256( (__m256i *)( might + ofs ), m );
+
+		if ( !_mm256_testz_si256( m, m ) )
+		{
+			if ( newFirst < 0 )
+				newFirst = i;
+			newEnd = i + 1;
+			more = _mm256_or_si256( more, _mm256_andnot_si256( _mm256_loadu_si256( (const __m256i *)( vis + ofs ) ), m ) );
+		}
+	}
+
+	first = ( newFirst < 0 ) ? 0 : newFirst;
+	end = newEnd;
+	bool bMore = !_mm256_testz_si256( more, more );
+
+	// the rest of vvis is SSE, avoid the AVX->SSE transition penalty
+	_mm256_zeroupper();
+	return bMore;
+}
+
+static bool CPUSupportsAVX2( void )
+{
+	// AVX2 needs the CPU flags and an OS that saves the ymm registers (OSXSAVE + XCR0 bits 1,2)
+	unsigned int nECX, nEBX7;
+#if defined( _MSC_VER )
+	int cpuInfo[4];
+	__cpuid( cpuInfo, 0 );
+	if ( cpuInfo[0] < 7 )
+		return false;
+	__cpuid( cpuInfo, 1 );
+	nECX = cpuInfo[2];
+	__cpuidex( cpuInfo, 7, 0 );
+	nEBX7 = cpuInfo[1];
+#else
+	unsigned int nEAX, nEBX, nEDX;
+	if ( __get_cpuid_max( 0, NULL ) < 7 )
+		return false;
+	__cpuid( 1, nEAX, nEBX, nECX, nEDX );
+	unsigned int nECX7;
+	__cpuid_count( 7, 0, nEAX, nEBX7, nECX7, nEDX );
+#endif
+	if ( ( nECX & ( ( 1 << 27 ) | ( 1 << 28 ) ) ) != ( ( 1 << 27 ) | ( 1 << 28 ) ) )
+		return false;
+	if ( !( nEBX7 & ( 1 << 5 ) ) )
+		return false;
+
+#if defined( _MSC_VER )
+	uint64 nXCR0 = _xgetbv( 0 );
+#else
+	unsigned int nXCR0Lo, nXCR0Hi;
+	__asm__ __volatile__ ( "xgetbv" : "=a" ( nXCR0Lo ), "=d" ( nXCR0Hi ) : "c" ( 0 ) );
+	uint64 nXCR0 = nXCR0Lo | ( (uint64)nXCR0Hi << 32 );
+#endif
+	return ( nXCR0 & 6 ) == 6;
+}
+
+static CombineMightSeeFn CombineMightSee = CPUSupportsAVX2() ? CombineMightSeeAVX2 : CombineMightSeeSSE2;
+
+// The range of blocks of a full portal vector that have bits set.
+static void MightSeeRange( const byte *bits, int &first, int &end )
+{
+	int numBlocks = portalbytes / PORTAL_BLOCK_BYTES;
+	first = 0;
+	end = 0;
+	for ( int i = 0; i < numBlocks; i++ )
+	{
+		const long *block = (const long *)( bits + i * PORTAL_BLOCK_BYTES );
+		bool bAny = false;
+		for ( int j = 0; j < PORTAL_BLOCK_BYTES / (int)sizeof( long ); j++ )
+			bAny |= ( block[j] != 0 );
+
+		if ( bAny )
+		{
+			if ( end == 0 )
+				first = i;
+			end = i + 1;
+		}
+	}
+}
+
+static inline bool StackMightSee( const pstack_t *stack, int pnum )
+{
+	int block = pnum / ( PORTAL_BLOCK_BYTES * 8 );
+	return block >= stack->mightFirst && block < stack->mightEnd && CheckBit( stack->mightsee, pnum );
+}
+
+
 int		c_fullskip;
 int		c_portalskip, c_leafskip;
 int		c_vistest, c_mighttest;
@@ -483,8 +632,9 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	portal_t	*p;
 	plane_t		backplane;
 	leaf_t 		*leaf;
-	int			i, j;
-	long		*test, *might, *vis, more;
+	int			i;
+	byte		*test;
+	bool		more;
 	int			pnum;
 
 #ifdef MPI
@@ -510,8 +660,6 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	stack.leaf = leaf;
 	stack.portal = NULL;
 
-	might = (long *)stack.mightsee;
-	vis = (long *)thread->base->portalvis;
 	
 	// check all portals for flowing into other leafs	
 	for (i=0 ; i<leaf->portals.Count() ; i++)
@@ -520,7 +668,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		p = leaf->portals[i];
 		pnum = p - portals;
 
-		if ( ! (prevstack->mightsee[pnum >> 3] & (1<<(pnum&7)) ) )
+		if ( !StackMightSee( prevstack, pnum ) )
 		{
 			continue;	// can't possibly see it
 		}
@@ -528,19 +676,16 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		// if the portal can't see anything we haven't allready seen, skip it
 		if (p->status == stat_done)
 		{
-			test = (long *)p->portalvis;
+			test = p->portalvis;
 		}
 		else
 		{
-			test = (long *)p->portalflood;
+			test = p->portalflood;
 		}
 
-		more = 0;
-		for (j=0 ; j<portallongs ; j++)
-		{
-			might[j] = ((long *)prevstack->mightsee)[j] & test[j];
-			more |= (might[j] & ~vis[j]);
-		}
+		stack.mightFirst = prevstack->mightFirst;
+		stack.mightEnd = prevstack->mightEnd;
+		more = CombineMightSee( stack.mightsee, prevstack->mightsee, test, thread->base->portalvis, stack.mightFirst, stack.mightEnd );
 		
 		if ( !more && CheckBit( thread->base->portalvis, pnum ) )
 		{	// can't see anything new
@@ -631,7 +776,6 @@ generates the portalvis bit vector
 void PortalFlow (int iThread, int portalnum)
 {
 	threaddata_t	data;
-	int				i;
 	portal_t		*p;
 	int				c_might, c_can;
 
@@ -646,8 +790,8 @@ void PortalFlow (int iThread, int portalnum)
 	data.pstack_head.portal = p;
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
-	for (i=0 ; i<portallongs ; i++)
-		((long *)data.pstack_head.mightsee)[i] = ((long *)p->portalflood)[i];
+	memcpy (data.pstack_head.mightsee, p->portalflood, portalbytes);
+	MightSeeRange (p->portalflood, data.pstack_head.mightFirst, data.pstack_head.mightEnd);
 
 	RecursiveLeafFlow (p->leaf, &data, &data.pstack_head);
 
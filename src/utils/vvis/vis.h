@@ -14,6 +14,10 @@
 
 #define	MAX_PORTALS	65536
 
+// The portal bit vectors are padded to whole blocks so the flow can combine them
+// a SIMD register at a time.
+#define	PORTAL_BLOCK_BYTES	32
+
 #define	PORTALFILE	"PRT1"
 
 extern bool g_bUseRadius;			// prototyping TF2, "radius vis" solution
@@ -67,6 +71,7 @@ struct leaf_t
 struct pstack_t
 {
 	byte		mightsee[MAX_PORTALS/8];		// bit string
+	int			mightFirst, mightEnd;			// blocks of mightsee outside this range are all clear
 	pstack_t	*next;
 	leaf_t		*leaf;
 	portal_t	*portal;	// portal exiting
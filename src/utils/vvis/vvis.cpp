@@ -22,6 +22,12 @@
 #include "tools_minidump.h"
 #include "loadcmdline.h"
 #include "byteswap.h"
+#include "fork_distribute.h"
+
+#ifdef FORK_DISTRIBUTE
+#include <errno.h>
+#include <sys/mman.h>
+#endif
 
 
 int			g_numportals;
@@ -144,6 +150,82 @@ void BuildTracePortals( int clusterStart )
 	}
 }
 
+/*
+=============
+ScheduleExpensivePortals
+
+Sorting leaves the most expensive portals for last, where one of them can keep a
+thread busy long after the others have run out of work. Move one per thread (or
+fork worker) up to the latest point where the cheaper portals after it can still
+keep the others busy until the biggest finishes. They still get to reuse the flow
+of nearly everything that was sorted ahead of them.
+
+The threads take work in chunks of consecutive portals, so the expensive ones are
+spread a chunk apart to land with different threads. Fork workers take one
+portal at a time.
+=============
+*/
+static double PortalFlowCost (portal_t *p)
+{
+	// chains grow with the portals that might be seen at each step
+	return (double)p->nummightsee * p->nummightsee;
+}
+
+void ScheduleExpensivePortals (void)
+{
+	int		i;
+	int		nPortals = g_numportals*2;
+	int		nExpensive = numthreads;
+	int		nStride = GetThreadWorkChunkSize( nPortals );
+#ifdef FORK_DISTRIBUTE
+	if ( ForkDistribute_IsActive() )
+	{
+		nExpensive = g_nForkWorkers;
+		nStride = 1;
+	}
+#endif
+	int		nCheap = nPortals - nExpensive;
+
+	if ( nExpensive < 2 || nCheap < nExpensive * MAX( nStride, 4 ) )
+		return;
+
+	// how much cheap work has to be left to cover the expensive portals
+	double flBiggest = PortalFlowCost( sorted_portals[nPortals-1] );
+	double flNeeded = 0;
+	for (i=nCheap ; i<nPortals ; i++)
+		flNeeded += flBiggest - PortalFlowCost( sorted_portals[i] );
+
+	int iInsert = nCheap;
+	double flRemaining = 0;
+	while ( iInsert > 0 && flRemaining < flNeeded )
+	{
+		iInsert--;
+		flRemaining += PortalFlowCost( sorted_portals[iInsert] );
+	}
+
+	// leave room to spread them out
+	iInsert = MIN( iInsert, nPortals - 1 - (nExpensive-1)*nStride );
+
+	CUtlVector<portal_t *> expensive;
+	for (i=nPortals-1 ; i>=nCheap ; i--)
+		expensive.AddToTail( sorted_portals[i] );
+
+	CUtlVector<portal_t *> cheap;
+	cheap.CopyArray( &sorted_portals[iInsert], nCheap-iInsert );
+
+	int iExpensive = 0;
+	int iCheap = 0;
+	for (i=iInsert ; i<nPortals ; i++)
+	{
+		if ( iExpensive < nExpensive && i - iInsert == iExpensive * nStride )
+			sorted_portals[i] = expensive[iExpensive++];
+		else
+			sorted_portals[i] = cheap[iCheap++];
+	}
+
+	qprintf ("scheduled %i most expensive portals %i apart from %i of %i\n", nExpensive, nStride, iInsert, nPortals);
+}
+
 void SortPortals (void)
 {
 	int		i;
@@ -154,6 +236,8 @@ void SortPortals (void)
 	if (nosort)
 		return;
 	qsort (sorted_portals, g_numportals*2, sizeof(sorted_portals[0]), PComp);
+
+	ScheduleExpensivePortals ();
 }
 
 
@@ -281,6 +365,122 @@ static int CompressAndCrosscheckClusterVis( int clusternum )
 }
 
 
+#ifdef FORK_DISTRIBUTE
+//-----------------------------------------------------------------------------
+// -fork work units. These mirror the ones in mpivis.cpp. Where mpivis multicasts
+// each finished portalvis to the other workers, here the portalvis vectors live
+// in a shared mapping and the master appends each finished portal to a shared
+// list, so every worker can prune its flow with the portals the others finished.
+//-----------------------------------------------------------------------------
+struct ForkPortalFlowShared_t
+{
+	volatile int32	m_nDone;			// entries in m_iDone the master has published
+	int32			m_iDone[1];			// portal indices, in the order they finished
+};
+
+static ForkPortalFlowShared_t *g_pForkPortalFlow = NULL;
+static int g_iForkPortalFlowSeen = 0;	// per process: how much of m_iDone this worker has applied
+
+static void Fork_ProcessBasePortalVis( int iThread, uint64 iPortal, MessageBuffer *pBuf )
+{
+	BasePortalVis( iThread, iPortal );
+
+	portal_t *p = &portals[iPortal];
+	pBuf->write( p->portalfront, portalbytes );
+	pBuf->write( p->portalflood, portalbytes );
+}
+
+static void Fork_ReceiveBasePortalVis( uint64 iWorkUnit, MessageBuffer *pBuf, int iWorker )
+{
+	if ( pBuf->getLen() - pBuf->getOffset() != portalbytes*2 )
+		Error( "Invalid BasePortalVis result from worker %d.", iWorker );
+
+	portal_t *p = &portals[iWorkUnit];
+
+	p->portalfront = (byte*)malloc (portalbytes);
+	pBuf->read( p->portalfront, portalbytes );
+
+	p->portalflood = (byte*)malloc (portalbytes);
+	pBuf->read( p->portalflood, portalbytes );
+
+	p->portalvis = (byte*)malloc (portalbytes);
+	memset (p->portalvis, 0, portalbytes);
+
+	p->nummightsee = CountBits( p->portalflood, g_numportals*2 );
+}
+
+//-----------------------------------------------------------------------------
+// Moves every portalvis into one shared mapping, so the workers write their
+// results where the master and the other workers can see them
+//-----------------------------------------------------------------------------
+static void Fork_SharePortalVis()
+{
+	int nPortals = g_numportals*2;
+	size_t nListBytes = ( sizeof( ForkPortalFlowShared_t ) + nPortals * sizeof( int32 ) + PORTAL_BLOCK_BYTES - 1 ) & ~( PORTAL_BLOCK_BYTES - 1 );
+	size_t nBytes = nListBytes + (size_t)nPortals * portalbytes;
+
+	void *pShared = mmap( NULL, nBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+	if ( pShared == MAP_FAILED )
+		Error( "PortalFlow: couldn't map %llu bytes of shared portal vis (%s)\n", (uint64)nBytes, strerror( errno ) );
+
+	g_pForkPortalFlow = (ForkPortalFlowShared_t*)pShared;
+	g_pForkPortalFlow->m_nDone = 0;
+	g_iForkPortalFlowSeen = 0;
+
+	byte *pVis = (byte*)pShared + nListBytes;
+	for ( int i = 0; i < nPortals; i++, pVis += portalbytes )
+	{
+		memcpy( pVis, portals[i].portalvis, portalbytes );
+		free( portals[i].portalvis );
+		portals[i].portalvis = pVis;
+	}
+
+	// The mapping stays for the rest of the run, ClusterMerge reads portalvis from it
+}
+
+static void Fork_ProcessPortalFlow( int iThread, uint64 iPortal, MessageBuffer *pBuf )
+{
+	// Pick up everything finished since this worker's last work unit. Their portalvis
+	// is complete: the master only publishes a portal after its worker sent the result.
+	int nDone = g_pForkPortalFlow->m_nDone;
+	ThreadMemoryBarrier();
+	for ( ; g_iForkPortalFlowSeen < nDone; g_iForkPortalFlowSeen++ )
+	{
+		portals[g_pForkPortalFlow->m_iDone[g_iForkPortalFlowSeen]].status = stat_done;
+	}
+
+	// The result goes straight into the shared portalvis, the message just says it's done
+	PortalFlow( iThread, iPortal );
+}
+
+static void Fork_ReceivePortalFlow( uint64 iWorkUnit, MessageBuffer *pBuf, int iWorker )
+{
+	if ( pBuf->getLen() != pBuf->getOffset() )
+		Error( "Invalid PortalFlow result from worker %d.", iWorker );
+
+	portal_t *p = sorted_portals[iWorkUnit];
+	p->status = stat_done;
+
+	// Only the master writes the list, so publishing is a plain store behind a barrier
+	int nDone = g_pForkPortalFlow->m_nDone;
+	g_pForkPortalFlow->m_iDone[nDone] = p - portals;
+	ThreadMemoryBarrier();
+	g_pForkPortalFlow->m_nDone = nDone + 1;
+}
+
+static void RunForkWork( const char *pszName, int nWorkUnits, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn )
+{
+	Msg( "%-20s ", pszName );
+	StartPacifier( "" );
+
+	double elapsed = ForkDistributeWork( nWorkUnits, processFn, receiveFn );
+
+	EndPacifier( false );
+	Msg( " (%d)\n", (int)elapsed );
+}
+#endif
+
+
 /*
 ==================
 CalcPortalVis
@@ -308,6 +508,14 @@ void CalcPortalVis (void)
  		RunMPIPortalFlow();
 	}
 	else 
+#endif
+#ifdef FORK_DISTRIBUTE
+	if ( ForkDistribute_IsActive() )
+	{
+		Fork_SharePortalVis();
+		RunForkWork( "PortalFlow:", g_numportals*2, Fork_ProcessPortalFlow, Fork_ReceivePortalFlow );
+	}
+	else
 #endif
 	{
 		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
@@ -339,6 +547,13 @@ void CalcVis (void)
 		RunMPIBasePortalVis();
 	}
 	else 
+#endif
+#ifdef FORK_DISTRIBUTE
+	if ( ForkDistribute_IsActive() )
+	{
+		RunForkWork( "BasePortalVis:", g_numportals*2, Fork_ProcessBasePortalVis, Fork_ReceiveBasePortalVis );
+	}
+	else
 #endif
 	{
 	    RunThreadsOnIndividual (g_numportals*2, true, BasePortalVis);
@@ -478,7 +693,7 @@ void LoadPortals (char *name)
 	leafbytes = ((portalclusters+63)&~63)>>3;
 	leaflongs = leafbytes/sizeof(long);
 	
-	portalbytes = ((g_numportals*2+63)&~63)>>3;
+	portalbytes = ((g_numportals*2+PORTAL_BLOCK_BYTES*8-1)&~(PORTAL_BLOCK_BYTES*8-1))>>3;
 	portallongs = portalbytes/sizeof(long);
 
 // each file portal is split into two memory portals
@@ -922,6 +1137,22 @@ int ParseCommandLine( int argc, char **argv )
 			numthreads = atoi (argv[i+1]);
 			i++;
 		}
+#ifdef FORK_DISTRIBUTE
+		else if (!Q_stricmp(argv[i],"-fork"))
+		{
+			if ( ++i < argc )
+			{
+				g_nForkWorkers = atoi (argv[i]);
+			}
+
+			if ( g_nForkWorkers <= 0 )
+			{
+				Warning("Error: expected a positive value after '-fork'\n\n" );
+				i = 100000;	// force it to print the usage
+				break;
+			}
+		}
+#endif
 		else if (!Q_stricmp(argv[i], "-fast"))
 		{
 			Msg ("fastvis = true\n");
@@ -959,6 +1190,10 @@ int ParseCommandLine( int argc, char **argv )
 		{
 			g_bLowPriority = true;
 		}
+		else if( !Q_stricmp( argv[i], "-numa" ) )
+		{
+			g_bPinThreadsToNUMANodes = true;
+		}
 		else if ( !Q_stricmp( argv[i], "-FullMinidumps" ) )
 		{
 			EnableFullMinidumps( true );
@@ -1028,6 +1263,7 @@ void PrintUsage( int argc, char **argv )
 		"  -mpi            : Use VMPI to distribute computations.\n"
 #endif
 		"  -low            : Run as an idle-priority process.\n"
+		"  -numa           : Spread threads over NUMA nodes and pin each to a CPU (Linux only).\n"
 		"                    env_fog_controller specifies one.\n"
 		"\n"
 		"  -vproject <directory> : Override the VPROJECT environment variable.\n"
@@ -1041,6 +1277,8 @@ void PrintUsage( int argc, char **argv )
 #endif
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
+		"  -fork <n>       : Run BasePortalVis and PortalFlow in n worker processes\n"
+		"                    instead of threads (Linux only).\n"
 		"  -nosort         : Don't sort portals (sorting is an optimization).\n"
 		"  -tmpin          : Make portals come from \\tmp\\<mapname>.\n"
 		"  -tmpout         : Make portals come from \\tmp\\<mapname>.\n"
@@ -1214,6 +1452,7 @@ int RunVVis( int argc, char **argv )
 
 	char str[512];
 	GetHourMinuteSecondsString( (int)( end - start ), str, sizeof( str ) );
+	ThreadPrintPhaseTimes();
 	Msg( "%s elapsed\n", str );
 
 	ReleasePakFileLumps();